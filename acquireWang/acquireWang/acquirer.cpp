@@ -1,4 +1,7 @@
 #include "acquirer.h"
+#pragma warning(push, 0)
+#include <algorithm>
+#pragma warning(pop)
 
 /* * * * * * * * * *
  * PUBLIC METHODS  *
@@ -7,11 +10,17 @@
 /* Constructor and destructor */
 BaseAcquirer::BaseAcquirer(const std::string& _name, BaseCamera& _camera) :
 		name(_name), camera(_camera), acquireThread(nullptr),
-		queue(FRAME_BUFFER_SIZE), queueGUI(FRAME_BUFFER_SIZE),
-		framesToAcquire(0), framesReceived(0), acquiring(true) {
+		queue(FRAME_BUFFER_SIZE),
+		framesToAcquire(0), framesReceived(0), framesDropped(0), framesGated(0), acquiring(true),
+		queueMaxFrames(FRAME_BUFFER_SIZE), queueMaxBytes(0), queuePolicy(OVERFLOW_BLOCK),
+		useCallbacks(false), callbacksActive(false), framePool(std::make_shared<FramePool>()),
+		saverSignal(nullptr), signalInterval(1) {
 	debugMessage("BaseAcquirer constructor " + name, DEBUG_HIDDEN_INFO);
 	// Initialize camera
 	camera.initialize();
+	// Preallocate frame buffers to the queue depth so acquisition does not allocate
+	framePool->preallocate(camera.getBytes(), FRAME_BUFFER_SIZE + FRAME_POOL_SLACK);
+	camera.setFramePool(framePool);
 	// Choose default GUI downsample rate
 	GUI_downsample_rate = (int)(camera.getFPS() / DISPLAY_FRAME_RATE);
 	if (GUI_downsample_rate < 1) GUI_downsample_rate = 1;
@@ -23,22 +32,71 @@ BaseAcquirer::~BaseAcquirer() {
 	if (acquiring) abortAcquisition();
 	// Finalize camera
 	camera.finalize();
+	camera.setFramePool(nullptr);
 	// Empty queues
 	emptyQueue();
-	emptyQueueGUI();
+	mailboxGUI.clear();
 }
 
 /* Other public methods */
 
 void BaseAcquirer::run() {
+	// Have the camera push frames if possible; otherwise poll it
+	callbacksActive = useCallbacks && camera.startFrameCallbacks([this](BaseFrame& frame) { onCameraFrame(frame); });
+	nextHealthCheck = std::chrono::steady_clock::now(); // check as soon as the thread starts
 	// Start thread
-	acquireThread = new std::thread(&BaseAcquirer::acquireLoop, this);
+	if (callbacksActive) acquireThread = new std::thread(&BaseAcquirer::monitorLoop, this);
+	else acquireThread = new std::thread(&BaseAcquirer::acquireLoop, this);
+}
+
+void BaseAcquirer::setQueueLimits(size_t maxFrames, size_t maxBytes, overflowPolicy policy) {
+	queueMaxFrames = maxFrames;
+	queueMaxBytes = maxBytes;
+	queuePolicy = policy;
+	// Make room for the frames a gate holds, which may all be passed on at once
+	if (gate != nullptr) {
+		if (maxFrames > 0) maxFrames += gate->getMaxHeldFrames();
+		if (maxBytes > 0) maxBytes += gate->getMaxHeldFrames() * camera.getBytes();
+	}
+	queue.setLimits(maxFrames, maxBytes, policy);
+	// Make sure the frame pool covers a full queue
+	size_t queueFrames = maxFrames;
+	if (maxBytes > 0 && camera.getBytes() > 0) {
+		size_t byteFrames = maxBytes / camera.getBytes();
+		if (queueFrames == 0 || byteFrames < queueFrames) queueFrames = byteFrames;
+	}
+	framePool->preallocate(camera.getBytes(), queueFrames + FRAME_POOL_SLACK);
+}
+
+std::vector<size_t> BaseAcquirer::getDroppedFrames() {
+	std::vector<size_t> result = droppedFrames;
+	std::vector<size_t> lost = queue.getLostFrames();
+	if (lost.empty()) return result;
+	result.insert(result.end(), lost.begin(), lost.end());
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+void BaseAcquirer::setFrameGate(std::unique_ptr<FrameGate> _gate) {
+	gate = std::move(_gate);
+	if (gate != nullptr) gatePassed.reserve(gate->getMaxHeldFrames() + 1);
+	setQueueLimits(queueMaxFrames, queueMaxBytes, queuePolicy);
+}
+
+bool BaseAcquirer::enableSpilling(const std::string& filename) {
+	if (spillFile != nullptr) return true;
+	std::unique_ptr<FrameSpillFile> file(new FrameSpillFile(filename, framePool));
+	if (!file->isOpen()) return false;
+	spillFile = std::move(file);
+	queue.setSpillFile(spillFile.get());
+	debugMessage(name + " frames can spill to " + filename, DEBUG_INFO);
+	return true;
 }
 
 BaseFrame BaseAcquirer::dequeue() {
 	BaseFrame result;
 	//queue.wait_dequeue_timed(result, TIME_WAIT_QUEUE);
-	queue.try_dequeue(result);
+	queue.tryDequeue(result);
 	if (result.isValid()) {
 		cnt++;
 		debugMessage(name + ": dequeued " + std::to_string(cnt) + " valid frames", DEBUG_HIDDEN_INFO);
@@ -46,18 +104,9 @@ BaseFrame BaseAcquirer::dequeue() {
 	return result;
 }
 
-BaseFrame BaseAcquirer::dequeueGUI() {
-	BaseFrame result;
-	queueGUI.try_dequeue(result);
-	return result;
-}
-
 BaseFrame BaseAcquirer::getMostRecentGUI() {
 	BaseFrame result;
-	// While there are things on the queue, dequeue
-	while (!isQueueGUIEmpty()) {
-		result = dequeueGUI();
-	}
+	mailboxGUI.take(result);
 	return result;
 }
 
@@ -69,11 +118,15 @@ double BaseAcquirer::getAcquisitionProgress() {
 void BaseAcquirer::reset() {
 	// Deinit
 	emptyQueue();
-	emptyQueueGUI();
+	mailboxGUI.clear();
+	queue.reopen();
 
 	// Reinit
 	framesToAcquire = 0;
 	framesReceived = 0;
+	framesDropped = 0;
+	framesGated = 0;
+	droppedFrames.clear();
 	acquiring = true;
 }
 
@@ -83,26 +136,56 @@ void BaseAcquirer::reset() {
 
 // Puts received frame onto thread-safe queue
 bool BaseAcquirer::enqueueFrame(BaseFrame& frame) {
-	bool result = queue.enqueue(frame);
-	if (!result) debugMessage("[" + std::to_string(framesReceived.load()) + "] Failed to enqueue " + name, DEBUG_ERROR);
+	bool result = true;
+	if (gate == nullptr) result = queue.enqueue(frame, framesReceived, droppedFrames);
+	else {
+		// Queue what the gate passes on (settling what it still holds after the last frame, before this frame counts)
+		gate->process(frame, framesReceived, gatePassed);
+		if (framesToAcquire > 0 && framesReceived + 1 >= framesToAcquire) gate->finish();
+		for (numberedFrame& passed : gatePassed) result = queue.enqueue(passed.second, passed.first, droppedFrames) && result;
+		gatePassed.clear();
+		framesGated = gate->getFramesDiscarded();
+	}
+	if (droppedFrames.size() > framesDropped) {
+		if (framesDropped == 0) debugMessage("[" + std::to_string(framesReceived.load()) + "] " + name + " queue is full: dropping frames", DEBUG_WARNING);
+		framesDropped = droppedFrames.size();
+	}
 	// Update number of frames received
 	framesReceived++;
+	// Wake the saver whenever a chunk's worth of frames has arrived
+	if (framesReceived % signalInterval == 0) notifySaver();
 	return result;
 }
 
-bool BaseAcquirer::enqueueFrameGUI(BaseFrame& frame) {
-	bool result = queueGUI.enqueue(frame);
-	return result;
+void BaseAcquirer::publishFrameGUI(BaseFrame& frame) {
+	BaseFrame shared(frame);
+	mailboxGUI.put(shared);
 }
 
 void BaseAcquirer::emptyQueue() {
 	BaseFrame dequeued;
-	while (queue.try_dequeue(dequeued)) {}
+	while (queue.tryDequeue(dequeued)) {}
 }
 
-void BaseAcquirer::emptyQueueGUI() {
-	BaseFrame dequeued;
-	while (queueGUI.try_dequeue(dequeued)) {}
+void BaseAcquirer::receiveFrame(BaseFrame& received) {
+	if (received.isValid()) { // i.e. success
+		// Publish for GUI (shares the frame buffer; no pixels are copied)
+		if (framesReceived % GUI_downsample_rate == 0) {
+			publishFrameGUI(received);
+		}
+		enqueueFrame(received);
+	} else {
+		debugMessage("Failed to receive " + name + " frame.", DEBUG_ERROR);
+	}
+}
+
+void BaseAcquirer::onCameraFrame(BaseFrame& received) {
+	// The camera may deliver a few frames after we are done
+	if (!acquiring || (framesToAcquire > 0 && framesReceived >= framesToAcquire)) return;
+	try { receiveFrame(received); }
+	catch (...) {
+		debugMessage("[" + std::to_string(framesReceived.load()) + "] Error receiving " + name + " frame", DEBUG_ERROR);
+	}
 }
 
 void BaseAcquirer::getAndEnqueue() {
@@ -110,32 +193,49 @@ void BaseAcquirer::getAndEnqueue() {
 		timers.start(DTIMER_GET_FRAME);
 		BaseFrame received = camera.getFrame(); // get frame from camera
 		timers.pause(DTIMER_GET_FRAME);
-		if (received.isValid()) { // i.e. success
-			// Enqueue for GUI (implicit copy)
-			if (framesReceived % GUI_downsample_rate == 0) {
-				enqueueFrameGUI(received);
-			}
-			enqueueFrame(received);
-		} else {
-			debugMessage("Failed to receive " + name + " frame.", DEBUG_ERROR);
-		}
+		receiveFrame(received);
 	}
 	catch (...) {
 		debugMessage("Unhandled exception in getAndEnqueue() for " + name + "!", DEBUG_ERROR);
 	}
 }
 
+void BaseAcquirer::checkCameraHealth() {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (now < nextHealthCheck) return;
+	nextHealthCheck = now + std::chrono::milliseconds(HEALTH_CHECK_INTERVAL_MS);
+	if (!camera.checkHealth()) debugMessage(name + " camera is not ready", DEBUG_ERROR);
+}
+
 void BaseAcquirer::acquireLoop() {
 	while (acquiring) {
 		//debugMessage("acquireLoop " + getName(), DEBUG_INFO);
 		// If not indefinitely acquiring, and we have acquired more than we need, stop acquiring
 		if (framesToAcquire > 0 && framesReceived >= framesToAcquire) break;
 		// Otherwise, block until new frame arrives on camera, then enqueue
+		checkCameraHealth();
 		try { getAndEnqueue(); }
 		catch (...) {
 			debugMessage("[" + std::to_string(framesReceived.load()) + "] Error receiving " + name + " frame", DEBUG_ERROR);
 		}
 	}
+	// Wake the saver so it can write the last chunk
+	notifySaver();
+	timers.addThreadCPUTime(name + " acquisition", getThreadCPUTime());
 	debugMessage("[!] Exiting " + name + " acquisition thread (acquired " +
 		std::to_string(framesReceived) + " frames).", DEBUG_IMPORTANT_INFO);
 }
+
+void BaseAcquirer::monitorLoop() {
+	while (acquiring) {
+		if (framesToAcquire > 0 && framesReceived >= framesToAcquire) break;
+		checkCameraHealth();
+		std::this_thread::sleep_for(std::chrono::microseconds(TIME_WAIT_QUEUE));
+	}
+	camera.stopFrameCallbacks();
+	// Wake the saver so it can write the last chunk
+	notifySaver();
+	timers.addThreadCPUTime(name + " monitor", getThreadCPUTime());
+	debugMessage("[!] Exiting " + name + " monitor thread (acquired " +
+		std::to_string(framesReceived) + " frames).", DEBUG_IMPORTANT_INFO);
+}
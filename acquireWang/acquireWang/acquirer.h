@@ -1,27 +1,41 @@
 #pragma once
 #pragma warning(push, 0)
+#include <memory>
 #include <vector>
 #include <thread>
-#include <readerwriterqueue.h>
 #pragma warning(pop)
 #include "camera.h"
+#include "framemailbox.h"
+#include "framegate.h"
+#include "framequeue.h"
+#include "framesignal.h"
 #include "timer.h"
 #include "debug.h"
 
-using namespace moodycamel;
-
 // Typedefs and defines
 #define frame_t std::pair<timestamp_t, T*>
 #define DISPLAY_FRAME_RATE 30.0
-#define FRAME_BUFFER_SIZE 100
+#define FRAME_BUFFER_SIZE 100 // Default capacity of the frame queue (frames)
+#define FRAME_POOL_SLACK 8 // Extra pooled buffers beyond the queue depth (frames in flight in the camera, saver, GUI)
 const int64_t TIME_WAIT_QUEUE = 50000; // [microseconds], so 50000 = 50 ms
+#define HEALTH_CHECK_INTERVAL_MS 1000 // How often the camera's connection and streaming state are checked
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * This class provides an interface for acquiring rapidly from a single
  * camera. It manages one thread per class instance that calls the camera
  * methods, and exposes the image data via a queue-esque API for BaseSaver
- * derived classes. It also supports piping some frames for display on a GUI.
+ * derived classes. It also hands the newest frame to a GUI through a
+ * lock-free mailbox.
+ * With callback mode on (and a camera that supports it), the camera pushes
+ * frames from its own thread and the acquirer's thread only monitors the
+ * camera's health; otherwise the thread polls the camera for frames.
+ * The queue to the saver is bounded (see setQueueLimits()); frames dropped
+ * on overflow are counted and their numbers kept for the output file. With
+ * spilling on (see enableSpilling()), a MemoryGovernor can move queued
+ * frames out to a file instead; it also limits the frame pool's memory (see
+ * setPoolLimit()), so that the buffers spilled frames leave are freed. With a frame gate (see setFrameGate()),
+ * only the frames the gate passes are queued.
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 class BaseAcquirer {
 protected:
@@ -29,26 +43,48 @@ protected:
 	BaseCamera& camera;
 private:
 	// Thread-safe queues
-	BlockingReaderWriterQueue<BaseFrame> queue; // timestamp, pointer to stored object
-	BlockingReaderWriterQueue<BaseFrame> queueGUI;
+	BoundedFrameQueue queue; // Frames waiting to be saved
+	FrameMailbox mailboxGUI; // Newest frame for the GUI
+	std::shared_ptr<FramePool> framePool; // Recycled frame buffers for this stream
+	std::unique_ptr<FrameSpillFile> spillFile; // Overflow tier of the queue (nullptr if spilling is off)
+	std::unique_ptr<FrameGate> gate; // Decides which frames are queued (nullptr to queue them all)
+	std::vector<numberedFrame> gatePassed; // Frames the gate passed on (reused for every frame)
+	size_t queueMaxFrames, queueMaxBytes; // Queue limits from setQueueLimits() (before making room for the gate)
+	overflowPolicy queuePolicy;
 
 	int GUI_downsample_rate; // How often we should skip frames when preparing frames for the GUI (1 = no frames skipped)
 	// Numbers of frames to acquire, and frames received
 	size_t framesToAcquire; // default value of 0 indicates indefinite acquisition
 	std::atomic<size_t> framesReceived;
+	std::atomic<size_t> framesDropped; // Number of frames discarded because the queue was full
+	std::atomic<size_t> framesGated; // Number of frames the gate discarded
+	std::vector<size_t> droppedFrames; // Numbers of the discarded frames (written by the acquisition thread only)
 
 	std::thread* acquireThread; // Thread for acquisition loop
 	std::atomic<bool> acquiring; // Flag to indicate if we should abort acquisition
+	bool useCallbacks; // true to have the camera push frames (if it supports it)
+	bool callbacksActive; // true if the camera is pushing frames
+	std::chrono::steady_clock::time_point nextHealthCheck;
+
+	std::atomic<FrameSignal*> saverSignal; // Signal to wake the saver (nullptr if none)
+	size_t signalInterval; // Number of frames between saver signals (i.e. the saver's chunk size)
+	void notifySaver() {
+		FrameSignal* signal = saverSignal;
+		if (signal != nullptr) signal->notify();
+	}
 
 	/* Methods */
-	bool enqueueFrame(BaseFrame& frame); // return true if successful
-	bool enqueueFrameGUI(BaseFrame& frame);
+	bool enqueueFrame(BaseFrame& frame); // return true if successful (moves the frame onto the queue)
+	void publishFrameGUI(BaseFrame& frame); // shares the frame with the GUI
 	void emptyQueue();
-	void emptyQueueGUI();
 
 	// Methods for thread
+	void receiveFrame(BaseFrame& received); // passes a frame from the camera on to the GUI and saver
+	void onCameraFrame(BaseFrame& received); // called from the camera's thread in callback mode
 	void getAndEnqueue();
-	void acquireLoop();
+	void checkCameraHealth(); // checks the camera if it is time to
+	void acquireLoop(); // polls the camera for frames
+	void monitorLoop(); // checks the camera's health while it pushes frames
 
 	// Debug
 	int cnt = 0;
@@ -68,27 +104,67 @@ public:
 	std::string getName() { return name; }
 	size_t getFramesReceived() { return framesReceived; }
 	size_t getFramesToAcquire() { return framesToAcquire; }
+	size_t getFramesDropped() { return framesDropped + queue.getFramesLost(); }
+	size_t getFramesGated() { return framesGated; }
+	// Number of frames that will reach the saver (only meaningful if getFramesToAcquire() > 0)
+	size_t getFramesToSave() { return (framesToAcquire > 0) ? framesToAcquire - getFramesDropped() - framesGated : 0; }
+	// Numbers (in acquisition order, from 0) of the frames dropped so far, including spilled frames that could not be
+	// read back (call once acquisition has ended)
+	std::vector<size_t> getDroppedFrames();
 	void setFramesToAcquire(size_t _framesToAcquire) { framesToAcquire = _framesToAcquire; }
 	double getSecondsToAcquire() { return (double) framesToAcquire / camera.getFPS(); }
 	bool isAcquiring() { return acquiring && framesReceived < framesToAcquire; }
 	void abortAcquisition() {
 		acquiring = false;
+		queue.close(); // stop blocking on a full queue
 		framesToAcquire = framesReceived;
 		if (acquireThread != nullptr) {
 			acquireThread->join();
 			delete acquireThread;
 			acquireThread = nullptr;
 		}
+		if (gate != nullptr) { // (the frames it still holds will not be saved)
+			gate->finish();
+			framesGated = gate->getFramesDiscarded();
+		}
+		notifySaver();
+	}
+	// Have the camera push frames from its own thread, if it supports it (call before run())
+	void setCallbackMode(bool _useCallbacks) { useCallbacks = _useCallbacks; }
+	bool isCallbackModeActive() { return callbacksActive; }
+	// Queue only the frames [_gate] passes (nullptr to queue them all); the queue limits are raised by the frames the
+	// gate may hold, which it can pass on all at once (call before run())
+	void setFrameGate(std::unique_ptr<FrameGate> _gate);
+	FrameGate* getFrameGate() { return gate.get(); }
+	// Wake [signal] every [interval] frames and when acquisition ends (nullptr to stop)
+	void setSaverSignal(FrameSignal* signal, size_t interval) {
+		signalInterval = (interval > 0) ? interval : 1;
+		saverSignal = signal;
 	}
 	
 	/* Queue APIs */
-	size_t getQueueSizeApprox() { return queue.size_approx(); }
-	size_t getQueueGUISizeApprox() { return queueGUI.size_approx(); }
-	bool isQueueEmpty() { return queue.peek() == nullptr; }
-	bool isQueueGUIEmpty() { return queueGUI.peek() == nullptr; }
+	// Bounds the frame queue to [maxFrames] frames and/or [maxBytes] bytes (0 = no limit; at least one
+	// limit should be set), applying [policy] when it is full
+	void setQueueLimits(size_t maxFrames, size_t maxBytes, overflowPolicy policy);
+	size_t getQueueSizeApprox() { return queue.size(); }
+	size_t getPoolHits() { return framePool->getHits(); }
+	size_t getPoolMisses() { return framePool->getMisses(); }
+	bool isQueueEmpty() { return queue.empty(); }
 	BaseFrame dequeue(); // Return true if successful
-	BaseFrame dequeueGUI();
-	BaseFrame getMostRecentGUI();
+	size_t getQueueBytes() { return queue.getMemoryBytes(); } // Bytes of queued frames held in memory
+	size_t getPoolBytes() { return framePool->getAllocatedBytes(); } // Bytes of frame buffers (queued, in use or free)
+	// Limits the frame pool to [bytes] bytes (0 for no limit): buffers given back beyond it are freed
+	void setPoolLimit(size_t bytes) { framePool->setByteLimit(bytes); }
+	// Lets the queue spill frames to [filename] (created now, deleted when the acquirer is); returns false if it could
+	// not be created
+	bool enableSpilling(const std::string& filename);
+	bool isSpillingEnabled() { return spillFile != nullptr; }
+	// Moves the oldest queued frame held in memory to the spill file; returns false if there was none to move
+	bool spillOldestFrame() { return queue.spillOldest(); }
+	size_t getFramesSpilled() { return (spillFile != nullptr) ? spillFile->getFramesWritten() : 0; }
+	uint64_t getBytesSpilled() { return (spillFile != nullptr) ? spillFile->getBytesWritten() : 0; }
+	uint64_t getSpillPendingBytes() { return (spillFile != nullptr) ? spillFile->getPendingBytes() : 0; } // Bytes waiting on disk
+	BaseFrame getMostRecentGUI(); // Returns an invalid frame if there is no new frame
 
 	/* Methods */
 	// Camera access methods (for the Law of Demeter)
@@ -114,7 +190,7 @@ public:
 	// Resets acquirer member variables as though freshly constructed
 	void reset();
 	// Returns true if there is a frame available to show on the GUI
-	bool readyForGUI() { return (queueGUI.peek() != nullptr); }
+	bool readyForGUI() { return mailboxGUI.hasNew(); }
 	// Returns true if the GUI in the main loop should stop blocking while waiting for this acquirer
 	bool shouldDraw() { return readyForGUI() || (framesReceived == framesToAcquire); }
 };
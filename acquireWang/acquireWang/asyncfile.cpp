@@ -0,0 +1,214 @@
+#include "asyncfile.h"
+#pragma warning(push, 0)
+#include <algorithm>
+#include <cstring>
+#ifdef _WIN32
+#include "Windows.h"
+#else
+#include <aio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#pragma warning(pop)
+#include "chunkarena.h" // alignedAlloc
+#include "debug.h"
+
+struct PendingWrite {
+	char* buffer;
+	uint64_t offset; // Offset of the write in flight
+	size_t bytes; // Size of the write in flight
+	bool inFlight;
+#ifdef _WIN32
+	OVERLAPPED overlapped;
+#else
+	aiocb cb;
+#endif
+};
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+AsyncFile::AsyncFile(const std::string& _filename, size_t _bufferBytes, size_t queueDepth, uint64_t preallocateBytes) :
+		filename(_filename),
+		bufferBytes((_bufferBytes + ASYNC_FILE_ALIGNMENT - 1) / ASYNC_FILE_ALIGNMENT * ASYNC_FILE_ALIGNMENT),
+		next(0), appended(0), completed(0), allocated(0), failed(false), unbuffered(true) {
+	// Open the file, without the operating system's cache if the file system allows it
+#ifdef _WIN32
+	handle = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		unbuffered = false;
+		handle = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+	}
+#else
+	fd = -1;
+#ifdef O_DIRECT
+	fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+#endif
+	if (fd < 0) {
+		unbuffered = false;
+		fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+#endif
+	if (!isOpen()) {
+		debugMessage("Failed to open " + filename, DEBUG_ERROR);
+		failed = true;
+		return;
+	}
+	if (!unbuffered) debugMessage("Cannot bypass the file cache for " + filename + "; writing it buffered", DEBUG_WARNING);
+
+	// Reserve the space up front, so that appending does not have to grow the file
+	if (preallocateBytes > 0) {
+		preallocateBytes = (preallocateBytes + ASYNC_FILE_ALIGNMENT - 1) / ASYNC_FILE_ALIGNMENT * ASYNC_FILE_ALIGNMENT;
+#ifdef _WIN32
+		LARGE_INTEGER size;
+		size.QuadPart = (LONGLONG) preallocateBytes;
+		if (SetFilePointerEx(handle, size, NULL, FILE_BEGIN) && SetEndOfFile(handle)) {
+			allocated = preallocateBytes;
+			// Without this (which needs the SE_MANAGE_VOLUME_NAME privilege), Windows zero-fills the space as it is written
+			if (!SetFileValidData(handle, size.QuadPart)) {
+				debugMessage("Cannot mark preallocated space of " + filename + " as valid", DEBUG_HIDDEN_INFO);
+			}
+		}
+#else
+		if (posix_fallocate(fd, 0, (off_t) preallocateBytes) == 0) allocated = preallocateBytes;
+#endif
+		if (allocated == 0) debugMessage("Failed to preallocate " + filename, DEBUG_WARNING);
+	}
+
+	// Set up the buffers (aligned, as unbuffered I/O requires)
+	for (size_t i = 0; i < std::max(queueDepth, (size_t) 1); i++) {
+		std::unique_ptr<PendingWrite> write(new PendingWrite());
+		write->buffer = (char*) alignedAlloc(bufferBytes, ASYNC_FILE_ALIGNMENT);
+		write->offset = 0;
+		write->bytes = 0;
+		write->inFlight = false;
+#ifdef _WIN32
+		write->overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+#endif
+		writes.push_back(std::move(write));
+	}
+}
+
+AsyncFile::~AsyncFile() {
+	close();
+	for (auto& write : writes) {
+		alignedFree(write->buffer);
+#ifdef _WIN32
+		CloseHandle(write->overlapped.hEvent);
+#endif
+	}
+}
+
+bool AsyncFile::isOpen() {
+#ifdef _WIN32
+	return handle != INVALID_HANDLE_VALUE;
+#else
+	return fd >= 0;
+#endif
+}
+
+char* AsyncFile::getBuffer() {
+	if (failed || !waitFor(*writes[next])) return nullptr;
+	return writes[next]->buffer;
+}
+
+bool AsyncFile::submit(size_t bytes) {
+	if (failed) return false;
+	if (bytes > bufferBytes || (unbuffered && bytes % ASYNC_FILE_ALIGNMENT != 0)) {
+		debugMessage("Invalid write of " + std::to_string(bytes) + " bytes to " + filename, DEBUG_ERROR);
+		failed = true;
+		return false;
+	}
+	PendingWrite& write = *writes[next];
+	if (!waitFor(write)) return false;
+	write.offset = appended;
+	write.bytes = bytes;
+#ifdef _WIN32
+	HANDLE event = write.overlapped.hEvent;
+	std::memset(&write.overlapped, 0, sizeof(write.overlapped));
+	write.overlapped.hEvent = event;
+	write.overlapped.Offset = (DWORD) (appended & 0xFFFFFFFF);
+	write.overlapped.OffsetHigh = (DWORD) (appended >> 32);
+	if (!WriteFile(handle, write.buffer, (DWORD) bytes, NULL, &write.overlapped) && GetLastError() != ERROR_IO_PENDING) {
+		failed = true;
+	}
+#else
+	std::memset(&write.cb, 0, sizeof(write.cb));
+	write.cb.aio_fildes = fd;
+	write.cb.aio_buf = write.buffer;
+	write.cb.aio_nbytes = bytes;
+	write.cb.aio_offset = (off_t) appended;
+	if (aio_write(&write.cb) != 0) failed = true;
+#endif
+	if (failed) {
+		debugMessage("Failed to start writing " + filename, DEBUG_ERROR);
+		return false;
+	}
+	write.inFlight = true;
+	appended += bytes;
+	next = (next + 1) % writes.size();
+	return true;
+}
+
+bool AsyncFile::drain() {
+	bool result = !failed;
+	// (oldest first, so that the completed bytes advance in order)
+	for (size_t i = 0; i < writes.size(); i++) {
+		if (!waitFor(*writes[(next + i) % writes.size()])) result = false;
+	}
+	return result;
+}
+
+bool AsyncFile::close() {
+	if (!isOpen()) return false;
+	bool result = drain();
+	// Give back the preallocated space that was not used
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	size.QuadPart = (LONGLONG) appended;
+	if (!SetFilePointerEx(handle, size, NULL, FILE_BEGIN) || !SetEndOfFile(handle)) result = false;
+	if (!FlushFileBuffers(handle)) result = false; // (file metadata)
+	CloseHandle(handle);
+	handle = INVALID_HANDLE_VALUE;
+#else
+	if (ftruncate(fd, (off_t) appended) != 0) result = false;
+	if (fsync(fd) != 0) result = false; // (file metadata)
+	::close(fd);
+	fd = -1;
+#endif
+	if (!result) debugMessage("Failed to finish writing " + filename, DEBUG_ERROR);
+	return result;
+}
+
+/* * * * * * * * * *
+ * PRIVATE METHODS *
+ * * * * * * * * * */
+
+bool AsyncFile::waitFor(PendingWrite& write) {
+	if (!write.inFlight) return !failed;
+	write.inFlight = false;
+	bool result = true;
+#ifdef _WIN32
+	DWORD written = 0;
+	result = GetOverlappedResult(handle, &write.overlapped, &written, TRUE) && written == write.bytes;
+#else
+	const aiocb* list[1] = { &write.cb };
+	int error;
+	while ((error = aio_error(&write.cb)) == EINPROGRESS) aio_suspend(list, 1, NULL);
+	ssize_t written = aio_return(&write.cb);
+	result = (error == 0 && written == (ssize_t) write.bytes);
+#endif
+	if (!result) {
+		debugMessage("Failed to write " + filename, DEBUG_ERROR);
+		failed = true;
+	}
+	// Writes are waited for in the order they were submitted, so this one follows the bytes completed so far
+	else if (!failed && write.offset == completed) {
+		completed += write.bytes;
+	}
+	return result;
+}
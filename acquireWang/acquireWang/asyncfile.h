@@ -0,0 +1,70 @@
+#pragma once
+#pragma warning(push, 0)
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#pragma warning(pop)
+
+#define ASYNC_FILE_ALIGNMENT 4096 // Alignment of unbuffered writes (offsets, sizes and buffers)
+
+struct PendingWrite; // Platform-specific state of one in-flight write
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class implements an append-only file written without the operating
+ * system's cache (FILE_FLAG_NO_BUFFERING on Windows, O_DIRECT elsewhere),
+ * with a fixed number of writes in flight at once (overlapped I/O on
+ * Windows, POSIX AIO elsewhere). The caller fills one of the file's aligned
+ * buffers and submits it; getBuffer() only waits if every buffer is still
+ * being written. Writes must be whole multiples of ASYNC_FILE_ALIGNMENT.
+ *
+ * The file can be preallocated, so that appending does not have to extend
+ * it; it is cut back to the bytes actually written when it is closed. Until
+ * then, the file size says nothing about what was written, so callers that
+ * index the file should only index up to getBytesCompleted().
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class AsyncFile {
+private:
+	const std::string filename;
+	const size_t bufferBytes; // Capacity of each buffer
+	std::vector< std::unique_ptr<PendingWrite> > writes; // Ring of buffers (and their writes)
+	size_t next; // Index of the next buffer to fill
+	uint64_t appended; // Bytes submitted so far (the offset of the next write)
+	uint64_t completed; // Bytes known to be written (every write up to here has completed)
+	uint64_t allocated; // Bytes preallocated
+	bool failed; // true once a write has failed
+	bool unbuffered; // true if the file bypasses the operating system's cache
+#ifdef _WIN32
+	void* handle;
+#else
+	int fd;
+#endif
+
+	bool waitFor(PendingWrite& write); // Waits for a write to complete (if in flight); returns false if it failed
+
+	// Disable assignment operator and copy constructor
+	AsyncFile& operator=(const AsyncFile& other) = delete;
+	AsyncFile(const AsyncFile& other) = delete;
+
+public:
+	// Creates (or truncates) [_filename], with [queueDepth] buffers of [_bufferBytes] bytes (rounded up to the
+	// alignment), preallocating [preallocateBytes] bytes (0 for none)
+	AsyncFile(const std::string& _filename, size_t _bufferBytes, size_t queueDepth, uint64_t preallocateBytes = 0);
+	~AsyncFile(); // Closes the file (if close() was not called)
+
+	bool isOpen();
+	bool isUnbuffered() { return unbuffered; }
+	size_t getBufferBytes() { return bufferBytes; }
+	uint64_t getBytesWritten() { return appended; }
+	uint64_t getBytesCompleted() { return completed; }
+
+	// Returns the next buffer to fill, waiting for its previous write if necessary (nullptr after a failure)
+	char* getBuffer();
+	// Starts writing the first [bytes] bytes of the buffer from getBuffer() at the end of the file (returns
+	// false if the write could not be started, or an earlier write failed)
+	bool submit(size_t bytes);
+	// Waits for every write in flight; returns false if any failed
+	bool drain();
+	// Drains, cuts the file to the bytes written and closes it; returns false if anything failed
+	bool close();
+};
@@ -0,0 +1,1039 @@
+#include "bench.h"
+#pragma warning(push, 0)
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+#include "json.hpp" // JSON
+#pragma warning(pop)
+#include "synthcam.h"
+#include "fakepgcam.h"
+#include "bitpacking.h"
+#include "acquirer.h"
+#include "h5out.h"
+#include "memorygovernor.h"
+#include "rawout.h"
+#include "segmentout.h"
+#include "rawconvert.h"
+#include "tailreader.h"
+#include "temporaldelta.h"
+#include "triggergate.h"
+#include "motiongate.h"
+#include "timer.h"
+#include "debug.h"
+
+/* * * * * * * * * *
+ * HELPER METHODS  *
+ * * * * * * * * * */
+
+// Returns the size of a file in bytes
+static size_t getFileBytes(const std::string& filename) {
+	std::ifstream f(filename, std::ios::binary | std::ios::ate);
+	return f.good() ? (size_t) f.tellg() : 0;
+}
+
+// Records [numFrames] synthetic Kinect-like and Point Grey-like frames as fast as they can be saved,
+// and prints the sustained throughput (in MB/s of uncompressed frames); with SAVE_RAW or SAVE_SEGMENTS,
+// [filename] is the root of the files' names. [onStart] (if given) is called once saving has started. With
+// _memoryBudgetMB set, a memory governor spills queued frames beyond the budget (to [spillDirectory], if given, instead
+// of next to the recording), and its counters are printed too.
+static void benchSaving(std::map<std::string, size_t>& params, const std::string& label, const std::string& filename,
+		size_t numFrames, size_t compressionWorkers, saveFormat format = SAVE_HDF5, const std::function<void()>& onStart = nullptr,
+		const std::string& spillDirectory = "") {
+	SyntheticCamera kincam(512, 424, sizeof(uint16_t), 30, true);
+	SyntheticCamera pgcam(1280, 1024, sizeof(uint8_t), 100, true);
+	std::vector<BaseAcquirer*> acquirers = { new BaseAcquirer("kinect", kincam), new BaseAcquirer("pg", pgcam) };
+	std::vector<std::string> names = { "kinect", "pg" };
+	std::vector<PredType> types = { KINECT_H5T, POINTGREY_H5T };
+	size_t frameChunkSize = params["_frameChunkSize"];
+	std::vector<DSetCreatPropList> dcpls = {
+		createStreamDcpl(params, "kinect", frameChunkSize, params["_kinectYchunk"], params["_kinectXchunk"]),
+		createStreamDcpl(params, "pg", frameChunkSize, params["_pgYchunk"], params["_pgXchunk"]) };
+	FileAccPropList fapl;
+	fapl.setCache(65536000, params["_rdcc_nslots"], params["_rdcc_nbytes"], 0);
+	fapl.setSieveBufSize(params["_sievebufsize"]);
+	for (BaseAcquirer* acquirer : acquirers) acquirer->setFramesToAcquire(numFrames);
+
+	std::string outFilename = filename;
+	BaseSaver* out = nullptr;
+	H5Out* h5out = nullptr;
+	if (format == SAVE_RAW) {
+		out = new RawOut(outFilename, acquirers, frameChunkSize, names, params["_rawQueueDepth"]);
+	}
+	else if (format == SAVE_SEGMENTS) {
+		out = new SegmentOut(outFilename, acquirers, frameChunkSize, names, params["_segmentMB"],
+			getFlushPolicy(params), params["_flushInterval"]);
+	}
+	else {
+		out = h5out = new H5Out(outFilename, acquirers, frameChunkSize, names, types,
+			FileCreatPropList::DEFAULT, fapl, dcpls, params["_perStreamFiles"] != 0, compressionWorkers,
+			getFlushPolicy(params), params["_flushInterval"], params["_rotateMB"], params["_rotateMinutes"] * 60,
+			params["_swmr"] != 0, { params["_temporalDelta"] != 0, false });
+	}
+	std::unique_ptr<MemoryGovernor> governor;
+	if (params["_memoryBudgetMB"] > 0) {
+		std::string title = (format == SAVE_HDF5) ? filename.substr(0, filename.size() - 3) : filename;
+		governor.reset(new MemoryGovernor((uint64_t) params["_memoryBudgetMB"] << 20, acquirers, frameChunkSize,
+			getSpillPrefix(title, spillDirectory)));
+	}
+	if (onStart) onStart();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (BaseAcquirer* acquirer : acquirers) {
+		acquirer->run();
+		acquirer->beginAcquisition();
+	}
+	if (governor) governor->start();
+	while (out->isSaving()) {
+		// Stand in for the preview window
+		for (BaseAcquirer* acquirer : acquirers) acquirer->getMostRecentGUI();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	for (BaseAcquirer* acquirer : acquirers) acquirer->abortAcquisition();
+	out->abortSaving(false);
+	out->writeDroppedFrames();
+	if (params["_linkStreamFiles"] && h5out != nullptr) h5out->linkStreamFiles();
+	delete out;
+	std::string memoryLine;
+	if (governor) {
+		governor->stop();
+		char line[256];
+		std::snprintf(line, sizeof(line), "    (peak memory %llu MB of %llu MB, %zu frames (%llu MB) spilled to disk)",
+			(unsigned long long) (governor->getPeakBytes() >> 20), (unsigned long long) (governor->getBudgetBytes() >> 20),
+			governor->getFramesSpilled(), (unsigned long long) (governor->getBytesSpilled() >> 20));
+		memoryLine = line;
+		governor.reset();
+	}
+	for (BaseAcquirer* acquirer : acquirers) delete acquirer;
+
+	double rawBytes = (double) numFrames * (kincam.getBytes() + pgcam.getBytes());
+	size_t fileBytes = 0;
+	if (format == SAVE_RAW) {
+		for (const std::string& name : names) fileBytes += getFileBytes(filename + "_" + name + ".raw");
+	}
+	else if (format == SAVE_SEGMENTS) {
+		for (const std::string& name : names) {
+			for (size_t i = 0; ; i++) {
+				char suffix[32];
+				std::snprintf(suffix, sizeof(suffix), "_%05d.seg", (int) i);
+				size_t bytes = getFileBytes(filename + "_" + name + suffix);
+				if (bytes == 0) break;
+				fileBytes += bytes;
+			}
+		}
+	}
+	else if (params["_rotateMB"] > 0 || params["_rotateMinutes"] > 0) {
+		std::ifstream f(filename.substr(0, filename.size() - 3) + ".rotation.json");
+		std::string dir = filename.substr(0, filename.find_last_of("/\\") + 1);
+		std::set<std::string> parts;
+		nlohmann::json index = f.good() ? nlohmann::json::parse(f) : nlohmann::json::object();
+		if (index.find("streams") != index.end()) {
+			for (auto& stream : index["streams"]) {
+				for (auto& part : stream["parts"]) parts.insert(part["file"].get<std::string>());
+			}
+		}
+		for (const std::string& part : parts) fileBytes += getFileBytes(dir + part);
+	}
+	else {
+		fileBytes = getFileBytes(filename);
+	}
+	if (format == SAVE_HDF5 && params["_perStreamFiles"] && params["_rotateMB"] == 0 && params["_rotateMinutes"] == 0) {
+		for (const std::string& name : names) fileBytes += getFileBytes(filename.substr(0, filename.size() - 3) + "_" + name + ".h5");
+	}
+	char line[256];
+	std::snprintf(line, sizeof(line), "  %-22s %10.1f MB/s %8.2f s   ratio %.2f", label.c_str(),
+		rawBytes / seconds / 1e6, seconds, fileBytes > 0 ? rawBytes / fileBytes : 0.0);
+	debugMessage(line, DEBUG_MUST_SHOW);
+	if (!memoryLine.empty()) debugMessage(memoryLine, DEBUG_MUST_SHOW);
+}
+
+// Compares HDF5's own filter pipeline on the saving thread with the compression pool
+static int benchCompression(int argc, char* argv[], std::map<std::string, size_t>& params) {
+	size_t numFrames = (argc > 0) ? std::stoul(argv[0]) : 1000;
+	std::string filename = (argc > 1) ? argv[1] : "bench_compression.h5";
+	debugMessage("Saving " + std::to_string(numFrames) + " Kinect (512x424x16) and Point Grey (1280x1024x8) frames to " +
+		filename + " (deflate = " + std::to_string(params["_compression"]) + "):", DEBUG_MUST_SHOW);
+	benchSaving(params, "HDF5 filters", filename, numFrames, 0);
+	for (size_t workers : { 1, 2, 4, 8 }) {
+		benchSaving(params, std::to_string(workers) + " compression workers", filename, numFrames, workers);
+	}
+	return EXIT_SUCCESS;
+}
+
+// Compares the sustained saving throughput under each flush policy
+static int benchDurability(int argc, char* argv[], std::map<std::string, size_t>& params) {
+	size_t numFrames = (argc > 0) ? std::stoul(argv[0]) : 1000;
+	std::string filename = (argc > 1) ? argv[1] : "bench_durability.h5";
+	debugMessage("Saving " + std::to_string(numFrames) + " Kinect (512x424x16) and Point Grey (1280x1024x8) frames to " +
+		filename + " (deflate = " + std::to_string(params["_compression"]) + ", " +
+		std::to_string(params["_compressionWorkers"]) + " compression workers):", DEBUG_MUST_SHOW);
+	struct { flushPolicy policy; size_t interval; const char* label; } runs[] = {
+		{ FLUSH_EVERY_CHUNKS, 1, "flush every chunk" },
+		{ FLUSH_EVERY_CHUNKS, 10, "flush every 10 chunks" },
+		{ FLUSH_EVERY_SECONDS, 1, "flush every second" },
+		{ FLUSH_EVERY_SECONDS, 5, "flush every 5 seconds" },
+		{ FLUSH_NONE, 0, "no flushing" } };
+	for (auto& run : runs) {
+		params["_flushPolicy"] = run.policy;
+		params["_flushInterval"] = run.interval;
+		timers.resetAll();
+		benchSaving(params, run.label, filename, numFrames, params["_compressionWorkers"]);
+		debugMessage("    (" + std::to_string(timers.getCount(DTIMER_FLUSH)) + " flushes taking " +
+			std::to_string(timers.getTotalTime(DTIMER_FLUSH)) + " s)", DEBUG_MUST_SHOW);
+	}
+	return EXIT_SUCCESS;
+}
+
+// Compares saving to HDF5 with saving raw files and mapped segments, and times converting those to HDF5
+static int benchRaw(int argc, char* argv[], std::map<std::string, size_t>& params) {
+	size_t numFrames = (argc > 0) ? std::stoul(argv[0]) : 1000;
+	std::string root = (argc > 1) ? argv[1] : "bench_raw";
+	debugMessage("Saving " + std::to_string(numFrames) + " Kinect (512x424x16) and Point Grey (1280x1024x8) frames to " +
+		root + ".h5 (deflate = " + std::to_string(params["_compression"]) + ", " +
+		std::to_string(params["_compressionWorkers"]) + " compression workers), to raw files and to " +
+		std::to_string(params["_segmentMB"]) + " MB segments:", DEBUG_MUST_SHOW);
+	benchSaving(params, "HDF5", root + ".h5", numFrames, params["_compressionWorkers"]);
+	struct { saveFormat format; std::string root; const char* label; } runs[] = {
+		{ SAVE_RAW, root, "raw" },
+		{ SAVE_SEGMENTS, root + "_seg", "segments" } };
+	bool converted = true;
+	for (auto& run : runs) {
+		timers.resetAll();
+		benchSaving(params, run.label, run.root, numFrames, 0, run.format);
+		char line[256];
+		for (auto& threadTime : timers.getThreadCPUTimes()) {
+			std::snprintf(line, sizeof(line), "    %-24s %8.3f s CPU", threadTime.first.c_str(), threadTime.second);
+			debugMessage(line, DEBUG_MUST_SHOW);
+		}
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool result = convertRawRecording(run.root, run.root + "_converted.h5", params);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::snprintf(line, sizeof(line), "    %-22s %s in %.2f s", "conversion to HDF5", result ? "done" : "FAILED", seconds);
+		debugMessage(line, DEBUG_MUST_SHOW);
+		converted = converted && result;
+	}
+	return converted ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Saves to HDF5 files rotated every [rotateMB] MB, and checks against the files that the index accounts for every
+// frame exactly once, in order
+static int benchRotation(int argc, char* argv[], std::map<std::string, size_t>& params) {
+	size_t numFrames = (argc > 0) ? std::stoul(argv[0]) : 1000;
+	size_t rotateMB = (argc > 1) ? std::stoul(argv[1]) : 64;
+	std::string filename = (argc > 2) ? argv[2] : "bench_rotation.h5";
+	debugMessage("Saving " + std::to_string(numFrames) + " Kinect (512x424x16) and Point Grey (1280x1024x8) frames to " +
+		filename + " (deflate = " + std::to_string(params["_compression"]) + ", " +
+		std::to_string(params["_compressionWorkers"]) + " compression workers), rotating files every " +
+		std::to_string(rotateMB) + " MB:", DEBUG_MUST_SHOW);
+	params["_rotateMB"] = rotateMB;
+	params["_rotateMinutes"] = 0;
+	timers.resetAll();
+	benchSaving(params, "rotating", filename, numFrames, params["_compressionWorkers"]);
+	params["_rotateMB"] = 0;
+	char line[256];
+	std::snprintf(line, sizeof(line), "    (%zu rotations taking %.6f s on the saving threads)",
+		timers.getCount(DTIMER_ROTATE), timers.getTotalTime(DTIMER_ROTATE));
+	debugMessage(line, DEBUG_MUST_SHOW);
+
+	// Check the index against the files
+	std::ifstream f(filename.substr(0, filename.size() - 3) + ".rotation.json");
+	if (!f.good()) return EXIT_FAILURE;
+	nlohmann::json index = nlohmann::json::parse(f);
+	std::string dir = filename.substr(0, filename.find_last_of("/\\") + 1);
+	bool consistent = true;
+	for (auto& stream : index["streams"]) {
+		std::string name = stream["name"];
+		size_t nextFrame = 0, numFiles = 0;
+		double lastTimestamp = -1;
+		bool streamConsistent = true;
+		for (auto& part : stream["parts"]) {
+			size_t firstFrame = part["firstFrame"], partFrames = part["numFrames"];
+			H5File file(dir + part["file"].get<std::string>(), H5F_ACC_RDONLY);
+			DataSet dataset = file.openDataSet(name);
+			hsize_t dims[4];
+			dataset.getSpace().getSimpleExtentDims(dims);
+			unsigned long long first = 0;
+			dataset.openAttribute("firstFrame").read(PredType::NATIVE_ULLONG, &first);
+			std::vector<double> timestamps(partFrames);
+			if (partFrames > 0) file.openDataSet(name + "_time").read(timestamps.data(), PredType::NATIVE_DOUBLE);
+			// Frames must continue where the previous file stopped, at increasing times
+			if (firstFrame != nextFrame || first != firstFrame || dims[0] != partFrames ||
+					(partFrames > 0 && timestamps[0] <= lastTimestamp)) {
+				streamConsistent = false;
+			}
+			if (partFrames > 0) lastTimestamp = timestamps.back();
+			nextFrame += partFrames;
+			numFiles++;
+		}
+		if (nextFrame != numFrames) streamConsistent = false;
+		std::snprintf(line, sizeof(line), "    %-8s %6zu frames in %zu files%s", name.c_str(), nextFrame, numFiles,
+			streamConsistent ? "" : "   MISMATCH");
+		debugMessage(line, DEBUG_MUST_SHOW);
+		consistent = consistent && streamConsistent;
+	}
+	return consistent ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Compares saving normally with saving in SWMR mode while a reader follows the file, and prints how long after
+// acquisition the reader gets each frame
+static int benchSwmr(int argc, char* argv[], std::map<std::string, size_t>& params) {
+	size_t numFrames = (argc > 0) ? std::stoul(argv[0]) : 1000;
+	std::string filename = (argc > 1) ? argv[1] : "bench_swmr.h5";
+	debugMessage("Saving " + std::to_string(numFrames) + " Kinect (512x424x16) and Point Grey (1280x1024x8) frames to " +
+		filename + " (deflate = " + std::to_string(params["_compression"]) + ", " +
+		std::to_string(params["_compressionWorkers"]) + " compression workers):", DEBUG_MUST_SHOW);
+	params["_swmr"] = 0;
+	benchSaving(params, "normal", filename, numFrames, params["_compressionWorkers"]);
+
+	// Follow both streams on another thread while saving in SWMR mode
+	std::atomic<bool> saved(false);
+	std::thread* readerThread = nullptr;
+	std::vector<size_t> framesSeen(2, 0);
+	std::vector<double> totalLatency(2, 0), maxLatency(2, 0);
+	const char* names[] = { "kinect", "pg" };
+	auto follow = [&]() {
+		std::vector< std::unique_ptr<TailReader> > readers;
+		for (const char* name : names) readers.push_back(std::unique_ptr<TailReader>(new TailReader(filename, name)));
+		while (true) {
+			bool done = saved; // (read before polling, so the last frames are not missed)
+			size_t numNew = 0;
+			for (size_t i = 0; i < readers.size(); i++) {
+				numNew += readers[i]->poll([&](size_t /*frameNumber*/, const char* /*frame*/, double timestamp) {
+					double latency = getClockStamp() - timestamp;
+					framesSeen[i]++;
+					totalLatency[i] += latency;
+					maxLatency[i] = std::max(maxLatency[i], latency);
+				});
+			}
+			if (done && numNew == 0) break;
+			if (numNew == 0) std::this_thread::sleep_for(std::chrono::milliseconds(TAIL_POLL_MS));
+		}
+	};
+	params["_swmr"] = 1;
+	timers.resetAll();
+	benchSaving(params, "SWMR", filename, numFrames, params["_compressionWorkers"], SAVE_HDF5,
+		[&]() { readerThread = new std::thread(follow); });
+	params["_swmr"] = 0;
+	saved = true;
+	readerThread->join();
+	delete readerThread;
+	char line[256];
+	std::snprintf(line, sizeof(line), "    (%zu flushes taking %.3f s)", timers.getCount(DTIMER_FLUSH), timers.getTotalTime(DTIMER_FLUSH));
+	debugMessage(line, DEBUG_MUST_SHOW);
+	bool complete = true;
+	for (size_t i = 0; i < framesSeen.size(); i++) {
+		std::snprintf(line, sizeof(line), "    %-8s %6zu frames read while saving, %.3f s after acquisition on average (at most %.3f s)",
+			names[i], framesSeen[i], framesSeen[i] > 0 ? totalLatency[i] / framesSeen[i] : 0.0, maxLatency[i]);
+		debugMessage(line, DEBUG_MUST_SHOW);
+		complete = complete && (framesSeen[i] == numFrames);
+	}
+	return complete ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Acquires frames from two paced Point Grey-like stand-ins, the synthetic camera and a fake Point Grey camera whose
+// images go through PointGreyCamera's Spinnaker event handler, first by polling getFrame() on the acquisition
+// thread and then from each one's event source. Prints the frames received and dropped and the CPU time of each
+// thread, and fails unless every frame arrives, none are dropped and the callbacks were actually used.
+static int benchCallbacks(int argc, char* argv[], std::map<std::string, size_t>& /*params*/) {
+	size_t numFrames = (argc > 0) ? std::stoul(argv[0]) : 1000;
+	size_t fps = (argc > 1) ? std::stoul(argv[1]) : 100;
+	debugMessage("Acquiring " + std::to_string(numFrames) + " Point Grey (1280x1024x8) frames at " +
+		std::to_string(fps) + " fps:", DEBUG_MUST_SHOW);
+	bool allPassed = true;
+	for (bool fakePG : { false, true }) {
+		debugMessage(fakePG ? "  fake Point Grey camera (Spinnaker image events):" : "  synthetic camera:", DEBUG_MUST_SHOW);
+		for (bool callbacks : { false, true }) {
+			timers.resetAll();
+			std::unique_ptr<BaseCamera> cam;
+			if (fakePG) cam.reset(new FakePointGreyCamera(1280, 1024, (double) fps));
+			else cam.reset(new SyntheticCamera(1280, 1024, sizeof(uint8_t), (double) fps));
+			BaseAcquirer* acquirer = new BaseAcquirer("pg", *cam);
+			acquirer->setCallbackMode(callbacks);
+			acquirer->setFramesToAcquire(numFrames);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			acquirer->run();
+			acquirer->beginAcquisition();
+			double consumerCPUStart = getThreadCPUTime();
+			size_t dequeued = 0;
+			while (acquirer->isAcquiring() || !acquirer->isQueueEmpty()) {
+				// Stand in for the saver and the preview window
+				while (acquirer->dequeue().isValid()) dequeued++;
+				acquirer->getMostRecentGUI();
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			double consumerCPU = getThreadCPUTime() - consumerCPUStart;
+			bool active = acquirer->isCallbackModeActive();
+			acquirer->abortAcquisition();
+			while (acquirer->dequeue().isValid()) dequeued++;
+			bool passed = (acquirer->getFramesReceived() == numFrames) && (acquirer->getFramesDropped() == 0) &&
+				(dequeued == numFrames) && (active == callbacks);
+			allPassed = allPassed && passed;
+
+			char line[256];
+			std::snprintf(line, sizeof(line), "    %-10s %6zu frames received, %4zu dropped, %6zu dequeued in %.2f s%s",
+				!callbacks ? "polling" : (active ? "callbacks" : "callbacks (unsupported, polled)"),
+				acquirer->getFramesReceived(), acquirer->getFramesDropped(), dequeued, seconds,
+				passed ? "" : "   FAILED");
+			debugMessage(line, DEBUG_MUST_SHOW);
+			delete acquirer;
+			timers.addThreadCPUTime("consumer", consumerCPU);
+			for (auto& threadTime : timers.getThreadCPUTimes()) {
+				std::snprintf(line, sizeof(line), "      %-24s %8.3f s CPU", threadTime.first.c_str(), threadTime.second);
+				debugMessage(line, DEBUG_MUST_SHOW);
+			}
+		}
+	}
+	return allPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Times the 10- and 12-bit unpack and pack kernels on Point Grey-sized frames, and the depth packing kernels on
+// Kinect-sized frames, with each instruction set this CPU supports, and checks that they all give the same
+// results as the scalar kernels
+static int benchPacking(int argc, char* argv[], std::map<std::string, size_t>& /*params*/) {
+	size_t numFrames = (argc > 0) ? std::stoul(argv[0]) : 200;
+	const size_t numPixels = 1280 * 1024;
+	const char* levelNames[] = { "scalar", "SSE", "AVX2" };
+	simdLevel best = getSimdLevel();
+	debugMessage("Unpacking and packing " + std::to_string(numFrames) + " 1280x1024 frames (best kernels: " +
+		levelNames[best] + "):", DEBUG_MUST_SHOW);
+
+	std::vector<uint16_t> pixels(numPixels), unpacked(numPixels), reference(numPixels);
+	bool allMatch = true;
+	for (pixelPacking packing : { PACKING_MONO10P, PACKING_MONO12P, PACKING_MONO12_PACKED }) {
+		std::vector<uint8_t> packed(getPackedBytes(packing, numPixels)), repacked(packed.size());
+		for (size_t i = 0; i < numPixels; i++) pixels[i] = (uint16_t) ((i * 2654435761u) >> 7); // arbitrary 16-bit values
+		setSimdLevel(SIMD_SCALAR);
+		packPixels(packing, pixels.data(), packed.data(), numPixels);
+		unpackPixels(packing, packed.data(), reference.data(), numPixels);
+
+		for (int level = SIMD_SCALAR; level <= best; level++) {
+			setSimdLevel((simdLevel) level);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (size_t f = 0; f < numFrames; f++) unpackPixels(packing, packed.data(), unpacked.data(), numPixels);
+			double unpackSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			start = std::chrono::steady_clock::now();
+			for (size_t f = 0; f < numFrames; f++) packPixels(packing, reference.data(), repacked.data(), numPixels);
+			double packSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			bool match = (unpacked == reference) && (repacked == packed);
+			allMatch = allMatch && match;
+
+			char line[256];
+			std::snprintf(line, sizeof(line), "  %-13s %-7s unpack %8.1f Mpixels/s   pack %8.1f Mpixels/s%s",
+				getPackingName(packing).c_str(), levelNames[level], numFrames * numPixels / unpackSeconds / 1e6,
+				numFrames * numPixels / packSeconds / 1e6, match ? "" : "   MISMATCH");
+			debugMessage(line, DEBUG_MUST_SHOW);
+		}
+	}
+
+	// Depth packing, on Kinect-sized frames of depths (in mm) that mostly fit 13 bits
+	const size_t depthPixels = 512 * 424;
+	std::vector<uint16_t> depths(depthPixels), depthReference(depthPixels), depthUnpacked(depthPixels);
+	for (size_t i = 0; i < depthPixels; i++) depths[i] = (uint16_t) (500 + ((i * 2654435761u) >> 13) % 7800); // (some over 8191)
+	for (size_t bits : { 12, 13 }) {
+		uint16_t maxValue = (uint16_t) ((1 << bits) - 1);
+		std::vector<uint8_t> packed(getDepthPackedBytes(bits, depthPixels)), reference(packed.size());
+		setSimdLevel(SIMD_SCALAR);
+		size_t referenceClamped = packDepth(depths.data(), reference.data(), depthPixels, bits, maxValue);
+		for (size_t i = 0; i < depthPixels; i++) depthReference[i] = std::min(depths[i], maxValue);
+
+		for (int level = SIMD_SCALAR; level <= best; level++) {
+			setSimdLevel((simdLevel) level);
+			size_t clamped = 0;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (size_t f = 0; f < numFrames; f++) clamped = packDepth(depths.data(), packed.data(), depthPixels, bits, maxValue);
+			double packSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			start = std::chrono::steady_clock::now();
+			for (size_t f = 0; f < numFrames; f++) unpackDepth(packed.data(), depthUnpacked.data(), depthPixels, bits);
+			double unpackSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			bool match = (packed == reference) && (depthUnpacked == depthReference) && (clamped == referenceClamped);
+			allMatch = allMatch && match;
+
+			char line[256];
+			std::snprintf(line, sizeof(line), "  %-13s %-7s unpack %8.1f Mpixels/s   pack %8.1f Mpixels/s   (%zu clamped)%s",
+				("depth " + std::to_string(bits) + "-bit").c_str(), levelNames[level], numFrames * depthPixels / unpackSeconds / 1e6,
+				numFrames * depthPixels / packSeconds / 1e6, clamped, match ? "" : "   MISMATCH");
+			debugMessage(line, DEBUG_MUST_SHOW);
+		}
+	}
+	setSimdLevel(best);
+	return allMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Frames of one stream for the codec benchmark
+struct CodecSample {
+	std::string name;
+	size_t height, width, bytesPerPixel;
+	double fps;
+	size_t numFrames;
+	std::vector<char> frames;
+};
+
+// Turns the frames of [sample], as stored in the stream's [dataset] of [file], back into pixels: decodes temporal
+// delta coding, and unpacks packed frames (described by the stream's _packing, _bitsPerPixel and _pixelWidth
+// attributes) to 16 bits. Returns false if the frames are coded in a way this cannot undo.
+static bool decodeCodecSample(H5File& file, DataSet& dataset, CodecSample& sample) {
+	if (dataset.attrExists(TEMPORAL_DELTA_ATTRIBUTE)) {
+		unsigned long long keyInterval = 0;
+		dataset.openAttribute(TEMPORAL_DELTA_ATTRIBUTE).read(PredType::NATIVE_ULLONG, &keyInterval);
+		if (sample.bytesPerPixel != sizeof(uint16_t) || !decodeTemporalDelta((uint16_t*) sample.frames.data(),
+				sample.numFrames, sample.height * sample.width, 0, (size_t) keyInterval)) return false;
+	}
+	if (!file.attrExists(sample.name + "_packing")) return true;
+	std::string description;
+	unsigned long long bits = 0, pixelWidth = 0;
+	Attribute packingAttribute = file.openAttribute(sample.name + "_packing");
+	packingAttribute.read(packingAttribute.getStrType(), description);
+	if (file.attrExists(sample.name + "_bitsPerPixel"))
+		file.openAttribute(sample.name + "_bitsPerPixel").read(PredType::NATIVE_ULLONG, &bits);
+	if (file.attrExists(sample.name + "_pixelWidth"))
+		file.openAttribute(sample.name + "_pixelWidth").read(PredType::NATIVE_ULLONG, &pixelWidth);
+	pixelPacking packing = PACKING_NONE;
+	for (pixelPacking candidate : { PACKING_MONO10P, PACKING_MONO12P, PACKING_MONO12_PACKED })
+		if (description == getPackingDescription(candidate)) packing = candidate;
+	bool depth = (bits > 0 && description == getDepthPackingDescription((size_t) bits));
+	if ((packing == PACKING_NONE && !depth) || sample.bytesPerPixel != sizeof(uint8_t) || pixelWidth == 0) return false;
+
+	// Unpack row by row (each row of the dataset is one packed row of pixels)
+	std::vector<char> packed(std::move(sample.frames));
+	size_t rows = sample.numFrames * sample.height;
+	sample.frames.assign(rows * (size_t) pixelWidth * sizeof(uint16_t), 0);
+	for (size_t r = 0; r < rows; r++) {
+		const uint8_t* src = (const uint8_t*) packed.data() + r * sample.width;
+		uint16_t* dst = (uint16_t*) sample.frames.data() + r * (size_t) pixelWidth;
+		if (depth) unpackDepth(src, dst, (size_t) pixelWidth, (size_t) bits);
+		else unpackPixels(packing, src, dst, (size_t) pixelWidth);
+	}
+	sample.width = (size_t) pixelWidth;
+	sample.bytesPerPixel = sizeof(uint16_t);
+	return true;
+}
+
+// Reads up to [numFrames] frames of each stream of the recording [filename] (the datasets with timestamps),
+// estimating each stream's frame rate from its timestamps. Delta-coded and packed streams are decoded to pixels
+// first, so that codecs are compared on what the cameras saw; streams that cannot be decoded are skipped.
+static std::vector<CodecSample> readCodecSamples(const std::string& filename, size_t numFrames) {
+	std::vector<CodecSample> samples;
+	H5File file(filename, H5F_ACC_RDONLY);
+	for (hsize_t i = 0; i < file.getNumObjs(); i++) {
+		std::string name = file.getObjnameByIdx(i);
+		if (file.getObjTypeByIdx(i) != H5G_DATASET || (name.size() >= 5 && name.substr(name.size() - 5) == "_time")) continue;
+		if (!H5Lexists(file.getId(), (name + "_time").c_str(), H5P_DEFAULT)) continue;
+		DataSet dataset = file.openDataSet(name);
+		DataSpace fileSpace = dataset.getSpace();
+		if (fileSpace.getSimpleExtentNdims() != 4) continue;
+		hsize_t dims[4];
+		fileSpace.getSimpleExtentDims(dims);
+		CodecSample sample;
+		sample.name = name;
+		sample.height = (size_t) (dims[1] * dims[2]); // (channels stacked)
+		sample.width = (size_t) dims[3];
+		sample.bytesPerPixel = dataset.getDataType().getSize();
+		sample.numFrames = (size_t) std::min(dims[0], (hsize_t) numFrames);
+		if (sample.numFrames == 0) continue;
+		sample.frames.resize(sample.numFrames * sample.height * sample.width * sample.bytesPerPixel);
+		hsize_t offset[4] = { 0, 0, 0, 0 };
+		hsize_t count[4] = { sample.numFrames, dims[1], dims[2], dims[3] };
+		fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+		dataset.read(sample.frames.data(), dataset.getDataType(), DataSpace(4, count), fileSpace);
+		if (!decodeCodecSample(file, dataset, sample)) {
+			debugMessage("Skipping " + name + ": its frames are packed or delta-coded in a way the benchmark cannot decode",
+				DEBUG_WARNING);
+			continue;
+		}
+		std::vector<double> timestamps(sample.numFrames);
+		DataSet tsdataset = file.openDataSet(name + "_time");
+		DataSpace tsFileSpace = tsdataset.getSpace();
+		hsize_t tsoffset[2] = { 0, 0 };
+		hsize_t tscount[2] = { sample.numFrames, 1 };
+		tsFileSpace.selectHyperslab(H5S_SELECT_SET, tscount, tsoffset);
+		tsdataset.read(timestamps.data(), PredType::NATIVE_DOUBLE, DataSpace(2, tscount), tsFileSpace);
+		double span = timestamps.back() - timestamps.front();
+		sample.fps = (sample.numFrames > 1 && span > 0) ? (sample.numFrames - 1) / span : 0;
+		samples.push_back(std::move(sample));
+	}
+	return samples;
+}
+
+// Makes [numFrames] frames of each of the synthetic Kinect-like and Point Grey-like cameras
+static std::vector<CodecSample> makeCodecSamples(size_t numFrames) {
+	std::vector<CodecSample> samples;
+	SyntheticCamera kincam(512, 424, sizeof(uint16_t), 30, true);
+	SyntheticCamera pgcam(1280, 1024, sizeof(uint8_t), 100, true);
+	std::pair<const char*, SyntheticCamera*> cameras[] = { { "kinect", &kincam }, { "pg", &pgcam } };
+	for (auto& camera : cameras) {
+		CodecSample sample = { camera.first, camera.second->getHeight(), camera.second->getWidth(),
+			camera.second->getBytesPerPixel(), camera.second->getFPS(), numFrames, std::vector<char>() };
+		for (size_t k = 0; k < numFrames; k++) {
+			BaseFrame frame = camera.second->getFrame();
+			const char* data = (const char*) frame.getData();
+			sample.frames.insert(sample.frames.end(), data, data + camera.second->getBytes());
+		}
+		samples.push_back(std::move(sample));
+	}
+	return samples;
+}
+
+// Compresses a sample with [codec] into an in-memory HDF5 file (with the sample's chunk shape, through HDF5's filter
+// pipeline on one thread) and reads it back; returns false if the codec failed. With temporalDelta, the frames of
+// a 16-bit sample are delta-coded first and decoded afterwards, as H5Out and TailReader would (and timed with it).
+static bool benchCodec(const CodecSample& sample, frameCodec codec, size_t level, std::map<std::string, size_t>& params,
+		double& ratio, double& encodeMBps, double& decodeMBps, bool temporalDelta = false) {
+	bool kinect = (sample.name == "kinect");
+	// Whole chunks of frames only (so that the ratio does not count the unused end of a chunk)
+	size_t chunkFrames = std::min(std::max(params["_frameChunkSize"], (size_t) 1), sample.numFrames);
+	size_t numFrames = sample.numFrames / chunkFrames * chunkFrames;
+	size_t numBytes = sample.frames.size() / sample.numFrames * numFrames;
+	size_t yChunk = std::min(std::max(params[kinect ? "_kinectYchunk" : "_pgYchunk"], (size_t) 1), sample.height);
+	size_t xChunk = std::min(std::max(params[kinect ? "_kinectXchunk" : "_pgXchunk"], (size_t) 1), sample.width);
+	DSetCreatPropList dcpl = createFrameDcpl(chunkFrames, yChunk, xChunk, params["_compression"], params["_lz4_block_size"],
+		codec, level);
+	FileAccPropList fapl;
+	fapl.setCore(64 << 20, false); // (nothing is written to disk)
+	fapl.setCache(0, 0, 0, 0); // (every chunk is decoded when read back)
+	try {
+		H5File file("bench_codec_" + sample.name + ".h5", H5F_ACC_TRUNC, FileCreatPropList::DEFAULT, fapl);
+		hsize_t dims[4] = { numFrames, 1, sample.height, sample.width };
+		const PredType& datatype = (sample.bytesPerPixel == 2) ? PredType::STD_U16LE : PredType::STD_U8LE;
+		DataSet dataset = file.createDataSet("frames", datatype, DataSpace(4, dims), dcpl);
+		size_t framePixels = sample.height * sample.width;
+		std::vector<char> coded;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (temporalDelta) {
+			coded.assign(sample.frames.begin(), sample.frames.begin() + numBytes);
+			for (size_t k = 0; k < numFrames; k += chunkFrames) {
+				encodeTemporalDelta((uint16_t*) coded.data() + k * framePixels, chunkFrames, framePixels);
+			}
+		}
+		dataset.write(temporalDelta ? coded.data() : sample.frames.data(), datatype);
+		double encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::vector<char> decoded(numBytes);
+		start = std::chrono::steady_clock::now();
+		dataset.read(decoded.data(), datatype);
+		if (temporalDelta) decodeTemporalDelta((uint16_t*) decoded.data(), numFrames, framePixels, 0, chunkFrames);
+		double decodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (std::memcmp(decoded.data(), sample.frames.data(), numBytes) != 0) {
+			debugMessage("  " + getCodecName(codec, level) + " did not round-trip " + sample.name, DEBUG_ERROR);
+			return false;
+		}
+		ratio = (double) numBytes / std::max(dataset.getStorageSize(), (hsize_t) 1);
+		encodeMBps = numBytes / encodeSeconds / 1e6;
+		decodeMBps = numBytes / decodeSeconds / 1e6;
+	}
+	catch (...) {
+		return false;
+	}
+	return true;
+}
+
+// Compares the codecs on frames of each stream of a recording (or on synthetic frames), and, given the disk's
+// bandwidth, suggests for each stream the fastest codec that compresses enough to stay under it
+static int benchCodecs(int argc, char* argv[], std::map<std::string, size_t>& params) {
+	std::string filename = (argc > 0) ? argv[0] : "synthetic";
+	size_t numFrames = (argc > 1) ? std::stoul(argv[1]) : 100;
+	double diskMBps = (argc > 2) ? atof(argv[2]) : 0;
+	std::vector<CodecSample> samples = (filename == "synthetic") ? makeCodecSamples(numFrames) :
+		readCodecSamples(filename, numFrames);
+	if (samples.empty()) {
+		debugMessage("No streams found in " + filename, DEBUG_ERROR);
+		return EXIT_FAILURE;
+	}
+	struct { frameCodec codec; size_t level; } runs[] = {
+		{ CODEC_NONE, 0 }, { CODEC_LZ4, 0 }, { CODEC_ZSTD, 1 }, { CODEC_ZSTD, 3 }, { CODEC_ZSTD, 9 },
+		{ CODEC_BLOSC_LZ4, 5 }, { CODEC_BLOSC_ZSTD, 1 }, { CODEC_BLOSC_ZSTD, 5 } };
+	double totalMBps = 0; // (uncompressed, from all the cameras)
+	for (const CodecSample& sample : samples) totalMBps += sample.fps * sample.height * sample.width * sample.bytesPerPixel / 1e6;
+	double neededRatio = (diskMBps > 0) ? totalMBps / diskMBps : 0;
+	char line[256];
+	bool allWorked = true;
+	for (const CodecSample& sample : samples) {
+		std::snprintf(line, sizeof(line), "%s: %zu frames of %zux%zux%zu from %s (%.1f fps)", sample.name.c_str(), sample.numFrames,
+			sample.width, sample.height, 8 * sample.bytesPerPixel, filename.c_str(), sample.fps);
+		debugMessage(line, DEBUG_MUST_SHOW);
+		double streamMBps = sample.fps * sample.height * sample.width * sample.bytesPerPixel / 1e6;
+		double bestMBps = 0;
+		size_t best = sizeof(runs) / sizeof(runs[0]);
+		for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+			std::string name = getCodecName(runs[i].codec, runs[i].level);
+			if (!isCodecAvailable(runs[i].codec)) {
+				debugMessage("  " + name + std::string(std::max((size_t) 1, 16 - name.size()), ' ') + "(no HDF5 filter plugin)", DEBUG_MUST_SHOW);
+				continue;
+			}
+			double ratio = 0, encodeMBps = 0, decodeMBps = 0;
+			if (!benchCodec(sample, runs[i].codec, runs[i].level, params, ratio, encodeMBps, decodeMBps)) {
+				debugMessage("  " + name + std::string(std::max((size_t) 1, 16 - name.size()), ' ') + "FAILED", DEBUG_MUST_SHOW);
+				allWorked = false;
+				continue;
+			}
+			std::snprintf(line, sizeof(line), "  %-15s ratio %6.2f   encode %8.1f MB/s   decode %8.1f MB/s", name.c_str(),
+				ratio, encodeMBps, decodeMBps);
+			debugMessage(line, DEBUG_MUST_SHOW);
+			// Fast enough for the camera on one thread, and small enough for this stream's share of the disk
+			if (diskMBps > 0 && ratio >= neededRatio && encodeMBps >= streamMBps && encodeMBps > bestMBps) {
+				bestMBps = encodeMBps;
+				best = i;
+			}
+		}
+		if (diskMBps > 0 && best < sizeof(runs) / sizeof(runs[0])) {
+			std::snprintf(line, sizeof(line), "  -> \"_codec_%s\": %d, \"_codecLevel_%s\": %zu (%s)", sample.name.c_str(), (int) runs[best].codec,
+				sample.name.c_str(), runs[best].level, getCodecName(runs[best].codec, runs[best].level).c_str());
+			debugMessage(line, DEBUG_MUST_SHOW);
+		}
+		else if (diskMBps > 0) {
+			std::snprintf(line, sizeof(line), "  -> no codec compresses by %.2f fast enough (try compression workers)", neededRatio);
+			debugMessage(line, DEBUG_MUST_SHOW);
+		}
+	}
+	if (diskMBps > 0) {
+		std::snprintf(line, sizeof(line), "The cameras produce %.1f MB/s, so they need a ratio of %.2f to stay under %.1f MB/s",
+			totalMBps, neededRatio, diskMBps);
+		debugMessage(line, DEBUG_MUST_SHOW);
+	}
+	return allWorked ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Compares the codecs with and without temporal delta coding on the 16-bit streams of a recording (or on
+// synthetic frames), checking that every frame round-trips, then times the decoding kernels with each
+// instruction set this CPU supports and checks that they agree
+static int benchDelta(int argc, char* argv[], std::map<std::string, size_t>& params) {
+	std::string filename = (argc > 0) ? argv[0] : "synthetic";
+	size_t numFrames = (argc > 1) ? std::stoul(argv[1]) : 100;
+	std::vector<CodecSample> samples = (filename == "synthetic") ? makeCodecSamples(numFrames) :
+		readCodecSamples(filename, numFrames);
+	samples.erase(std::remove_if(samples.begin(), samples.end(), [](const CodecSample& sample) { return sample.bytesPerPixel != 2; }),
+		samples.end());
+	if (samples.empty()) {
+		debugMessage("No 16-bit streams found in " + filename, DEBUG_ERROR);
+		return EXIT_FAILURE;
+	}
+	struct { frameCodec codec; size_t level; } runs[] = {
+		{ CODEC_LZ4, 0 }, { CODEC_ZSTD, 1 }, { CODEC_ZSTD, 3 }, { CODEC_BLOSC_LZ4, 5 } };
+	const char* levelNames[] = { "scalar", "SSE", "AVX2" };
+	simdLevel best = getSimdLevel();
+	char line[256];
+	bool allWorked = true;
+	for (const CodecSample& sample : samples) {
+		std::snprintf(line, sizeof(line), "%s: %zu frames of %zux%zux16 from %s", sample.name.c_str(), sample.numFrames,
+			sample.width, sample.height, filename.c_str());
+		debugMessage(line, DEBUG_MUST_SHOW);
+		for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+			std::string name = getCodecName(runs[i].codec, runs[i].level);
+			if (!isCodecAvailable(runs[i].codec)) {
+				debugMessage("  " + name + std::string(std::max((size_t) 1, 16 - name.size()), ' ') + "(no HDF5 filter plugin)", DEBUG_MUST_SHOW);
+				continue;
+			}
+			for (bool delta : { false, true }) {
+				double ratio = 0, encodeMBps = 0, decodeMBps = 0;
+				std::string label = delta ? "+ delta" : "";
+				if (!benchCodec(sample, runs[i].codec, runs[i].level, params, ratio, encodeMBps, decodeMBps, delta)) {
+					debugMessage("  " + name + " " + label + "   FAILED", DEBUG_MUST_SHOW);
+					allWorked = false;
+					continue;
+				}
+				std::snprintf(line, sizeof(line), "  %-15s %-7s ratio %6.2f   encode %8.1f MB/s   decode %8.1f MB/s", name.c_str(),
+					label.c_str(), ratio, encodeMBps, decodeMBps);
+				debugMessage(line, DEBUG_MUST_SHOW);
+			}
+		}
+
+		// The kernels alone, on one chunk's worth of frames (coded once, decoded repeatedly)
+		size_t framePixels = sample.height * sample.width;
+		size_t chunkFrames = std::min(std::max(params["_frameChunkSize"], (size_t) 1), sample.numFrames);
+		const uint16_t* original = (const uint16_t*) sample.frames.data();
+		std::vector<uint16_t> coded(original, original + chunkFrames * framePixels), decoded;
+		encodeTemporalDelta(coded.data(), chunkFrames, framePixels);
+		size_t repeats = std::max((size_t) 1, (size_t) 2000 / chunkFrames);
+		for (int level = SIMD_SCALAR; level <= best; level++) {
+			setSimdLevel((simdLevel) level);
+			double seconds = 0;
+			for (size_t r = 0; r < repeats; r++) {
+				decoded = coded;
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				decodeTemporalDelta(decoded.data(), chunkFrames, framePixels, 0, chunkFrames);
+				seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+			bool match = std::equal(decoded.begin(), decoded.end(), original);
+			allWorked = allWorked && match;
+			std::snprintf(line, sizeof(line), "  delta decoding %-7s %8.1f Mpixels/s%s", levelNames[level],
+				repeats * chunkFrames * framePixels / std::max(seconds, 1e-9) / 1e6, match ? "" : "   MISMATCH");
+			debugMessage(line, DEBUG_MUST_SHOW);
+		}
+		setSimdLevel(best);
+	}
+	return allWorked ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Saves with the frame queues held to a memory budget (frames beyond it spill to disk) and without one, and prints
+// the peak memory, the frames spilled and the CPU time of each thread
+static int benchSpill(int argc, char* argv[], std::map<std::string, size_t>& params) {
+	size_t numFrames = (argc > 0) ? std::stoul(argv[0]) : 1000;
+	size_t budgetMB = (argc > 1) ? std::stoul(argv[1]) : 256;
+	std::string filename = (argc > 2) ? argv[2] : "bench_spill.h5";
+	std::string spillDirectory = (argc > 3) ? argv[3] : "";
+	debugMessage("Saving " + std::to_string(numFrames) + " Kinect (512x424x16) and Point Grey (1280x1024x8) frames to " +
+		filename + " (deflate = " + std::to_string(params["_compression"]) + ", " +
+		std::to_string(params["_compressionWorkers"]) + " compression workers):", DEBUG_MUST_SHOW);
+	size_t previousBudget = params["_memoryBudgetMB"];
+	char line[256];
+	for (size_t budget : { (size_t) 0, budgetMB }) {
+		params["_memoryBudgetMB"] = budget;
+		timers.resetAll();
+		benchSaving(params, budget > 0 ? std::to_string(budget) + " MB budget" : "no budget", filename, numFrames,
+			params["_compressionWorkers"], SAVE_HDF5, nullptr, spillDirectory);
+		for (auto& threadTime : timers.getThreadCPUTimes()) {
+			std::snprintf(line, sizeof(line), "    %-24s %8.3f s CPU", threadTime.first.c_str(), threadTime.second);
+			debugMessage(line, DEBUG_MUST_SHOW);
+		}
+	}
+	params["_memoryBudgetMB"] = previousBudget;
+	return EXIT_SUCCESS;
+}
+
+// Records [seconds] of paced synthetic Kinect-like and Point Grey-like frames, saving only around two triggers fired
+// through the API, checks that each stream saved exactly the frames of its intervals, and compares the CPU time of
+// the acquisition threads with recording everything
+static int benchTrigger(int argc, char* argv[], std::map<std::string, size_t>& params) {
+	double seconds = (argc > 0) ? std::stod(argv[0]) : 10;
+	double preSeconds = (argc > 1) ? std::stod(argv[1]) : 1;
+	double postSeconds = (argc > 2) ? std::stod(argv[2]) : 1;
+	std::string filename = (argc > 3) ? argv[3] : "bench_trigger.h5";
+	debugMessage("Acquiring " + std::to_string(seconds) + " s of Kinect (512x424x16, 30 fps) and Point Grey (1280x1024x8, "
+		"100 fps) frames to " + filename + ", keeping " + std::to_string(preSeconds) + " s before and " +
+		std::to_string(postSeconds) + " s after triggers at 30% and 70%:", DEBUG_MUST_SHOW);
+	std::vector<std::string> names = { "kinect", "pg" };
+	std::vector<PredType> types = { KINECT_H5T, POINTGREY_H5T };
+	size_t frameChunkSize = params["_frameChunkSize"];
+	bool consistent = true;
+	char line[256];
+	for (bool triggered : { false, true }) {
+		timers.resetAll();
+		SyntheticCamera kincam(512, 424, sizeof(uint16_t), 30);
+		SyntheticCamera pgcam(1280, 1024, sizeof(uint8_t), 100);
+		std::vector<SyntheticCamera*> cameras = { &kincam, &pgcam };
+		std::vector<BaseAcquirer*> acquirers = { new BaseAcquirer("kinect", kincam), new BaseAcquirer("pg", pgcam) };
+		std::shared_ptr<RecordingTrigger> trigger = std::make_shared<RecordingTrigger>();
+		for (size_t i = 0; i < acquirers.size(); i++) {
+			acquirers[i]->setFramesToAcquire((size_t) (seconds * cameras[i]->getFPS()));
+			if (triggered) {
+				acquirers[i]->setFrameGate(std::unique_ptr<FrameGate>(new TriggerGate(trigger,
+					(size_t) std::ceil(preSeconds * cameras[i]->getFPS()), (size_t) std::ceil(postSeconds * cameras[i]->getFPS()))));
+			}
+		}
+		std::vector<DSetCreatPropList> dcpls = {
+			createStreamDcpl(params, "kinect", frameChunkSize, params["_kinectYchunk"], params["_kinectXchunk"]),
+			createStreamDcpl(params, "pg", frameChunkSize, params["_pgYchunk"], params["_pgXchunk"]) };
+		FileAccPropList fapl;
+		fapl.setCache(65536000, params["_rdcc_nslots"], params["_rdcc_nbytes"], 0);
+		H5Out* out = new H5Out(filename, acquirers, frameChunkSize, names, types, FileCreatPropList::DEFAULT, fapl, dcpls,
+			false, params["_compressionWorkers"]);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (BaseAcquirer* acquirer : acquirers) {
+			acquirer->run();
+			acquirer->beginAcquisition();
+		}
+		size_t triggersFired = 0;
+		while (out->isSaving()) {
+			double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (triggersFired < 2 && elapsed >= seconds * (triggersFired == 0 ? 0.3 : 0.7)) {
+				trigger->fire("API");
+				triggersFired++;
+			}
+			for (BaseAcquirer* acquirer : acquirers) acquirer->getMostRecentGUI();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		for (BaseAcquirer* acquirer : acquirers) acquirer->abortAcquisition();
+		out->abortSaving(false);
+		out->writeDroppedFrames();
+		std::snprintf(line, sizeof(line), "  %s", triggered ? "triggered" : "everything");
+		debugMessage(line, DEBUG_MUST_SHOW);
+		for (BaseAcquirer* acquirer : acquirers) {
+			FrameGate* gate = acquirer->getFrameGate();
+			std::snprintf(line, sizeof(line), "    %-8s %6zu frames received, %6zu saved, %6zu skipped, %4zu dropped",
+				acquirer->getName().c_str(), acquirer->getFramesReceived(), acquirer->getFramesToSave(),
+				acquirer->getFramesGated(), acquirer->getFramesDropped());
+			debugMessage(line, DEBUG_MUST_SHOW);
+			if (gate != nullptr) {
+				for (auto& interval : gate->getIntervals()) {
+					std::snprintf(line, sizeof(line), "      frames %zu to %zu", interval.first, interval.first + interval.second - 1);
+					debugMessage(line, DEBUG_MUST_SHOW);
+				}
+			}
+		}
+		delete out;
+		for (BaseAcquirer* acquirer : acquirers) delete acquirer;
+		for (auto& threadTime : timers.getThreadCPUTimes()) {
+			std::snprintf(line, sizeof(line), "    %-24s %8.3f s CPU", threadTime.first.c_str(), threadTime.second);
+			debugMessage(line, DEBUG_MUST_SHOW);
+		}
+		if (!triggered) continue;
+
+		// Check each stream's frames against the frames of its intervals, less those dropped
+		H5File file(filename, H5F_ACC_RDONLY);
+		for (size_t i = 0; i < names.size(); i++) {
+			SyntheticCamera reference(cameras[i]->getWidth(), cameras[i]->getHeight(), cameras[i]->getBytesPerPixel(), 0, true);
+			std::vector<BaseFrame> patterns;
+			for (size_t k = 0; k < SYNTHETIC_PATTERNS; k++) patterns.push_back(reference.getFrame());
+			DataSet intervalset = file.openDataSet(names[i] + "_intervals"), droppedset = file.openDataSet(names[i] + "_dropped");
+			hsize_t intervaldims[2] = { 0, 2 }, droppeddims[1] = { 0 };
+			intervalset.getSpace().getSimpleExtentDims(intervaldims);
+			droppedset.getSpace().getSimpleExtentDims(droppeddims);
+			std::vector<unsigned long long> intervals(intervaldims[0] * 2), dropped(droppeddims[0]);
+			if (!intervals.empty()) intervalset.read(intervals.data(), PredType::NATIVE_ULLONG);
+			if (!dropped.empty()) droppedset.read(dropped.data(), PredType::NATIVE_ULLONG);
+			std::vector<size_t> numbers;
+			for (size_t k = 0; k < intervals.size(); k += 2) {
+				for (unsigned long long n = intervals[k]; n < intervals[k] + intervals[k + 1]; n++) {
+					if (std::find(dropped.begin(), dropped.end(), n) == dropped.end()) numbers.push_back((size_t) n);
+				}
+			}
+			DataSet dataset = file.openDataSet(names[i]);
+			hsize_t dims[4];
+			dataset.getSpace().getSimpleExtentDims(dims);
+			size_t frameBytes = cameras[i]->getBytes(), bad = 0;
+			std::vector<char> frames((size_t) dims[0] * frameBytes);
+			if (dims[0] > 0) dataset.read(frames.data(), dataset.getDataType());
+			for (size_t k = 0; k < std::min(numbers.size(), (size_t) dims[0]); k++) {
+				if (std::memcmp(frames.data() + k * frameBytes, patterns[numbers[k] % SYNTHETIC_PATTERNS].getData(), frameBytes)) bad++;
+			}
+			bool streamConsistent = (dims[0] == numbers.size() && bad == 0 && intervaldims[0] > 0);
+			std::snprintf(line, sizeof(line), "    %-8s %6zu frames in the file, %6zu in its intervals%s", names[i].c_str(),
+				(size_t) dims[0], numbers.size(), streamConsistent ? "" : "   MISMATCH");
+			debugMessage(line, DEBUG_MUST_SHOW);
+			consistent = consistent && streamConsistent;
+		}
+	}
+	return consistent ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Makes frame [k] of a scene for the motion benchmark: a still, slightly noisy background (with depth dropouts that
+// flicker, for depths), and a square that appears at frame [moveStart], moves, and disappears at frame [moveEnd]
+static BaseFrame makeMotionFrame(size_t width, size_t height, size_t bytesPerPixel, size_t k, size_t moveStart, size_t moveEnd) {
+	BaseFrame frame(width, height, bytesPerPixel, 1);
+	uint32_t noise = (uint32_t) (k * 2654435761u);
+	size_t side = height / 3, step = width / 50;
+	size_t left = (k - moveStart) * step % (width - side), top = height / 3;
+	bool moving = (k >= moveStart && k < moveEnd);
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			noise = noise * 1664525 + 1013904223;
+			size_t i = y * width + x;
+			bool square = moving && x >= left && x < left + side && y >= top && y < top + side;
+			if (bytesPerPixel == 1) ((uint8_t*) frame.getMutableData())[i] = (uint8_t) (square ? 200 : 50 + (noise >> 30));
+			else if (i % 97 == k % 2) ((uint16_t*) frame.getMutableData())[i] = 0; // (no depth, every other frame)
+			else ((uint16_t*) frame.getMutableData())[i] = (uint16_t) (square ? 1000 : 1500 + (noise >> 30));
+		}
+	}
+	return frame;
+}
+
+// Times the motion scoring kernels with each instruction set this CPU supports (checking them against the scalar
+// kernels), then runs Point Grey-like and Kinect-like scenes with movement in the middle through motion gates at
+// several decimations, and checks that each saves just the movement and its padding
+static int benchMotion(int argc, char* argv[], std::map<std::string, size_t>& /*params*/) {
+	size_t numFrames = (argc > 0) ? std::stoul(argv[0]) : 300;
+	size_t moveStart = numFrames / 3, moveEnd = 2 * numFrames / 3, preFrames = 10, postFrames = 20;
+	const char* levelNames[] = { "scalar", "SSE", "AVX2" };
+	simdLevel best = getSimdLevel();
+	struct { const char* name; size_t width, height, bytesPerPixel; bool depth; } streams[] = {
+		{ "pg", 1280, 1024, 1, false },
+		{ "kinect", 512, 424, 2, true } };
+	debugMessage("Scoring motion in " + std::to_string(numFrames) + " frames with movement in frames " + std::to_string(moveStart) +
+		" to " + std::to_string(moveEnd) + " (best kernels: " + levelNames[best] + "):", DEBUG_MUST_SHOW);
+	bool allMatch = true;
+	char line[256];
+	for (auto& stream : streams) {
+		BaseFrame first = makeMotionFrame(stream.width, stream.height, stream.bytesPerPixel, moveStart, moveStart, moveEnd);
+		BaseFrame second = makeMotionFrame(stream.width, stream.height, stream.bytesPerPixel, moveStart + 1, moveStart, moveEnd);
+		size_t numPixels = stream.width * stream.height, reference = 0;
+		for (int level = SIMD_SCALAR; level <= best; level++) {
+			size_t changed = 0;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (size_t f = 0; f < numFrames; f++) {
+				changed = countChangedPixels(second.getData(), first.getData(), numPixels, stream.bytesPerPixel, 16, stream.depth, (simdLevel) level);
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (level == SIMD_SCALAR) reference = changed;
+			allMatch = allMatch && (changed == reference);
+			std::snprintf(line, sizeof(line), "  %-8s %-7s %8.1f Mpixels/s   (%zu changed)%s", stream.name, levelNames[level],
+				numFrames * numPixels / seconds / 1e6, changed, changed == reference ? "" : "   MISMATCH");
+			debugMessage(line, DEBUG_MUST_SHOW);
+		}
+
+		// Whole frames through gates
+		std::vector<BaseFrame> frames;
+		for (size_t k = 0; k < numFrames; k++) {
+			frames.push_back(makeMotionFrame(stream.width, stream.height, stream.bytesPerPixel, k, moveStart, moveEnd));
+		}
+		for (size_t decimation : { 1, 2, 4, 8 }) {
+			MotionSettings settings = { decimation, 16, 5, 2 };
+			MotionGate gate(stream.width, stream.height, stream.bytesPerPixel, stream.depth, settings, preFrames, postFrames);
+			std::vector<numberedFrame> passed;
+			for (size_t k = 0; k < numFrames; k++) {
+				BaseFrame frame(frames[k]); // (shares the buffer)
+				gate.process(frame, k, passed);
+			}
+			gate.finish();
+			std::vector< std::pair<size_t, size_t> > intervals = gate.getIntervals();
+			bool match = (intervals.size() == 1 && intervals[0].first == moveStart - preFrames &&
+				intervals[0].second == moveEnd - moveStart + 1 + preFrames + postFrames && passed.size() == intervals[0].second);
+			allMatch = allMatch && match;
+			std::string saved;
+			for (auto& interval : intervals) {
+				saved += " " + std::to_string(interval.first) + "-" + std::to_string(interval.first + interval.second - 1);
+			}
+			std::snprintf(line, sizeof(line), "    every %zu rows: %7.1f us per frame, saved frames%s%s", decimation,
+				gate.getSecondsPerFrame() * 1e6, saved.c_str(), match ? "" : "   MISMATCH");
+			debugMessage(line, DEBUG_MUST_SHOW);
+		}
+	}
+	setSimdLevel(best);
+	return allMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+int runBenchmark(int argc, char* argv[], std::map<std::string, size_t>& params) {
+	std::string name = (argc > 0) ? argv[0] : "";
+	try {
+		if (name == "compression") return benchCompression(argc - 1, argv + 1, params);
+		if (name == "callbacks") return benchCallbacks(argc - 1, argv + 1, params);
+		if (name == "packing") return benchPacking(argc - 1, argv + 1, params);
+		if (name == "durability") return benchDurability(argc - 1, argv + 1, params);
+		if (name == "raw") return benchRaw(argc - 1, argv + 1, params);
+		if (name == "rotation") return benchRotation(argc - 1, argv + 1, params);
+		if (name == "swmr") return benchSwmr(argc - 1, argv + 1, params);
+		if (name == "codecs") return benchCodecs(argc - 1, argv + 1, params);
+		if (name == "delta") return benchDelta(argc - 1, argv + 1, params);
+		if (name == "spill") return benchSpill(argc - 1, argv + 1, params);
+		if (name == "trigger") return benchTrigger(argc - 1, argv + 1, params);
+		if (name == "motion") return benchMotion(argc - 1, argv + 1, params);
+	}
+	catch (...) {
+		debugMessage("Benchmark " + name + " failed", DEBUG_ERROR);
+		return EXIT_FAILURE;
+	}
+	debugMessage("Usage:\n\tacquireWang.exe --bench compression [numFrames = 1000] [filename = bench_compression.h5]\n"
+		"\tacquireWang.exe --bench callbacks [numFrames = 1000] [fps = 100]\n"
+		"\tacquireWang.exe --bench packing [numFrames = 200]\n"
+		"\tacquireWang.exe --bench durability [numFrames = 1000] [filename = bench_durability.h5]\n"
+		"\tacquireWang.exe --bench raw [numFrames = 1000] [filename = bench_raw]\n"
+		"\tacquireWang.exe --bench rotation [numFrames = 1000] [rotateMB = 64] [filename = bench_rotation.h5]\n"
+		"\tacquireWang.exe --bench swmr [numFrames = 1000] [filename = bench_swmr.h5]\n"
+		"\tacquireWang.exe --bench codecs [filename = synthetic] [numFrames = 100] [diskMBps = 0]\n"
+		"\tacquireWang.exe --bench delta [filename = synthetic] [numFrames = 100]\n"
+		"\tacquireWang.exe --bench spill [numFrames = 1000] [budgetMB = 256] [filename = bench_spill.h5] [spillDirectory]\n"
+		"\tacquireWang.exe --bench trigger [seconds = 10] [preSeconds = 1] [postSeconds = 1] [filename = bench_trigger.h5]\n"
+		"\tacquireWang.exe --bench motion [numFrames = 300]",
+		DEBUG_MUST_SHOW);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#pragma warning(push, 0)
+#include <map>
+#include <string>
+#pragma warning(pop)
+
+// Runs the benchmark named by argv[0] (from "acquireWang.exe --bench name [options]"),
+// using the recording parameters in [params]; returns the exit code
+int runBenchmark(int argc, char* argv[], std::map<std::string, size_t>& params);
@@ -0,0 +1,449 @@
+#include "bitpacking.h"
+#pragma warning(push, 0)
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#pragma warning(pop)
+
+// MSVC compiles intrinsics for any instruction set; GCC and Clang need to be told per function
+#ifdef __GNUC__
+#define TARGET_SSE __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_BMI2 __attribute__((target("bmi2")))
+#else
+#define TARGET_SSE
+#define TARGET_AVX2
+#define TARGET_BMI2
+#endif
+
+// How each pixel of a group is extracted: v is the 16 bits made of the group's bytes [lo] (low) and [hi] (high),
+// and the pixel is ((((v * mul) & 0xFFFF) >> shift) & maskA) | (v & maskB). All the kernels use this, so they
+// always agree.
+struct packingLayout {
+	size_t bits, groupPixels, groupBytes;
+	unsigned int shift;
+	uint8_t lo[4], hi[4];
+	uint16_t mul[4], maskA[4], maskB[4];
+};
+static const packingLayout LAYOUTS[] = {
+	{ 16, 1, 2, 0, { 0 }, { 1 }, { 1 }, { 0xFFFF }, { 0 } }, // PACKING_NONE (unused)
+	{ 10, 4, 5, 6, { 0, 1, 2, 3 }, { 1, 2, 3, 4 }, { 64, 16, 4, 1 }, { 0x3FF, 0x3FF, 0x3FF, 0x3FF }, { 0, 0, 0, 0 } },
+	{ 12, 2, 3, 4, { 0, 1 }, { 1, 2 }, { 16, 1 }, { 0xFFF, 0xFFF }, { 0, 0 } },
+	{ 12, 2, 3, 4, { 1, 1 }, { 0, 2 }, { 1, 1 }, { 0xFF0, 0xFFF }, { 0x00F, 0 } }
+};
+
+static std::atomic<int> simdLimit(SIMD_AVX2);
+
+/* * * * * * * * * *
+ * HELPER METHODS  *
+ * * * * * * * * * */
+
+static simdLevel detectSimdLevel() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool ssse3 = (info[2] & (1 << 9)) != 0;
+	bool osAVX = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+	bool avx2 = false;
+	if (maxLeaf >= 7 && osAVX) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool ssse3 = __builtin_cpu_supports("ssse3") != 0;
+	bool avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+	if (avx2 && ssse3) return SIMD_AVX2;
+	if (ssse3) return SIMD_SSE;
+	return SIMD_SCALAR;
+}
+
+// True if the CPU has BMI2 (PEXT and PDEP), which every AVX2 Intel CPU has, but not every AVX2 AMD CPU
+static bool detectBmi2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 8)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("bmi2") != 0;
+#endif
+}
+
+// Fills the constants for unpacking 8 pixels (a whole number of groups) with one 16-byte shuffle
+static void getUnpackConstants(const packingLayout& layout, uint8_t* shuffle, uint16_t* mul, uint16_t* maskA, uint16_t* maskB) {
+	for (size_t i = 0; i < 8; i++) {
+		size_t group = i / layout.groupPixels, j = i % layout.groupPixels;
+		shuffle[2 * i] = (uint8_t) (group * layout.groupBytes + layout.lo[j]);
+		shuffle[2 * i + 1] = (uint8_t) (group * layout.groupBytes + layout.hi[j]);
+		mul[i] = layout.mul[j];
+		maskA[i] = layout.maskA[j];
+		maskB[i] = layout.maskB[j];
+	}
+}
+
+static void unpackScalar(const packingLayout& layout, const uint8_t* src, uint16_t* dst, size_t numGroups, unsigned int dstShift) {
+	for (size_t g = 0; g < numGroups; g++) {
+		for (size_t j = 0; j < layout.groupPixels; j++) {
+			uint16_t v = (uint16_t) (src[layout.lo[j]] | (src[layout.hi[j]] << 8));
+			uint16_t pixel = (uint16_t) ((((uint16_t) (v * layout.mul[j]) >> layout.shift) & layout.maskA[j]) | (v & layout.maskB[j]));
+			*dst++ = (uint16_t) (pixel << dstShift);
+		}
+		src += layout.groupBytes;
+	}
+}
+
+// Unpacks 8 pixels per step; returns the number of pixels unpacked
+TARGET_SSE static size_t unpackSSE(const packingLayout& layout, const uint8_t* src, uint16_t* dst, size_t numPixels, unsigned int dstShift) {
+	alignas(16) uint8_t shuffle[16];
+	alignas(16) uint16_t mul[8], maskA[8], maskB[8];
+	getUnpackConstants(layout, shuffle, mul, maskA, maskB);
+	const __m128i vShuffle = _mm_load_si128((const __m128i*) shuffle);
+	const __m128i vMul = _mm_load_si128((const __m128i*) mul);
+	const __m128i vMaskA = _mm_load_si128((const __m128i*) maskA);
+	const __m128i vMaskB = _mm_load_si128((const __m128i*) maskB);
+	const __m128i vShift = _mm_cvtsi32_si128((int) layout.shift);
+	const __m128i vDstShift = _mm_cvtsi32_si128((int) dstShift);
+	const size_t stepBytes = 8 / layout.groupPixels * layout.groupBytes;
+	const size_t totalBytes = numPixels / layout.groupPixels * layout.groupBytes;
+
+	size_t done = 0;
+	for (size_t pos = 0; pos + 16 <= totalBytes; pos += stepBytes) { // (each load reads past the step)
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (src + pos)), vShuffle);
+		__m128i pixels = _mm_or_si128(_mm_and_si128(_mm_srl_epi16(_mm_mullo_epi16(v, vMul), vShift), vMaskA),
+			_mm_and_si128(v, vMaskB));
+		_mm_storeu_si128((__m128i*) (dst + done), _mm_sll_epi16(pixels, vDstShift));
+		done += 8;
+	}
+	return done;
+}
+
+// Unpacks 16 pixels per step (8 in each 128-bit lane); returns the number of pixels unpacked
+TARGET_AVX2 static size_t unpackAVX2(const packingLayout& layout, const uint8_t* src, uint16_t* dst, size_t numPixels, unsigned int dstShift) {
+	alignas(16) uint8_t shuffle[16];
+	alignas(16) uint16_t mul[8], maskA[8], maskB[8];
+	getUnpackConstants(layout, shuffle, mul, maskA, maskB);
+	const __m256i vShuffle = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) shuffle));
+	const __m256i vMul = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) mul));
+	const __m256i vMaskA = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) maskA));
+	const __m256i vMaskB = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) maskB));
+	const __m128i vShift = _mm_cvtsi32_si128((int) layout.shift);
+	const __m128i vDstShift = _mm_cvtsi32_si128((int) dstShift);
+	const size_t stepBytes = 8 / layout.groupPixels * layout.groupBytes;
+	const size_t totalBytes = numPixels / layout.groupPixels * layout.groupBytes;
+
+	size_t done = 0;
+	for (size_t pos = 0; pos + stepBytes + 16 <= totalBytes; pos += 2 * stepBytes) {
+		__m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) (src + pos))),
+			_mm_loadu_si128((const __m128i*) (src + pos + stepBytes)), 1);
+		__m256i v = _mm256_shuffle_epi8(bytes, vShuffle);
+		__m256i pixels = _mm256_or_si256(_mm256_and_si256(_mm256_srl_epi16(_mm256_mullo_epi16(v, vMul), vShift), vMaskA),
+			_mm256_and_si256(v, vMaskB));
+		_mm256_storeu_si256((__m256i*) (dst + done), _mm256_sll_epi16(pixels, vDstShift));
+		done += 16;
+	}
+	return done;
+}
+
+static void packScalar(pixelPacking packing, const uint16_t* src, uint8_t* dst, size_t numGroups, unsigned int srcShift) {
+	const packingLayout& layout = LAYOUTS[packing];
+	const uint16_t mask = (uint16_t) ((1 << layout.bits) - 1);
+	for (size_t g = 0; g < numGroups; g++) {
+		if (packing == PACKING_MONO12_PACKED) {
+			uint16_t p0 = (src[0] >> srcShift) & mask, p1 = (src[1] >> srcShift) & mask;
+			dst[0] = (uint8_t) (p0 >> 4);
+			dst[1] = (uint8_t) ((p0 & 0xF) | ((p1 & 0xF) << 4));
+			dst[2] = (uint8_t) (p1 >> 4);
+		}
+		else { // least significant bit first
+			uint64_t bits = 0;
+			for (size_t j = 0; j < layout.groupPixels; j++) {
+				bits |= (uint64_t) ((src[j] >> srcShift) & mask) << (j * layout.bits);
+			}
+			for (size_t b = 0; b < layout.groupBytes; b++) dst[b] = (uint8_t) (bits >> (8 * b));
+		}
+		src += layout.groupPixels;
+		dst += layout.groupBytes;
+	}
+}
+
+// Combines 8 pixels into 16-bit pairs in 32-bit lanes, and for 10 bits, those into 40-bit groups in 64-bit lanes
+// (the bytes to keep are then picked by packShuffle())
+TARGET_SSE static __m128i packGroupsSSE(__m128i pixels, size_t bits, __m128i vShift, __m128i vMask, __m128i vPairMul) {
+	__m128i pairs = _mm_madd_epi16(_mm_and_si128(_mm_srl_epi16(pixels, vShift), vMask), vPairMul);
+	if (bits == 12) return pairs;
+	return _mm_or_si128(_mm_and_si128(pairs, _mm_set1_epi64x(0xFFFFF)), _mm_slli_epi64(_mm_srli_epi64(pairs, 32), 20));
+}
+
+static void getPackShuffle(size_t bits, uint8_t* shuffle) {
+	size_t n = 0;
+	if (bits == 12) { // 3 bytes of each 32-bit lane
+		for (size_t lane = 0; lane < 4; lane++) for (size_t b = 0; b < 3; b++) shuffle[n++] = (uint8_t) (4 * lane + b);
+	}
+	else { // 5 bytes of each 64-bit lane
+		for (size_t lane = 0; lane < 2; lane++) for (size_t b = 0; b < 5; b++) shuffle[n++] = (uint8_t) (8 * lane + b);
+	}
+	while (n < 16) shuffle[n++] = 0x80; // zero
+}
+
+// Packs 8 pixels per step (Mono10p and Mono12p only); returns the number of pixels packed
+TARGET_SSE static size_t packSSE(const packingLayout& layout, const uint16_t* src, uint8_t* dst, size_t numPixels, unsigned int srcShift) {
+	alignas(16) uint8_t shuffle[16];
+	getPackShuffle(layout.bits, shuffle);
+	const __m128i vShuffle = _mm_load_si128((const __m128i*) shuffle);
+	const __m128i vShift = _mm_cvtsi32_si128((int) srcShift);
+	const __m128i vMask = _mm_set1_epi16((short) ((1 << layout.bits) - 1));
+	const __m128i vPairMul = _mm_set1_epi32(1 | (1 << (16 + layout.bits)));
+	const size_t stepBytes = 8 / layout.groupPixels * layout.groupBytes;
+	alignas(16) uint8_t packed[16];
+
+	size_t done = 0;
+	for (; done + 8 <= numPixels; done += 8) {
+		__m128i groups = packGroupsSSE(_mm_loadu_si128((const __m128i*) (src + done)), layout.bits, vShift, vMask, vPairMul);
+		_mm_store_si128((__m128i*) packed, _mm_shuffle_epi8(groups, vShuffle));
+		std::memcpy(dst, packed, stepBytes);
+		dst += stepBytes;
+	}
+	return done;
+}
+
+// Packs 16 pixels per step (Mono10p and Mono12p only); returns the number of pixels packed
+TARGET_AVX2 static size_t packAVX2(const packingLayout& layout, const uint16_t* src, uint8_t* dst, size_t numPixels, unsigned int srcShift) {
+	alignas(16) uint8_t shuffle[16];
+	getPackShuffle(layout.bits, shuffle);
+	const __m256i vShuffle = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) shuffle));
+	const __m128i vShift = _mm_cvtsi32_si128((int) srcShift);
+	const __m256i vMask = _mm256_set1_epi16((short) ((1 << layout.bits) - 1));
+	const __m256i vPairMul = _mm256_set1_epi32(1 | (1 << (16 + layout.bits)));
+	const size_t stepBytes = 8 / layout.groupPixels * layout.groupBytes;
+	alignas(32) uint8_t packed[32];
+
+	size_t done = 0;
+	for (; done + 16 <= numPixels; done += 16) {
+		__m256i pixels = _mm256_and_si256(_mm256_srl_epi16(_mm256_loadu_si256((const __m256i*) (src + done)), vShift), vMask);
+		__m256i groups = _mm256_madd_epi16(pixels, vPairMul);
+		if (layout.bits == 10) {
+			groups = _mm256_or_si256(_mm256_and_si256(groups, _mm256_set1_epi64x(0xFFFFF)),
+				_mm256_slli_epi64(_mm256_srli_epi64(groups, 32), 20));
+		}
+		_mm256_store_si256((__m256i*) packed, _mm256_shuffle_epi8(groups, vShuffle));
+		std::memcpy(dst, packed, stepBytes);
+		std::memcpy(dst + stepBytes, packed + 16, stepBytes);
+		dst += 2 * stepBytes;
+	}
+	return done;
+}
+
+// Depth packing works on groups of 8 pixels, as a 128-bit little-endian value [lo, hi]; [bits] < 16, so half a group
+// (4 pixels) always fits in 64 bits
+static void packDepthGroupScalar(const uint16_t* pixels, uint8_t* dst, size_t bits) {
+	uint64_t lo = 0, hi = 0;
+	for (size_t j = 0; j < 8; j++) {
+		size_t pos = j * bits;
+		uint64_t value = pixels[j];
+		if (pos < 64) {
+			lo |= value << pos;
+			if (pos + bits > 64) hi |= value >> (64 - pos);
+		}
+		else {
+			hi |= value << (pos - 64);
+		}
+	}
+	uint8_t group[16];
+	std::memcpy(group, &lo, 8);
+	std::memcpy(group + 8, &hi, 8);
+	std::memcpy(dst, group, bits);
+}
+static void unpackDepthGroupScalar(const uint8_t* src, uint16_t* pixels, size_t bits) {
+	uint8_t group[16] = { 0 };
+	std::memcpy(group, src, bits);
+	uint64_t lo, hi;
+	std::memcpy(&lo, group, 8);
+	std::memcpy(&hi, group + 8, 8);
+	const uint64_t mask = (1u << bits) - 1;
+	for (size_t j = 0; j < 8; j++) {
+		size_t pos = j * bits;
+		uint64_t value = (pos < 64) ? (lo >> pos) | ((pos + bits > 64) ? hi << (64 - pos) : 0) : hi >> (pos - 64);
+		pixels[j] = (uint16_t) (value & mask);
+	}
+}
+
+// PEXT gathers the low [bits] bits of 4 pixels at once, and PDEP spreads them back ([laneMask] has the low [bits]
+// bits of each 16-bit lane set). Whole 16-byte stores and loads are used where they stay inside the frame.
+TARGET_BMI2 static void packDepthGroupBMI2(const uint16_t* pixels, uint8_t* dst, size_t bits, uint64_t laneMask, bool room) {
+	uint64_t a, b;
+	std::memcpy(&a, pixels, 8);
+	std::memcpy(&b, pixels + 4, 8);
+	a = _pext_u64(a, laneMask);
+	b = _pext_u64(b, laneMask);
+	const unsigned int half = (unsigned int) (4 * bits);
+	uint64_t group[2] = { a | (b << half), b >> (64 - half) };
+	std::memcpy(dst, group, room ? 16 : bits);
+}
+TARGET_BMI2 static void unpackDepthGroupBMI2(const uint8_t* src, uint16_t* pixels, size_t bits, uint64_t laneMask, bool room) {
+	uint64_t group[2] = { 0, 0 };
+	std::memcpy(group, src, room ? 16 : bits);
+	const unsigned int half = (unsigned int) (4 * bits);
+	const uint64_t halfMask = (1ull << half) - 1;
+	uint64_t a = _pdep_u64(group[0] & halfMask, laneMask);
+	uint64_t b = _pdep_u64(((group[0] >> half) | (group[1] << (64 - half))) & halfMask, laneMask);
+	std::memcpy(pixels, &a, 8);
+	std::memcpy(pixels + 4, &b, 8);
+}
+
+// Clamps 8 pixels to [maxValue] into [clamped] (min(v, max) = v - saturated(v - max)); returns the number clamped
+static size_t clampDepthScalar(const uint16_t* src, uint16_t* clamped, size_t numPixels, uint16_t maxValue) {
+	size_t count = 0;
+	for (size_t j = 0; j < numPixels; j++) {
+		count += (src[j] > maxValue);
+		clamped[j] = (src[j] > maxValue) ? maxValue : src[j];
+	}
+	return count;
+}
+TARGET_SSE static size_t clampDepthSSE(const uint16_t* src, uint16_t* clamped, uint16_t maxValue) {
+	__m128i v = _mm_loadu_si128((const __m128i*) src);
+	__m128i excess = _mm_subs_epu16(v, _mm_set1_epi16((short) maxValue));
+	_mm_storeu_si128((__m128i*) clamped, _mm_sub_epi16(v, excess));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi16(excess, _mm_setzero_si128())) == 0xFFFF) return 0;
+	uint16_t ignored[8];
+	return clampDepthScalar(src, ignored, 8, maxValue); // (rare: just count them)
+}
+TARGET_AVX2 static size_t clampDepthAVX2(const uint16_t* src, uint16_t* clamped, uint16_t maxValue) {
+	__m256i v = _mm256_loadu_si256((const __m256i*) src);
+	__m256i excess = _mm256_subs_epu16(v, _mm256_set1_epi16((short) maxValue));
+	_mm256_storeu_si256((__m256i*) clamped, _mm256_sub_epi16(v, excess));
+	if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(excess, _mm256_setzero_si256())) == -1) return 0;
+	uint16_t ignored[16];
+	return clampDepthScalar(src, ignored, 16, maxValue);
+}
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+pixelPacking getPixelPacking(const std::string& pixelFormat) {
+	if (pixelFormat == "Mono10p") return PACKING_MONO10P;
+	if (pixelFormat == "Mono12p") return PACKING_MONO12P;
+	if (pixelFormat == "Mono12Packed") return PACKING_MONO12_PACKED;
+	return PACKING_NONE;
+}
+
+std::string getPackingName(pixelPacking packing) {
+	switch (packing) {
+		case PACKING_MONO10P: return "Mono10p";
+		case PACKING_MONO12P: return "Mono12p";
+		case PACKING_MONO12_PACKED: return "Mono12Packed";
+		default: return "";
+	}
+}
+
+std::string getPackingDescription(pixelPacking packing) {
+	switch (packing) {
+		case PACKING_MONO10P: return "10 bits per pixel, 4 pixels in 5 bytes, least significant bit first "
+			"(pixel n of a group is bits 10n to 10n+9 of the 40-bit little-endian group)";
+		case PACKING_MONO12P: return "12 bits per pixel, 2 pixels in 3 bytes, least significant bit first "
+			"(pixel n of a group is bits 12n to 12n+11 of the 24-bit little-endian group)";
+		case PACKING_MONO12_PACKED: return "12 bits per pixel, 2 pixels in 3 bytes: "
+			"byte 0 = pixel 0 bits 11-4, byte 1 = pixel 0 bits 3-0 | pixel 1 bits 3-0 << 4, byte 2 = pixel 1 bits 11-4";
+		default: return "not packed";
+	}
+}
+
+size_t getPackedBits(pixelPacking packing) { return (packing == PACKING_NONE) ? 0 : LAYOUTS[packing].bits; }
+size_t getPackingGroupPixels(pixelPacking packing) { return LAYOUTS[packing].groupPixels; }
+size_t getPackingGroupBytes(pixelPacking packing) { return LAYOUTS[packing].groupBytes; }
+
+size_t getPackedBytes(pixelPacking packing, size_t numPixels) {
+	return numPixels / LAYOUTS[packing].groupPixels * LAYOUTS[packing].groupBytes;
+}
+
+simdLevel getSimdLevel() {
+	static const simdLevel detected = detectSimdLevel();
+	return (simdLimit < (int) detected) ? (simdLevel) simdLimit.load() : detected;
+}
+
+void setSimdLevel(simdLevel level) {
+	simdLimit = level;
+}
+
+void unpackPixels(pixelPacking packing, const uint8_t* src, uint16_t* dst, size_t numPixels, unsigned int dstShift) {
+	if (packing == PACKING_NONE) return;
+	const packingLayout& layout = LAYOUTS[packing];
+	simdLevel level = getSimdLevel();
+	size_t done = 0;
+	if (level >= SIMD_AVX2) done = unpackAVX2(layout, src, dst, numPixels, dstShift);
+	if (level >= SIMD_SSE) {
+		done += unpackSSE(layout, src + getPackedBytes(packing, done), dst + done, numPixels - done, dstShift);
+	}
+	unpackScalar(layout, src + getPackedBytes(packing, done), dst + done, (numPixels - done) / layout.groupPixels, dstShift);
+}
+
+void packPixels(pixelPacking packing, const uint16_t* src, uint8_t* dst, size_t numPixels, unsigned int srcShift) {
+	if (packing == PACKING_NONE) return;
+	const packingLayout& layout = LAYOUTS[packing];
+	simdLevel level = getSimdLevel();
+	size_t done = 0;
+	if (packing != PACKING_MONO12_PACKED) {
+		if (level >= SIMD_AVX2) done = packAVX2(layout, src, dst, numPixels, srcShift);
+		if (level >= SIMD_SSE) {
+			done += packSSE(layout, src + done, dst + getPackedBytes(packing, done), numPixels - done, srcShift);
+		}
+	}
+	packScalar(packing, src + done, dst + getPackedBytes(packing, done), (numPixels - done) / layout.groupPixels, srcShift);
+}
+
+std::string getDepthPackingDescription(size_t bits) {
+	return std::to_string(bits) + " bits per pixel, 8 pixels in " + std::to_string(bits) + " bytes, least significant bit first "
+		"(pixel n of a group is bits " + std::to_string(bits) + "n to " + std::to_string(bits) + "n+" + std::to_string(bits - 1) +
+		" of the " + std::to_string(8 * bits) + "-bit little-endian group)";
+}
+
+size_t getDepthPackedBytes(size_t bits, size_t numPixels) {
+	return numPixels / 8 * bits;
+}
+
+size_t packDepth(const uint16_t* src, uint8_t* dst, size_t numPixels, size_t bits, uint16_t maxValue) {
+	static const bool bmi2 = detectBmi2();
+	maxValue = std::min(maxValue, (uint16_t) ((1u << bits) - 1));
+	simdLevel level = getSimdLevel();
+	bool usePext = bmi2 && level >= SIMD_AVX2;
+	uint64_t laneMask = 0x0001000100010001ull * ((1u << bits) - 1);
+	size_t totalBytes = getDepthPackedBytes(bits, numPixels);
+	size_t clamped = 0;
+	alignas(32) uint16_t pixels[16];
+	for (size_t done = 0; done < numPixels; ) {
+		// Clamp 16 or 8 pixels, then pack them a group at a time
+		size_t step = (level >= SIMD_AVX2 && done + 16 <= numPixels) ? 16 : 8;
+		if (step == 16) clamped += clampDepthAVX2(src + done, pixels, maxValue);
+		else if (level >= SIMD_SSE) clamped += clampDepthSSE(src + done, pixels, maxValue);
+		else clamped += clampDepthScalar(src + done, pixels, 8, maxValue);
+		for (size_t g = 0; g < step; g += 8) {
+			size_t offset = getDepthPackedBytes(bits, done + g);
+			if (usePext) packDepthGroupBMI2(pixels + g, dst + offset, bits, laneMask, offset + 16 <= totalBytes);
+			else packDepthGroupScalar(pixels + g, dst + offset, bits);
+		}
+		done += step;
+	}
+	return clamped;
+}
+
+void unpackDepth(const uint8_t* src, uint16_t* dst, size_t numPixels, size_t bits) {
+	static const bool bmi2 = detectBmi2();
+	bool usePext = bmi2 && getSimdLevel() >= SIMD_AVX2;
+	uint64_t laneMask = 0x0001000100010001ull * ((1u << bits) - 1);
+	size_t totalBytes = getDepthPackedBytes(bits, numPixels);
+	for (size_t done = 0; done < numPixels; done += 8) {
+		size_t offset = getDepthPackedBytes(bits, done);
+		if (usePext) unpackDepthGroupBMI2(src + offset, dst + done, bits, laneMask, offset + 16 <= totalBytes);
+		else unpackDepthGroupScalar(src + offset, dst + done, bits);
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+#pragma warning(push, 0)
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#pragma warning(pop)
+
+// Layouts of packed 10- and 12-bit pixels
+enum pixelPacking {
+	PACKING_NONE = 0,
+	PACKING_MONO10P = 1,		// 4 pixels in 5 bytes, least significant bit first (pixel 0 = bits 0-9 of the group)
+	PACKING_MONO12P = 2,		// 2 pixels in 3 bytes, least significant bit first (pixel 0 = bits 0-11 of the group)
+	PACKING_MONO12_PACKED = 3	// 2 pixels in 3 bytes: pixel 0 bits 11-4, then the low nibbles of pixels 0 and 1, then pixel 1 bits 11-4
+};
+
+// Instruction sets the packing kernels can use
+enum simdLevel { SIMD_SCALAR = 0, SIMD_SSE = 1, SIMD_AVX2 = 2 };
+
+// Returns the packing of a Spinnaker pixel format ("Mono10p", "Mono12p" or "Mono12Packed"), or PACKING_NONE
+pixelPacking getPixelPacking(const std::string& pixelFormat);
+// Returns the Spinnaker name of a packing (e.g. "Mono12p")
+std::string getPackingName(pixelPacking packing);
+// Returns a description of a packed layout, for saving with the data
+std::string getPackingDescription(pixelPacking packing);
+size_t getPackedBits(pixelPacking packing); // Bits per pixel
+size_t getPackingGroupPixels(pixelPacking packing); // Pixels in each group of whole bytes
+size_t getPackingGroupBytes(pixelPacking packing); // Bytes in each group
+// Returns the bytes taken by [numPixels] packed pixels ([numPixels] must be a multiple of the group size)
+size_t getPackedBytes(pixelPacking packing, size_t numPixels);
+
+// Returns the best instruction set the kernels use on this CPU (limited by setSimdLevel())
+simdLevel getSimdLevel();
+// Limits the instruction set the kernels use (e.g. to compare them); it is never raised above what the CPU supports
+void setSimdLevel(simdLevel level);
+
+// Unpacks [numPixels] pixels (a multiple of the group size) from [src] into [dst], shifted left by [dstShift]
+// bits (e.g. 16 - getPackedBits() to scale them to the full 16-bit range)
+void unpackPixels(pixelPacking packing, const uint8_t* src, uint16_t* dst, size_t numPixels, unsigned int dstShift = 0);
+// Packs [numPixels] pixels (a multiple of the group size) from [src] into [dst], after shifting them right by
+// [srcShift] bits (e.g. 16 - getPackedBits() to keep the most significant bits of 16-bit pixels)
+void packPixels(pixelPacking packing, const uint16_t* src, uint8_t* dst, size_t numPixels, unsigned int srcShift = 0);
+
+// Depth packing (e.g. Kinect depth, which needs 13 bits): groups of 8 pixels of [bits] bits (1 to 15) in [bits]
+// bytes, least significant bit first. The kernels clamp with SSE2/AVX2 and pack with BMI2 (PEXT/PDEP) where the
+// CPU has them (AVX2 level); PEXT and PDEP are slow on AMD CPUs before Zen 3, which --bench packing shows.
+std::string getDepthPackingDescription(size_t bits);
+// Returns the bytes taken by [numPixels] pixels (a multiple of 8) packed to [bits] bits
+size_t getDepthPackedBytes(size_t bits, size_t numPixels);
+// Packs [numPixels] pixels (a multiple of 8) from [src] into [dst], clamping any above [maxValue] (which is
+// itself limited to 2^[bits] - 1) to it; returns the number of pixels clamped
+size_t packDepth(const uint16_t* src, uint8_t* dst, size_t numPixels, size_t bits, uint16_t maxValue);
+// Unpacks [numPixels] pixels (a multiple of 8) of [bits] bits from [src] into [dst]
+void unpackDepth(const uint8_t* src, uint16_t* dst, size_t numPixels, size_t bits);
@@ -1,5 +1,6 @@
 #pragma once
 #pragma warning(push, 0)
+#include <functional>
 #include <utility>
 #pragma warning(pop)
 #include "frame.h"
@@ -7,6 +8,7 @@
 // Constants
 const bool DEBUGGING = false;
 enum cameraType { CAMERA_UNKNOWN, CAMERA_PG, CAMERA_KINECT };
+typedef std::function<void(BaseFrame&)> frameCallback; // Receives frames pushed by a camera
 
 class BaseCamera {
 protected:
@@ -15,6 +17,8 @@ protected:
 	cameraType camType;
 
 	size_t totalFrames;
+
+	std::shared_ptr<FramePool> framePool; // Pool that frames returned by getFrame() borrow buffers from
 public:
 	// Default constructor to give default values to members
 	BaseCamera() : width(0), height(0), channels(0), bytesPerPixel(0), fps(0),
@@ -33,10 +37,23 @@ public:
 	virtual void endAcquisition() {};
 	virtual bool isReady() { return true; };
 
+	// Sets the buffer pool for frames returned by getFrame() (called by the acquirer)
+	void setFramePool(std::shared_ptr<FramePool> _framePool) { framePool = _framePool; }
+
 	// [frame] should already have the right dimensions, etc.
 	// (getFrame only fills the data buffer of the frame)
 	virtual BaseFrame getFrame() = 0;
 
+	// Cameras that can push frames themselves (e.g. from driver events) override these: after
+	// startFrameCallbacks() returns true, the camera calls [callback] on its own thread with each new frame
+	// until stopFrameCallbacks(). Returns false if the camera only supports getFrame().
+	virtual bool startFrameCallbacks(frameCallback /*callback*/) { return false; }
+	virtual void stopFrameCallbacks() {}
+
+	// Checks (and if possible restores) the camera's connection and streaming state; called at a low rate
+	// during acquisition rather than for every frame. Returns false if the camera is not usable.
+	virtual bool checkHealth() { return true; }
+
 	size_t getWidth() { return width; }
 	size_t getHeight() { return height; }
 	size_t getChannels() { return channels; }
@@ -0,0 +1,138 @@
+#pragma once
+#pragma warning(push, 0)
+#include <cstdlib>
+#include <functional>
+#include <vector>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#pragma warning(pop)
+#include "frame.h"
+
+#define CHUNK_SLAB_ALIGNMENT 4096 // Alignment of slab memory (suitable for unbuffered I/O)
+
+// Allocates and frees aligned memory for slabs
+inline void* alignedAlloc(size_t bytes, size_t alignment) {
+#ifdef _WIN32
+	return _aligned_malloc(bytes, alignment);
+#else
+	void* result = nullptr;
+	if (posix_memalign(&result, alignment, bytes) != 0) return nullptr;
+	return result;
+#endif
+}
+inline void alignedFree(void* ptr) {
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	std::free(ptr);
+#endif
+}
+
+// One chunk's worth of contiguous frames and their timestamps
+struct ChunkSlab {
+	char* data; // [capacity] frames of [frameBytes] bytes, back to back
+	double* timestamps; // [capacity] timestamps
+	size_t numFrames; // Number of frames currently in the slab
+};
+
+// Returns the memory for the [slabNumber]th slab filled (counting from 0), which must have room for a whole slab
+typedef std::function<char*(size_t slabNumber)> slabPlacer;
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class provides a preallocated ring of chunk-sized slabs for a single
+ * stream. Frames are copied straight into their final slot in the slab being
+ * filled, so a full slab can be handed to a writer as one contiguous buffer
+ * without any staging copy or per-chunk allocation. Slabs are written and
+ * released in the order they were filled.
+ *
+ * A slab placer can instead put each slab where the writer wants the frames
+ * to end up (e.g. in a memory-mapped file), so that writing a slab needs no
+ * copy at all.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class ChunkArena {
+private:
+	const size_t frameBytes; // Bytes per frame
+	const size_t capacity; // Frames per slab
+	std::vector<ChunkSlab> slabs; // Ring of slabs
+	size_t head; // Index of oldest slab in use (the next to be written)
+	size_t inUse; // Number of slabs in use (the last one is being filled)
+	slabPlacer placer; // Places each slab as it starts to be filled (if set)
+	size_t slabsStarted; // Number of slabs started so far
+
+	ChunkSlab& tail() { return slabs[(head + inUse - 1) % slabs.size()]; }
+
+	// Disable assignment operator and copy constructor
+	ChunkArena& operator=(const ChunkArena& other) = delete;
+	ChunkArena(const ChunkArena& other) = delete;
+
+public:
+	// Constructor and destructor
+	ChunkArena(size_t _frameBytes, size_t _capacity, size_t numSlabs) :
+			frameBytes(_frameBytes), capacity(_capacity), slabs(numSlabs), head(0), inUse(0),
+			slabsStarted(0) {
+		size_t slabBytes = ((frameBytes * capacity + CHUNK_SLAB_ALIGNMENT - 1) / CHUNK_SLAB_ALIGNMENT) * CHUNK_SLAB_ALIGNMENT;
+		for (ChunkSlab& slab : slabs) {
+			slab.data = (char*) alignedAlloc(slabBytes, CHUNK_SLAB_ALIGNMENT);
+			slab.timestamps = new double[capacity];
+			slab.numFrames = 0;
+		}
+	}
+	~ChunkArena() {
+		for (ChunkSlab& slab : slabs) {
+			if (!placer) alignedFree(slab.data); // (placed slabs are not ours)
+			delete[] slab.timestamps;
+		}
+	}
+
+	/* Getter methods */
+	size_t getFrameBytes() { return frameBytes; }
+	size_t getCapacity() { return capacity; }
+	// Number of frames currently held in all slabs
+	size_t size() {
+		size_t result = 0;
+		for (size_t i = 0; i < inUse; i++) result += slabs[(head + i) % slabs.size()].numFrames;
+		return result;
+	}
+	bool empty() { return inUse == 0 || (inUse == 1 && slabs[head].numFrames == 0); }
+	// Returns true if another frame can be pushed
+	bool hasRoom() { return inUse < slabs.size() || tail().numFrames < capacity; }
+
+	/* Methods */
+	// Has slabs use the memory returned by [_placer] instead of their own (call before pushing any frames)
+	void setSlabPlacer(slabPlacer _placer) {
+		for (ChunkSlab& slab : slabs) {
+			alignedFree(slab.data);
+			slab.data = nullptr;
+		}
+		placer = _placer;
+	}
+	// Copies a frame into the next free slot; returns false if all slabs are full
+	bool push(BaseFrame& frame) {
+		if (inUse == 0 || tail().numFrames == capacity) {
+			if (inUse == slabs.size()) return false;
+			inUse++;
+			tail().numFrames = 0;
+			if (placer) tail().data = placer(slabsStarted);
+			slabsStarted++;
+		}
+		ChunkSlab& slab = tail();
+		frame.copyDataToBuffer(slab.data + slab.numFrames * frameBytes);
+		slab.timestamps[slab.numFrames] = frame.getTimestamp();
+		slab.numFrames++;
+		return true;
+	}
+	// Oldest slab (the next to be written)
+	ChunkSlab& front() { return slabs[head]; }
+	// Returns true if the oldest slab holds a full chunk
+	bool frontFull() { return inUse > 0 && slabs[head].numFrames == capacity; }
+	// Releases the oldest slab after it has been written
+	void popFront() {
+		if (inUse == 0) return;
+		slabs[head].numFrames = 0;
+		head = (head + 1) % slabs.size();
+		inUse--;
+	}
+	// Discards all frames
+	void clear() { while (inUse > 0) popFront(); }
+};
@@ -0,0 +1,231 @@
+#pragma once
+#pragma warning(push, 0)
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "H5Cpp.h" // HDF5
+#include "zlib.h" // deflate filter
+#include "lz4.h" // LZ4 filter
+#include "zstd.h" // Zstandard filter
+#include "blosc.h" // Blosc filter
+#pragma warning(pop)
+#include "codec.h"
+#include "debug.h"
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class encodes one HDF5 chunk of a frame dataset outside of HDF5, so
+ * that chunks can be compressed in parallel and written with a direct chunk
+ * write. It reads the chunk dimensions and filter pipeline from the dataset,
+ * and applies the same filters in the same order (with the same on-disk
+ * format) as HDF5 would, so stock readers with the filters can decode the
+ * result. Supported filters: shuffle, deflate, LZ4 (32004), Zstandard (32015)
+ * and Blosc (32001).
+ *
+ * Chunks are numbered over the chunk grid of one slab of frames (time,
+ * channel, y, x; x fastest). encodeChunk() is safe to call from several
+ * threads at once.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class ChunkEncoder {
+private:
+	struct Filter {
+		H5Z_filter_t id;
+		std::vector<unsigned int> params;
+	};
+	std::vector<Filter> filters; // Filter pipeline, in the order applied when writing
+	bool supported; // false if the dataset uses a filter (or chunk shape) we cannot reproduce
+
+	size_t elementBytes; // Bytes per pixel
+	hsize_t frameDims[3]; // channels, height, width
+	hsize_t chunkDims[4]; // frames, channels, height, width
+	size_t gridDims[3]; // Number of chunks along channels, height, width
+
+	// Returns the number of chunks along [length] for chunks of size [chunk]
+	static size_t numAlong(hsize_t length, hsize_t chunk) { return (size_t) ((length + chunk - 1) / chunk); }
+
+	// Splits a chunk index into chunk coordinates (time, channel, y, x)
+	void getChunkCoords(size_t index, size_t coords[4]) {
+		coords[3] = index % gridDims[2]; index /= gridDims[2];
+		coords[2] = index % gridDims[1]; index /= gridDims[1];
+		coords[1] = index % gridDims[0]; index /= gridDims[0];
+		coords[0] = index;
+	}
+
+	/* Filters (each reads [in] and replaces [out]) */
+	static bool shuffle(const std::vector<char>& in, std::vector<char>& out, size_t typeBytes) {
+		out.resize(in.size());
+		size_t numElements = in.size() / typeBytes;
+		for (size_t j = 0; j < typeBytes; j++) {
+			char* dest = out.data() + j * numElements;
+			const char* src = in.data() + j;
+			for (size_t i = 0; i < numElements; i++) dest[i] = src[i * typeBytes];
+		}
+		// Leftover bytes (if the chunk is not a whole number of elements) are copied as-is
+		size_t done = numElements * typeBytes;
+		std::memcpy(out.data() + done, in.data() + done, in.size() - done);
+		return true;
+	}
+	static bool deflate(const std::vector<char>& in, std::vector<char>& out, int level) {
+		uLongf outBytes = compressBound((uLong) in.size());
+		out.resize(outBytes);
+		if (compress2((Bytef*) out.data(), &outBytes, (const Bytef*) in.data(), (uLong) in.size(), level) != Z_OK) return false;
+		out.resize(outBytes);
+		return true;
+	}
+	// Writes [value] big-endian (as the LZ4 filter does)
+	static void putBigEndian(char* dest, uint64_t value, int numBytes) {
+		for (int i = numBytes - 1; i >= 0; i--) { dest[i] = (char) (value & 0xff); value >>= 8; }
+	}
+	static bool lz4(const std::vector<char>& in, std::vector<char>& out, size_t blockBytes) {
+		// Format: total bytes (8), block bytes (4), then for each block its compressed size (4) and data
+		// (a block that does not shrink is stored uncompressed)
+		size_t numBytes = in.size();
+		if (numBytes > INT32_MAX) return false;
+		if (blockBytes == 0 || blockBytes > numBytes) blockBytes = numBytes;
+		size_t numBlocks = (numBytes > 0) ? (numBytes - 1) / blockBytes + 1 : 0;
+		out.resize(12 + numBlocks * (4 + LZ4_compressBound((int) blockBytes)));
+		putBigEndian(out.data(), numBytes, 8);
+		putBigEndian(out.data() + 8, blockBytes, 4);
+		size_t outBytes = 12;
+		for (size_t done = 0; done < numBytes; done += blockBytes) {
+			int srcBytes = (int) std::min(blockBytes, numBytes - done);
+			char* dest = out.data() + outBytes + 4;
+			int compressed = LZ4_compress_default(in.data() + done, dest, srcBytes, LZ4_compressBound(srcBytes));
+			if (compressed <= 0) return false;
+			if (compressed >= srcBytes) {
+				std::memcpy(dest, in.data() + done, srcBytes);
+				compressed = srcBytes;
+			}
+			putBigEndian(out.data() + outBytes, compressed, 4);
+			outBytes += 4 + compressed;
+		}
+		out.resize(outBytes);
+		return true;
+	}
+	static bool zstd(const std::vector<char>& in, std::vector<char>& out, int level) {
+		// Format: one Zstandard frame (which records the uncompressed size)
+		out.resize(ZSTD_compressBound(in.size()));
+		size_t outBytes = ZSTD_compress(out.data(), out.size(), in.data(), in.size(), level);
+		if (ZSTD_isError(outBytes)) return false;
+		out.resize(outBytes);
+		return true;
+	}
+	static bool blosc(const std::vector<char>& in, std::vector<char>& out, const std::vector<unsigned int>& params) {
+		// Format: one Blosc buffer. Parameters: filter and Blosc versions, pixel size, chunk size, level, shuffle
+		// mode and compressor (as filled in by the filter when the dataset was created)
+		if (params.size() < 7) return false;
+		const char* compressor = nullptr;
+		if (blosc_compcode_to_compname((int) params[6], &compressor) < 0) return false;
+		// Room for an incompressible chunk, which Blosc stores as-is (so, unlike the filter, this never fails)
+		out.resize(in.size() + BLOSC_MAX_OVERHEAD);
+		int outBytes = blosc_compress_ctx((int) params[4], (int) params[5], params[2], in.size(), in.data(),
+			out.data(), out.size(), compressor, 0, 1);
+		if (outBytes <= 0) return false;
+		out.resize(outBytes);
+		return true;
+	}
+
+public:
+	// Reads the chunk shape and filters of [dataset], which holds frames of [dims] (channels, height, width)
+	// written in slabs of [slabFrames] frames
+	ChunkEncoder(H5::DataSet& dataset, const std::vector<size_t>& dims, size_t slabFrames) : supported(true) {
+		elementBytes = dataset.getDataType().getSize();
+		for (int i = 0; i < 3; i++) frameDims[i] = dims[i];
+		H5::DSetCreatPropList dcpl = dataset.getCreatePlist();
+		if (dcpl.getLayout() != H5D_CHUNKED || dcpl.getChunk(4, chunkDims) != 4) {
+			supported = false;
+			return;
+		}
+		for (int i = 0; i < 3; i++) gridDims[i] = numAlong(frameDims[i], chunkDims[i + 1]);
+		// Slabs must start on chunk boundaries in time
+		if (chunkDims[0] == 0 || slabFrames % chunkDims[0] != 0) supported = false;
+
+		// Read filter pipeline (with the parameters HDF5 filled in when the dataset was created)
+		int numFilters = dcpl.getNfilters();
+		for (int i = 0; i < numFilters; i++) {
+			unsigned int flags = 0;
+			size_t numParams = 8;
+			unsigned int params[8] = { 0 };
+			char name[64];
+			unsigned int config = 0;
+			Filter filter;
+			filter.id = dcpl.getFilter(i, flags, numParams, params, sizeof(name), name, config);
+			filter.params.assign(params, params + std::min(numParams, (size_t) 8));
+			if (filter.id != H5Z_FILTER_SHUFFLE && filter.id != H5Z_FILTER_DEFLATE && filter.id != H5Z_FILTER_LZ4 &&
+					filter.id != H5Z_FILTER_ZSTD && filter.id != H5Z_FILTER_BLOSC) {
+				debugMessage("Filter " + std::to_string(filter.id) + " is not supported for parallel compression", DEBUG_WARNING);
+				supported = false;
+			}
+			filters.push_back(filter);
+		}
+	}
+
+	/* Getter methods */
+	bool isSupported() { return supported; }
+	// Number of chunks covering a slab of [numFrames] frames
+	size_t getNumChunks(size_t numFrames) {
+		return numAlong(numFrames, chunkDims[0]) * gridDims[0] * gridDims[1] * gridDims[2];
+	}
+	// Dataset offset of chunk [index] of a slab whose first frame is frame [firstFrame]
+	void getChunkOffset(size_t index, size_t firstFrame, hsize_t offset[4]) {
+		size_t coords[4];
+		getChunkCoords(index, coords);
+		offset[0] = firstFrame + coords[0] * chunkDims[0];
+		for (int i = 1; i < 4; i++) offset[i] = coords[i] * chunkDims[i];
+	}
+
+	/* Methods */
+	// Gathers chunk [index] from a slab of [numFrames] contiguous frames and runs the filter pipeline on it
+	// (the area of the chunk outside the frames is zero, the default fill value)
+	bool encodeChunk(const char* slab, size_t numFrames, size_t index, std::vector<char>& out) {
+		thread_local std::vector<char> scratch;
+		size_t coords[4];
+		getChunkCoords(index, coords);
+		hsize_t start[4];
+		hsize_t count[4];
+		hsize_t extent[4] = { numFrames, frameDims[0], frameDims[1], frameDims[2] };
+		for (int i = 0; i < 4; i++) {
+			start[i] = coords[i] * chunkDims[i];
+			count[i] = std::min(chunkDims[i], extent[i] - start[i]);
+		}
+
+		// Gather rows of the chunk
+		size_t chunkBytes = (size_t) (chunkDims[0] * chunkDims[1] * chunkDims[2] * chunkDims[3]) * elementBytes;
+		out.assign(chunkBytes, 0);
+		size_t rowBytes = (size_t) count[3] * elementBytes;
+		for (hsize_t t = 0; t < count[0]; t++) {
+			for (hsize_t c = 0; c < count[1]; c++) {
+				for (hsize_t y = 0; y < count[2]; y++) {
+					size_t src = (size_t) ((((start[0] + t) * extent[1] + start[1] + c) * extent[2] + start[2] + y) * extent[3] + start[3]);
+					size_t dest = (size_t) (((t * chunkDims[1] + c) * chunkDims[2] + y) * chunkDims[3]);
+					std::memcpy(out.data() + dest * elementBytes, slab + src * elementBytes, rowBytes);
+				}
+			}
+		}
+
+		// Run filters
+		for (Filter& filter : filters) {
+			bool result = true;
+			if (filter.id == H5Z_FILTER_SHUFFLE) {
+				size_t typeBytes = filter.params.empty() ? elementBytes : filter.params[0];
+				if (typeBytes <= 1 || out.size() < typeBytes) continue; // HDF5 skips shuffling in these cases
+				result = shuffle(out, scratch, typeBytes);
+			}
+			else if (filter.id == H5Z_FILTER_DEFLATE) {
+				result = deflate(out, scratch, filter.params.empty() ? Z_DEFAULT_COMPRESSION : (int) filter.params[0]);
+			}
+			else if (filter.id == H5Z_FILTER_LZ4) {
+				result = lz4(out, scratch, filter.params.empty() ? 0 : filter.params[0]);
+			}
+			else if (filter.id == H5Z_FILTER_ZSTD) {
+				result = zstd(out, scratch, filter.params.empty() ? ZSTD_DEFAULT_LEVEL : (int) filter.params[0]);
+			}
+			else if (filter.id == H5Z_FILTER_BLOSC) {
+				result = blosc(out, scratch, filter.params);
+			}
+			if (!result) return false;
+			out.swap(scratch);
+		}
+		return true;
+	}
+};
@@ -0,0 +1,90 @@
+#pragma once
+#pragma warning(push, 0)
+#include <map>
+#include <string>
+#include "H5Cpp.h" // HDF5
+#pragma warning(pop)
+#include "debug.h"
+
+#define H5Z_FILTER_LZ4 32004 // Registered ID of the HDF5 LZ4 filter plugin
+#define H5Z_FILTER_BLOSC 32001 // Registered ID of the HDF5 Blosc filter plugin
+#define H5Z_FILTER_ZSTD 32015 // Registered ID of the HDF5 Zstandard filter plugin
+#define ZSTD_DEFAULT_LEVEL 3
+#define BLOSC_DEFAULT_LEVEL 5
+
+// Codecs for frame datasets (_codec, which can be overridden per stream, e.g. "_codec_kinect", as can _codecLevel)
+enum frameCodec {
+	CODEC_LZ4 = 0,			// deflate (if _compression > 0), shuffle and LZ4: the original pipeline
+	CODEC_ZSTD = 1,			// shuffle and Zstandard
+	CODEC_BLOSC_LZ4 = 2,	// Blosc with bit shuffling and LZ4
+	CODEC_BLOSC_ZSTD = 3,	// Blosc with bit shuffling and Zstandard
+	CODEC_NONE = 4,			// uncompressed
+	NUM_CODECS = 5
+};
+
+// Returns a codec's name as used in config.json (e.g. "zstd"), with its level if it has one
+inline std::string getCodecName(frameCodec codec, size_t level = 0) {
+	switch (codec) {
+	case CODEC_LZ4: return "lz4";
+	case CODEC_ZSTD: return "zstd-" + std::to_string(level > 0 ? level : ZSTD_DEFAULT_LEVEL);
+	case CODEC_BLOSC_LZ4: return "blosc-lz4-" + std::to_string(level > 0 ? level : BLOSC_DEFAULT_LEVEL);
+	case CODEC_BLOSC_ZSTD: return "blosc-zstd-" + std::to_string(level > 0 ? level : BLOSC_DEFAULT_LEVEL);
+	case CODEC_NONE: return "none";
+	default: return "unknown";
+	}
+}
+
+// Returns the ID of the HDF5 filter plugin a codec needs (or 0 if it needs none)
+inline H5Z_filter_t getCodecFilter(frameCodec codec) {
+	switch (codec) {
+	case CODEC_LZ4: return H5Z_FILTER_LZ4;
+	case CODEC_ZSTD: return H5Z_FILTER_ZSTD;
+	case CODEC_BLOSC_LZ4: case CODEC_BLOSC_ZSTD: return H5Z_FILTER_BLOSC;
+	default: return 0;
+	}
+}
+
+// Returns true if HDF5 can find the filter a codec needs (plugins are loaded from HDF5_PLUGIN_PATH)
+inline bool isCodecAvailable(frameCodec codec) {
+	H5Z_filter_t filter = getCodecFilter(codec);
+	return filter == 0 || H5Zfilter_avail(filter) > 0;
+}
+
+// Reads the codec and level of [stream] from the recording parameters (0 is the codec's default level)
+inline void getStreamCodec(std::map<std::string, size_t>& params, const std::string& stream, frameCodec& codec, size_t& level) {
+	auto it = params.find("_codec_" + stream);
+	size_t value = (it != params.end()) ? it->second : params["_codec"];
+	if (value >= NUM_CODECS) {
+		debugMessage("Unknown codec " + std::to_string(value) + " for " + stream + "; using LZ4", DEBUG_WARNING);
+		value = CODEC_LZ4;
+	}
+	codec = (frameCodec) value;
+	it = params.find("_codecLevel_" + stream);
+	level = (it != params.end()) ? it->second : params["_codecLevel"];
+}
+
+// Adds the filters of [codec] at [level] to [dcpl]. The LZ4 codec keeps the original pipeline, with deflate
+// at [deflateLevel] (if > 0) and LZ4 blocks of [lz4BlockSize] bytes.
+inline void setCodecFilters(H5::DSetCreatPropList& dcpl, frameCodec codec, size_t level, size_t deflateLevel, size_t lz4BlockSize) {
+	if (codec == CODEC_LZ4) {
+		if (deflateLevel > 0) dcpl.setDeflate((int) deflateLevel);
+		// Enable shuffle filter
+		dcpl.setShuffle();
+		// Enable the LZ4 filter
+		const unsigned int lz4_params[1] = { (unsigned int) lz4BlockSize }; // block size in bytes (default = 1<<30 == 1.0 GB)
+		dcpl.setFilter(H5Z_FILTER_LZ4, H5Z_FLAG_MANDATORY, 1, lz4_params);
+	}
+	else if (codec == CODEC_ZSTD) {
+		dcpl.setShuffle();
+		const unsigned int zstd_params[1] = { (unsigned int) (level > 0 ? level : ZSTD_DEFAULT_LEVEL) };
+		dcpl.setFilter(H5Z_FILTER_ZSTD, H5Z_FLAG_MANDATORY, 1, zstd_params);
+	}
+	else if (codec == CODEC_BLOSC_LZ4 || codec == CODEC_BLOSC_ZSTD) {
+		// The first four parameters (filter and Blosc versions, pixel size and chunk size) are filled in by the filter;
+		// then the level, the shuffle mode (2 = bit shuffling, which Blosc does with SSE2/AVX2) and the compressor
+		// (1 = LZ4, 5 = Zstandard)
+		const unsigned int blosc_params[7] = { 0, 0, 0, 0, (unsigned int) (level > 0 ? level : BLOSC_DEFAULT_LEVEL), 2,
+			(codec == CODEC_BLOSC_LZ4) ? 1u : 5u };
+		dcpl.setFilter(H5Z_FILTER_BLOSC, H5Z_FLAG_MANDATORY, 7, blosc_params);
+	}
+}
@@ -0,0 +1,61 @@
+#include "compressionpool.h"
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+CompressionPool::CompressionPool(size_t numWorkers) : stopping(false) {
+	for (size_t i = 0; i < numWorkers; i++) {
+		workers.push_back(new std::thread(&CompressionPool::workLoop, this));
+	}
+}
+
+CompressionPool::~CompressionPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workReady.notify_all();
+	for (std::thread* worker : workers) {
+		worker->join();
+		delete worker;
+	}
+	debugMessage("~CompressionPool", DEBUG_HIDDEN_INFO);
+}
+
+void CompressionPool::run(size_t numTasks, const std::function<void(size_t)>& task) {
+	if (numTasks == 0) return;
+	// Without workers, just run the tasks here
+	if (workers.empty()) {
+		for (size_t i = 0; i < numTasks; i++) task(i);
+		return;
+	}
+	Batch batch = { &task, numTasks, 0, 0 };
+	std::unique_lock<std::mutex> lock(mutex);
+	batches.push_back(&batch);
+	workReady.notify_all();
+	batchDone.wait(lock, [&batch]() { return batch.done == batch.numTasks; });
+}
+
+/* * * * * * * * * *
+ * PRIVATE METHODS *
+ * * * * * * * * * */
+
+void CompressionPool::workLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		workReady.wait(lock, [this]() { return stopping || !batches.empty(); });
+		if (stopping) break;
+		// Take the next task of the oldest batch
+		Batch* batch = batches.front();
+		size_t index = batch->next++;
+		if (batch->next == batch->numTasks) batches.pop_front();
+		// Run it without holding the lock
+		lock.unlock();
+		(*batch->task)(index);
+		lock.lock();
+		batch->done++;
+		if (batch->done == batch->numTasks) batchDone.notify_all();
+	}
+	timers.addThreadCPUTime("compression", getThreadCPUTime());
+}
@@ -0,0 +1,52 @@
+#pragma once
+#pragma warning(push, 0)
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#pragma warning(pop)
+#include "timer.h"
+#include "debug.h"
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class manages a fixed set of worker threads for compressing chunks.
+ * A caller hands run() a batch of independent tasks (e.g. every chunk of a
+ * slab) and blocks until all of them are done; batches from several callers
+ * (e.g. per-stream saving threads) are worked on at the same time.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class CompressionPool {
+private:
+	struct Batch {
+		const std::function<void(size_t)>* task;
+		size_t numTasks;
+		size_t next; // Index of the next task to hand out
+		size_t done; // Number of tasks finished
+	};
+
+	std::vector<std::thread*> workers;
+	std::mutex mutex; // Guards batches and all Batch members
+	std::condition_variable workReady; // Signals workers that a batch was queued (or the pool is stopping)
+	std::condition_variable batchDone; // Signals callers that a task finished
+	std::deque<Batch*> batches; // Batches with tasks not yet handed out
+	bool stopping;
+
+	void workLoop();
+
+	// Disable assignment operator and copy constructor
+	CompressionPool& operator=(const CompressionPool& other) = delete;
+	CompressionPool(const CompressionPool& other) = delete;
+
+public:
+	// Constructor and destructor
+	CompressionPool(size_t numWorkers);
+	~CompressionPool();
+
+	/* Getter methods */
+	size_t getNumWorkers() { return workers.size(); }
+
+	/* Methods */
+	// Runs task(0) ... task(numTasks - 1) on the workers, and returns once all have finished
+	void run(size_t numTasks, const std::function<void(size_t)>& task);
+};
@@ -52,8 +52,13 @@ enum dtimer {
 	DTIMER_GET_FRAME = 7,			// getting frames from camera
 	DTIMER_MOVE_WRITE = 8,			// moving frames to write buffers (includes dequeueing frames)
 	DTIMER_DEQUEUE = 9,				// dequeueing frames
-	DTIMER_FRAME_COPY_CONST = 10,	// frame copy constructor
-	DTIMER_FRAME_ASSIGN = 11		// frame assignment operator
+	DTIMER_COPY_SHARE = 10,			// frame copies that share a buffer instead of copying it (count only)
+	DTIMER_FRAME_ASSIGN = 11,		// frame assignment operator (count only)
+	DTIMER_COPY_DETACH = 12,		// copy-on-write of a shared frame buffer
+	DTIMER_SAVER_WAIT = 13,			// saving thread sleeping while waiting for frames
+	DTIMER_COMPRESS = 14,			// saving thread waiting for chunks to be compressed on the compression pool
+	DTIMER_FLUSH = 15,				// flushing files to disk (on the flushing thread)
+	DTIMER_ROTATE = 16				// switching a stream to its next file (on the saving thread)
 };
 
 inline void printDebugTimerInfo() {
@@ -66,11 +71,28 @@ inline void printDebugTimerInfo() {
 	debugMessage("  Getting frames:                 " + std::to_string(timers.getTotalTime(DTIMER_GET_FRAME)), DEBUG_INFO);
 	debugMessage("Saving thread:", DEBUG_INFO);
 	debugMessage("  Writing frames:                 " + std::to_string(timers.getTotalTime(DTIMER_WRITE_FRAME)), DEBUG_INFO);
+	debugMessage("  Compressing chunks:             " + std::to_string(timers.getTotalTime(DTIMER_COMPRESS)), DEBUG_INFO);
 	debugMessage("  Moving frames to write buffers: " + std::to_string(timers.getTotalTime(DTIMER_MOVE_WRITE)), DEBUG_INFO);
 	debugMessage("    Dequeueing frames:            " + std::to_string(timers.getTotalTime(DTIMER_DEQUEUE)), DEBUG_INFO);
+	debugMessage("  Waiting for frames:             " + std::to_string(timers.getTotalTime(DTIMER_SAVER_WAIT)) +
+		" (" + std::to_string(timers.getCount(DTIMER_SAVER_WAIT)) + " waits)", DEBUG_INFO);
+	debugMessage("  Flushing files:                 " + std::to_string(timers.getTotalTime(DTIMER_FLUSH)) +
+		" (" + std::to_string(timers.getCount(DTIMER_FLUSH)) + " flushes)", DEBUG_INFO);
+	debugMessage("  Rotating files:                 " + std::to_string(timers.getTotalTime(DTIMER_ROTATE)) +
+		" (" + std::to_string(timers.getCount(DTIMER_ROTATE)) + " rotations)", DEBUG_INFO);
 	debugMessage("General:", DEBUG_INFO);
-	debugMessage("  Copying frames to buffers:      " + std::to_string(timers.getTotalTime(DTIMER_COPY_TO)), DEBUG_INFO);
-	debugMessage("  Copying frames from buffers:    " + std::to_string(timers.getTotalTime(DTIMER_COPY_FROM)), DEBUG_INFO);
-	debugMessage("  Frame copy constructor:         " + std::to_string(timers.getTotalTime(DTIMER_FRAME_COPY_CONST)), DEBUG_INFO);
-	debugMessage("  Frame assignment operator:      " + std::to_string(timers.getTotalTime(DTIMER_FRAME_ASSIGN)), DEBUG_INFO);
+	debugMessage("  Copying frames to buffers:      " + std::to_string(timers.getTotalTime(DTIMER_COPY_TO)) +
+		" (" + std::to_string(timers.getCount(DTIMER_COPY_TO)) + " copies)", DEBUG_INFO);
+	debugMessage("  Copying frames from buffers:    " + std::to_string(timers.getTotalTime(DTIMER_COPY_FROM)) +
+		" (" + std::to_string(timers.getCount(DTIMER_COPY_FROM)) + " copies)", DEBUG_INFO);
+	debugMessage("  Copy-on-write of shared frames: " + std::to_string(timers.getTotalTime(DTIMER_COPY_DETACH)) +
+		" (" + std::to_string(timers.getCount(DTIMER_COPY_DETACH)) + " copies)", DEBUG_INFO);
+	debugMessage("  Frame copies sharing a buffer:  " + std::to_string(timers.getCount(DTIMER_COPY_SHARE)), DEBUG_INFO);
+	debugMessage("  Frame assignments:              " + std::to_string(timers.getCount(DTIMER_FRAME_ASSIGN)), DEBUG_INFO);
+	debugMessage("Thread CPU time:", DEBUG_INFO);
+	for (auto& threadTime : timers.getThreadCPUTimes()) {
+		std::string label = "  " + threadTime.first + ":";
+		if (label.length() < 34) label += std::string(34 - label.length(), ' ');
+		debugMessage(label + std::to_string(threadTime.second), DEBUG_INFO);
+	}
 }
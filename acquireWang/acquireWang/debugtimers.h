@@ -1,5 +1,10 @@
 #pragma once
+#include <atomic>
 #include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
 #include <vector>
 
 class DebugTimers {
@@ -8,15 +13,22 @@ private:
 	std::vector<double> times;
 	std::vector<bool> enabled;
 	std::vector<std::chrono::time_point<std::chrono::high_resolution_clock>> starts;
+	std::unique_ptr<std::atomic<size_t>[]> counts; // number of times each timer was started or counted
+	std::mutex threadTimesMutex;
+	std::vector<std::pair<std::string, double>> threadTimes; // CPU time used by each finished pipeline thread
 public:
 	// Constructor
 	DebugTimers(size_t _numTimers) : numTimers(_numTimers), times(numTimers, 0), enabled(numTimers, false),
-			starts(numTimers, std::chrono::time_point<std::chrono::high_resolution_clock>()) {}
+			starts(numTimers, std::chrono::time_point<std::chrono::high_resolution_clock>()),
+			counts(new std::atomic<size_t>[_numTimers]) {
+		for (size_t i = 0; i < numTimers; i++) counts[i] = 0;
+	}
 	
 	// Start a timer
 	void start(size_t ind) {
 		// Validate input
 		if (ind < 0 || ind >= numTimers) return; // out of bounds
+		counts[ind]++;
 		if (enabled[ind]) return; // already started
 
 		// Start timer
@@ -36,6 +48,13 @@ public:
 		times[ind] += elapsed.count();
 	}
 
+	// Count an event without timing it
+	void count(size_t ind) {
+		// Validate input
+		if (ind < 0 || ind >= numTimers) return; // out of bounds
+		counts[ind]++;
+	}
+
 	// Returns if a timer is currently running
 	bool isRunning(size_t ind) {
 		return enabled[ind];
@@ -49,12 +68,35 @@ public:
 		return times[ind];
 	}
 
+	// Returns number of times a timer was started or counted
+	size_t getCount(size_t ind) {
+		// Validate input
+		if (ind < 0 || ind >= numTimers) return 0; // out of bounds
+
+		return counts[ind];
+	}
+
+	// Records the CPU time used by a pipeline thread (call just before the thread exits)
+	void addThreadCPUTime(const std::string& name, double seconds) {
+		std::lock_guard<std::mutex> lock(threadTimesMutex);
+		threadTimes.push_back(std::make_pair(name, seconds));
+	}
+
+	// Returns the CPU times recorded by addThreadCPUTime
+	std::vector<std::pair<std::string, double>> getThreadCPUTimes() {
+		std::lock_guard<std::mutex> lock(threadTimesMutex);
+		return threadTimes;
+	}
+
 	// Resets all timers
 	void resetAll() {
 		for (size_t i = 0; i < numTimers; i++) {
 			enabled[i] = false;
 			times[i] = 0;
+			counts[i] = 0;
 			starts[i] = std::chrono::time_point<std::chrono::high_resolution_clock>();
 		}
+		std::lock_guard<std::mutex> lock(threadTimesMutex);
+		threadTimes.clear();
 	}
 }; 
@@ -0,0 +1,101 @@
+#pragma once
+#pragma warning(push, 0)
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#pragma warning(pop)
+#include "pgcam.h"
+#include "timer.h"
+
+#define FAKE_PG_PATTERNS 16 // Number of distinct images cycled through
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class implements a stand-in for a Point Grey camera, for exercising
+ * the Spinnaker image event path without hardware. It raises image events
+ * itself: a thread wraps pregenerated Mono8 pixels in Spinnaker images at
+ * the camera's frame rate and hands them to the handler PointGreyCamera
+ * registered, so each one is converted and pushed by onImage() exactly as a
+ * camera's would be. Polled frames go through the same conversion.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class FakePointGreyCamera : public PointGreyCamera {
+private:
+	std::vector< std::vector<uint8_t> > patterns; // Pregenerated images
+	size_t imageIndex;
+	std::chrono::steady_clock::time_point nextFrameTime;
+	std::thread* eventThread; // Raises image events (nullptr if no handler is registered)
+	std::atomic<bool> raising;
+
+	// Waits until [time] (advanced by one frame), then wraps the next image's pixels in a Spinnaker image
+	Spinnaker::ImagePtr nextImage(std::chrono::steady_clock::time_point& time) {
+		time += std::chrono::microseconds((long long) (1e6 / fps));
+		std::this_thread::sleep_until(time);
+		std::vector<uint8_t>& pattern = patterns[imageIndex++ % FAKE_PG_PATTERNS];
+		return Spinnaker::Image::Create(getWidth(), getHeight(), 0, 0, Spinnaker::PixelFormat_Mono8, pattern.data());
+	}
+
+	void eventLoop(Spinnaker::ImageEvent* handler) {
+		std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now();
+		while (raising) {
+			handler->OnImageEvent(nextImage(time));
+		}
+		timers.addThreadCPUTime("fake PG events", getThreadCPUTime());
+	}
+
+protected:
+	void registerImageEvents(Spinnaker::ImageEvent& handler) override {
+		if (eventThread != nullptr) return;
+		raising = true;
+		eventThread = new std::thread(&FakePointGreyCamera::eventLoop, this, &handler);
+	}
+
+	void unregisterImageEvents(Spinnaker::ImageEvent& /*handler*/) override {
+		if (eventThread == nullptr) return;
+		raising = false;
+		eventThread->join();
+		delete eventThread;
+		eventThread = nullptr;
+	}
+
+public:
+	FakePointGreyCamera(size_t _width, size_t _height, double _fps) :
+			PointGreyCamera(_width, _height, _fps), imageIndex(0), eventThread(nullptr), raising(false) {
+		// Generate images (a pattern that moves from image to image)
+		for (size_t f = 0; f < FAKE_PG_PATTERNS; f++) {
+			std::vector<uint8_t> pattern(getWidth() * getHeight());
+			for (size_t y = 0; y < getHeight(); y++) {
+				for (size_t x = 0; x < getWidth(); x++) {
+					pattern[y * getWidth() + x] = (uint8_t) (x + 2 * y + 8 * f);
+				}
+			}
+			patterns.push_back(pattern);
+		}
+	}
+
+	~FakePointGreyCamera() override {
+		stopFrameCallbacks();
+	}
+
+	void initialize() override {}
+
+	void finalize() override {}
+
+	void beginAcquisition() override {
+		nextFrameTime = std::chrono::steady_clock::now();
+	}
+
+	void endAcquisition() override {}
+
+	BaseFrame getFrame() override {
+		return convertImage(nextImage(nextFrameTime));
+	}
+
+	bool checkHealth() override {
+		return true;
+	}
+
+	bool isReady() override {
+		return totalFrames > 0;
+	}
+};
@@ -2,16 +2,26 @@
 #pragma warning(push, 0)
 #include <cstdlib>
 #include <cstring>
-#include "debug.h"
+#include <memory>
+#include <utility>
 #pragma warning(pop)
+#include "framepool.h"
+#include "debug.h"
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * This class provides an interface for a generic frame object. The datatype
  * is abstracted away into the class, and the internal data buffer is
- * protected (though mutable) and internally managed. Different camera types
- * should inherit from this class and replace the void pointers (void*) with
- * concrete data type pointers, such as uint8_t* or uint16_t*, for the sake
- * of type safety.
+ * protected and internally managed. Different camera types should inherit
+ * from this class and replace the void pointers (void*) with concrete data
+ * type pointers, such as uint8_t* or uint16_t*, for the sake of type safety.
+ * If a FramePool is provided, the data buffer is borrowed from (and given
+ * back to) that pool instead of the heap.
+ *
+ * Frames are cheap handles: copying or assigning a frame shares the same
+ * reference-counted data buffer instead of copying pixels, so one camera
+ * buffer can flow to the saver and the GUI without a memcpy. The pixels are
+ * treated as immutable once a frame has been shared; writing to a shared
+ * frame first gives it a private copy (copy-on-write).
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 class BaseFrame {
 private:
@@ -20,20 +30,55 @@ private:
 	bool valid;
 
 	double timestamp;
-	void* data;
+	void* data; // Reference-counted buffer (see FramePool)
+	std::shared_ptr<FramePool> pool; // Pool that data is borrowed from (nullptr if heap-allocated)
 
 	// Allocates memory for data buffer
-	void* allocate() { return std::calloc(getNumPixels(), bytesPerPixel); }
+	void* allocate() {
+		if (pool != nullptr) return pool->borrow(getBytes());
+		return FramePool::newBuffer(getBytes());
+	}
+	// Drops this frame's reference to the data buffer, freeing it (or giving it
+	// back to the pool) if this was the last reference
+	void release() {
+		if (data == nullptr) return;
+		if (FramePool::dropRef(data)) {
+			if (pool != nullptr) pool->giveBack(data);
+			else FramePool::deleteBuffer(data);
+		}
+		data = nullptr;
+	}
+	// Gives this frame a private copy of its data if the buffer is shared
+	void detach() {
+		if (data == nullptr || !FramePool::isShared(data)) return;
+		timers.start(DTIMER_COPY_DETACH);
+		void* shared = data;
+		data = allocate();
+		std::memcpy(data, shared, getBytes());
+		FramePool::dropRef(shared); // not the last reference, since it was shared
+		timers.pause(DTIMER_COPY_DETACH);
+	}
+	// Takes on the dimensions and metadata of another frame (but not its data)
+	void copyMetadata(const BaseFrame& other) {
+		width = other.width;
+		height = other.height;
+		channels = other.channels;
+		bytesPerPixel = other.bytesPerPixel;
+		valid = other.valid;
+		timestamp = other.timestamp;
+	}
 
 public:
 	// Constructor and destructor
-	BaseFrame(size_t _width, size_t _height, size_t _bytesPerPixel, size_t _channels) :
+	BaseFrame(size_t _width, size_t _height, size_t _bytesPerPixel, size_t _channels,
+			std::shared_ptr<FramePool> _pool = nullptr) :
 			width(_width), height(_height), bytesPerPixel(_bytesPerPixel), channels(_channels),
-			timestamp(0), valid(true) {
+			timestamp(0), valid(true), pool(_pool) {
 		data = allocate();
 	}
-	BaseFrame(size_t _width, size_t _height, size_t channels, size_t _bytesPerPixel, void* _data, double _timestamp) :
-			BaseFrame(_width, _height, _bytesPerPixel, channels) {
+	BaseFrame(size_t _width, size_t _height, size_t channels, size_t _bytesPerPixel, void* _data, double _timestamp,
+			std::shared_ptr<FramePool> _pool = nullptr) :
+			BaseFrame(_width, _height, _bytesPerPixel, channels, _pool) {
 		copyDataFromBuffer(_data);
 		setTimestamp(_timestamp);
 	}
@@ -41,18 +86,24 @@ public:
 	BaseFrame() : width(0), height(0), channels(0), bytesPerPixel(0), timestamp(0), data(nullptr), valid(false) {}
 	virtual ~BaseFrame() {
 		//debugMessage("~BaseFrame " + std::to_string(width) + " " + std::to_string(height), DEBUG_INFO);
-		if (data != nullptr) std::free(data);
+		release();
 	}
 
-	// Copy constructor (deep copy; calls assignment operator overload)
+	// Copy constructor (shallow copy; shares the data buffer)
 	BaseFrame(const BaseFrame& other) : width(other.width), height(other.height), channels(other.channels),
-			bytesPerPixel(other.bytesPerPixel), timestamp(other.timestamp), valid(other.valid) {
-		timers.start(DTIMER_FRAME_COPY_CONST);
-		data = allocate();
-		copyDataFromBuffer(other.data);
-		timers.pause(DTIMER_FRAME_COPY_CONST);
+			bytesPerPixel(other.bytesPerPixel), timestamp(other.timestamp), valid(other.valid),
+			data(other.data), pool(other.pool) {
+		timers.count(DTIMER_COPY_SHARE);
+		if (data != nullptr) FramePool::addRef(data);
+	}
+	// Move constructor (takes over the data buffer)
+	BaseFrame(BaseFrame&& other) noexcept : width(other.width), height(other.height), channels(other.channels),
+			bytesPerPixel(other.bytesPerPixel), timestamp(other.timestamp), valid(other.valid),
+			data(other.data), pool(std::move(other.pool)) {
+		other.data = nullptr;
+		other.valid = false;
 	}
-	
+
 	// Getters and setters
 	bool isValid() const { return valid; }
 	size_t getWidth() const { return width; }
@@ -67,11 +118,23 @@ public:
 
 	// Buffer access methods (protect data from abuse)
 	// Derived classes should override these for type safety
-	void copyDataFromBuffer(void* buffer, bool verbose = false, std::string context = "") {
+	// Read-only access to the (possibly shared) pixel data
+	const void* getData() const { return data; }
+	// Writable access to the pixel data, for filling a frame before it is passed on
+	void* getMutableData() {
+		detach();
+		return data;
+	}
+	void copyDataFromBuffer(const void* buffer, bool verbose = false, std::string context = "") {
 		try {
 			if (verbose) {
 				debugMessage("copyDataFromBuffer: context " + context, DEBUG_INFO);
 			}
+			if (data != nullptr && FramePool::isShared(data)) {
+				// Don't copy the old contents just to overwrite them
+				release();
+				data = allocate();
+			}
 			timers.start(DTIMER_COPY_FROM);
 			std::memcpy(data, buffer, getBytes());
 			timers.pause(DTIMER_COPY_FROM);
@@ -91,22 +154,28 @@ public:
 		}
 	}
 
-	// Assignment operator override
-	BaseFrame& operator=(const BaseFrame& other) { // deep copy
-		timers.start(DTIMER_FRAME_ASSIGN);
+	// Assignment operator override (shallow copy; shares the data buffer)
+	BaseFrame& operator=(const BaseFrame& other) {
+		timers.count(DTIMER_FRAME_ASSIGN);
 		if (this != &other) {
-			width = other.width;
-			height = other.height;
-			channels = other.channels;
-			bytesPerPixel = other.bytesPerPixel;
-			valid = other.valid;
-
-			timestamp = other.timestamp;
-			data = allocate(); // assignment operator is called on an uncontructed instance?
-			copyDataFromBuffer(other.data);
+			if (other.data != nullptr) FramePool::addRef(other.data);
+			release(); // drop old buffer before taking on the new one
+			copyMetadata(other);
+			data = other.data;
+			pool = other.pool;
+		}
+		return *this;
+	}
+	// Move assignment operator (takes over the data buffer)
+	BaseFrame& operator=(BaseFrame&& other) noexcept {
+		if (this != &other) {
+			release();
+			copyMetadata(other);
+			data = other.data;
+			pool = std::move(other.pool);
+			other.data = nullptr;
+			other.valid = false;
 		}
-		timers.pause(DTIMER_FRAME_ASSIGN);
-
 		return *this;
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,66 @@
+#include "framegate.h"
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+FrameGate::FrameGate(size_t _preFrames, size_t _postFrames) :
+		preFrames(_preFrames), postFrames(_postFrames), ring(_preFrames), ringStart(0), ringCount(0), postRemaining(0),
+		passing(false), framesPassed(0), framesDiscarded(0) {}
+
+void FrameGate::process(BaseFrame& frame, size_t frameNumber, std::vector<numberedFrame>& passed) {
+	if (isOpen(frame)) {
+		// Pass on the frames held, then this one
+		for (; ringCount > 0; ringCount--) {
+			numberedFrame& held = ring[ringStart];
+			pass(held.first, held.second, passed);
+			ringStart = (ringStart + 1) % preFrames;
+		}
+		ringStart = 0;
+		pass(frameNumber, frame, passed);
+		postRemaining = postFrames;
+		passing = true;
+	}
+	else if (postRemaining > 0) {
+		pass(frameNumber, frame, passed);
+		postRemaining--;
+	}
+	else {
+		passing = false;
+		if (preFrames == 0) {
+			framesDiscarded++;
+			return; // (the frame's buffer goes back to the pool with [frame])
+		}
+		// Hold the frame in the ring, in place of the oldest when it is full
+		size_t slot = (ringStart + ringCount) % preFrames;
+		if (ringCount == preFrames) {
+			framesDiscarded++;
+			ringStart = (ringStart + 1) % preFrames;
+		}
+		else ringCount++;
+		ring[slot].first = frameNumber;
+		ring[slot].second = std::move(frame);
+	}
+}
+
+void FrameGate::finish() {
+	for (; ringCount > 0; ringCount--) {
+		ring[ringStart].second = BaseFrame();
+		ringStart = (ringStart + 1) % preFrames;
+		framesDiscarded++;
+	}
+	ringStart = 0;
+	passing = false;
+}
+
+/* * * * * * * * * *
+ * HELPER METHODS  *
+ * * * * * * * * * */
+
+void FrameGate::pass(size_t frameNumber, BaseFrame& frame, std::vector<numberedFrame>& passed) {
+	// Extend the last interval if this frame follows it
+	if (!intervals.empty() && intervals.back().first + intervals.back().second == frameNumber) intervals.back().second++;
+	else intervals.push_back(std::make_pair(frameNumber, (size_t) 1));
+	passed.push_back(std::make_pair(frameNumber, std::move(frame)));
+	framesPassed++;
+}
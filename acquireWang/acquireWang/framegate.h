@@ -0,0 +1,70 @@
+#pragma once
+#pragma warning(push, 0)
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+#pragma warning(pop)
+#include "frame.h"
+
+typedef std::pair<size_t, BaseFrame> numberedFrame; // A frame and its number (in acquisition order, from 0)
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class decides which frames of a stream reach the saver (see
+ * BaseAcquirer::setFrameGate()). Derived classes say, frame by frame,
+ * whether the gate is open. Frames are passed on while it is open and for
+ * [postFrames] frames after it closes. While it is closed, the last
+ * [preFrames] frames are held in a ring and passed on when it opens again,
+ * so each saved interval starts [preFrames] frames early. Other frames are
+ * discarded.
+ *
+ * The ring's slots are allocated up front, and frames are moved into them
+ * with their pooled buffers, so holding a frame copies no pixels. The
+ * intervals passed are kept, so the saved frames can be matched to frame
+ * numbers (and the acquisition timeline) afterwards.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class FrameGate {
+private:
+	const size_t preFrames;
+	const size_t postFrames;
+	std::vector<numberedFrame> ring; // Frames held while closed (the oldest at ringStart)
+	size_t ringStart;
+	size_t ringCount;
+	size_t postRemaining; // Frames still to pass after the gate closed
+	std::vector< std::pair<size_t, size_t> > intervals; // First frame number and number of frames of each interval passed
+	std::atomic<bool> passing; // true while frames are passed on
+	std::atomic<size_t> framesPassed;
+	std::atomic<size_t> framesDiscarded;
+
+	void pass(size_t frameNumber, BaseFrame& frame, std::vector<numberedFrame>& passed);
+
+	// Disable assignment operator and copy constructor
+	FrameGate& operator=(const FrameGate& other) = delete;
+	FrameGate(const FrameGate& other) = delete;
+
+protected:
+	// Returns true if the gate is open for [frame] (called for every frame, on the acquisition thread)
+	virtual bool isOpen(BaseFrame& frame) = 0;
+
+public:
+	FrameGate(size_t _preFrames, size_t _postFrames);
+	virtual ~FrameGate() {}
+
+	/* Getter methods */
+	size_t getPreFrames() { return preFrames; }
+	size_t getPostFrames() { return postFrames; }
+	size_t getMaxHeldFrames() { return preFrames; } // Most frames held at once (the acquirer makes room for them)
+	bool isPassing() { return passing; }
+	size_t getFramesPassed() { return framesPassed; }
+	size_t getFramesDiscarded() { return framesDiscarded; }
+	// First frame number and number of frames of each interval passed (call once acquisition has ended)
+	std::vector< std::pair<size_t, size_t> > getIntervals() { return intervals; }
+	// Describes the gate (e.g. for the output file)
+	virtual std::string getDescription() = 0;
+
+	/* Methods */
+	// Takes [frame] (numbered [frameNumber]), and appends the frames to pass on now to [passed], in order
+	void process(BaseFrame& frame, size_t frameNumber, std::vector<numberedFrame>& passed);
+	// Discards the frames still held (call when acquisition ends)
+	void finish();
+};
@@ -0,0 +1,57 @@
+#pragma once
+#pragma warning(push, 0)
+#include <atomic>
+#pragma warning(pop)
+#include "frame.h"
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class implements a lock-free triple buffer holding only the newest
+ * frame, for handing frames from one writer (an acquisition thread) to one
+ * reader (the GUI). The writer and reader each own a slot, and swap it with
+ * the shared middle slot in a single atomic exchange, so neither ever waits
+ * for the other. Frames are shared, not copied, and older frames the reader
+ * never took are simply replaced, so the cost is constant no matter how far
+ * behind the reader falls.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class FrameMailbox {
+private:
+	static const unsigned int INDEX_MASK = 3;
+	static const unsigned int FRESH = 4; // Set in [middle] when it holds a frame the reader has not taken
+
+	BaseFrame slots[3];
+	std::atomic<unsigned int> middle; // Index of the shared slot (plus FRESH)
+	unsigned int back; // Index of the writer's slot
+	unsigned int front; // Index of the reader's slot
+
+	// Disable assignment operator and copy constructor
+	FrameMailbox& operator=(const FrameMailbox& other) = delete;
+	FrameMailbox(const FrameMailbox& other) = delete;
+
+public:
+	FrameMailbox() : middle(1), back(0), front(2) {}
+
+	// Publishes [frame], replacing any frame the reader has not taken (writer only)
+	void put(BaseFrame& frame) {
+		slots[back] = std::move(frame);
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	// Returns true if a frame was published since the last take()
+	bool hasNew() { return (middle.load(std::memory_order_acquire) & FRESH) != 0; }
+
+	// Moves the newest frame into [frame] if there is one the reader has not taken yet (reader only)
+	bool take(BaseFrame& frame) {
+		if (!hasNew()) return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+		frame = std::move(slots[front]);
+		return true;
+	}
+
+	// Releases all frames (only while neither the writer nor the reader is running)
+	void clear() {
+		for (BaseFrame& slot : slots) slot = BaseFrame();
+		middle = 1;
+		back = 0;
+		front = 2;
+	}
+};
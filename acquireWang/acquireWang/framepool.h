@@ -0,0 +1,171 @@
+#pragma once
+#pragma warning(push, 0)
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+#pragma warning(pop)
+
+#define FRAME_POOL_PAGE_SIZE 4096 // Buffer sizes are rounded up to a multiple of this to form size classes
+#define FRAME_BUFFER_HEADER_SIZE 64 // Bytes reserved in front of each data buffer for its reference count
+
+// Header stored in front of every frame data buffer so that frames can share it
+struct FrameBufferHeader {
+	std::atomic<size_t> refs; // Number of frames referring to this buffer
+	size_t classBytes; // Size class of the data that follows the header
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class provides a recycling pool of frame data buffers for a single
+ * stream. Buffers are grouped into size classes, so frames of the same
+ * dimensions share storage. BaseFrame borrows a buffer when it is constructed
+ * and gives it back when it is destroyed, so once the pool has been
+ * preallocated to the queue depth, steady-state acquisition does no heap
+ * allocation. Buffers are only freed when the pool itself is destroyed,
+ * unless it is limited to a number of bytes (setByteLimit()), as when frames
+ * spill to disk to stay within a memory budget: buffers given back beyond
+ * the limit are freed.
+ * Each buffer carries a reference count in a small header so that copies of
+ * a frame can share one buffer; it goes back to the pool with the last copy.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class FramePool {
+private:
+	std::mutex mutex; // Guards freeBuffers (borrowed on acquisition threads, given back on any thread)
+	std::map< size_t, std::vector<void*> > freeBuffers; // Available buffers for each size class
+	size_t byteLimit; // Most bytes kept allocated once buffers are given back (0 for no limit)
+
+	std::atomic<size_t> hits; // Number of borrows satisfied by a recycled buffer
+	std::atomic<size_t> misses; // Number of borrows that had to allocate
+	std::atomic<size_t> allocatedBytes; // Total bytes allocated by this pool
+
+	// Size class that a buffer of the given number of bytes belongs to
+	static size_t sizeClass(size_t bytes) {
+		return ((bytes + FRAME_POOL_PAGE_SIZE - 1) / FRAME_POOL_PAGE_SIZE) * FRAME_POOL_PAGE_SIZE;
+	}
+
+	// Allocates a new buffer for the given size class
+	void* allocate(size_t classBytes) {
+		allocatedBytes += classBytes;
+		return newBuffer(classBytes);
+	}
+
+	// Disable assignment operator and copy constructor
+	FramePool& operator=(const FramePool& other) = delete;
+	FramePool(const FramePool& other) = delete;
+
+public:
+	// Constructor and destructor
+	FramePool() : byteLimit(0), hits(0), misses(0), allocatedBytes(0) {}
+	~FramePool() {
+		for (auto& entry : freeBuffers) {
+			for (void* buffer : entry.second) deleteBuffer(buffer);
+		}
+	}
+
+	/* Reference-counted buffer methods (also used for frames without a pool) */
+	// Allocates a zeroed buffer of [bytes] bytes with a reference count of 1
+	static void* newBuffer(size_t bytes) {
+		char* block = (char*) std::calloc(FRAME_BUFFER_HEADER_SIZE + bytes, 1);
+		if (block == nullptr) return nullptr;
+		FrameBufferHeader* header = new (block) FrameBufferHeader;
+		header->refs = 1;
+		header->classBytes = bytes;
+		return block + FRAME_BUFFER_HEADER_SIZE;
+	}
+	// Frees a buffer allocated by newBuffer()
+	static void deleteBuffer(void* buffer) {
+		if (buffer == nullptr) return;
+		char* block = (char*) buffer - FRAME_BUFFER_HEADER_SIZE;
+		((FrameBufferHeader*) block)->~FrameBufferHeader();
+		std::free(block);
+	}
+	static FrameBufferHeader* getHeader(void* buffer) {
+		return (FrameBufferHeader*) ((char*) buffer - FRAME_BUFFER_HEADER_SIZE);
+	}
+	// Adds a reference to a buffer
+	static void addRef(void* buffer) { getHeader(buffer)->refs++; }
+	// Removes a reference from a buffer; returns true if that was the last reference
+	static bool dropRef(void* buffer) { return --getHeader(buffer)->refs == 0; }
+	// Returns true if more than one frame refers to a buffer
+	static bool isShared(void* buffer) { return getHeader(buffer)->refs > 1; }
+
+	// Makes sure at least [count] buffers of [bytes] bytes are available (as far as the byte limit allows)
+	void preallocate(size_t bytes, size_t count) {
+		size_t classBytes = sizeClass(bytes);
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<void*>& available = freeBuffers[classBytes];
+		available.reserve(count);
+		while (available.size() < count && (byteLimit == 0 || allocatedBytes + classBytes <= byteLimit)) {
+			void* buffer = allocate(classBytes);
+			if (buffer == nullptr) break;
+			available.push_back(buffer);
+		}
+	}
+
+	// Returns a buffer of at least [bytes] bytes with a reference count of 1
+	// (contents are undefined if recycled)
+	void* borrow(size_t bytes) {
+		size_t classBytes = sizeClass(bytes);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::vector<void*>& available = freeBuffers[classBytes];
+			if (!available.empty()) {
+				void* buffer = available.back();
+				available.pop_back();
+				getHeader(buffer)->refs = 1;
+				hits++;
+				return buffer;
+			}
+		}
+		misses++;
+		return allocate(classBytes);
+	}
+
+	// Returns a buffer previously obtained from borrow() once its last reference is dropped
+	// (freeing it instead if the pool has more than its byte limit allocated)
+	void giveBack(void* buffer) {
+		if (buffer == nullptr) return;
+		size_t classBytes = getHeader(buffer)->classBytes;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (byteLimit == 0 || allocatedBytes <= byteLimit) {
+				freeBuffers[classBytes].push_back(buffer);
+				return;
+			}
+		}
+		allocatedBytes -= classBytes;
+		deleteBuffer(buffer);
+	}
+
+	// Keeps at most [bytes] bytes allocated once buffers are given back (0 for no limit), freeing available
+	// buffers beyond it now
+	void setByteLimit(size_t bytes) {
+		std::vector<void*> excess;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			byteLimit = bytes;
+			if (byteLimit == 0) return;
+			for (auto& entry : freeBuffers) {
+				while (!entry.second.empty() && allocatedBytes > byteLimit) {
+					excess.push_back(entry.second.back());
+					entry.second.pop_back();
+					allocatedBytes -= entry.first;
+				}
+			}
+		}
+		for (void* buffer : excess) deleteBuffer(buffer);
+	}
+
+	/* Getter methods */
+	// Number of recycled buffers currently available for [bytes]-byte frames
+	size_t getFreeCount(size_t bytes) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = freeBuffers.find(sizeClass(bytes));
+		return (it == freeBuffers.end()) ? 0 : it->second.size();
+	}
+	size_t getHits() { return hits; }
+	size_t getMisses() { return misses; }
+	size_t getAllocatedBytes() { return allocatedBytes; }
+};
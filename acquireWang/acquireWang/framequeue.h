@@ -0,0 +1,197 @@
+#pragma once
+#pragma warning(push, 0)
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+#pragma warning(pop)
+#include "frame.h"
+#include "spillfile.h"
+
+// What to do with a frame that arrives while the queue is full
+enum overflowPolicy {
+	OVERFLOW_BLOCK = 0,			// wait for room (the camera itself has to buffer or drop)
+	OVERFLOW_DROP_OLDEST = 1,	// discard the oldest queued frame
+	OVERFLOW_DROP_NEWEST = 2	// discard the arriving frame
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class provides a single-producer, single-consumer frame queue with a
+ * hard limit on the number of frames and/or bytes it holds. When it is full,
+ * enqueue() applies the overflow policy, and reports the numbers of any
+ * frames it discards (frames are numbered by the producer) so that drops can
+ * be accounted for.
+ *
+ * With a spill file, the oldest frames held in memory can be moved out to
+ * it (spillOldest(), called by MemoryGovernor), and are read back in order
+ * when they reach the front of the queue. Spilled frames do not count
+ * against the limits, which only bound the frames held in memory.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class BoundedFrameQueue {
+private:
+	std::mutex mutex;
+	std::condition_variable notFull; // Signals a blocked producer that a frame was dequeued (or the queue closed)
+	std::deque< std::pair<size_t, BaseFrame> > frames; // Frame numbers and frames, oldest first
+	size_t maxFrames; // Capacity in frames (0 = unlimited)
+	size_t maxBytes; // Capacity in bytes (0 = unlimited)
+	overflowPolicy policy;
+	size_t bytes; // Bytes of frame data currently queued in memory
+	bool closed; // true to stop blocking (e.g. when acquisition is aborted)
+	FrameSpillFile* spillFile; // Overflow tier (nullptr if none)
+	size_t spilled; // Frames at the front of [frames] that are in the spill file (or being written to it)
+	size_t spillWritten; // Frames at the front of [frames] that are completely written to the spill file
+	std::vector<size_t> lost; // Numbers of spilled frames that could not be read back
+
+	// Returns true if [frameBytes] more bytes do not fit
+	bool isFull(size_t frameBytes) {
+		size_t inMemory = frames.size() - spilled;
+		if (inMemory == 0) return false; // always accept one frame
+		return (maxFrames > 0 && inMemory >= maxFrames) || (maxBytes > 0 && bytes + frameBytes > maxBytes);
+	}
+
+	// Disable assignment operator and copy constructor
+	BoundedFrameQueue& operator=(const BoundedFrameQueue& other) = delete;
+	BoundedFrameQueue(const BoundedFrameQueue& other) = delete;
+
+public:
+	BoundedFrameQueue(size_t _maxFrames, size_t _maxBytes = 0, overflowPolicy _policy = OVERFLOW_BLOCK) :
+			maxFrames(_maxFrames), maxBytes(_maxBytes), policy(_policy), bytes(0), closed(false),
+			spillFile(nullptr), spilled(0), spillWritten(0) {}
+
+	/* Getter and setter methods */
+	void setLimits(size_t _maxFrames, size_t _maxBytes, overflowPolicy _policy) {
+		std::lock_guard<std::mutex> lock(mutex);
+		maxFrames = _maxFrames;
+		maxBytes = _maxBytes;
+		policy = _policy;
+	}
+	// Spills frames to [_spillFile] from now on (nullptr to stop; call while nothing is spilled)
+	void setSpillFile(FrameSpillFile* _spillFile) {
+		std::lock_guard<std::mutex> lock(mutex);
+		spillFile = _spillFile;
+	}
+	size_t size() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return frames.size();
+	}
+	bool empty() { return size() == 0; }
+	// Bytes of frame data held in memory (not counting spilled frames)
+	size_t getMemoryBytes() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return bytes;
+	}
+	// Numbers of the spilled frames that could not be read back (and so were dequeued as dropped)
+	std::vector<size_t> getLostFrames() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return lost;
+	}
+	size_t getFramesLost() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return lost.size();
+	}
+
+	/* Methods */
+	// Moves [frame] (numbered [frameNumber]) onto the queue, applying the overflow policy if full.
+	// Appends the numbers of any discarded frames to [dropped]; returns false if [frame] itself was not queued.
+	bool enqueue(BaseFrame& frame, size_t frameNumber, std::vector<size_t>& dropped) {
+		size_t frameBytes = frame.getBytes();
+		std::unique_lock<std::mutex> lock(mutex);
+		if (isFull(frameBytes)) {
+			if (policy == OVERFLOW_DROP_NEWEST) {
+				dropped.push_back(frameNumber);
+				return false;
+			}
+			else if (policy == OVERFLOW_DROP_OLDEST) {
+				while (isFull(frameBytes)) { // (the oldest in memory: spilled frames are safe)
+					dropped.push_back(frames[spilled].first);
+					bytes -= frames[spilled].second.getBytes();
+					frames.erase(frames.begin() + spilled);
+				}
+			}
+			else {
+				notFull.wait(lock, [this, frameBytes]() { return closed || !isFull(frameBytes); });
+				if (closed && isFull(frameBytes)) {
+					dropped.push_back(frameNumber);
+					return false;
+				}
+			}
+		}
+		bytes += frameBytes;
+		frames.push_back(std::make_pair(frameNumber, std::move(frame)));
+		return true;
+	}
+
+	// Moves the oldest frame into [frame]; returns false if the queue is empty (or the oldest frame is still
+	// being spilled). Only one thread may dequeue.
+	bool tryDequeue(BaseFrame& frame) {
+		bool fromSpill = false;
+		size_t frameNumber = 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (frames.empty()) return false;
+			if (spilled > 0) {
+				if (spillWritten == 0) return false;
+				frameNumber = frames.front().first;
+				frames.pop_front();
+				spilled--;
+				spillWritten--;
+				fromSpill = true;
+			}
+			else {
+				frame = std::move(frames.front().second);
+				bytes -= frame.getBytes();
+				frames.pop_front();
+			}
+		}
+		notFull.notify_one();
+		// Read a spilled frame back (in order: the spill file is first in, first out too); if that fails, the frame
+		// counts as dropped, so that the saver does not wait for it
+		if (fromSpill && !spillFile->read(frame)) {
+			std::lock_guard<std::mutex> lock(mutex);
+			lost.push_back(frameNumber);
+			return false;
+		}
+		return true;
+	}
+
+	// Moves the oldest frame held in memory to the spill file; returns false if there is none (or no spill file,
+	// or writing failed, in which case the frame stays in memory). Only one thread may spill.
+	bool spillOldest() {
+		BaseFrame frame;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (spillFile == nullptr || spilled >= frames.size()) return false;
+			frame = std::move(frames[spilled].second);
+			bytes -= frame.getBytes();
+			spilled++;
+		}
+		bool written = spillFile->write(frame);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (written) {
+				spillWritten++;
+			}
+			else { // (still the last frame being spilled: only this thread spills)
+				spilled--;
+				bytes += frame.getBytes();
+				frames[spilled].second = std::move(frame);
+			}
+		}
+		if (written) notFull.notify_one();
+		return written;
+	}
+
+	// Stops enqueue() from blocking (until reopen())
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+		}
+		notFull.notify_all();
+	}
+	void reopen() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = false;
+	}
+};
@@ -0,0 +1,44 @@
+#pragma once
+#pragma warning(push, 0)
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#pragma warning(pop)
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class lets acquisition threads wake a sleeping saver thread. Any
+ * number of threads may call notify(); a single waiting thread sleeps in
+ * waitUntil() until it is notified or a deadline passes. Notifications are
+ * latched, so one that arrives while the saver is busy is not lost.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class FrameSignal {
+private:
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool pending; // true if notified since the last wait
+
+	// Disable assignment operator and copy constructor
+	FrameSignal& operator=(const FrameSignal& other) = delete;
+	FrameSignal(const FrameSignal& other) = delete;
+
+public:
+	FrameSignal() : pending(false) {}
+
+	// Wakes the waiting thread (or the next one to wait)
+	void notify() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending = true;
+		}
+		cv.notify_one();
+	}
+
+	// Blocks until notified or until [deadline]; returns true if notified
+	bool waitUntil(std::chrono::steady_clock::time_point deadline) {
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait_until(lock, deadline, [this]() { return pending; });
+		bool result = pending;
+		pending = false;
+		return result;
+	}
+};
@@ -1,27 +1,141 @@
 #pragma once
 #pragma warning(push, 0)
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#include <io.h> // _commit, _dup
+#else
+#include <unistd.h> // fsync, dup
+#endif
 #include "H5Cpp.h" // HDF5
+#include "hdf5_hl.h" // direct chunk writes
 #pragma warning(pop)
 
 #include "acquirer.h"
 #include "saver.h"
+#include "chunkencoder.h"
+#include "codec.h"
+#include "temporaldelta.h"
+#include "compressionpool.h"
+#include "manifest.h"
 #include "debug.h"
 
 using namespace H5;
 
 const PredType POINTGREY_H5T = PredType::STD_U8LE;
+const PredType POINTGREY16_H5T = PredType::STD_U16LE; // Point Grey frames saved in a 16-bit raw pixel format
 const PredType KINECT_H5T = PredType::STD_U16LE;
+const PredType KINECT_PACKED_H5T = PredType::STD_U8LE; // Kinect depths packed to fewer bits (rows of bytes)
 const PredType TIMESTAMP_H5T = PredType::NATIVE_DOUBLE;
 const PredType BOOKMARK_H5T = PredType::STD_U64LE;
 
+#define ROTATION_INDEX_FORMAT "acquireWang rotation"
+#define ROTATION_INDEX_VERSION 1
+#define ROTATION_RETRY_SECONDS 1 // Interval between attempts to create a next file that could not be created
+
+// Creates a DCPL for frame datasets: chunks of [chunkFrames] frames by [yChunk] x [xChunk] pixels,
+// compressed with [codec] at [codecLevel] (see codec.h; the LZ4 codec also deflates if [deflateLevel] > 0)
+inline DSetCreatPropList createFrameDcpl(size_t chunkFrames, size_t yChunk, size_t xChunk,
+		size_t deflateLevel, size_t lz4BlockSize, frameCodec codec = CODEC_LZ4, size_t codecLevel = 0) {
+	DSetCreatPropList dcpl;
+	const int frame_ndims = 4;
+	hsize_t chunk_dims[frame_ndims] = { chunkFrames, 1, yChunk, xChunk };
+	dcpl.setChunk(frame_ndims, chunk_dims);
+	setCodecFilters(dcpl, codec, codecLevel, deflateLevel, lz4BlockSize);
+	return dcpl;
+}
+
+// Creates the DCPL for the frame dataset of [stream], with the stream's codec from the recording parameters
+inline DSetCreatPropList createStreamDcpl(std::map<std::string, size_t>& params, const std::string& stream,
+		size_t chunkFrames, size_t yChunk, size_t xChunk) {
+	frameCodec codec;
+	size_t level;
+	getStreamCodec(params, stream, codec, level);
+	if (!isCodecAvailable(codec)) {
+		debugMessage("The HDF5 filter for " + getCodecName(codec, level) + " was not found (check HDF5_PLUGIN_PATH)", DEBUG_WARNING);
+	}
+	return createFrameDcpl(chunkFrames, yChunk, xChunk, params["_compression"], params["_lz4_block_size"], codec, level);
+}
+
+// An output file of a rotating recording that is not being written to: either opened ahead of a rotation,
+// or rotated away from and waiting to be finished
+struct RotatedFile {
+	H5File file;
+	std::string filename;
+	size_t number; // Position of the file in its sequence (from 0)
+	std::vector<size_t> streams; // Indices of the streams in the file
+	std::vector<DataSet> datasets; // Frame datasets (in the order of streams)
+	std::vector<DataSet> tsdatasets; // Timestamp datasets (in the order of streams)
+	std::vector<size_t> frames; // Frames of each stream the datasets have room for (opened) or hold (retired)
+	std::vector<size_t> firstFrames; // Number of each stream's first frame in the file (retired)
+};
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * This class implements an output stream to an HDF5 file, derived from the
  * BaseSaver class. It internally manages the HDF5 file, so it only needs
  * a DCPL and/or DAPL provided if necessary.
+ *
+ * With filePerStream, each stream is written by its own thread to its own
+ * file (named after the dataset, e.g. "session_kinect.h5"), and
+ * linkStreamFiles() can afterwards tie them together into a session file
+ * at the original filename using external links. HDF5 is not reentrant, so
+ * every HDF5 call still holds h5mutex: the threads only overlap dequeueing,
+ * filling slabs and compressing chunks, and a slow write of one stream still
+ * holds up the others. Compression is kept out of the lock by compressing
+ * on the worker pool below, which filePerStream therefore always uses.
+ *
+ * With compressionWorkers > 0, chunks are compressed in parallel on a pool
+ * of worker threads (outside the HDF5 lock) and written with direct chunk
+ * writes; streams whose filters ChunkEncoder cannot reproduce fall back to
+ * HDF5's own filter pipeline.
+ *
+ * Datasets are created at their final size when the number of frames to
+ * acquire is known, and otherwise grow geometrically; either way they are
+ * trimmed to the frames actually saved when the saver is destroyed. The
+ * dataspaces used for each write are kept and reused, so writing a chunk
+ * costs no dataspace creation or extent changes in the common case.
+ *
+ * Files are flushed to disk by a separate thread according to the flush
+ * policy, rather than by the writer threads. Each flush also records how
+ * many frames of each stream it covers in the frame dataset's "framesSaved"
+ * attribute, so that after a power loss, the file can be read up to the
+ * last flush (the datasets may already be sized for more frames).
+ *
+ * With a rotation size and/or period, the recording is split into a
+ * sequence of files ("session_0000.h5", "session_0001.h5", ..., or
+ * "session_kinect_0000.h5", ... with filePerStream) without stopping it.
+ * A rotation thread opens each file's successor, with its datasets, ahead
+ * of time; when a file is due, the writer switches to it between two
+ * chunks (see rotateFile()), and the rotation thread then trims, flushes
+ * and closes the old file. Each frame dataset's "firstFrame" attribute
+ * holds the number of its first frame, and an index ("session.rotation.json")
+ * records the range of frames of each stream in each file.
+ *
+ * With swmr, files are written in HDF5's single-writer/multiple-reader mode
+ * (HDF5 1.10 or later), so that analysis can read them during the recording
+ * (see TailReader). Datasets then grow a slab at a time, and each slab is
+ * published as it is written: the frames are flushed before the timestamp
+ * dataset is extended, so its length is the number of complete frames. As
+ * SWMR writers cannot add objects or attributes, the files leave SWMR mode
+ * (are closed and reopened) once saving has finished.
+ *
+ * Streams of 16-bit pixels can be delta-coded over time before they are
+ * compressed (see temporaldelta.h), with a key frame at the start of every
+ * chunk; their frame datasets then have a TEMPORAL_DELTA_ATTRIBUTE attribute.
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 class H5Out : public BaseSaver {
 private:
-	H5File file;
+	std::vector<H5File> files; // the output file, or one file per stream
+	std::vector<std::string> filenames; // names of files
+	H5File sessionFile; // file linking the per-stream files together (if linkStreamFiles() was called)
+	bool linked; // true if sessionFile is open
+	std::mutex h5mutex; // serializes every HDF5 call, including writes, from the writer threads (HDF5 is not reentrant)
 	// TODO: make a small class so that we have just one vector of that class (for cleanliness)
 	std::vector<DataSet> datasets; // collection of datasets
 	std::vector<DataSet> tsdatasets; // collection of datasets for timestamps
@@ -30,197 +144,906 @@ private:
 
 	const int ndims = 4;
 	std::vector< std::vector<size_t> > frameDims;
+	std::vector<size_t> allocatedFrames; // Frames each stream's datasets currently have room for
+	std::vector<DataSpace> fileSpaces; // Dataspaces of the frame datasets (refreshed when they grow)
+	std::vector<DataSpace> tsFileSpaces; // Dataspaces of the timestamp datasets (refreshed when they grow)
+	std::vector<DataSpace> memSpaces; // Memory dataspaces for a full slab of frames
+	std::vector<DataSpace> tsMemSpaces; // Memory dataspaces for a full slab of timestamps
+
+	std::unique_ptr<CompressionPool> compressionPool; // Workers for compressing chunks (nullptr if none)
+	std::vector< std::unique_ptr<ChunkEncoder> > encoders; // Encoder for each stream (nullptr to use HDF5's filters)
+	std::vector< std::vector< std::vector<char> > > encodedChunks; // Compressed chunks of the slab being written, for each stream
+
+	const flushPolicy flushMode;
+	const size_t flushInterval; // Chunks or seconds between flushes
+	std::thread* flushThread; // Thread flushing the files (nullptr with FLUSH_NONE)
+	std::mutex flushMutex;
+	std::condition_variable flushNeeded; // Signals the flushing thread (enough chunks written, or stopping)
+	size_t chunksSinceFlush;
+	bool stopFlushing;
+
+	const bool swmr; // true to write files in SWMR mode
+	bool swmrWriting; // true while the current files are in SWMR mode
+
+	std::vector<bool> temporalDelta; // true for each stream whose frames are delta-coded before compression
+	std::vector<size_t> deltaCodedFrames; // Frames of each stream delta-coded so far (a slab stays coded if its write fails)
+
+	// File rotation (the current files' state is guarded by h5mutex)
+	const FileCreatPropList fcpl;
+	const FileAccPropList fapl;
+	const std::vector<DSetCreatPropList> dcpls; // DCPLs of the frame datasets
+	DSetCreatPropList timeDcpl; // DCPL of the timestamp datasets
+	const hsize_t rotateBytes; // Size from which files are rotated (0 for no limit)
+	const size_t rotateSeconds; // Time after which files are rotated (0 for no limit)
+	std::vector<std::string> baseFilenames; // Names of the files, before numbering them
+	std::vector<size_t> fileNumbers; // Position of each current file in its sequence
+	std::vector<std::chrono::steady_clock::time_point> fileStarts; // When each current file was started
+	std::vector<size_t> firstFrames; // Number of each stream's first frame in its current file
+	std::vector<size_t> lastFileFrames; // Frames of each stream in its previous file (to size the next one)
+	std::vector< std::unique_ptr<RotatedFile> > nextFiles; // Successor of each current file (nullptr until opened)
+	std::vector< std::unique_ptr<RotatedFile> > retiredFiles; // Files rotated away from, to be finished
+	std::vector<bool> rotationLate; // true while a file is due for rotation but its successor is not open yet
+	std::unique_ptr<SessionManifest> rotationIndex; // Frame ranges of each file (nullptr without rotation)
+	std::thread* rotationThread; // Thread opening and finishing files (nullptr without rotation)
+	std::mutex rotationMutex;
+	std::condition_variable rotationNeeded; // Signals the rotation thread (a file was rotated, or stopping)
+	bool rotationWork;
+	bool stopRotating;
 
 	// TODO: Methods to de-duplicate code
 	//void initDataset(std::string& dsname) {
 	//}
 
+	// File that a stream is written to
+	size_t getFileIndex(size_t streamIndex) { return threadPerStream ? streamIndex : 0; }
+	H5File& getFile(size_t streamIndex) { return files[getFileIndex(streamIndex)]; }
+
+	bool isRotating() { return rotateBytes > 0 || rotateSeconds > 0; }
+
+	// Name of a file without the extension, e.g. "session.h5" -> "session"
+	static std::string getRoot(const std::string& filename) {
+		if (filename.size() > 3 && filename.substr(filename.size() - 3) == ".h5") return filename.substr(0, filename.size() - 3);
+		return filename;
+	}
+
+	// Name of the file for one stream, e.g. "session.h5" -> "session_kinect.h5"
+	static std::string getStreamFilename(const std::string& filename, const std::string& dsname) {
+		return getRoot(filename) + "_" + dsname + ".h5";
+	}
+
+	// Name of a file in a rotation, e.g. "session.h5" -> "session_0003.h5"
+	static std::string getPartFilename(const std::string& filename, size_t number) {
+		char suffix[16];
+		std::snprintf(suffix, sizeof(suffix), "_%04d.h5", (int) number);
+		return getRoot(filename) + suffix;
+	}
+
+	// Creates a stream's frame and timestamp datasets in [file], with room for [numFrames] frames
+	void createDatasets(H5File& file, size_t i, size_t numFrames, DataSet& dataset, DataSet& tsdataset) {
+		hsize_t dims[4] = { numFrames, frameDims[i][0], frameDims[i][1], frameDims[i][2] };
+		hsize_t maxdims[4] = { H5S_UNLIMITED, frameDims[i][0], frameDims[i][1], frameDims[i][2] };
+		dataset = file.createDataSet(dsnames[i].c_str(), datatypes[i], DataSpace(ndims, dims, maxdims), dcpls[i]);
+		unsigned long long noFrames = 0;
+		dataset.createAttribute("framesSaved", PredType::STD_U64LE, DataSpace(H5S_SCALAR)).write(PredType::NATIVE_ULLONG, &noFrames);
+		if (isRotating()) {
+			dataset.createAttribute("firstFrame", PredType::STD_U64LE, DataSpace(H5S_SCALAR)).write(PredType::NATIVE_ULLONG, &noFrames);
+		}
+		hsize_t tsdims[2] = { numFrames, 1 };
+		hsize_t tsmaxdims[2] = { H5S_UNLIMITED, 1 };
+		if (temporalDelta[i]) {
+			unsigned long long keyInterval = frameChunkSize;
+			dataset.createAttribute(TEMPORAL_DELTA_ATTRIBUTE, PredType::STD_U64LE, DataSpace(H5S_SCALAR)).write(PredType::NATIVE_ULLONG, &keyInterval);
+		}
+		tsdataset = file.createDataSet((dsnames[i] + "_time").c_str(), TIMESTAMP_H5T, DataSpace(2, tsdims, tsmaxdims), timeDcpl);
+	}
+
+	// Sets the number of frames in a stream's frame and timestamp datasets
+	void resizeDatasets(size_t i, DataSet& dataset, DataSet& tsdataset, size_t numFrames) {
+		hsize_t dims[4] = { numFrames, frameDims[i][0], frameDims[i][1], frameDims[i][2] };
+		hsize_t tsdims[2] = { numFrames, 1 };
+		dataset.extend(dims);
+		tsdataset.extend(tsdims);
+	}
+
+	// File creation properties: as given, without free-space tracking for SWMR (recordings only append)
+	static FileCreatPropList getFileCreation(const FileCreatPropList& fcpl, bool swmr) {
+		if (!swmr) return fcpl;
+		FileCreatPropList result;
+		if (fcpl.getId() != H5P_DEFAULT) result.copy(fcpl);
+#if H5_VERSION_GE(1, 10, 1)
+		H5Pset_file_space_strategy(result.getId(), H5F_FSPACE_STRATEGY_AGGR, 0, 1);
+#endif
+		return result;
+	}
+
+	// Frame dataset creation properties: as given, with chunks shrunk to the frames of [acquirers] where they are
+	// larger (e.g. for cameras cropped to a small region of interest), as fixed frame dimensions require
+	static std::vector<DSetCreatPropList> getFrameCreation(const std::vector<DSetCreatPropList>& dcpls,
+			std::vector<BaseAcquirer*>& acquirers) {
+		std::vector<DSetCreatPropList> result;
+		for (size_t i = 0; i < dcpls.size(); i++) {
+			hsize_t chunkDims[4];
+			bool fits = true;
+			if (i < acquirers.size() && dcpls[i].getLayout() == H5D_CHUNKED && dcpls[i].getChunk(4, chunkDims) == 4) {
+				std::vector<size_t> frameDims = acquirers[i]->getDims();
+				for (int d = 0; d < 3; d++) {
+					if (chunkDims[d + 1] > frameDims[d] && frameDims[d] > 0) {
+						chunkDims[d + 1] = frameDims[d];
+						fits = false;
+					}
+				}
+			}
+			if (fits) {
+				result.push_back(dcpls[i]);
+			}
+			else {
+				DSetCreatPropList dcpl;
+				dcpl.copy(dcpls[i]);
+				dcpl.setChunk(4, chunkDims);
+				result.push_back(dcpl);
+			}
+		}
+		return result;
+	}
+
+	// File access properties: as given, with the latest file format (which SWMR requires) for SWMR
+	static FileAccPropList getFileAccess(const FileAccPropList& fapl, bool swmr) {
+		if (!swmr) return fapl;
+		FileAccPropList result;
+		if (fapl.getId() != H5P_DEFAULT) result.copy(fapl);
+		result.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+		return result;
+	}
+
+	// Lets readers open a file while it is being written (call once every object in it has been created)
+	static void startSwmrWriting(H5File& file) {
+#if H5_VERSION_GE(1, 10, 0)
+		if (H5Fstart_swmr_write(file.getId()) < 0) debugMessage("Failed to start SWMR writing of " + file.getFileName(), DEBUG_ERROR);
+#endif
+	}
+
+	// Closes a file that is in SWMR mode and opens it again for normal writing; [datasets] (which must be all the
+	// objects open in it) are reopened in it
+	H5File reopenWithoutSwmr(H5File& file, const std::string& name, const std::vector<DataSet*>& datasets) {
+		std::vector<std::string> names;
+		for (DataSet* dataset : datasets) {
+			names.push_back(dataset->getObjName());
+			dataset->close();
+		}
+		file.close();
+		H5File reopened(name, H5F_ACC_RDWR, FileCreatPropList::DEFAULT, fapl);
+		for (size_t k = 0; k < datasets.size(); k++) *datasets[k] = reopened.openDataSet(names[k]);
+		return reopened;
+	}
+
+	// Takes the current files out of SWMR mode once saving has finished, so that the dropped frames and attributes
+	// can be added (call with h5mutex held)
+	void endSwmrWriting() {
+		if (!swmrWriting) return;
+		swmrWriting = false;
+		for (size_t g = 0; g < files.size(); g++) {
+			std::vector<DataSet*> open;
+			for (size_t i = 0; i < numStreams; i++) {
+				if (getFileIndex(i) != g) continue;
+				open.push_back(&datasets[i]);
+				open.push_back(&tsdatasets[i]);
+			}
+			try {
+				files[g] = reopenWithoutSwmr(files[g], filenames[g], open);
+			}
+			catch (...) {
+				debugMessage("Failed to reopen " + filenames[g] + " after SWMR writing", DEBUG_ERROR);
+			}
+		}
+		for (size_t i = 0; i < numStreams; i++) {
+			fileSpaces[i] = datasets[i].getSpace();
+			tsFileSpaces[i] = tsdatasets[i].getSpace();
+			unsigned long long first = firstFrames[i];
+			if (isRotating()) datasets[i].openAttribute("firstFrame").write(PredType::NATIVE_ULLONG, &first);
+		}
+	}
+
+	// Sets the number of frames in one dataset, refreshing its dataspace (with SWMR, where readers see each extent)
+	static void setFrames(DataSet& dataset, DataSpace& space, size_t numFrames) {
+		hsize_t dims[4];
+		space.getSimpleExtentDims(dims);
+		dims[0] = numFrames;
+		dataset.extend(dims);
+		space = dataset.getSpace();
+	}
+
+	// Returns a duplicate of the file descriptor of [f] for syncDescriptor(), which needs no lock (call with h5mutex
+	// held, after flushing the file), or -1 if the file does not use the default (sec2) driver, whose handle is one
+	static int getSyncDescriptor(H5File& f) {
+		hid_t fapl = H5Fget_access_plist(f.getId());
+		if (fapl < 0) return -1;
+		bool sec2 = (H5Pget_driver(fapl) == H5FD_SEC2);
+		H5Pclose(fapl);
+		void* handle = nullptr;
+		if (!sec2 || H5Fget_vfd_handle(f.getId(), H5P_DEFAULT, &handle) < 0 || handle == nullptr) return -1;
+#ifdef _WIN32
+		return _dup(*(int*) handle);
+#else
+		return dup(*(int*) handle);
+#endif
+	}
+
+	// Has the operating system write a file to disk, given a descriptor from getSyncDescriptor(), and closes it
+	static void syncDescriptor(int fd) {
+		if (fd < 0) return;
+#ifdef _WIN32
+		_commit(fd);
+		_close(fd);
+#else
+		fsync(fd);
+		::close(fd);
+#endif
+	}
+
+	// Compresses every chunk of the next slab of a stream on the compression pool
+	bool encodeChunks(size_t numFrames, size_t bufIndex) {
+		ChunkEncoder& encoder = *encoders[bufIndex];
+		std::vector< std::vector<char> >& chunks = encodedChunks[bufIndex];
+		size_t numChunks = encoder.getNumChunks(numFrames);
+		if (chunks.size() < numChunks) chunks.resize(numChunks);
+		const char* slab = writeBuffers[bufIndex]->front().data;
+		std::atomic<bool> success(true);
+		timers.start(DTIMER_COMPRESS);
+		compressionPool->run(numChunks, [&](size_t i) {
+			if (!encoder.encodeChunk(slab, numFrames, i, chunks[i])) success = false;
+		});
+		timers.pause(DTIMER_COMPRESS);
+		return success;
+	}
+
+	// Writes the chunks compressed by encodeChunks() (call with h5mutex held, after extending the dataset)
+	bool writeEncodedChunks(size_t numFrames, size_t bufIndex) {
+		ChunkEncoder& encoder = *encoders[bufIndex];
+		std::vector< std::vector<char> >& chunks = encodedChunks[bufIndex];
+		for (size_t i = 0; i < encoder.getNumChunks(numFrames); i++) {
+			hsize_t offset[4];
+			encoder.getChunkOffset(i, framesSaved[bufIndex] - firstFrames[bufIndex], offset);
+#if H5_VERSION_GE(1, 10, 3)
+			herr_t status = H5Dwrite_chunk(datasets[bufIndex].getId(), H5P_DEFAULT, 0, offset, chunks[i].size(), chunks[i].data());
+#else
+			herr_t status = H5DOwrite_chunk(datasets[bufIndex].getId(), H5P_DEFAULT, 0, offset, chunks[i].size(), chunks[i].data());
+#endif
+			if (status < 0) return false;
+		}
+		return true;
+	}
+
+	// Makes room for [numFrames] frames in a stream's datasets (call with h5mutex held), growing them to at least
+	// twice their size so that indefinite recordings rarely change extents
+	void reserveFrames(size_t bufIndex, size_t numFrames) {
+		if (numFrames <= allocatedFrames[bufIndex]) return;
+		size_t newFrames = std::max(numFrames, 2 * allocatedFrames[bufIndex]);
+		newFrames = (newFrames + frameChunkSize - 1) / frameChunkSize * frameChunkSize; // whole chunks
+		setExtents(bufIndex, newFrames);
+	}
+
+	// Sets the number of frames in a stream's datasets (call with h5mutex held)
+	void setExtents(size_t bufIndex, size_t numFrames) {
+		resizeDatasets(bufIndex, datasets[bufIndex], tsdatasets[bufIndex], numFrames);
+		fileSpaces[bufIndex] = datasets[bufIndex].getSpace();
+		tsFileSpaces[bufIndex] = tsdatasets[bufIndex].getSpace();
+		allocatedFrames[bufIndex] = numFrames;
+	}
+
+	// Flushes every file to disk, recording the frames saved so far in each frame dataset. Only HDF5's own
+	// flush holds up the writers; the operating system writes the files out after h5mutex is released.
+	void flushFiles() {
+		std::vector<int> descriptors;
+		{
+			std::lock_guard<std::mutex> lock(h5mutex);
+			timers.start(DTIMER_FLUSH);
+			try {
+				// (SWMR readers count the timestamps instead, as attributes cannot be written in SWMR mode)
+				for (size_t i = 0; i < numStreams && !swmrWriting; i++) {
+					unsigned long long frames = framesSaved[i] - firstFrames[i];
+					datasets[i].openAttribute("framesSaved").write(PredType::NATIVE_ULLONG, &frames);
+				}
+				for (H5File& f : files) {
+					f.flush(H5F_SCOPE_LOCAL);
+					descriptors.push_back(getSyncDescriptor(f));
+				}
+			}
+			catch (...) {
+				debugMessage("Failed to flush HDF5 files", DEBUG_ERROR);
+			}
+			timers.pause(DTIMER_FLUSH);
+		}
+		for (int fd : descriptors) syncDescriptor(fd);
+	}
+
+	// Flushes the files according to the flush policy, until stopFlushing
+	void flushLoop() {
+		std::unique_lock<std::mutex> lock(flushMutex);
+		while (!stopFlushing) {
+			if (flushMode == FLUSH_EVERY_SECONDS) {
+				flushNeeded.wait_for(lock, std::chrono::seconds(flushInterval), [this]() { return stopFlushing; });
+			}
+			else {
+				flushNeeded.wait(lock, [this]() { return stopFlushing || chunksSinceFlush >= flushInterval; });
+			}
+			if (stopFlushing) break;
+			chunksSinceFlush = 0;
+			lock.unlock();
+			flushFiles();
+			lock.lock();
+		}
+		timers.addThreadCPUTime("flushing", getThreadCPUTime());
+	}
+
+	// Counts a written chunk towards the next flush
+	void chunkWritten() {
+		if (flushMode != FLUSH_EVERY_CHUNKS) return;
+		bool flush;
+		{
+			std::lock_guard<std::mutex> lock(flushMutex);
+			flush = (++chunksSinceFlush >= flushInterval);
+		}
+		if (flush) flushNeeded.notify_one();
+	}
+
+	void stopFlushThread() {
+		if (flushThread == nullptr) return;
+		{
+			std::lock_guard<std::mutex> lock(flushMutex);
+			stopFlushing = true;
+		}
+		flushNeeded.notify_one();
+		flushThread->join();
+		delete flushThread;
+		flushThread = nullptr;
+	}
+
+	// Frames to make room for in a stream's datasets in a new file: a rotation period's worth when rotating by time
+	// (but no more than all the frames to acquire, if known), and otherwise as many as its previous file took
+	size_t getFramesPerFile(size_t i) {
+		if (swmr) return 0; // (readers would see the room as frames)
+		size_t frames = lastFileFrames[i];
+		if (rotateSeconds > 0) {
+			frames = (size_t) std::ceil(acquirers[i]->getFPS() * rotateSeconds);
+			if (acquirers[i]->getFramesToAcquire() > 0) frames = std::min(frames, acquirers[i]->getFramesToAcquire());
+		}
+		return (frames + frameChunkSize - 1) / frameChunkSize * frameChunkSize; // whole chunks
+	}
+
+	// Returns true if file [g] is due to be rotated (call with h5mutex held); every file gets at least one chunk
+	bool rotationDue(size_t g) {
+		if (!isRotating()) return false;
+		bool empty = true;
+		for (size_t i = 0; i < numStreams; i++) {
+			if (getFileIndex(i) == g && framesSaved[i] > firstFrames[i]) empty = false;
+		}
+		if (empty) return false;
+		if (rotateSeconds > 0 && std::chrono::steady_clock::now() - fileStarts[g] >= std::chrono::seconds(rotateSeconds)) return true;
+		hsize_t size = 0;
+		return rotateBytes > 0 && H5Fget_filesize(files[g].getId(), &size) >= 0 && size >= rotateBytes;
+	}
+
+	// Switches file [g] to its successor (call with h5mutex held, between two chunks, so that every frame of a
+	// chunk lands in the same file): the successor's datasets become the streams' current datasets, and the
+	// old file is left to the rotation thread to finish. Returns false (to try again at the next chunk, while
+	// the queues absorb the delay) if the successor is not open yet.
+	bool rotateFile(size_t g) {
+		if (nextFiles[g] == nullptr) {
+			if (!rotationLate[g]) debugMessage("Next file after " + filenames[g] + " is not ready; rotating later", DEBUG_WARNING);
+			rotationLate[g] = true;
+			return false;
+		}
+		timers.start(DTIMER_ROTATE);
+		std::unique_ptr<RotatedFile> next = std::move(nextFiles[g]);
+		std::unique_ptr<RotatedFile> retired(new RotatedFile());
+		retired->file = files[g];
+		retired->filename = filenames[g];
+		retired->number = fileNumbers[g];
+		retired->streams = next->streams;
+		for (size_t k = 0; k < next->streams.size(); k++) {
+			size_t i = next->streams[k];
+			retired->datasets.push_back(datasets[i]);
+			retired->tsdatasets.push_back(tsdatasets[i]);
+			retired->frames.push_back(framesSaved[i] - firstFrames[i]);
+			retired->firstFrames.push_back(firstFrames[i]);
+			lastFileFrames[i] = framesSaved[i] - firstFrames[i];
+			// Continue in the next file from the next frame
+			firstFrames[i] = framesSaved[i];
+			unsigned long long first = firstFrames[i];
+			if (!swmr) next->datasets[k].openAttribute("firstFrame").write(PredType::NATIVE_ULLONG, &first);
+			datasets[i] = next->datasets[k];
+			tsdatasets[i] = next->tsdatasets[k];
+			fileSpaces[i] = datasets[i].getSpace();
+			tsFileSpaces[i] = tsdatasets[i].getSpace();
+			allocatedFrames[i] = next->frames[k];
+		}
+		files[g] = next->file;
+		filenames[g] = next->filename;
+		fileNumbers[g] = next->number;
+		fileStarts[g] = std::chrono::steady_clock::now();
+		rotationLate[g] = false;
+		retiredFiles.push_back(std::move(retired));
+		timers.pause(DTIMER_ROTATE);
+		{
+			std::lock_guard<std::mutex> lock(rotationMutex);
+			rotationWork = true;
+		}
+		rotationNeeded.notify_one();
+		return true;
+	}
+
+	// Opens the successor of each current file that does not have one yet, with its streams' datasets
+	void openNextFiles() {
+		for (size_t g = 0; g < files.size(); g++) {
+			std::lock_guard<std::mutex> lock(h5mutex);
+			if (nextFiles[g] != nullptr) continue;
+			std::unique_ptr<RotatedFile> next(new RotatedFile());
+			next->number = fileNumbers[g] + 1;
+			next->filename = getPartFilename(baseFilenames[g], next->number);
+			try {
+				next->file = H5File(next->filename, H5F_ACC_TRUNC, fcpl, fapl);
+				for (size_t i = 0; i < numStreams; i++) {
+					if (getFileIndex(i) != g) continue;
+					DataSet dataset, tsdataset;
+					createDatasets(next->file, i, getFramesPerFile(i), dataset, tsdataset);
+					next->streams.push_back(i);
+					next->datasets.push_back(dataset);
+					next->tsdatasets.push_back(tsdataset);
+					next->frames.push_back(getFramesPerFile(i));
+				}
+				if (swmr) startSwmrWriting(next->file);
+				nextFiles[g] = std::move(next);
+			}
+			catch (...) {
+				debugMessage("Failed to create " + next->filename, DEBUG_ERROR);
+			}
+		}
+	}
+
+	// Trims, flushes and closes the files rotated away from, and records their frames in the index. The
+	// operating system writes each file out after h5mutex is released, so the writers are not held up by it.
+	void finishRetiredFiles() {
+		while (true) {
+			std::unique_ptr<RotatedFile> retired;
+			int descriptor = -1;
+			{
+				std::lock_guard<std::mutex> lock(h5mutex);
+				if (retiredFiles.empty()) break;
+				retired = std::move(retiredFiles.front());
+				retiredFiles.erase(retiredFiles.begin());
+				timers.start(DTIMER_FLUSH);
+				try {
+					if (swmr) {
+						std::vector<DataSet*> open;
+						for (size_t k = 0; k < retired->streams.size(); k++) {
+							open.push_back(&retired->datasets[k]);
+							open.push_back(&retired->tsdatasets[k]);
+						}
+						retired->file = reopenWithoutSwmr(retired->file, retired->filename, open);
+						for (size_t k = 0; k < retired->streams.size(); k++) {
+							unsigned long long first = retired->firstFrames[k];
+							retired->datasets[k].openAttribute("firstFrame").write(PredType::NATIVE_ULLONG, &first);
+						}
+					}
+					for (size_t k = 0; k < retired->streams.size(); k++) {
+						resizeDatasets(retired->streams[k], retired->datasets[k], retired->tsdatasets[k], retired->frames[k]);
+						unsigned long long frames = retired->frames[k];
+						retired->datasets[k].openAttribute("framesSaved").write(PredType::NATIVE_ULLONG, &frames);
+						retired->datasets[k].close();
+						retired->tsdatasets[k].close();
+					}
+					retired->file.flush(H5F_SCOPE_LOCAL);
+					descriptor = getSyncDescriptor(retired->file);
+					retired->file.close();
+				}
+				catch (...) {
+					debugMessage("Failed to finish " + retired->filename, DEBUG_ERROR);
+				}
+				timers.pause(DTIMER_FLUSH);
+			}
+			syncDescriptor(descriptor);
+			for (size_t k = 0; k < retired->streams.size(); k++) {
+				size_t i = retired->streams[k];
+				size_t lastFrame = retired->firstFrames[k] + retired->frames[k];
+				rotationIndex->setStreamPart(dsnames[i], retired->number, retired->filename, retired->firstFrames[k], retired->frames[k]);
+				rotationIndex->setStreamPart(dsnames[i], retired->number + 1,
+					getPartFilename(baseFilenames[getFileIndex(i)], retired->number + 1), lastFrame, 0);
+			}
+		}
+	}
+
+	// Opens the next files and finishes the retired ones, until stopRotating
+	void rotationLoop() {
+		std::unique_lock<std::mutex> lock(rotationMutex);
+		while (true) {
+			// (Also wakes up regularly, to retry creating a next file that could not be created)
+			rotationNeeded.wait_for(lock, std::chrono::seconds(ROTATION_RETRY_SECONDS), [this]() { return stopRotating || rotationWork; });
+			bool stop = stopRotating;
+			rotationWork = false;
+			lock.unlock();
+			finishRetiredFiles();
+			if (!stop) openNextFiles();
+			lock.lock();
+			if (stop) break;
+		}
+		timers.addThreadCPUTime("rotation", getThreadCPUTime());
+	}
+
+	// Stops the rotation thread once the retired files are finished, and deletes the unused next files
+	void stopRotationThread() {
+		if (rotationThread == nullptr) return;
+		{
+			std::lock_guard<std::mutex> lock(rotationMutex);
+			stopRotating = true;
+		}
+		rotationNeeded.notify_one();
+		rotationThread->join();
+		delete rotationThread;
+		rotationThread = nullptr;
+		std::lock_guard<std::mutex> lock(h5mutex);
+		for (auto& next : nextFiles) {
+			if (next == nullptr) continue;
+			std::string name = next->filename;
+			next.reset(); // (closes it)
+			std::remove(name.c_str());
+		}
+	}
+
+	// Files that root attributes are written to
+	std::vector<H5File*> getAttributeFiles() {
+		std::vector<H5File*> result;
+		for (H5File& f : files) result.push_back(&f);
+		if (linked) result.push_back(&sessionFile);
+		return result;
+	}
+
 public:
 	H5Out(std::string& _filename, std::vector<BaseAcquirer*>& _acquirers, const size_t _frameChunkSize,
 		const std::vector<std::string>& _dsnames, const std::vector<PredType>& _datatypes,
-		const FileCreatPropList& _fcpl, const FileAccPropList& _fapl, const std::vector<DSetCreatPropList>& _dcpls) :
-			BaseSaver(_filename, _acquirers, _frameChunkSize),
-			file(filename, H5F_ACC_TRUNC, _fcpl, _fapl),
-			dsnames(_dsnames), datatypes(_datatypes) {
+		const FileCreatPropList& _fcpl, const FileAccPropList& _fapl, const std::vector<DSetCreatPropList>& _dcpls,
+		const bool _filePerStream = false, const size_t _compressionWorkers = 0,
+		const flushPolicy _flushMode = FLUSH_EVERY_CHUNKS, const size_t _flushInterval = 1,
+		const size_t _rotateMB = 0, const size_t _rotateSeconds = 0, const bool _swmr = false,
+		const std::vector<bool>& _temporalDelta = std::vector<bool>()) :
+			BaseSaver(_filename, _acquirers, _frameChunkSize, _filePerStream),
+			dsnames(_dsnames), datatypes(_datatypes), linked(false),
+			flushMode(_flushMode), flushInterval((_flushInterval > 0) ? _flushInterval : 1), flushThread(nullptr),
+			chunksSinceFlush(0), stopFlushing(false), swmr(_swmr && H5_VERSION_GE(1, 10, 0)), swmrWriting(false),
+			fcpl(getFileCreation(_fcpl, swmr)), fapl(getFileAccess(_fapl, swmr)), dcpls(getFrameCreation(_dcpls, _acquirers)), rotateBytes((hsize_t) _rotateMB * 1024 * 1024), rotateSeconds(_rotateSeconds),
+			rotationThread(nullptr), rotationWork(true), stopRotating(false) {
+		// Create file(s) (numbered from 0 when rotating them)
+		if (threadPerStream) {
+			for (size_t i = 0; i < numStreams; i++) baseFilenames.push_back(getStreamFilename(filename, dsnames[i]));
+		}
+		else {
+			baseFilenames.push_back(filename);
+		}
+		for (size_t i = 0; i < baseFilenames.size(); i++) {
+			filenames.push_back(isRotating() ? getPartFilename(baseFilenames[i], 0) : baseFilenames[i]);
+			files.push_back(H5File(filenames[i], H5F_ACC_TRUNC, fcpl, fapl));
+		}
+		fileNumbers.resize(files.size(), 0);
+		fileStarts.resize(files.size(), std::chrono::steady_clock::now());
+		nextFiles.resize(files.size());
+		rotationLate.resize(files.size(), false);
+
 		// Initialize time DCPL
-		DSetCreatPropList time_dcpl;
 		const int time_ndims = 2;
-		size_t time_chunk_dims[time_ndims] = { frameChunkSize, 1 };
-		time_dcpl.setChunk(time_ndims, time_chunk_dims);
+		hsize_t time_chunk_dims[time_ndims] = { frameChunkSize, 1 };
+		timeDcpl.setChunk(time_ndims, time_chunk_dims);
 
-		// Initialize frameDims
+		// Initialize frameDims, and room for all the frames to acquire (if known; chunks are only
+		// allocated in the file as they are written, so this costs no disk space; not with SWMR, where
+		// readers would see the room as frames)
 		for (int i = 0; i < numStreams; i++) {
 			frameDims.push_back(_acquirers[i]->getDims());
+			firstFrames.push_back(0);
+			lastFileFrames.push_back(_acquirers[i]->getFramesToAcquire());
+			allocatedFrames.push_back((isRotating() || swmr) ? getFramesPerFile(i) : _acquirers[i]->getFramesToAcquire());
 		}
 
-		// Initialize frame datasets
+		// Delta-code the 16-bit streams that ask for it
 		for (int i = 0; i < numStreams; i++) {
-			// Prepare dataspace
-			size_t* dims = new size_t[ndims];
-			dims[0] = frameChunkSize;
-			dims[1] = frameDims[i][0]; dims[2] = frameDims[i][0]; dims[3] = frameDims[i][0];
-			size_t* maxdims = new size_t[ndims];
-			maxdims[0] = H5S_UNLIMITED;
-			maxdims[1] = frameDims[i][0]; maxdims[2] = frameDims[i][1]; maxdims[3] = frameDims[i][2];
-			DataSpace* dataspace = new DataSpace(ndims, dims, maxdims);
-
-			// Create dataset
-			datasets.push_back(file.createDataSet(dsnames[i].c_str(), datatypes[i], *dataspace, _dcpls[i]));
-
-			delete dims;
-			delete maxdims;
-			delete dataspace;
-		}
-		// Initialize timestamp datasets
+			bool delta = (i < (int) _temporalDelta.size()) && _temporalDelta[i];
+			if (delta && datatypes[i].getSize() != sizeof(uint16_t)) {
+				debugMessage("Temporal delta coding needs 16-bit pixels; not using it for " + dsnames[i], DEBUG_WARNING);
+				delta = false;
+			}
+			temporalDelta.push_back(delta);
+		}
+		deltaCodedFrames.resize(numStreams, 0);
+
+		// Initialize frame and timestamp datasets
 		for (int i = 0; i < numStreams; i++) {
-			// Prepare dataspace
-			size_t* dims = new size_t[2];
-			dims[0] = frameChunkSize;
-			dims[1] = 1;
-			size_t* maxdims = new size_t[2];
-			maxdims[0] = H5S_UNLIMITED;
-			maxdims[1] = 1;
-			DataSpace* dataspace = new DataSpace(2, dims, maxdims);
+			DataSet dataset, tsdataset;
+			createDatasets(getFile(i), i, allocatedFrames[i], dataset, tsdataset);
+			datasets.push_back(dataset);
+			tsdatasets.push_back(tsdataset);
+			fileSpaces.push_back(datasets[i].getSpace());
+			tsFileSpaces.push_back(tsdatasets[i].getSpace());
+			hsize_t dims[4] = { frameChunkSize, frameDims[i][0], frameDims[i][1], frameDims[i][2] };
+			memSpaces.push_back(DataSpace(ndims, dims));
+			hsize_t tsdims[2] = { frameChunkSize, 1 };
+			tsMemSpaces.push_back(DataSpace(2, tsdims));
+		}
 
-			// Create dataset
-			tsdatasets.push_back(file.createDataSet((dsnames[i] + "_time").c_str(), TIMESTAMP_H5T, *dataspace, time_dcpl));
+		// Index the files, and start opening each one's successor
+		if (isRotating()) {
+			rotationIndex.reset(new SessionManifest(getRoot(filename) + ".rotation.json", ROTATION_INDEX_FORMAT, ROTATION_INDEX_VERSION));
+			for (size_t i = 0; i < numStreams; i++) {
+				rotationIndex->addStream(dsnames[i], {});
+				rotationIndex->setStreamPart(dsnames[i], 0, filenames[getFileIndex(i)], 0, 0);
+			}
+			rotationThread = new std::thread(&H5Out::rotationLoop, this);
+		}
+
+		// Set up parallel compression (per-stream threads need it, or HDF5 would compress each chunk under h5mutex)
+		size_t compressionWorkers = _compressionWorkers;
+		if (threadPerStream && compressionWorkers == 0) {
+			debugMessage("Per-stream files compress chunks outside the HDF5 lock; using " + std::to_string(numStreams) +
+				" compression workers", DEBUG_WARNING);
+			compressionWorkers = numStreams;
+		}
+		if (compressionWorkers > 0) {
+			compressionPool.reset(new CompressionPool(compressionWorkers));
+			for (int i = 0; i < numStreams; i++) {
+				encoders.push_back(std::unique_ptr<ChunkEncoder>(new ChunkEncoder(datasets[i], frameDims[i], frameChunkSize)));
+				if (!encoders[i]->isSupported()) {
+					debugMessage("Using HDF5 filters for " + dsnames[i] + " (cannot compress its chunks in parallel)", DEBUG_WARNING);
+					encoders[i].reset();
+				}
+			}
+		}
+		else {
+			encoders.resize(numStreams);
+		}
+		encodedChunks.resize(numStreams);
 
-			delete dims;
-			delete maxdims;
-			delete dataspace;
+		// Open the files to readers (once every object in them has been created)
+		if (_swmr && !swmr) debugMessage("SWMR writing needs HDF5 1.10 or later; writing normally", DEBUG_WARNING);
+		if (swmr) {
+			for (H5File& f : files) startSwmrWriting(f);
+			swmrWriting = true;
 		}
+
+		if (flushMode != FLUSH_NONE) flushThread = new std::thread(&H5Out::flushLoop, this);
+		startSaving();
 	}
 
 	~H5Out() {
 		debugMessage("~H5Out", DEBUG_HIDDEN_INFO);
+		if (saving) abortSaving(true); // writer threads must stop before the files are closed
+		stopFlushThread();
+		stopRotationThread();
+		{
+			std::lock_guard<std::mutex> lock(h5mutex);
+			endSwmrWriting();
+		}
+		// Trim the datasets to the frames actually saved
+		for (int i = 0; i < numStreams; i++) {
+			size_t frames = framesSaved[i] - firstFrames[i];
+			try {
+				if (allocatedFrames[i] != frames) setExtents(i, frames);
+			}
+			catch (...) {
+				debugMessage("Failed to trim " + dsnames[i] + " to " + std::to_string(frames) + " frames", DEBUG_ERROR);
+			}
+			if (rotationIndex) {
+				rotationIndex->setStreamPart(dsnames[i], fileNumbers[getFileIndex(i)], filenames[getFileIndex(i)], firstFrames[i], frames);
+			}
+		}
+		flushFiles();
 		for (int i = 0; i < numStreams; i++) datasets[i].close();
-		file.close();
+		for (int i = 0; i < numStreams; i++) tsdatasets[i].close();
+		for (H5File& f : files) f.close();
+		if (linked) sessionFile.close();
 	}
 
-	// This does not modify the contents of the write buffer
-	virtual bool writeFrames(size_t numFrames, size_t bufIndex) {
-		bool success = true;
-		/* Write frame */
+	// Creates a session file at [filename] with external links to every stream's datasets
+	// (only meaningful with filePerStream, without rotation; call once saving has finished)
+	void linkStreamFiles() {
+		if (!threadPerStream || linked) return;
+		if (isRotating()) {
+			debugMessage("Not linking rotated files (see " + getRoot(filename) + ".rotation.json)", DEBUG_WARNING);
+			return;
+		}
+		std::lock_guard<std::mutex> lock(h5mutex);
+		endSwmrWriting();
 		try {
-			// Extend dataset
-			size_t* newdims = new size_t[ndims];
-			newdims[0] = framesSaved[bufIndex] + numFrames;
-			newdims[1] = frameDims[bufIndex][0]; newdims[2] = frameDims[bufIndex][1]; newdims[3] = frameDims[bufIndex][2];
-			debugMessage("newdims = [" + std::to_string(newdims[0]) + ", " + std::to_string(newdims[1]) + ", " + std::to_string(newdims[2]) + ", " + std::to_string(newdims[3]) + "]", DEBUG_HIDDEN_INFO);
-			datasets[bufIndex].extend(newdims);
-			DataSpace dataspace = datasets[bufIndex].getSpace();
-			// Calculate offset
-			size_t* offset = new size_t[ndims]();
-			offset[0] = framesSaved[bufIndex];
-			// Select hyperslab in dataset
-			size_t* selectdims = new size_t[ndims];
-			selectdims[0] = numFrames;
-			selectdims[1] = frameDims[bufIndex][0]; selectdims[2] = frameDims[bufIndex][1]; selectdims[3] = frameDims[bufIndex][2];
-			DataSpace filespace(dataspace);
-			filespace.selectHyperslab(H5S_SELECT_SET, selectdims, offset);
-			// Define memory space
-			DataSpace memspace(ndims, selectdims, NULL);
-
-			// Write
-			size_t frameBytes = acquirers[bufIndex]->getFrameBytes();
-			char* buffer = new char[frameBytes * numFrames];
-			for (size_t i = 0; i < numFrames; i++) {
-				writeBuffers[bufIndex][i].copyDataToBuffer(buffer + i * frameBytes);
+			sessionFile = H5File(filename, H5F_ACC_TRUNC);
+			for (size_t i = 0; i < numStreams; i++) {
+				// Link by bare file name, so the set of files can be moved together
+				std::string target = filenames[i].substr(filenames[i].find_last_of("/\\") + 1);
+				for (const std::string& dsname : { dsnames[i], dsnames[i] + "_time", dsnames[i] + "_dropped" }) {
+					if (H5Lexists(getFile(i).getId(), dsname.c_str(), H5P_DEFAULT) <= 0) continue;
+					H5Lcreate_external(target.c_str(), ("/" + dsname).c_str(), sessionFile.getId(), dsname.c_str(),
+						H5P_DEFAULT, H5P_DEFAULT);
+				}
 			}
-			timers.start(DTIMER_WRITE_FRAME);
-			datasets[bufIndex].write(buffer, datatypes[bufIndex], memspace, filespace);
-			tsdatasets[bufIndex].flush(H5F_SCOPE_GLOBAL);
-			timers.pause(DTIMER_WRITE_FRAME);
-			//framesSaved[bufIndex] += numFrames;
-
-			delete[] buffer;
-			delete[] newdims;
-			delete[] offset;
-			delete[] selectdims;
-			dataspace.close();
-			memspace.close();
-			filespace.close();
+			linked = true;
 		}
 		catch (...) {
-			return false;
+			debugMessage("Failed to create session file " + filename, DEBUG_ERROR);
+		}
+	}
+
+	// Records the frames each stream dropped (call once acquisition has ended): dataset [dsname]_dropped
+	// holds the numbers (in acquisition order, from 0) of the frames missing from [dsname]. For a gated stream,
+	// dataset [dsname]_intervals holds the first frame number and number of frames of each interval the gate
+	// passed (the frames of [dsname] are these, less the dropped frames).
+	virtual void writeDroppedFrames() {
+		for (size_t i = 0; i < numStreams; i++) {
+			std::vector<size_t> dropped = acquirers[i]->getDroppedFrames();
+			{
+				std::lock_guard<std::mutex> lock(h5mutex);
+				endSwmrWriting();
+				try {
+					std::vector<unsigned long long> numbers(dropped.begin(), dropped.end());
+					hsize_t dims[1] = { numbers.size() };
+					DataSpace dataspace(1, dims);
+					DataSet dataset = getFile(i).createDataSet((dsnames[i] + "_dropped").c_str(), PredType::STD_U64LE, dataspace);
+					if (!numbers.empty()) dataset.write(numbers.data(), PredType::NATIVE_ULLONG);
+				}
+				catch (...) {
+					debugMessage("Failed to record dropped frames for " + dsnames[i], DEBUG_ERROR);
+				}
+			}
+			writeScalarAttribute(dsnames[i] + "_dropped", dropped.size());
+			FrameGate* gate = acquirers[i]->getFrameGate();
+			if (gate != nullptr) writeGateIntervals(i, gate);
+		}
+	}
+
+	// Records the intervals [gate] passed for stream [i], and what the gate was
+	void writeGateIntervals(size_t i, FrameGate* gate) {
+		std::vector< std::pair<size_t, size_t> > intervals = gate->getIntervals();
+		{
+			std::lock_guard<std::mutex> lock(h5mutex);
+			try {
+				std::vector<unsigned long long> values;
+				for (auto& interval : intervals) {
+					values.push_back(interval.first);
+					values.push_back(interval.second);
+				}
+				hsize_t dims[2] = { intervals.size(), 2 };
+				DataSpace dataspace(2, dims);
+				DataSet dataset = getFile(i).createDataSet((dsnames[i] + "_intervals").c_str(), PredType::STD_U64LE, dataspace);
+				if (!values.empty()) dataset.write(values.data(), PredType::NATIVE_ULLONG);
+			}
+			catch (...) {
+				debugMessage("Failed to record gated intervals for " + dsnames[i], DEBUG_ERROR);
+			}
 		}
+		writeScalarAttribute(dsnames[i] + "_gate", gate->getDescription());
+		writeScalarAttribute(dsnames[i] + "_gated", gate->getFramesDiscarded());
+	}
 
-		/* Write timestamp */ // TODO: dedup code! Also in constructor (i.e. make separate functions)
+	// This only modifies the contents of the write buffer by delta-coding them (the saver releases the slab afterwards)
+	virtual bool writeFrames(size_t numFrames, size_t bufIndex) {
+		// Delta-code the frames in place (once, even if this slab is retried)
+		if (temporalDelta[bufIndex] && deltaCodedFrames[bufIndex] <= framesSaved[bufIndex]) {
+			std::vector<size_t>& dims = frameDims[bufIndex];
+			encodeTemporalDelta((uint16_t*) writeBuffers[bufIndex]->front().data, numFrames, dims[0] * dims[1] * dims[2]);
+			deltaCodedFrames[bufIndex] = framesSaved[bufIndex] + numFrames;
+		}
+		// Compress before taking the lock, so other streams can write meanwhile
+		bool direct = (encoders[bufIndex] != nullptr);
+		if (direct && !encodeChunks(numFrames, bufIndex)) return false;
+		std::lock_guard<std::mutex> lock(h5mutex);
 		try {
-			// Extend dataset
-			size_t* newdims = new size_t[2];
-			newdims[0] = framesSaved[bufIndex] + numFrames;
-			newdims[1] = 1;
-			tsdatasets[bufIndex].extend(newdims);
-			DataSpace dataspace = tsdatasets[bufIndex].getSpace();
-			// Calculate offset
-			size_t* offset = new size_t[2]();
-			offset[0] = framesSaved[bufIndex];
-			// Select hyperslab in dataset
-			size_t* selectdims = new size_t[2];
-			selectdims[0] = numFrames;
-			selectdims[1] = 1;
-			DataSpace filespace(dataspace);
-			filespace.selectHyperslab(H5S_SELECT_SET, selectdims, offset);
-			// Define memory space
-			DataSpace memspace(2, selectdims, NULL);
-
-			// Write
-			double* buffer = new double[numFrames];
-			for (size_t i = 0; i < numFrames; i++) {
-				*(buffer + i) = writeBuffers[bufIndex][i].getTimestamp();
+			if (rotationDue(getFileIndex(bufIndex))) rotateFile(getFileIndex(bufIndex));
+			size_t fileFrames = framesSaved[bufIndex] - firstFrames[bufIndex]; // (already in the current file)
+			if (swmrWriting) {
+				// Readers see every extent, so make room for exactly these frames (timestamps once they are written)
+				setFrames(datasets[bufIndex], fileSpaces[bufIndex], fileFrames + numFrames);
+				allocatedFrames[bufIndex] = fileFrames + numFrames;
 			}
+			else {
+				reserveFrames(bufIndex, fileFrames + numFrames);
+			}
+			// Memory dataspaces for a partial slab (only the last one can be)
+			std::unique_ptr<DataSpace> partialSpace, tsPartialSpace;
+			bool fullSlab = (numFrames == frameChunkSize);
+
+			/* Write frames */
+			hsize_t offset[4] = { fileFrames, 0, 0, 0 };
+			hsize_t count[4] = { numFrames, frameDims[bufIndex][0], frameDims[bufIndex][1], frameDims[bufIndex][2] };
 			timers.start(DTIMER_WRITE_FRAME);
-			tsdatasets[bufIndex].write(buffer, TIMESTAMP_H5T, memspace, filespace);
-			tsdatasets[bufIndex].flush(H5F_SCOPE_GLOBAL);
+			if (direct) {
+				if (!writeEncodedChunks(numFrames, bufIndex)) {
+					timers.pause(DTIMER_WRITE_FRAME);
+					return false;
+				}
+			}
+			else {
+				// Write straight from the chunk slab, which already holds the frames contiguously
+				fileSpaces[bufIndex].selectHyperslab(H5S_SELECT_SET, count, offset);
+				if (!fullSlab) partialSpace.reset(new DataSpace(ndims, count));
+				datasets[bufIndex].write(writeBuffers[bufIndex]->front().data, datatypes[bufIndex],
+					fullSlab ? memSpaces[bufIndex] : *partialSpace, fileSpaces[bufIndex]);
+			}
 			timers.pause(DTIMER_WRITE_FRAME);
-			framesSaved[bufIndex] += numFrames;
-
-			delete[] buffer;
-			delete[] newdims;
-			delete[] offset;
-			delete[] selectdims;
-			dataspace.close();
-			memspace.close();
-			filespace.close();
+			if (swmrWriting) {
+				// Publish the frames before the timestamps that announce them to readers
+				timers.start(DTIMER_FLUSH);
+				H5Dflush(datasets[bufIndex].getId());
+				timers.pause(DTIMER_FLUSH);
+				setFrames(tsdatasets[bufIndex], tsFileSpaces[bufIndex], fileFrames + numFrames);
+			}
 
-			return true;
+			/* Write timestamps */
+			hsize_t tsoffset[2] = { fileFrames, 0 };
+			hsize_t tscount[2] = { numFrames, 1 };
+			tsFileSpaces[bufIndex].selectHyperslab(H5S_SELECT_SET, tscount, tsoffset);
+			if (!fullSlab) tsPartialSpace.reset(new DataSpace(2, tscount));
+			timers.start(DTIMER_WRITE_FRAME);
+			tsdatasets[bufIndex].write(writeBuffers[bufIndex]->front().timestamps, TIMESTAMP_H5T,
+				fullSlab ? tsMemSpaces[bufIndex] : *tsPartialSpace, tsFileSpaces[bufIndex]);
+			timers.pause(DTIMER_WRITE_FRAME);
+			if (swmrWriting) {
+				timers.start(DTIMER_FLUSH);
+				H5Dflush(tsdatasets[bufIndex].getId());
+				timers.pause(DTIMER_FLUSH);
+			}
+			framesSaved[bufIndex] += numFrames;
 		}
 		catch (...) {
 			return false;
 		}
+		chunkWritten();
+		return true;
 	}
 
-	// Write scalar attribute to root group
-	void writeScalarAttribute(std::string name, int value) {
-		H5::Group root = file.openGroup("/");
-		int attr_data[1] = { value };
-		const H5::PredType datatype = H5::PredType::STD_I32LE;
-		H5::DataSpace attr_dataspace = H5::DataSpace(H5S_SCALAR);
-		H5::Attribute attribute = root.createAttribute(name, datatype, attr_dataspace);
-		attribute.write(datatype, attr_data);
-	}
-	void writeScalarAttribute(std::string name, size_t value) {
-		H5::Group root = file.openGroup("/");
-		size_t attr_data[1] = { value };
-		const H5::PredType datatype = H5::PredType::STD_U64LE;
-		H5::DataSpace attr_dataspace = H5::DataSpace(H5S_SCALAR);
-		H5::Attribute attribute = root.createAttribute(name, datatype, attr_dataspace);
-		attribute.write(datatype, attr_data);
-	}
-	void writeScalarAttribute(std::string name, double value) {
-		H5::Group root = file.openGroup("/");
-		double attr_data[1] = { value };
-		const H5::PredType datatype = H5::PredType::NATIVE_DOUBLE;
-		H5::DataSpace attr_dataspace = H5::DataSpace(H5S_SCALAR);
-		H5::Attribute attribute = root.createAttribute(name, datatype, attr_dataspace);
-		attribute.write(datatype, attr_data);
-	}
-	void writeScalarAttribute(std::string name, std::string value) {
-		H5::Group root = file.openGroup("/");
-		H5::StrType datatype(0, H5T_VARIABLE); // variable length string
-		H5::DataSpace attr_dataspace(H5S_SCALAR);
-		H5::Attribute attribute = root.createAttribute(name, datatype, attr_dataspace);
-		attribute.write(datatype, value);
+	// Write scalar attribute to root group (of the last files, and to the index, when rotating)
+	virtual void writeScalarAttribute(std::string name, int value) {
+		if (rotationIndex) rotationIndex->setAttribute(name, value);
+		std::lock_guard<std::mutex> lock(h5mutex);
+		endSwmrWriting();
+		for (H5File* file : getAttributeFiles()) {
+			H5::Group root = file->openGroup("/");
+			int attr_data[1] = { value };
+			const H5::PredType datatype = H5::PredType::STD_I32LE;
+			H5::DataSpace attr_dataspace = H5::DataSpace(H5S_SCALAR);
+			H5::Attribute attribute = root.createAttribute(name, datatype, attr_dataspace);
+			attribute.write(datatype, attr_data);
+		}
+	}
+	virtual void writeScalarAttribute(std::string name, size_t value) {
+		if (rotationIndex) rotationIndex->setAttribute(name, value);
+		std::lock_guard<std::mutex> lock(h5mutex);
+		endSwmrWriting();
+		for (H5File* file : getAttributeFiles()) {
+			H5::Group root = file->openGroup("/");
+			size_t attr_data[1] = { value };
+			const H5::PredType datatype = H5::PredType::STD_U64LE;
+			H5::DataSpace attr_dataspace = H5::DataSpace(H5S_SCALAR);
+			H5::Attribute attribute = root.createAttribute(name, datatype, attr_dataspace);
+			attribute.write(datatype, attr_data);
+		}
+	}
+	virtual void writeScalarAttribute(std::string name, double value) {
+		if (rotationIndex) rotationIndex->setAttribute(name, value);
+		std::lock_guard<std::mutex> lock(h5mutex);
+		endSwmrWriting();
+		for (H5File* file : getAttributeFiles()) {
+			H5::Group root = file->openGroup("/");
+			double attr_data[1] = { value };
+			const H5::PredType datatype = H5::PredType::NATIVE_DOUBLE;
+			H5::DataSpace attr_dataspace = H5::DataSpace(H5S_SCALAR);
+			H5::Attribute attribute = root.createAttribute(name, datatype, attr_dataspace);
+			attribute.write(datatype, attr_data);
+		}
+	}
+	virtual void writeScalarAttribute(std::string name, std::string value) {
+		if (rotationIndex) rotationIndex->setAttribute(name, value);
+		std::lock_guard<std::mutex> lock(h5mutex);
+		endSwmrWriting();
+		for (H5File* file : getAttributeFiles()) {
+			H5::Group root = file->openGroup("/");
+			H5::StrType datatype(0, H5T_VARIABLE); // variable length string
+			H5::DataSpace attr_dataspace(H5S_SCALAR);
+			H5::Attribute attribute = root.createAttribute(name, datatype, attr_dataspace);
+			attribute.write(datatype, value);
+		}
 	}
 };
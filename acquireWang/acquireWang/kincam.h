@@ -1,26 +1,33 @@
 #pragma once
 #pragma warning(push, 0)
+#include <atomic>
 #include <string>
 #include "Kinect.h"
 #include "comdef.h"
 #pragma warning(pop)
 #include "camera.h"
 #include "frame.h"
+#include "bitpacking.h"
 #include "debug.h"
 
 typedef uint16_t kinect_t;
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * This class implements the Kinect camera frame class, which derives from the
- * BaseFrame class.
+ * BaseFrame class. Frames are 16-bit depths (in mm) unless the camera packs
+ * them to fewer bits (see packDepth() in bitpacking.h); a packed frame is
+ * stored as rows of bytes, so its width is the packed row length in bytes.
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 class KinectFrame : public BaseFrame {
 public:
 	// Constructor overrides
-	KinectFrame(size_t _width, size_t _height) :
-			BaseFrame(_width, _height, sizeof(kinect_t), 1) {}
-	KinectFrame(size_t _width, size_t _height, kinect_t* _data, double _timestamp) :
-			BaseFrame(_width, _height, sizeof(kinect_t), 1, _data, _timestamp) {}
+	KinectFrame(size_t _width, size_t _height, std::shared_ptr<FramePool> _pool = nullptr) :
+			BaseFrame(_width, _height, sizeof(kinect_t), 1, _pool) {}
+	KinectFrame(size_t _width, size_t _height, kinect_t* _data, double _timestamp, std::shared_ptr<FramePool> _pool = nullptr) :
+			BaseFrame(_width, _height, sizeof(kinect_t), 1, _data, _timestamp, _pool) {}
+	// Frame of [_pixelWidth] x [_height] depths packed to [_bits] bits
+	KinectFrame(size_t _pixelWidth, size_t _height, size_t _bits, std::shared_ptr<FramePool> _pool) :
+			BaseFrame(getDepthPackedBytes(_bits, _pixelWidth), _height, 1, 1, _pool) {}
 	// Method overrides
 	void copyDataFromBuffer(kinect_t* buffer) {
 		BaseFrame::copyDataFromBuffer(buffer);
@@ -28,6 +35,12 @@ public:
 	void copyDataToBuffer(kinect_t* buffer) {
 		BaseFrame::copyDataToBuffer(buffer);
 	}
+
+	// Unpacks a frame packed to [bits] bits into [buffer] (width * height depths)
+	static void unpack(const BaseFrame& frame, size_t bits, kinect_t* buffer) {
+		size_t rowPixels = frame.getWidth() / bits * 8;
+		unpackDepth((const uint8_t*) frame.getData(), buffer, rowPixels * frame.getHeight(), bits);
+	}
 };
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -35,6 +48,10 @@ public:
  * BaseCamera class. The current implementation (using the default Windows
  * driver) does not permit multiple Kinect cameras, and currently only returns
  * the depth stream.
+ * Depths take at most 13 bits (the sensor reads up to about 8 m), so they can
+ * be packed to that many bits, or fewer with a smaller depth range, as they
+ * arrive (setDepthPacking()). Depths beyond the range are clamped to it and
+ * counted, afresh for each recording.
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 class KinectCamera : public BaseCamera {
 private:
@@ -46,6 +63,11 @@ private:
 	bool valid; // true if camera is valid
 	bool silent; // to silence error messages at beginning of kinect acquisition
 
+	size_t depthBits; // Bits each depth is packed to (0 if frames are not packed)
+	kinect_t maxDepth; // Largest depth stored (in mm); larger ones are clamped to it
+	size_t pixelWidth; // Frame width in pixels ([width] is in bytes for packed frames)
+	std::atomic<size_t> clampedPixels; // Depths clamped to maxDepth since the camera was last initialized
+
 	void handleHRESULT(HRESULT hr, std::string whileDoing) {
 		if (hr != S_OK) {
 			_com_error err(hr);
@@ -56,7 +78,7 @@ private:
 		}
 	}
 public:
-	KinectCamera() {
+	KinectCamera() : depthBits(0), maxDepth(0), pixelWidth(0), clampedPixels(0) {
 		valid = true;
 		silent = false;
 		try {
@@ -101,6 +123,7 @@ public:
 			handleHRESULT(hr, "getting depth frame width");
 			height = (size_t)_height;
 			width = (size_t)_width;
+			pixelWidth = width;
 
 			frameDescription->Release();
 			hr = kinectSensor->Close();
@@ -121,8 +144,36 @@ public:
 
 	bool isValid() { return valid; }
 
+	// Packs frames to [bits] bits (1 to 15; 0 to leave them 16-bit) as they arrive, clamping depths beyond [_maxDepth] mm
+	// (0 for the largest that fits). With [bits] = 0 but a depth range, the bits are the fewest that hold it.
+	// Returns false (leaving frames unpacked) if the frame width cannot be packed; call before acquiring.
+	bool setDepthPacking(size_t bits, size_t _maxDepth) {
+		if (bits == 0 && _maxDepth > 0) {
+			while (bits < 16 && ((size_t) 1 << bits) <= _maxDepth) bits++;
+		}
+		if (bits == 0 || bits >= 16) {
+			if (bits >= 16) debugMessage("Kinect depths can only be packed to 1-15 bits; leaving them 16-bit", DEBUG_WARNING);
+			return bits == 0;
+		}
+		if (pixelWidth % 8 != 0) {
+			debugMessage("Kinect width " + std::to_string(pixelWidth) + " is not a multiple of 8 pixels, as depth packing needs", DEBUG_ERROR);
+			return false;
+		}
+		depthBits = bits;
+		size_t largest = ((size_t) 1 << bits) - 1;
+		maxDepth = (kinect_t) ((_maxDepth > 0 && _maxDepth < largest) ? _maxDepth : largest);
+		width = getDepthPackedBytes(depthBits, pixelWidth);
+		bytesPerPixel = 1;
+		return true;
+	}
+	size_t getDepthBits() { return depthBits; }
+	kinect_t getMaxDepth() { return maxDepth; }
+	size_t getPixelWidth() { return pixelWidth; }
+	size_t getClampedPixels() { return clampedPixels; }
+
 	void initialize() override {
 		debugMessage("kinect initialize()", DEBUG_HIDDEN_INFO);
+		clampedPixels = 0; // (counted per recording, whose acquirer initializes the camera)
 		HRESULT hr = kinectSensor->Open();
 		handleHRESULT(hr, "opening Kinect sensor");
 		silent = true;
@@ -176,9 +227,22 @@ public:
 			hr = depthFrame->AccessUnderlyingBuffer(&depthBufferSize, &depthBuffer);
 			handleHRESULT(hr, "getting depth frame data");
 
-			// Copy frame
-			KinectFrame frame(getWidth(), getHeight());
-			frame.copyDataFromBuffer((kinect_t*) depthBuffer);
+			// Copy frame (packing it if needed)
+			KinectFrame frame = (depthBits > 0) ? KinectFrame(pixelWidth, getHeight(), depthBits, framePool) :
+				KinectFrame(getWidth(), getHeight(), framePool);
+			if (depthBits > 0) {
+				timers.start(DTIMER_COPY_FROM);
+				size_t clamped = packDepth((const kinect_t*) depthBuffer, (uint8_t*) frame.getMutableData(), pixelWidth * getHeight(),
+					depthBits, maxDepth);
+				timers.pause(DTIMER_COPY_FROM);
+				if (clamped > 0 && clampedPixels == 0) {
+					debugMessage("Kinect depths beyond " + std::to_string(maxDepth) + " mm are being clamped", DEBUG_WARNING);
+				}
+				clampedPixels += clamped;
+			}
+			else {
+				frame.copyDataFromBuffer((kinect_t*) depthBuffer);
+			}
 
 			// Set timestamp
 			double newTimestamp = getClockStamp(); // get timestamp when received
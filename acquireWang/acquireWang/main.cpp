@@ -16,6 +16,9 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
 
 #include <chrono> // Timing
 
@@ -26,16 +29,26 @@
 
 // Other unit files
 #include "acquirer.h"
+#include "memorygovernor.h"
+#include "triggergate.h"
+#include "motiongate.h"
 #include "kincam.h"
 #include "pgcam.h"
 #include "h5out.h"
+#include "rawout.h"
+#include "segmentout.h"
+#include "rawconvert.h"
+#include "tailreader.h"
+#include "tuner.h"
 #include "previewwindow.h"
 #include "debug.h"
 #include "utils.h"
+#include "bench.h"
 
 /* Global variables */
 size_t frameChunkSize;
 std::map<std::string, size_t> params;
+std::string spillDirectory; // Where frames spill beyond the memory budget (--spill; empty for next to the recording)
 
 // For threads
 std::atomic<bool> stopSerialLoop;
@@ -48,8 +61,43 @@ std::vector<PredType> dtypes;
 std::vector<DSetCreatPropList> dcpls;
 
 /* Methods */
-// Serial thread loop
-void serialLoop(Serial* serial, std::string filename) {
+// Returns parameter [name] for one stream, preferring a per-stream override ([name]_[stream])
+size_t getStreamParam(const std::string& name, const std::string& stream) {
+	auto it = params.find(name + "_" + stream);
+	return (it != params.end()) ? it->second : params[name];
+}
+
+// Sets the saved format and datatype of Point Grey stream [i] from its camera (which may fall back to unpacked
+// frames once initialized; see PointGreyCamera::initialize())
+void setPointGreyFormat(size_t i, PointGreyCamera& pgcam) {
+	if (pgcam.getPacking() != PACKING_NONE) formats[i] = GRAY_PACKED;
+	else formats[i] = (pgcam.getBytesPerPixel() == 2) ? GRAY_16BIT : GRAY_8BIT;
+	dtypes[i] = (pgcam.getBytesPerPixel() == 2) ? POINTGREY16_H5T : POINTGREY_H5T;
+}
+
+// Fires [trigger] for each complete line of DAQ data in [pending] (followed by [data]) whose column [column] (from 1)
+// changes to a nonzero value; leaves an incomplete last line in [pending]
+void watchDaqLine(std::string& pending, const char* data, int length, size_t column, double& lastValue,
+		RecordingTrigger* trigger) {
+	pending.append(data, length);
+	size_t lineEnd;
+	while ((lineEnd = pending.find('\n')) != std::string::npos) {
+		std::stringstream line(pending.substr(0, lineEnd));
+		pending.erase(0, lineEnd + 1);
+		std::string field;
+		size_t k = 0;
+		while (std::getline(line, field, ',') && ++k < column) {}
+		if (k < column) continue; // (too few columns)
+		char* end = nullptr;
+		double value = std::strtod(field.c_str(), &end);
+		if (end == field.c_str()) continue; // (not a number, e.g. a header)
+		if (value != lastValue && value != 0 && !std::isnan(lastValue)) trigger->fire("DAQ column " + std::to_string(column));
+		lastValue = value;
+	}
+}
+
+// Serial thread loop (with a [trigger], the DAQ line in [triggerColumn] fires it; see watchDaqLine())
+void serialLoop(Serial* serial, std::string filename, RecordingTrigger* trigger, size_t triggerColumn) {
 	// Preallocate memory
 	char incomingData[1 << 10] = "";
 	int dataLength = 1 << 10 - 1;
@@ -58,6 +106,8 @@ void serialLoop(Serial* serial, std::string filename) {
 	// Open CSV file
 	std::ofstream csvFile;
 	csvFile.open(filename);
+	std::string pendingLine; // DAQ data after the last complete line
+	double lastValue = std::nan(""); // Last value of the trigger column (none yet)
 
 	// Serial read loop
 	while (serial->IsConnected()) {
@@ -72,12 +122,17 @@ void serialLoop(Serial* serial, std::string filename) {
 		//csvFile << incomingData;
 		csvFile.write(incomingData, readResult);
 		csvFile.flush();
+		if (trigger != nullptr && triggerColumn > 0 && readResult > 0) {
+			watchDaqLine(pendingLine, incomingData, readResult, triggerColumn, lastValue, trigger);
+		}
 	}
 	csvFile.close();
+	timers.addThreadCPUTime("serial", getThreadCPUTime());
 }
 
-// Recording session
-int record(std::string& saveTitle, double duration) {
+// Recording session (of [duration] minutes, or until stopped if 0); with [rotate], HDF5 files are rotated
+// according to _rotateMinutes and _rotateMB
+int record(std::string& saveTitle, double duration, bool rotate = false) {
 	/* Start serial */
 	debugMessage("Searching for serial connection", DEBUG_INFO);
 	Serial* serial = new Serial("COM4", CBR_256000);
@@ -94,19 +149,95 @@ int record(std::string& saveTitle, double duration) {
 	for (size_t i = 0; i < cameras.size(); i++) {
 		// Make new acquirer
 		acquirers.push_back(new BaseAcquirer(camnames[i], *cameras[i]));
+		size_t queueFrames = getStreamParam("_queueFrames", camnames[i]);
+		size_t queueBytes = getStreamParam("_queueBytes", camnames[i]);
+		if (queueFrames == 0 && queueBytes == 0) queueFrames = FRAME_BUFFER_SIZE;
+		acquirers[i]->setQueueLimits(queueFrames, queueBytes, (overflowPolicy) getStreamParam("_overflowPolicy", camnames[i]));
+		acquirers[i]->setCallbackMode(getStreamParam("_frameCallbacks", camnames[i]) != 0);
+		// (the acquirer initialized the camera)
+		PointGreyCamera* pgcam = dynamic_cast<PointGreyCamera*>(cameras[i]);
+		if (pgcam != nullptr) setPointGreyFormat(i, *pgcam);
 	}
 
-	/* Prepare HDF5 saver */
-	// Check if file exists
-	if (fileExists(saveTitle + ".h5")) {
-		debugMessage("File already exists. Overwriting...", DEBUG_WARNING);
+	/* Set up triggered recording */
+	// (each stream keeps the last _preTriggerSeconds in memory, and saves them and _postTriggerSeconds more on a trigger)
+	std::shared_ptr<RecordingTrigger> trigger;
+	if (params["_triggered"]) {
+		trigger = std::make_shared<RecordingTrigger>();
+		for (size_t i = 0; i < cameras.size(); i++) {
+			size_t preFrames = (size_t) std::ceil(params["_preTriggerSeconds"] * cameras[i]->getFPS());
+			size_t postFrames = (size_t) std::ceil(params["_postTriggerSeconds"] * cameras[i]->getFPS());
+			acquirers[i]->setFrameGate(std::unique_ptr<FrameGate>(new TriggerGate(trigger, preFrames, postFrames)));
+		}
+	}
+
+	/* Set up motion gating */
+	// (streams with _motionGate save only while something moves; see MotionGate)
+	for (size_t i = 0; i < cameras.size(); i++) {
+		if (trigger != nullptr || getStreamParam("_motionGate", camnames[i]) == 0) continue;
+		bool packed = (formats[i] == GRAY_PACKED || formats[i] == DEPTH_PACKED);
+		if (packed || cameras[i]->getBytesPerPixel() > 2 || cameras[i]->getChannels() != 1) {
+			debugMessage(camnames[i] + ": motion gating needs unpacked 8- or 16-bit frames; saving every frame", DEBUG_WARNING);
+			continue;
+		}
+		MotionSettings settings = { getStreamParam("_motionDecimation", camnames[i]), getStreamParam("_motionPixelDelta", camnames[i]),
+			getStreamParam("_motionOnPermille", camnames[i]), getStreamParam("_motionOffPermille", camnames[i]) };
+		size_t preFrames = (size_t) std::ceil(getStreamParam("_motionPreSeconds", camnames[i]) * cameras[i]->getFPS());
+		size_t postFrames = (size_t) std::ceil(getStreamParam("_motionPostSeconds", camnames[i]) * cameras[i]->getFPS());
+		acquirers[i]->setFrameGate(std::unique_ptr<FrameGate>(new MotionGate(cameras[i]->getWidth(), cameras[i]->getHeight(),
+			cameras[i]->getBytesPerPixel(), cameras[i]->getCamType() == CAMERA_KINECT, settings, preFrames, postFrames)));
+	}
+	if (params["_saveFormat"] != SAVE_HDF5 &&
+			std::any_of(acquirers.begin(), acquirers.end(), [](BaseAcquirer* acq) { return acq->getFrameGate() != nullptr; })) {
+		debugMessage("Only HDF5 recordings keep the gated intervals (the frames' timestamps are kept)", DEBUG_WARNING);
+	}
+
+	/* Set up frame counts */
+	// (before preparing the saver, which sizes its datasets to fit them)
+	for (size_t i = 0; i < cameras.size(); i++) {
+		size_t totalFrames = round(duration * 60.0 * cameras[i]->getFPS());
+		acquirers[i]->setFramesToAcquire(totalFrames);
+	}
+
+	/* Prepare saver */
+	BaseSaver* saver = nullptr;
+	H5Out* h5out = nullptr;
+	if (params["_saveFormat"] == SAVE_RAW) {
+		// Raw files (convert them to HDF5 afterwards with --convert)
+		saver = new RawOut(saveTitle, acquirers, frameChunkSize, camnames, params["_rawQueueDepth"]);
+	}
+	else if (params["_saveFormat"] == SAVE_SEGMENTS) {
+		// Memory-mapped segment files (also converted to HDF5 with --convert)
+		saver = new SegmentOut(saveTitle, acquirers, frameChunkSize, camnames, params["_segmentMB"],
+			getFlushPolicy(params), params["_flushInterval"]);
+	}
+	else {
+		// Check if file exists
+		if (fileExists(saveTitle + ".h5")) {
+			debugMessage("File already exists. Overwriting...", DEBUG_WARNING);
+		}
+		// Set up file access property list
+		H5::FileAccPropList fapl;
+		fapl.setCache(65536000, params["_rdcc_nslots"], params["_rdcc_nbytes"], 0);
+		fapl.setSieveBufSize(params["_sievebufsize"]);
+		// Delta-code the 16-bit streams that ask for it (e.g. "_temporalDelta_kinect")
+		std::vector<bool> temporalDelta;
+		for (size_t i = 0; i < cameras.size(); i++) temporalDelta.push_back(getStreamParam("_temporalDelta", camnames[i]) != 0);
+		// Create saving object
+		saver = h5out = new H5Out(saveTitle + ".h5", acquirers, frameChunkSize, camnames, dtypes,
+			H5::FileCreatPropList::DEFAULT, fapl, dcpls, params["_perStreamFiles"] != 0, params["_compressionWorkers"],
+			getFlushPolicy(params), params["_flushInterval"],
+			rotate ? params["_rotateMB"] : 0, rotate ? params["_rotateMinutes"] * 60 : 0, params["_swmr"] != 0,
+			temporalDelta);
+	}
+
+	/* Prepare memory governor */
+	// (spills queued frames to disk beyond the memory budget)
+	MemoryGovernor* governor = nullptr;
+	if (params["_memoryBudgetMB"] > 0) {
+		governor = new MemoryGovernor((uint64_t) params["_memoryBudgetMB"] << 20, acquirers, frameChunkSize,
+			getSpillPrefix(saveTitle, spillDirectory));
 	}
-	// Set up file access property list
-	H5::FileAccPropList fapl;
-	fapl.setCache(65536000, params["_rdcc_nslots"], params["_rdcc_nbytes"], 0);
-	// Create saving object
-	H5Out* h5out = new H5Out(saveTitle + ".h5", acquirers, frameChunkSize, camnames, dtypes,
-		H5::FileCreatPropList::DEFAULT, fapl, dcpls);
 
 	/* Print camera parameters */
 	debugMessage("Camera parameters:", DEBUG_INFO);
@@ -120,19 +251,19 @@ int record(std::string& saveTitle, double duration) {
 				debugMessage("    Gain (dB) = " + std::to_string(pCam->getGain()), DEBUG_INFO);
 				debugMessage("    Temperature (C) = " + std::to_string(pCam->getTemperature()), DEBUG_INFO);
 				debugMessage("    Serial = " + pCam->getSerial(), DEBUG_INFO);
+				debugMessage("    Pixel format = " + pCam->getPixelFormat(), DEBUG_INFO);
+				debugMessage("    Frame size = " + std::to_string(pCam->getPixelWidth()) + "x" + std::to_string(pCam->getHeight()) +
+					" at (" + std::to_string(pCam->getOffsetX()) + ", " + std::to_string(pCam->getOffsetY()) + "), cropping: " +
+					pCam->getCropping(), DEBUG_INFO);
 			}
 		}
 	}
-	/* Set up frame counts */
-	for (size_t i = 0; i < cameras.size(); i++) {
-		size_t totalFrames = round(duration * 60.0 * cameras[i]->getFPS());
-		acquirers[i]->setFramesToAcquire(totalFrames);
-	}
-
 	/* Start */
 	// Prepare GUI
 	PreviewWindow preview(960, 720, "Wang Lab behavior acquisition tool (press Q to stop acquisition)",
-		acquirers, *h5out, cameras, formats);
+		acquirers, *saver, cameras, formats);
+	preview.setMemoryGovernor(governor);
+	preview.setTrigger(trigger.get());
 	// Start acquisition
 	timers.pause(DTIMER_PREP);
 	timers.start(DTIMER_ACQUISITION);
@@ -140,11 +271,12 @@ int record(std::string& saveTitle, double duration) {
 		acquirers[i]->run();
 		acquirers[i]->beginAcquisition();
 	}
+	if (governor != nullptr) governor->start();
 	// Start serial thread
 	stopSerialLoop = false;
 	std::thread* serialThread = nullptr;
 	if (serial->IsConnected()) {
-		serialThread = new std::thread(serialLoop, serial, saveTitle + "_daq.csv");
+		serialThread = new std::thread(serialLoop, serial, saveTitle + "_daq.csv", trigger.get(), params["_triggerDaqColumn"]);
 	}
 	// Wait for cameras to be ready
 	debugMessage("Waiting for cameras to be ready...", DEBUG_INFO);
@@ -152,7 +284,9 @@ int record(std::string& saveTitle, double duration) {
 		while (!cameras[i]->isReady()) {}
 	}
 	// Start GUI
+	double guiCPUStart = getThreadCPUTime();
 	preview.run();
+	timers.addThreadCPUTime("GUI", getThreadCPUTime() - guiCPUStart);
 
 	/* Stop */
 	// End acquisition
@@ -176,24 +310,108 @@ int record(std::string& saveTitle, double duration) {
 	}
 
 	// Stop saving but keep saving acquired frames
-	h5out->abortSaving(false); // wait for thread to be joined
+	saver->abortSaving(false); // wait for threads to be joined
+	if (governor != nullptr) governor->stop();
+	saver->writeDroppedFrames();
+	if (params["_linkStreamFiles"] && h5out != nullptr) h5out->linkStreamFiles();
 
 	// Write metadata
 	for (size_t i = 0; i < acquirers.size(); i++) {
-		h5out->writeScalarAttribute(acquirers[i]->getName() + "_fps", cameras[i]->getFPS());
+		saver->writeScalarAttribute(acquirers[i]->getName() + "_fps", cameras[i]->getFPS());
 		if (acquirers[i]->getCamType() == CAMERA_PG) { // Point-Grey specific metadata
 			PointGreyCamera* pCam = dynamic_cast<PointGreyCamera*>(cameras[i]);
 			if (pCam != nullptr) {
-				h5out->writeScalarAttribute(acquirers[i]->getName() + "_serial", pCam->getSerial());
-				h5out->writeScalarAttribute(acquirers[i]->getName() + "_exposure", pCam->getExposure());
-				h5out->writeScalarAttribute(acquirers[i]->getName() + "_gain", pCam->getGain());
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_serial", pCam->getSerial());
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_exposure", pCam->getExposure());
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_gain", pCam->getGain());
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_pixelFormat", pCam->getPixelFormat());
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_offsetX", pCam->getOffsetX());
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_offsetY", pCam->getOffsetY());
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_cropping", pCam->getCropping());
+				if (pCam->getPacking() != PACKING_NONE) { // describe the packed layout
+					saver->writeScalarAttribute(acquirers[i]->getName() + "_packing", getPackingDescription(pCam->getPacking()));
+					saver->writeScalarAttribute(acquirers[i]->getName() + "_bitsPerPixel", getPackedBits(pCam->getPacking()));
+					saver->writeScalarAttribute(acquirers[i]->getName() + "_pixelWidth", pCam->getPixelWidth());
+				}
+			}
+		}
+		if (acquirers[i]->getCamType() == CAMERA_KINECT) { // describe packed depths
+			KinectCamera* kCam = dynamic_cast<KinectCamera*>(cameras[i]);
+			if (kCam != nullptr && kCam->getDepthBits() > 0) {
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_packing", getDepthPackingDescription(kCam->getDepthBits()));
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_bitsPerPixel", kCam->getDepthBits());
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_pixelWidth", kCam->getPixelWidth());
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_maxDepth", (size_t) kCam->getMaxDepth());
+				saver->writeScalarAttribute(acquirers[i]->getName() + "_clampedPixels", kCam->getClampedPixels());
 			}
 		}
 	}
-	h5out->writeScalarAttribute("deflate", params["_compression"]);
+	saver->writeScalarAttribute("deflate", params["_compression"]);
+	if (trigger != nullptr) saver->writeScalarAttribute("triggers", trigger->getCount());
+	if (governor != nullptr) {
+		saver->writeScalarAttribute("memoryBudgetMB", params["_memoryBudgetMB"]);
+		for (size_t i = 0; i < acquirers.size(); i++) {
+			saver->writeScalarAttribute(acquirers[i]->getName() + "_framesSpilled", acquirers[i]->getFramesSpilled());
+		}
+	}
+	for (size_t i = 0; i < acquirers.size(); i++) {
+		frameCodec codec;
+		size_t level;
+		getStreamCodec(params, acquirers[i]->getName(), codec, level);
+		saver->writeScalarAttribute(acquirers[i]->getName() + "_codec", getCodecName(codec, level));
+	}
+
+	// Report dropped frames
+	for (size_t i = 0; i < acquirers.size(); i++) {
+		if (acquirers[i]->getFramesDropped() > 0) {
+			debugMessage(acquirers[i]->getName() + ": dropped " + std::to_string(acquirers[i]->getFramesDropped()) +
+				" frames (queue full)", DEBUG_WARNING);
+		}
+	}
+	// Report triggers and gated streams
+	if (trigger != nullptr) {
+		for (auto& event : trigger->getEvents()) {
+			debugMessage("Trigger at " + std::to_string(event.first) + " s (" + event.second + ")", DEBUG_INFO);
+		}
+	}
+	for (size_t i = 0; i < acquirers.size(); i++) {
+		FrameGate* gate = acquirers[i]->getFrameGate();
+		if (gate == nullptr) continue;
+		debugMessage(acquirers[i]->getName() + ": saved " + std::to_string(gate->getFramesPassed()) + " frames in " +
+			std::to_string(gate->getIntervals().size()) + " intervals, skipped " + std::to_string(gate->getFramesDiscarded()), DEBUG_INFO);
+		MotionGate* motionGate = dynamic_cast<MotionGate*>(gate);
+		if (motionGate != nullptr) {
+			debugMessage("  scoring motion took " + std::to_string(motionGate->getSecondsPerFrame() * 1e6) + " us per frame", DEBUG_INFO);
+		}
+	}
+	// Report memory use
+	if (governor != nullptr) {
+		debugMessage("Peak buffered memory " + std::to_string(governor->getPeakBytes() >> 20) + " MB (budget " +
+			std::to_string(governor->getBudgetBytes() >> 20) + " MB)", DEBUG_INFO);
+		for (size_t i = 0; i < acquirers.size(); i++) {
+			if (acquirers[i]->getFramesSpilled() > 0) {
+				debugMessage(acquirers[i]->getName() + ": spilled " + std::to_string(acquirers[i]->getFramesSpilled()) +
+					" frames (" + std::to_string(acquirers[i]->getBytesSpilled() >> 20) + " MB) to disk", DEBUG_INFO);
+			}
+		}
+	}
+	// Report clamped depths
+	for (size_t i = 0; i < cameras.size(); i++) {
+		KinectCamera* kCam = dynamic_cast<KinectCamera*>(cameras[i]);
+		if (kCam != nullptr && kCam->getClampedPixels() > 0) {
+			debugMessage(acquirers[i]->getName() + ": clamped " + std::to_string(kCam->getClampedPixels()) + " depths beyond " +
+				std::to_string(kCam->getMaxDepth()) + " mm", DEBUG_WARNING);
+		}
+	}
+	// Report frame buffer pool usage
+	for (size_t i = 0; i < acquirers.size(); i++) {
+		debugMessage(acquirers[i]->getName() + " frame pool: " + std::to_string(acquirers[i]->getPoolHits()) + " hits, " +
+			std::to_string(acquirers[i]->getPoolMisses()) + " misses", DEBUG_INFO);
+	}
 
 	// Finalize
-	delete h5out;
+	delete governor;
+	delete saver;
 	for (size_t i = 0; i < cameras.size(); i++) {
 		delete acquirers[i];
 	}
@@ -209,10 +427,51 @@ int main(int argc, char* argv[]) {
 	/* Parse input arguments */
 	double recordingDuration(0); // minutes
 	bool fixedlen = true;
+	bool tuning = false; // tune the HDF5 layout for the connected cameras instead of recording
+	size_t tuneFrames = TUNE_DEFAULT_FRAMES;
+	std::string tuneOutput = "config.json";
+	// Options (anywhere on the command line)
+	std::vector<char*> args;
+	for (int i = 0; i < argc; i++) {
+		if (std::string(argv[i]) == "--spill" && i + 1 < argc) spillDirectory = argv[++i];
+		else args.push_back(argv[i]);
+	}
+	argc = (int) args.size();
+	argv = args.data();
 	if (argc < 2) {
-		debugMessage("Usage:\n\tacquireWang.exe filename [numMinutes = 0]", DEBUG_MUST_SHOW);
+		debugMessage("Usage:\n\tacquireWang.exe filename [numMinutes = 0] [--spill directory]\n\tacquireWang.exe --bench name [options]"
+			"\n\tacquireWang.exe --convert filename [output = filename.h5]"
+			"\n\tacquireWang.exe --tail filename dataset [idleSeconds = 10]"
+			"\n\tacquireWang.exe --tune [numFrames = " + std::to_string(TUNE_DEFAULT_FRAMES) + "] [output = config.json]", DEBUG_MUST_SHOW);
 		exit(EXIT_FAILURE);
 	}
+	else if (std::string(argv[1]) == "--bench") { // benchmarks (no cameras needed)
+		params = readConfig();
+		return runBenchmark(argc - 2, argv + 2, params);
+	}
+	else if (std::string(argv[1]) == "--convert") { // raw recording to HDF5 (no cameras needed)
+		if (argc < 3) {
+			debugMessage("Usage:\n\tacquireWang.exe --convert filename [output = filename.h5]", DEBUG_MUST_SHOW);
+			exit(EXIT_FAILURE);
+		}
+		params = readConfig();
+		std::string root = argv[2];
+		std::string output = (argc > 3) ? argv[3] : root + ".h5";
+		return convertRawRecording(root, output, params) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	else if (std::string(argv[1]) == "--tail") { // follow a recording being written in SWMR mode (no cameras needed)
+		if (argc < 4) {
+			debugMessage("Usage:\n\tacquireWang.exe --tail filename dataset [idleSeconds = 10]", DEBUG_MUST_SHOW);
+			exit(EXIT_FAILURE);
+		}
+		double idleSeconds = (argc > 4) ? atof(argv[4]) : 10.0;
+		return tailRecording(argv[2], argv[3], idleSeconds) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	else if (std::string(argv[1]) == "--tune") { // tune chunking and caches for the connected cameras and this disk
+		tuning = true;
+		if (argc > 2) tuneFrames = std::stoul(argv[2]);
+		if (argc > 3) tuneOutput = argv[3];
+	}
 	else if (argc == 2) { // if numMinutes not specified, run without fixed length
 		fixedlen = false;
 	}
@@ -226,28 +485,6 @@ int main(int argc, char* argv[]) {
 
 	frameChunkSize = params["_frameChunkSize"];
 
-	/* Set up HDF5 DCPLs */
-	// Set up dataset creation property lists
-	H5::DSetCreatPropList kin_dcpl;
-	const int frame_ndims = 4;
-	size_t kin_chunk_dims[frame_ndims] = { frameChunkSize, 1, params["_kinectYchunk"], params["_kinectXchunk"] };
-	kin_dcpl.setChunk(frame_ndims, kin_chunk_dims);
-	H5::DSetCreatPropList pg_dcpl;
-	size_t pg_chunk_dims[frame_ndims] = { frameChunkSize, 1, params["_pgYchunk"], params["_pgXchunk"] };
-	pg_dcpl.setChunk(frame_ndims, pg_chunk_dims);
-	if (params["_compression"] > 0) {
-		kin_dcpl.setDeflate(params["_compression"]);
-		pg_dcpl.setDeflate(params["_compression"]);
-	}
-	// Enable shuffle filter
-	kin_dcpl.setShuffle();
-	pg_dcpl.setShuffle();
-	// Enable the LZ4 filter
-	const int H5Z_FILTER_LZ4 = 32004;
-	const unsigned int lz4_params[1] = { params["_lz4_block_size"] }; // block size in bytes (default = 1<<30 == 1.0 GB)
-	kin_dcpl.setFilter(H5Z_FILTER_LZ4, H5Z_FLAG_MANDATORY, 1, lz4_params);
-	pg_dcpl.setFilter(H5Z_FILTER_LZ4, H5Z_FLAG_MANDATORY, 1, lz4_params);
-
 	/* Set up cameras */
 	// Initialize Point Grey system
 	Spinnaker::SystemPtr system = Spinnaker::System::GetInstance();
@@ -262,9 +499,14 @@ int main(int argc, char* argv[]) {
 		debugMessage("Found valid Kinect camera", DEBUG_INFO);
 		cameras.push_back(kincam);
 		camnames.push_back("kinect");
-		formats.push_back(DEPTH_16BIT);
-		dtypes.push_back(KINECT_H5T);
-		dcpls.push_back(kin_dcpl);
+		// Pack depths to fewer bits?
+		kincam->setDepthPacking(params["_kinectDepthBits"], params["_kinectMaxDepth"]);
+		size_t depthBits = kincam->getDepthBits();
+		formats.push_back((depthBits > 0) ? DEPTH_PACKED : DEPTH_16BIT);
+		dtypes.push_back((depthBits > 0) ? KINECT_PACKED_H5T : KINECT_H5T);
+		// Set up dataset creation property list (with the stream's codec; packed chunks span the same pixels)
+		size_t xChunk = (depthBits > 0) ? std::max(getDepthPackedBytes(depthBits, params["_kinectXchunk"]), (size_t) 1) : params["_kinectXchunk"];
+		dcpls.push_back(createStreamDcpl(params, "kinect", frameChunkSize, params["_kinectYchunk"], xChunk));
 	}
 
 	// Set up Point Grey cameras
@@ -279,6 +521,10 @@ int main(int argc, char* argv[]) {
 		// If config file with this serial number exists, apply settings
 		std::string pg_config_filename = "pg" + serial + ".json";
 		bool triggeredAcquisition = false;
+		bool rawPixels = false;
+		size_t packBits = 0;
+		bool roi = false, roiSoftware = false;
+		size_t roiX = 0, roiY = 0, roiWidth = 0, roiHeight = 0;
 		if (fileExists(pg_config_filename)) {
 			debugMessage("Point Grey configuration file found: " + pg_config_filename, DEBUG_INFO);
 			json pg_config = readJSON(pg_config_filename);
@@ -347,20 +593,90 @@ int main(int argc, char* argv[]) {
 					debugMessage("    Output of exposure signal activated", DEBUG_INFO);
 				}
 			}
+			// Sensor pixel format (e.g. "Mono8", "BayerRG8", "Mono16")
+			item = pg_config.find("pixel_format");
+			if (item != pg_config.end()) {
+				std::string val = item.value().get<std::string>();
+				Spinnaker::GenApi::CEnumerationPtr pixelFormatNode = pCam->GetNodeMap().GetNode("PixelFormat");
+				Spinnaker::GenApi::CEnumEntryPtr entry = pixelFormatNode->GetEntryByName(val.c_str());
+				if (Spinnaker::GenApi::IsAvailable(entry) && Spinnaker::GenApi::IsReadable(entry)) {
+					pixelFormatNode->SetIntValue(entry->GetValue());
+					debugMessage("    Set pixel format = " + val, DEBUG_INFO);
+				}
+				else {
+					debugMessage("    Pixel format " + val + " is not available", DEBUG_WARNING);
+				}
+			}
+			// Save the sensor's pixels as-is instead of converting every frame to Mono8?
+			item = pg_config.find("raw_pixels");
+			if (item != pg_config.end()) {
+				std::string val = item.value().get<std::string>();
+				std::transform(val.begin(), val.end(), val.begin(), ::toupper);
+				rawPixels = (val == "TRUE" || val == "YES" || val == "ON" || val == "Y" || val == "T");
+			}
+			// Pack raw Mono16 pixels to 10 or 12 bits?
+			item = pg_config.find("pack_bits");
+			if (item != pg_config.end()) {
+				packBits = item.value().get<size_t>();
+			}
+			// Region of interest (offset and size on the sensor; a size of 0 extends to the sensor's edge)
+			const char* roiKeys[4] = { "roi_x", "roi_y", "roi_width", "roi_height" };
+			size_t* roiValues[4] = { &roiX, &roiY, &roiWidth, &roiHeight };
+			for (int k = 0; k < 4; k++) {
+				item = pg_config.find(roiKeys[k]);
+				if (item != pg_config.end()) {
+					*roiValues[k] = item.value().get<size_t>();
+					roi = true;
+				}
+			}
+			// Crop every image instead of setting the camera's ROI?
+			item = pg_config.find("roi_software");
+			if (item != pg_config.end()) {
+				std::string val = item.value().get<std::string>();
+				std::transform(val.begin(), val.end(), val.begin(), ::toupper);
+				roiSoftware = (val == "TRUE" || val == "YES" || val == "ON" || val == "Y" || val == "T");
+			}
+		}
+		std::string rawPixelFormat;
+		if (rawPixels) {
+			Spinnaker::GenApi::CEnumerationPtr pixelFormatNode = pCam->GetNodeMap().GetNode("PixelFormat");
+			rawPixelFormat = pixelFormatNode->ToString();
+			debugMessage("    Saving raw " + rawPixelFormat + " pixels", DEBUG_INFO);
 		}
 		pCam->DeInit();
 		// Add camera along with system reference
-		cameras.push_back(new PointGreyCamera(system.operator->(), pCam, triggeredAcquisition));
+		PointGreyCamera* pgcam = new PointGreyCamera(system.operator->(), pCam, triggeredAcquisition, rawPixelFormat, packBits);
+		if (roi) {
+			pgcam->setRegionOfInterest(roiX, roiY, roiWidth, roiHeight, roiSoftware);
+			debugMessage("    Region of interest: " + std::to_string(roiWidth) + "x" + std::to_string(roiHeight) + " at (" +
+				std::to_string(roiX) + ", " + std::to_string(roiY) + ")" + (roiSoftware ? ", cropped in software" : ""), DEBUG_INFO);
+		}
+		cameras.push_back(pgcam);
 		// Add to camnames, dtypes, etc.
 		camnames.push_back("pg" + std::to_string(i));
 		formats.push_back(GRAY_8BIT);
 		dtypes.push_back(POINTGREY_H5T);
-		dcpls.push_back(pg_dcpl);
+		setPointGreyFormat(formats.size() - 1, *pgcam);
+		dcpls.push_back(createStreamDcpl(params, camnames.back(), frameChunkSize, params["_pgYchunk"], params["_pgXchunk"]));
 	}
 
 	debugMessage("Initialization complete\n", DEBUG_INFO);
+	if (tuning) {
+		// Tune for the connected cameras' frames (or, without any, for a Kinect and a Point Grey camera)
+		std::vector<TuneStream> streams;
+		for (size_t i = 0; i < cameras.size(); i++) {
+			cameras[i]->initialize(); // (Point Grey cameras only know their frame size once initialized)
+			streams.push_back({ camnames[i], cameras[i]->getCamType(), cameras[i]->getWidth(),
+				cameras[i]->getHeight(), cameras[i]->getBytesPerPixel(), cameras[i]->getFPS() });
+		}
+		if (streams.empty()) {
+			debugMessage("No cameras found: tuning for a 512x424 Kinect and a 1280x1024 Point Grey camera", DEBUG_WARNING);
+			streams = { { "kinect", CAMERA_KINECT, 512, 424, sizeof(uint16_t), 30 }, { "pg0", CAMERA_PG, 1280, 1024, sizeof(uint8_t), 100 } };
+		}
+		tuneConfig(streams, params, tuneFrames, tuneOutput);
+	}
 	// Check number of cameras
-	if (cameras.size() == 0) {
+	else if (cameras.size() == 0) {
 		debugMessage("No cameras to record from!", DEBUG_ERROR);
 	}
 	/* Recording loop */
@@ -374,6 +690,9 @@ int main(int argc, char* argv[]) {
 	}
 	else {
 		const double MAX_DURATION = 20.0; // Set upper limit so we don't fill the hard drive
+		// Rotating HDF5 files instead splits each recording into files within one session (without stopping
+		// acquisition), so a recording runs until it is stopped
+		bool rotate = (params["_saveFormat"] == SAVE_HDF5) && (params["_rotateMinutes"] > 0 || params["_rotateMB"] > 0);
 		int iteration = 0;
 
 		while (true) { // Loop as long as user wants to record
@@ -400,7 +719,7 @@ int main(int argc, char* argv[]) {
 			try {
 				timers.start(DTIMER_OVERALL);
 				timers.start(DTIMER_PREP);
-				record(saveTitle + "-" + titleIndex, MAX_DURATION);
+				record(saveTitle + "-" + titleIndex, rotate ? 0 : MAX_DURATION, rotate);
 				timers.pause(DTIMER_CLEANUP);
 				timers.pause(DTIMER_OVERALL);
 				printDebugTimerInfo();
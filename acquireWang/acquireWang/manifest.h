@@ -0,0 +1,77 @@
+#pragma once
+#pragma warning(push, 0)
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include "json.hpp" // JSON
+#pragma warning(pop)
+#include "debug.h"
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class keeps the JSON manifest of a recording saved as plain files
+ * (raw or mapped segments), or split across rotated HDF5 files: its format,
+ * the files of each stream, and the metadata attributes that would
+ * otherwise be HDF5 root attributes. The file is rewritten whenever it
+ * changes, so it is always up to date.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class SessionManifest {
+private:
+	const std::string filename;
+	nlohmann::json contents;
+	std::mutex mutex; // (attributes can be set from any thread)
+
+	// Rewrites the file (call with mutex held)
+	void save() {
+		std::ofstream f(filename);
+		f << contents.dump(4);
+		if (!f.good()) debugMessage("Failed to write " + filename, DEBUG_ERROR);
+	}
+
+	// Disable assignment operator and copy constructor
+	SessionManifest& operator=(const SessionManifest& other) = delete;
+	SessionManifest(const SessionManifest& other) = delete;
+
+public:
+	SessionManifest(const std::string& _filename, const std::string& format, int version) : filename(_filename) {
+		contents["format"] = format;
+		contents["version"] = version;
+		contents["streams"] = nlohmann::json::array();
+		contents["attributes"] = nlohmann::json::object();
+		save();
+	}
+
+	// Lists a stream's files (by bare name, so the set of files can be moved together), e.g.
+	// addStream("kinect", { { "data", "session_kinect.raw" } })
+	void addStream(const std::string& name, std::map<std::string, std::string> files) {
+		std::lock_guard<std::mutex> lock(mutex);
+		nlohmann::json stream;
+		stream["name"] = name;
+		for (auto& file : files) stream[file.first] = file.second.substr(file.second.find_last_of("/\\") + 1);
+		contents["streams"].push_back(stream);
+		save();
+	}
+
+	// Records that frames [firstFrame, firstFrame + numFrames) of a stream (added with addStream()) are in [file],
+	// the [number]th file of the stream (numFrames is 0 while the file is being written)
+	void setStreamPart(const std::string& name, size_t number, const std::string& file, size_t firstFrame, size_t numFrames) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (nlohmann::json& stream : contents["streams"]) {
+			if (stream["name"] != name) continue;
+			nlohmann::json part;
+			part["file"] = file.substr(file.find_last_of("/\\") + 1);
+			part["firstFrame"] = firstFrame;
+			part["numFrames"] = numFrames;
+			if (stream.find("parts") == stream.end()) stream["parts"] = nlohmann::json::array();
+			stream["parts"][number] = part;
+		}
+		save();
+	}
+
+	template <typename T>
+	void setAttribute(const std::string& name, T value) {
+		std::lock_guard<std::mutex> lock(mutex);
+		contents["attributes"][name] = value;
+		save();
+	}
+};
@@ -0,0 +1,74 @@
+#include "mappedfile.h"
+#pragma warning(push, 0)
+#include <algorithm>
+#ifdef _WIN32
+#include "Windows.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#pragma warning(pop)
+#include "debug.h"
+
+#define MAPPED_FILE_PAGE 4096 // Flushed ranges start on a page boundary
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+MappedFile::MappedFile(const std::string& _filename, uint64_t _bytes) : filename(_filename), bytes(_bytes), data(nullptr) {
+#ifdef _WIN32
+	mappingHandle = NULL;
+	fileHandle = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle != INVALID_HANDLE_VALUE) {
+		// Mapping more than the file holds extends it to the full size
+		mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, (DWORD) (bytes >> 32), (DWORD) (bytes & 0xFFFFFFFF), NULL);
+		if (mappingHandle != NULL) data = (char*) MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, (size_t) bytes);
+	}
+#else
+	fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd >= 0) {
+		// Reserve the space (otherwise running out of disk while writing through the mapping kills the process)
+		bool sized = (posix_fallocate(fd, 0, (off_t) bytes) == 0);
+		if (!sized) {
+			debugMessage("Failed to preallocate " + filename, DEBUG_WARNING);
+			sized = (ftruncate(fd, (off_t) bytes) == 0);
+		}
+		if (sized) {
+			void* mapped = mmap(NULL, (size_t) bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (mapped != MAP_FAILED) data = (char*) mapped;
+		}
+	}
+#endif
+	if (data == nullptr) debugMessage("Failed to map " + filename, DEBUG_ERROR);
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+	if (data != nullptr) UnmapViewOfFile(data);
+	if (mappingHandle != NULL) CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+#else
+	if (data != nullptr) munmap(data, (size_t) bytes);
+	if (fd >= 0) close(fd);
+#endif
+}
+
+bool MappedFile::flush(uint64_t offset, uint64_t length, bool wait) {
+	if (data == nullptr) return false;
+	uint64_t start = offset / MAPPED_FILE_PAGE * MAPPED_FILE_PAGE;
+	uint64_t end = std::min(offset + length, bytes);
+	if (end <= start) return true;
+#ifdef _WIN32
+	// FlushViewOfFile() only starts writing the pages; FlushFileBuffers() waits for them
+	bool result = FlushViewOfFile(data + start, (size_t) (end - start)) != 0;
+	if (wait && result) result = FlushFileBuffers(fileHandle) != 0;
+#else
+	bool result = msync(data + start, (size_t) (end - start), wait ? MS_SYNC : MS_ASYNC) == 0;
+	if (wait && result) result = fsync(fd) == 0;
+#endif
+	if (!result) debugMessage("Failed to flush " + filename, DEBUG_ERROR);
+	return result;
+}
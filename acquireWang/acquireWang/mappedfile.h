@@ -0,0 +1,42 @@
+#pragma once
+#pragma warning(push, 0)
+#include <cstdint>
+#include <string>
+#pragma warning(pop)
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class maps a whole file of a fixed size into memory for writing.
+ * The file is created (or truncated) at its full size with its space
+ * reserved, so writing through the mapping cannot fail for lack of disk
+ * space. Writes reach the file as the operating system writes back the
+ * mapped pages; flush() starts (or waits for) that.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class MappedFile {
+private:
+	const std::string filename;
+	const uint64_t bytes;
+	char* data; // nullptr if the file could not be mapped
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int fd;
+#endif
+
+	// Disable assignment operator and copy constructor
+	MappedFile& operator=(const MappedFile& other) = delete;
+	MappedFile(const MappedFile& other) = delete;
+
+public:
+	MappedFile(const std::string& _filename, uint64_t _bytes);
+	~MappedFile(); // Unmaps and closes the file (without waiting for writeback)
+
+	bool isOpen() { return data != nullptr; }
+	char* getData() { return data; }
+	uint64_t getBytes() { return bytes; }
+	const std::string& getFilename() { return filename; }
+
+	// Writes back the mapped pages in [offset, offset + length); if [wait], returns once they (and the file's
+	// metadata) are on disk, and otherwise only starts writing them
+	bool flush(uint64_t offset, uint64_t length, bool wait);
+};
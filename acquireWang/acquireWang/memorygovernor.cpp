@@ -0,0 +1,103 @@
+#include "memorygovernor.h"
+#pragma warning(push, 0)
+#include <algorithm>
+#pragma warning(pop)
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+MemoryGovernor::MemoryGovernor(uint64_t _budgetBytes, std::vector<BaseAcquirer*>& _acquirers, size_t frameChunkSize,
+		const std::string& spillPrefix) :
+		budgetBytes(_budgetBytes), acquirers(_acquirers), fixedBytes(0), governThread(nullptr), stopping(false),
+		memoryBytes(0), peakBytes(0), diskBytes(0) {
+	for (BaseAcquirer* acquirer : acquirers) {
+		fixedBytes += (uint64_t) CHUNK_ARENA_SLABS * frameChunkSize * acquirer->getFrameBytes();
+		acquirer->enableSpilling(spillPrefix + "_" + acquirer->getName() + ".spill");
+	}
+	// Share the rest of the budget between the streams' frame pools (at least a frame each)
+	uint64_t poolShare = (budgetBytes > fixedBytes && !acquirers.empty()) ? (budgetBytes - fixedBytes) / acquirers.size() : 0;
+	for (BaseAcquirer* acquirer : acquirers) {
+		acquirer->setPoolLimit((size_t) std::max(poolShare, (uint64_t) acquirer->getFrameBytes()));
+	}
+	if (fixedBytes >= budgetBytes) {
+		debugMessage("The saver's chunk buffers alone (" + std::to_string(fixedBytes >> 20) + " MB) exceed the "
+			"memory budget (" + std::to_string(budgetBytes >> 20) + " MB): every queued frame will be spilled", DEBUG_WARNING);
+	}
+	memoryBytes = peakBytes = 0;
+	measure();
+}
+
+MemoryGovernor::~MemoryGovernor() {
+	stop();
+}
+
+uint64_t MemoryGovernor::getBytesSpilled() {
+	uint64_t result = 0;
+	for (BaseAcquirer* acquirer : acquirers) result += acquirer->getBytesSpilled();
+	return result;
+}
+
+size_t MemoryGovernor::getFramesSpilled() {
+	size_t result = 0;
+	for (BaseAcquirer* acquirer : acquirers) result += acquirer->getFramesSpilled();
+	return result;
+}
+
+void MemoryGovernor::start() {
+	if (governThread != nullptr) return;
+	stopping = false;
+	governThread = new std::thread(&MemoryGovernor::governLoop, this);
+}
+
+void MemoryGovernor::stop() {
+	if (governThread == nullptr) return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	governThread->join();
+	delete governThread;
+	governThread = nullptr;
+}
+
+/* * * * * * * * * *
+ * HELPER METHODS  *
+ * * * * * * * * * */
+
+uint64_t MemoryGovernor::measure() {
+	uint64_t memory = fixedBytes, disk = 0;
+	for (BaseAcquirer* acquirer : acquirers) {
+		memory += acquirer->getPoolBytes();
+		disk += acquirer->getSpillPendingBytes();
+	}
+	memoryBytes = memory;
+	diskBytes = disk;
+	if (memory > peakBytes) peakBytes = memory;
+	return memory;
+}
+
+void MemoryGovernor::governLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping) {
+		lock.unlock();
+		// Spill the oldest frames of the fullest queue until back within budget
+		while (measure() > budgetBytes) {
+			BaseAcquirer* fullest = nullptr;
+			size_t fullestBytes = 0;
+			for (BaseAcquirer* acquirer : acquirers) {
+				size_t queued = acquirer->getQueueBytes();
+				if (queued > fullestBytes) {
+					fullest = acquirer;
+					fullestBytes = queued;
+				}
+			}
+			if (fullest == nullptr || !fullest->spillOldestFrame()) break; // (nothing left to spill, or the disk failed)
+		}
+		lock.lock();
+		wake.wait_for(lock, std::chrono::milliseconds(MEMORY_GOVERNOR_INTERVAL_MS), [this]() { return stopping; });
+	}
+	lock.unlock();
+	timers.addThreadCPUTime("memory governor", getThreadCPUTime());
+}
@@ -0,0 +1,81 @@
+#pragma once
+#pragma warning(push, 0)
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#pragma warning(pop)
+#include "acquirer.h"
+#include "saver.h" // CHUNK_ARENA_SLABS
+
+#define MEMORY_GOVERNOR_INTERVAL_MS 5 // How often the governor checks memory use
+
+// Root of the names of the spill files of recording [title]: next to the recording, or in [directory] if given
+// (e.g. a scratch disk other than the one being recorded to)
+inline std::string getSpillPrefix(const std::string& title, const std::string& directory = "") {
+	if (directory.empty()) return title;
+	std::string separator = (directory.back() == '/' || directory.back() == '\\') ? "" : "/";
+	return directory + separator + title.substr(title.find_last_of("/\\") + 1);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class keeps the frames buffered by a recording within a memory
+ * budget (_memoryBudgetMB). Buffered memory is the saver's chunk arenas,
+ * which are fixed, plus the acquirers' frame pools: every frame buffer
+ * allocated, whether queued, in use or free. Each pool is limited to its
+ * stream's share of what the arenas leave of the budget, so buffers are
+ * recycled within the budget and spilled frames give their memory back. A
+ * thread checks it every MEMORY_GOVERNOR_INTERVAL_MS; while it is over the
+ * budget, the oldest frame of the stream with the most queued bytes is
+ * moved to that stream's spill file on disk, to be read back when the saver
+ * gets to it. Nothing is dropped unless the disk cannot keep up either.
+ *
+ * Its counters (memory in use, peak, bytes spilled and bytes still waiting
+ * on disk) can be read at any time, e.g. by the preview window.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class MemoryGovernor {
+private:
+	const uint64_t budgetBytes;
+	std::vector<BaseAcquirer*>& acquirers;
+	uint64_t fixedBytes; // Bytes of the saver's chunk arenas
+
+	std::thread* governThread;
+	std::mutex mutex;
+	std::condition_variable wake; // Signals the thread to stop
+	bool stopping;
+
+	// Live counters
+	std::atomic<uint64_t> memoryBytes; // Buffered bytes at the last check
+	std::atomic<uint64_t> peakBytes; // Most buffered bytes seen
+	std::atomic<uint64_t> diskBytes; // Bytes waiting in the spill files at the last check
+
+	void governLoop();
+	uint64_t measure(); // updates the counters and returns the buffered bytes
+
+	// Disable assignment operator and copy constructor
+	MemoryGovernor& operator=(const MemoryGovernor& other) = delete;
+	MemoryGovernor(const MemoryGovernor& other) = delete;
+
+public:
+	// Keeps [_acquirers] (and a saver writing [frameChunkSize] frames per chunk) within [_budgetBytes], spilling to
+	// "[spillPrefix]_<stream>.spill" files
+	MemoryGovernor(uint64_t _budgetBytes, std::vector<BaseAcquirer*>& _acquirers, size_t frameChunkSize,
+		const std::string& spillPrefix);
+	~MemoryGovernor(); // Stops the thread (the spill files belong to the acquirers)
+
+	/* Getter methods */
+	uint64_t getBudgetBytes() { return budgetBytes; }
+	uint64_t getFixedBytes() { return fixedBytes; }
+	uint64_t getMemoryBytes() { return memoryBytes; }
+	uint64_t getPeakBytes() { return peakBytes; }
+	uint64_t getDiskBytes() { return diskBytes; }
+	uint64_t getBytesSpilled();
+	size_t getFramesSpilled();
+
+	/* Methods */
+	void start(); // Starts checking memory (call once the acquirers run)
+	void stop(); // Stops checking memory (call once the acquirers have stopped)
+};
@@ -0,0 +1,174 @@
+#include "motiongate.h"
+#pragma warning(push, 0)
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <immintrin.h>
+#pragma warning(pop)
+
+// MSVC compiles intrinsics for any instruction set; GCC and Clang need to be told per function
+#ifdef __GNUC__
+#define TARGET_SSE __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE
+#define TARGET_AVX2
+#endif
+
+/* * * * * * * * * *
+ * HELPER METHODS  *
+ * * * * * * * * * */
+
+// Number of bits set (without relying on the POPCNT instruction)
+static inline size_t countBits(uint32_t bits) {
+	bits = bits - ((bits >> 1) & 0x55555555);
+	bits = (bits & 0x33333333) + ((bits >> 2) & 0x33333333);
+	return (size_t) ((((bits + (bits >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+}
+
+// Each kernel counts as many pixels as fit its vectors, adds the changed ones to [changed], and returns how many it did
+static void countChanged8Scalar(const uint8_t* frame, const uint8_t* previous, size_t numPixels, uint8_t delta, size_t& changed) {
+	for (size_t i = 0; i < numPixels; i++) {
+		int difference = (int) frame[i] - (int) previous[i];
+		if (difference > delta || -difference > delta) changed++;
+	}
+}
+static void countChanged16Scalar(const uint16_t* frame, const uint16_t* previous, size_t numPixels, uint16_t delta, bool depth,
+		size_t& changed) {
+	for (size_t i = 0; i < numPixels; i++) {
+		if (depth && (frame[i] == 0 || previous[i] == 0)) continue;
+		int difference = (int) frame[i] - (int) previous[i];
+		if (difference > delta || -difference > delta) changed++;
+	}
+}
+
+TARGET_SSE static size_t countChanged8SSE(const uint8_t* frame, const uint8_t* previous, size_t numPixels, uint8_t delta,
+		size_t& changed) {
+	const __m128i vDelta = _mm_set1_epi8((char) delta);
+	size_t done = 0;
+	for (; done + 16 <= numPixels; done += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*) (frame + done)), b = _mm_loadu_si128((const __m128i*) (previous + done));
+		__m128i difference = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+		__m128i unchanged = _mm_cmpeq_epi8(_mm_subs_epu8(difference, vDelta), _mm_setzero_si128());
+		changed += 16 - countBits((uint32_t) _mm_movemask_epi8(unchanged));
+	}
+	return done;
+}
+TARGET_SSE static size_t countChanged16SSE(const uint16_t* frame, const uint16_t* previous, size_t numPixels, uint16_t delta,
+		bool depth, size_t& changed) {
+	const __m128i vDelta = _mm_set1_epi16((short) delta), vZero = _mm_setzero_si128();
+	size_t done = 0, changedBits = 0;
+	for (; done + 8 <= numPixels; done += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i*) (frame + done)), b = _mm_loadu_si128((const __m128i*) (previous + done));
+		__m128i difference = _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+		__m128i skip = _mm_cmpeq_epi16(_mm_subs_epu16(difference, vDelta), vZero); // (unchanged)
+		if (depth) skip = _mm_or_si128(skip, _mm_or_si128(_mm_cmpeq_epi16(a, vZero), _mm_cmpeq_epi16(b, vZero)));
+		changedBits += 16 - countBits((uint32_t) _mm_movemask_epi8(skip)); // (two bits per pixel)
+	}
+	changed += changedBits / 2;
+	return done;
+}
+
+TARGET_AVX2 static size_t countChanged8AVX2(const uint8_t* frame, const uint8_t* previous, size_t numPixels, uint8_t delta,
+		size_t& changed) {
+	const __m256i vDelta = _mm256_set1_epi8((char) delta);
+	size_t done = 0;
+	for (; done + 32 <= numPixels; done += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i*) (frame + done)), b = _mm256_loadu_si256((const __m256i*) (previous + done));
+		__m256i difference = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+		__m256i unchanged = _mm256_cmpeq_epi8(_mm256_subs_epu8(difference, vDelta), _mm256_setzero_si256());
+		changed += 32 - countBits((uint32_t) _mm256_movemask_epi8(unchanged));
+	}
+	return done;
+}
+TARGET_AVX2 static size_t countChanged16AVX2(const uint16_t* frame, const uint16_t* previous, size_t numPixels, uint16_t delta,
+		bool depth, size_t& changed) {
+	const __m256i vDelta = _mm256_set1_epi16((short) delta), vZero = _mm256_setzero_si256();
+	size_t done = 0, changedBits = 0;
+	for (; done + 16 <= numPixels; done += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i*) (frame + done)), b = _mm256_loadu_si256((const __m256i*) (previous + done));
+		__m256i difference = _mm256_or_si256(_mm256_subs_epu16(a, b), _mm256_subs_epu16(b, a));
+		__m256i skip = _mm256_cmpeq_epi16(_mm256_subs_epu16(difference, vDelta), vZero); // (unchanged)
+		if (depth) skip = _mm256_or_si256(skip, _mm256_or_si256(_mm256_cmpeq_epi16(a, vZero), _mm256_cmpeq_epi16(b, vZero)));
+		changedBits += 32 - countBits((uint32_t) _mm256_movemask_epi8(skip)); // (two bits per pixel)
+	}
+	changed += changedBits / 2;
+	return done;
+}
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+size_t countChangedPixels(const void* frame, const void* previous, size_t numPixels, size_t bytesPerPixel,
+		size_t delta, bool depth, simdLevel level) {
+	size_t changed = 0, done = 0;
+	if (bytesPerPixel == 1) {
+		const uint8_t* a = (const uint8_t*) frame;
+		const uint8_t* b = (const uint8_t*) previous;
+		uint8_t d = (uint8_t) std::min(delta, (size_t) UINT8_MAX);
+		if (level >= SIMD_AVX2) done = countChanged8AVX2(a, b, numPixels, d, changed);
+		if (level >= SIMD_SSE) done += countChanged8SSE(a + done, b + done, numPixels - done, d, changed);
+		countChanged8Scalar(a + done, b + done, numPixels - done, d, changed);
+	}
+	else if (bytesPerPixel == 2) {
+		const uint16_t* a = (const uint16_t*) frame;
+		const uint16_t* b = (const uint16_t*) previous;
+		uint16_t d = (uint16_t) std::min(delta, (size_t) UINT16_MAX);
+		if (level >= SIMD_AVX2) done = countChanged16AVX2(a, b, numPixels, d, depth, changed);
+		if (level >= SIMD_SSE) done += countChanged16SSE(a + done, b + done, numPixels - done, d, depth, changed);
+		countChanged16Scalar(a + done, b + done, numPixels - done, d, depth, changed);
+	}
+	return changed;
+}
+
+MotionGate::MotionGate(size_t _width, size_t _height, size_t _bytesPerPixel, bool _depth, const MotionSettings& _settings,
+		size_t _preFrames, size_t _postFrames) :
+		FrameGate(_preFrames, _postFrames), width(_width), height(_height), bytesPerPixel(_bytesPerPixel), depth(_depth),
+		settings(_settings), havePrevious(false), active(false), lastPermille(0), framesScored(0), scoreNanoseconds(0) {
+	size_t decimation = (settings.decimation > 0) ? settings.decimation : 1;
+	previous.resize(((height + decimation - 1) / decimation) * width * bytesPerPixel);
+}
+
+std::string MotionGate::getDescription() {
+	return "motion (every " + std::to_string(settings.decimation) + " rows, pixel changes over " +
+		std::to_string(settings.pixelDelta) + (depth ? " mm" : "") + ", open from " + std::to_string(settings.onPermille) +
+		" to " + std::to_string(settings.offPermille) + " per mille changed, " + std::to_string(getPreFrames()) +
+		" frames before, " + std::to_string(getPostFrames()) + " after)";
+}
+
+/* * * * * * * * * *
+ * HELPER METHODS  *
+ * * * * * * * * * */
+
+bool MotionGate::isOpen(BaseFrame& frame) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t permille = scoreFrame(frame);
+	// Hysteresis: open at the higher threshold, stay open down to the lower one
+	if (!active && permille >= settings.onPermille && settings.onPermille > 0) active = true;
+	else if (active && permille < settings.offPermille) active = false;
+	lastPermille = permille;
+	framesScored++;
+	scoreNanoseconds += (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	return active;
+}
+
+size_t MotionGate::scoreFrame(const BaseFrame& frame) {
+	if (frame.getWidth() != width || frame.getHeight() != height || frame.getBytesPerPixel() != bytesPerPixel) return 0;
+	size_t decimation = (settings.decimation > 0) ? settings.decimation : 1;
+	size_t rowBytes = width * bytesPerPixel;
+	simdLevel level = getSimdLevel();
+	size_t changed = 0, scored = 0;
+	const char* data = (const char*) frame.getData();
+	char* kept = previous.data();
+	for (size_t y = 0; y < height; y += decimation, kept += rowBytes) {
+		const char* row = data + y * rowBytes;
+		if (havePrevious) changed += countChangedPixels(row, kept, width, bytesPerPixel, settings.pixelDelta, depth, level);
+		std::memcpy(kept, row, rowBytes);
+		scored += width;
+	}
+	bool scoredPrevious = havePrevious;
+	havePrevious = true;
+	if (!scoredPrevious || scored == 0) return 0;
+	return changed * 1000 / scored;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#pragma warning(push, 0)
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#pragma warning(pop)
+#include "framegate.h"
+#include "bitpacking.h" // simdLevel
+
+// How a MotionGate scores frames and when it opens
+struct MotionSettings {
+	size_t decimation; // Score every [decimation]th row (1 = every row)
+	size_t pixelDelta; // A pixel has changed if it differs from the previous frame by more than this (grey levels or mm)
+	size_t onPermille; // Open when at least this many pixels per thousand scored have changed
+	size_t offPermille; // Close when fewer than this many per thousand have changed (no more than [onPermille])
+};
+
+// Returns the number of the [numPixels] pixels of [frame] that differ from [previous] by more than [delta]; with
+// [depth] (16-bit pixels only), pixels that are 0 (no depth) in either frame do not count
+size_t countChangedPixels(const void* frame, const void* previous, size_t numPixels, size_t bytesPerPixel,
+	size_t delta, bool depth, simdLevel level);
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This gate saves the frames of a stream while something moves in it, with
+ * [preFrames] frames of lead-in and [postFrames] of lead-out. Each frame is
+ * scored by the share of pixels that changed since the previous frame, on
+ * every [decimation]th row. For a depth stream, a changed pixel is a depth
+ * change, and pixels with no depth (0) in either frame are ignored, as
+ * they flicker at edges. The score must reach [onPermille] to open the
+ * gate, but only has to stay at [offPermille] to keep it open, so noise
+ * around one threshold does not chop the intervals up.
+ *
+ * The counting kernels use SSE2 or AVX2 where the CPU has them (limited by
+ * setSimdLevel(), as for bit packing). Only the scored rows are kept from
+ * the previous frame, so each frame costs a pass over those rows and a copy
+ * of them; the time is counted (see getSecondsPerFrame()). Frames must be
+ * 8- or 16-bit pixels, unpacked.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class MotionGate : public FrameGate {
+private:
+	const size_t width, height, bytesPerPixel;
+	const bool depth;
+	const MotionSettings settings;
+	std::vector<char> previous; // Scored rows of the previous frame
+	bool havePrevious;
+	bool active; // true while the score says something is moving
+	std::atomic<size_t> lastPermille; // Score of the last frame
+	std::atomic<size_t> framesScored;
+	std::atomic<uint64_t> scoreNanoseconds; // Time spent scoring frames
+
+	// Scores [frame] against the previous frame, in changed pixels per thousand, and keeps its rows for the next
+	size_t scoreFrame(const BaseFrame& frame);
+
+	// Disable assignment operator and copy constructor
+	MotionGate& operator=(const MotionGate& other) = delete;
+	MotionGate(const MotionGate& other) = delete;
+
+protected:
+	virtual bool isOpen(BaseFrame& frame);
+
+public:
+	// Gates frames of [_width] x [_height] pixels of [_bytesPerPixel] bytes (depths, with [_depth])
+	MotionGate(size_t _width, size_t _height, size_t _bytesPerPixel, bool _depth, const MotionSettings& _settings,
+		size_t _preFrames, size_t _postFrames);
+
+	/* Getter methods */
+	size_t getLastPermille() { return lastPermille; }
+	size_t getFramesScored() { return framesScored; }
+	// Average time taken to score a frame (on the acquisition thread)
+	double getSecondsPerFrame() { return (framesScored > 0) ? scoreNanoseconds * 1e-9 / framesScored : 0; }
+	virtual std::string getDescription();
+};
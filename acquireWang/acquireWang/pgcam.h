@@ -1,45 +1,118 @@
 #pragma once
 #pragma warning(push, 0)
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
 #include <thread>
+#include <vector>
 #include "Spinnaker.h"
 #include "SpinGenApi/SpinnakerGenApi.h"
 #pragma warning(pop)
 #include "camera.h"
+#include "bitpacking.h"
 #include "debug.h"
 
 typedef uint8_t pointgrey_t;
 
+// Returns the bytes per pixel of a Spinnaker pixel format that can be stored as-is (one 8- or 16-bit
+// sample per pixel), or 0 if frames in [pixelFormat] have to be converted to Mono8
+inline size_t getRawBytesPerPixel(const std::string& pixelFormat) {
+	if (pixelFormat == "Mono8" || pixelFormat == "BayerRG8" || pixelFormat == "BayerGB8" ||
+			pixelFormat == "BayerGR8" || pixelFormat == "BayerBG8") return 1;
+	if (pixelFormat == "Mono16" || pixelFormat == "BayerRG16" || pixelFormat == "BayerGB16" ||
+			pixelFormat == "BayerGR16" || pixelFormat == "BayerBG16") return 2;
+	return 0;
+}
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * This class implements the Point Grey camera frame class, which derives
- * from the BaseFrame class.
+ * from the BaseFrame class. Frames are Mono8 unless the camera stores the
+ * sensor's pixel format as-is, which may use 2 bytes per pixel, or pack 10-
+ * or 12-bit pixels into bytes (see bitpacking.h). A packed frame is stored
+ * as rows of bytes, so its width is the packed row length in bytes.
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 class PointGreyFrame : public BaseFrame {
 public:
 	// Constructor overloads
-	PointGreyFrame(size_t _width, size_t _height) :
-			BaseFrame(_width, _height, sizeof(pointgrey_t), 1) {}
-	PointGreyFrame(size_t _width, size_t _height, pointgrey_t* _data, double _timestamp) :
-			BaseFrame(_width, _height, sizeof(pointgrey_t), 1, _data, _timestamp) {}
-	// Method overloads
+	PointGreyFrame(size_t _width, size_t _height, std::shared_ptr<FramePool> _pool = nullptr) :
+			BaseFrame(_width, _height, sizeof(pointgrey_t), 1, _pool) {}
+	PointGreyFrame(size_t _width, size_t _height, size_t _bytesPerPixel, std::shared_ptr<FramePool> _pool) :
+			BaseFrame(_width, _height, _bytesPerPixel, 1, _pool) {}
+	PointGreyFrame(size_t _width, size_t _height, pointgrey_t* _data, double _timestamp, std::shared_ptr<FramePool> _pool = nullptr) :
+			BaseFrame(_width, _height, sizeof(pointgrey_t), 1, _data, _timestamp, _pool) {}
+	// Packed frame of [_pixelWidth] x [_height] pixels
+	PointGreyFrame(size_t _pixelWidth, size_t _height, pixelPacking _packing, std::shared_ptr<FramePool> _pool) :
+			BaseFrame(getPackedBytes(_packing, _pixelWidth), _height, 1, 1, _pool) {}
+	// Method overloads (the base class's stay visible, for copying raw pixels of other types)
+	using BaseFrame::copyDataFromBuffer;
 	void copyDataFromBuffer(pointgrey_t* buffer) {
 		BaseFrame::copyDataFromBuffer(buffer);
 	}
 	void copyDataToBuffer(pointgrey_t* buffer) {
 		BaseFrame::copyDataToBuffer(buffer);
 	}
+
+	// Unpacks a packed frame into [buffer] (width * height pixels), shifted left by [shift] bits
+	static void unpack(const BaseFrame& frame, pixelPacking packing, uint16_t* buffer, unsigned int shift = 0) {
+		size_t rowPixels = frame.getWidth() / getPackingGroupBytes(packing) * getPackingGroupPixels(packing);
+		unpackPixels(packing, (const uint8_t*) frame.getData(), buffer, rowPixels * frame.getHeight(), shift);
+	}
 };
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * This class implements the Point Grey camera class, which derives from the
  * BaseCamera class. This requires the Point Grey context to be managed
  * outside the class.
+ * Frames can be polled with getFrame() or pushed from Spinnaker image events
+ * (startFrameCallbacks()); either way, connection and streaming checks are
+ * left to checkHealth() instead of being made for every frame. Derived
+ * stand-ins can supply the images instead of a camera (FakePointGreyCamera),
+ * so that the event path can be exercised without hardware.
+ * Frames are normally converted to Mono8 as they arrive. With a raw pixel
+ * format, the sensor's pixels are copied as-is instead (e.g. a Bayer mosaic
+ * is not demosaiced), and any conversion is left to the preview or to
+ * whoever reads the file, using the pixel format saved as metadata.
+ * Packed frames need rows of whole packing groups; if the frame width is not
+ * one, the camera falls back to unpacked frames when initialized.
+ * Frames can be cropped to a region of interest (setRegionOfInterest()). The
+ * camera's own ROI (Width, Height, OffsetX and OffsetY) is set where it can
+ * be, so cropped pixels never cross the bus; whatever the sensor's
+ * increments leave over (or all of it, if the ROI cannot be set) is cropped
+ * as each image is copied out of Spinnaker's buffer, by reading only the
+ * region's rows and columns. Either way the frame size is that of the region.
+ * Without a region, the camera's ROI is reset to the whole sensor.
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 class PointGreyCamera : public BaseCamera {
 private:
+	// Receives images from Spinnaker image events
+	class ImageEventHandler : public Spinnaker::ImageEvent {
+	private:
+		PointGreyCamera& owner;
+	public:
+		ImageEventHandler(PointGreyCamera& _owner) : owner(_owner) {}
+		void OnImageEvent(Spinnaker::ImagePtr image) { owner.onImage(image); }
+	};
+
 	Spinnaker::System* sys;
 	std::string serial;
 	Spinnaker::Camera* pCam;
 	bool triggeredAcquisition;
+	std::string pixelFormat; // Pixel format of saved frames
+	bool rawPixels; // true to save frames in the sensor's pixel format instead of converting them to Mono8
+	pixelPacking packing; // Packing of saved frames (PACKING_NONE if each pixel is whole bytes)
+	bool packOnAcquire; // true to pack Mono16 images from the sensor as they arrive
+	size_t pixelWidth; // Frame width in pixels ([width] is in bytes for packed frames)
+	bool roiRequested; // true to crop frames to the region below
+	bool roiSoftwareOnly; // true to crop every image instead of setting the camera's ROI
+	size_t roiX, roiY, roiWidth, roiHeight; // Requested region on the sensor (a size of 0 extends to the sensor's edge)
+	size_t imageWidth, imageHeight; // Size of the images the camera sends, in pixels (its ROI)
+	size_t sensorOffsetX, sensorOffsetY; // Offset of the camera's ROI on the sensor
+	size_t cropX, cropY; // Offset of frames within the images the camera sends (cropped in software)
+	bool sensorROI; // true if the camera's ROI was set to (part of) the region
+	std::vector<uint8_t> convertBuffer; // Whole converted image, when frames converted to Mono8 are cropped in software
+	std::unique_ptr<ImageEventHandler> imageEventHandler; // Registered while frames are pushed (nullptr otherwise)
+	frameCallback callback; // Receives pushed frames
 
 	uint64_t init_timestamp_ns;
 	double init_timestamp_win;
@@ -164,15 +237,290 @@ private:
 		}
 		return result;
 	}
+
+protected:
+	// Converts a Spinnaker image into a frame (invalid if the image is incomplete)
+	BaseFrame convertImage(Spinnaker::ImagePtr pNewFrame) {
+		if (pNewFrame == nullptr) {
+			return BaseFrame();
+		}
+		if (pNewFrame->IsIncomplete()) {
+			debugMessage("PG image incomplete with image status " + std::to_string(pNewFrame->GetImageStatus()), DEBUG_ERROR);
+			return BaseFrame();
+		}
+		PointGreyFrame frame(getWidth(), getHeight(), getBytesPerPixel(), framePool);
+		if (rawPixels) {
+			size_t rowBytes = getWidth() * getBytesPerPixel();
+			size_t sensorBits = packOnAcquire ? 16 : ((packing != PACKING_NONE) ? getPackedBits(packing) : 8 * getBytesPerPixel());
+			if (pNewFrame->GetWidth() != imageWidth || pNewFrame->GetHeight() != imageHeight ||
+					pNewFrame->GetBitsPerPixel() != sensorBits) {
+				debugMessage("PG image does not match the " + pixelFormat + " frame format", DEBUG_ERROR);
+				return BaseFrame();
+			}
+			// First pixel of the frame within the image (the region's rows are read with the image's stride)
+			size_t cropBytes = packOnAcquire ? cropX * sizeof(uint16_t) :
+				((packing != PACKING_NONE) ? getPackedBytes(packing, cropX) : cropX * getBytesPerPixel());
+			const uint8_t* src = (const uint8_t*) pNewFrame->GetData() + cropY * pNewFrame->GetStride() + cropBytes;
+			if (packOnAcquire) {
+				// Keep the most significant bits of each 16-bit pixel
+				timers.start(DTIMER_COPY_FROM);
+				uint8_t* dst = (uint8_t*) frame.getMutableData();
+				for (size_t y = 0; y < getHeight(); y++) {
+					packPixels(packing, (const uint16_t*) (src + y * pNewFrame->GetStride()), dst + y * rowBytes,
+						pixelWidth, (unsigned int) (16 - getPackedBits(packing)));
+				}
+				timers.pause(DTIMER_COPY_FROM);
+			}
+			// Copy the sensor's pixels as they are
+			else if (pNewFrame->GetStride() == rowBytes) {
+				frame.copyDataFromBuffer(src);
+			}
+			else { // padded or cropped rows
+				timers.start(DTIMER_COPY_FROM);
+				uint8_t* dst = (uint8_t*) frame.getMutableData();
+				for (size_t y = 0; y < getHeight(); y++) {
+					std::memcpy(dst + y * rowBytes, src + y * pNewFrame->GetStride(), rowBytes);
+				}
+				timers.pause(DTIMER_COPY_FROM);
+			}
+		}
+		else if (imageWidth == getWidth() && imageHeight == getHeight()) {
+			// Convert straight into the frame's buffer and ensure each pixel is 1 byte
+			// (the converted image wraps our buffer, so no further copy is needed)
+			Spinnaker::ImagePtr pgBuffer = Spinnaker::Image::Create(getWidth(), getHeight(), 0, 0,
+				Spinnaker::PixelFormat_Mono8, frame.getMutableData());
+			timers.start(DTIMER_COPY_FROM);
+			pNewFrame->Convert(pgBuffer, Spinnaker::PixelFormat_Mono8, Spinnaker::HQ_LINEAR);
+			timers.pause(DTIMER_COPY_FROM);
+		}
+		else {
+			// Convert the whole image (demosaicing needs the pixels around the region), then copy the region's rows
+			if (pNewFrame->GetWidth() != imageWidth || pNewFrame->GetHeight() != imageHeight) {
+				debugMessage("PG image does not match the camera's region of interest", DEBUG_ERROR);
+				return BaseFrame();
+			}
+			convertBuffer.resize(imageWidth * imageHeight);
+			Spinnaker::ImagePtr pgBuffer = Spinnaker::Image::Create(imageWidth, imageHeight, 0, 0,
+				Spinnaker::PixelFormat_Mono8, convertBuffer.data());
+			timers.start(DTIMER_COPY_FROM);
+			pNewFrame->Convert(pgBuffer, Spinnaker::PixelFormat_Mono8, Spinnaker::HQ_LINEAR);
+			uint8_t* dst = (uint8_t*) frame.getMutableData();
+			for (size_t y = 0; y < getHeight(); y++) {
+				std::memcpy(dst + y * getWidth(), convertBuffer.data() + (cropY + y) * imageWidth + cropX, getWidth());
+			}
+			timers.pause(DTIMER_COPY_FROM);
+		}
+
+		// Set timestamp TODO: more precise? Also kinect
+		//uint64_t nowTime = pNewFrame->GetTimeStamp();
+		//debugMessage(std::to_string(nowTime) + " - " + std::to_string(init_timestamp_ns) + " = " +
+		//	std::to_string((double)(nowTime - init_timestamp_ns)), DEBUG_INFO);
+		//double newTimestamp = (double)(nowTime - init_timestamp_ns) / 1000000000.0 + init_timestamp_win;
+		double newTimestamp = getClockStamp();
+		frame.setTimestamp(newTimestamp);
+
+		totalFrames++;
+		return frame;
+	}
+
+	// Registers [handler] for the camera's image events (stand-ins without a camera raise the events themselves)
+	virtual void registerImageEvents(Spinnaker::ImageEvent& handler) {
+		pCam->RegisterEvent(handler);
+	}
+
+	virtual void unregisterImageEvents(Spinnaker::ImageEvent& handler) {
+		pCam->UnregisterEvent(handler);
+	}
+
+	// Stand-in for a camera of [_width] x [_height] Mono8 pixels at [_fps] fps, with no Spinnaker camera behind it:
+	// derived classes supply the images (see FakePointGreyCamera), which are converted as a camera's would be
+	PointGreyCamera(size_t _width, size_t _height, double _fps) :
+			sys(nullptr), pCam(nullptr), triggeredAcquisition(false), pixelFormat("Mono8"), rawPixels(false),
+			packing(PACKING_NONE), packOnAcquire(false), pixelWidth(_width), roiRequested(false), roiSoftwareOnly(false),
+			roiX(0), roiY(0), roiWidth(0), roiHeight(0), imageWidth(_width), imageHeight(_height), sensorOffsetX(0),
+			sensorOffsetY(0), cropX(0), cropY(0), sensorROI(false) {
+		channels = 1;
+		camType = CAMERA_PG;
+		bytesPerPixel = sizeof(pointgrey_t);
+		width = _width;
+		height = _height;
+		fps = _fps;
+	}
+
+private:
+	// Handles an image event (on Spinnaker's thread; Spinnaker releases the image afterwards)
+	void onImage(Spinnaker::ImagePtr image) {
+		try {
+			BaseFrame frame = convertImage(image);
+			if (callback) callback(frame);
+		}
+		catch (...) {
+			debugMessage("Error while handling PG image event", DEBUG_ERROR);
+		}
+	}
+
+	// Fits the span [start, start + length) to [align] pixels and to a sensor [size] pixels across
+	// (a [length] of 0 extends to the edge); returns false if the span starts outside the sensor
+	static bool fitSpan(size_t& start, size_t& length, size_t size, size_t align) {
+		if (start >= size) return false;
+		size_t end = (length == 0) ? size : std::min(start + length, size);
+		start -= start % align;
+		end = std::min(end + (align - end % align) % align, size);
+		length = end - start;
+		return length > 0;
+	}
+
+	// Least common multiple of [a] and [b] (both > 0)
+	static size_t leastCommonMultiple(size_t a, size_t b) {
+		size_t x = a, y = b;
+		while (y != 0) {
+			size_t r = x % y;
+			x = y;
+			y = r;
+		}
+		return a / x * b;
+	}
+
+	// Shrinks the camera's ROI (given by the [sizeNode] and [offsetNode] of one axis) to the smallest span the
+	// sensor's increments allow that holds [start, start + length), and returns its offset; returns false
+	// (leaving the whole axis) if no span short of the whole sensor ([size] pixels across) holds it. The offset
+	// is also a multiple of [align], so that what is left to crop in software stays aligned like [start].
+	static bool setSensorSpan(Spinnaker::GenApi::CIntegerPtr sizeNode, Spinnaker::GenApi::CIntegerPtr offsetNode,
+			size_t start, size_t length, size_t size, size_t align, size_t& offset) {
+		size_t offsetInc = leastCommonMultiple((size_t) std::max((int64_t) 1, offsetNode->GetInc()), align);
+		size_t sizeInc = (size_t) std::max((int64_t) 1, sizeNode->GetInc());
+		offset = start - start % offsetInc;
+		size_t span = start + length - offset;
+		span = std::max(span + (sizeInc - span % sizeInc) % sizeInc, (size_t) sizeNode->GetMin());
+		if (span >= size || offset + span > size) return false;
+		sizeNode->SetValue((int64_t) span); // (the size first, which leaves room for the offset)
+		offsetNode->SetValue((int64_t) offset);
+		return true;
+	}
+
+	// Sets the camera's ROI to hold the requested region, and the software crop to the rest; sets the frame size
+	void applyRegionOfInterest() {
+		Spinnaker::GenApi::INodeMap& nmap = pCam->GetNodeMap();
+		Spinnaker::GenApi::CIntegerPtr widthNode = nmap.GetNode("Width");
+		Spinnaker::GenApi::CIntegerPtr heightNode = nmap.GetNode("Height");
+		Spinnaker::GenApi::CIntegerPtr offsetXNode = nmap.GetNode("OffsetX");
+		Spinnaker::GenApi::CIntegerPtr offsetYNode = nmap.GetNode("OffsetY");
+		bool cropped = false;
+		sensorROI = false;
+		size_t x = roiX, y = roiY, w = roiWidth, h = roiHeight;
+		bool settable = Spinnaker::GenApi::IsWritable(widthNode) && Spinnaker::GenApi::IsWritable(heightNode) &&
+			Spinnaker::GenApi::IsWritable(offsetXNode) && Spinnaker::GenApi::IsWritable(offsetYNode);
+		// Start from the whole sensor, so no ROI is left over from an earlier recording (or, if the ROI
+		// cannot be set, from whatever the camera sends)
+		if (settable) {
+			try {
+				offsetXNode->SetValue(0);
+				offsetYNode->SetValue(0);
+				widthNode->SetValue(widthNode->GetMax());
+				heightNode->SetValue(heightNode->GetMax());
+			}
+			catch (...) {
+				debugMessage("Error while resetting PG region of interest", DEBUG_ERROR);
+				settable = false;
+			}
+		}
+		if (roiRequested) {
+			try {
+				size_t sensorWidth = (size_t) widthNode->GetValue();
+				size_t sensorHeight = (size_t) heightNode->GetValue();
+				// Keep Bayer tiles and packing groups whole
+				bool bayer = rawPixels && pixelFormat.compare(0, 5, "Bayer") == 0;
+				size_t alignX = (packing != PACKING_NONE) ? getPackingGroupPixels(packing) : (bayer ? 2 : 1);
+				size_t alignY = bayer ? 2 : 1;
+				if (!fitSpan(x, w, sensorWidth, alignX) || !fitSpan(y, h, sensorHeight, alignY)) {
+					debugMessage("PG region of interest starts outside the " + std::to_string(sensorWidth) + "x" +
+						std::to_string(sensorHeight) + " image; not cropping", DEBUG_WARNING);
+				}
+				else {
+					if (settable && !roiSoftwareOnly) {
+						size_t offset;
+						if (setSensorSpan(widthNode, offsetXNode, x, w, sensorWidth, alignX, offset)) {
+							x -= offset;
+							sensorROI = true;
+						}
+						if (setSensorSpan(heightNode, offsetYNode, y, h, sensorHeight, alignY, offset)) {
+							y -= offset;
+							sensorROI = true;
+						}
+					}
+					cropped = true;
+				}
+			}
+			catch (...) {
+				debugMessage("Error while setting PG region of interest; not cropping", DEBUG_ERROR);
+			}
+		}
+		imageWidth = (size_t) widthNode->GetValue();
+		imageHeight = (size_t) heightNode->GetValue();
+		sensorOffsetX = Spinnaker::GenApi::IsReadable(offsetXNode) ? (size_t) offsetXNode->GetValue() : 0;
+		sensorOffsetY = Spinnaker::GenApi::IsReadable(offsetYNode) ? (size_t) offsetYNode->GetValue() : 0;
+		cropX = cropped ? x : 0;
+		cropY = cropped ? y : 0;
+		pixelWidth = cropped ? w : imageWidth;
+		height = cropped ? h : imageHeight;
+	}
+
+	// Saves frames without packing them: Mono16 sensor pixels as they are, or camera-packed pixels converted to Mono8
+	void unpackFrames() {
+		if (packOnAcquire) {
+			pixelFormat = "Mono16";
+			bytesPerPixel = getRawBytesPerPixel(pixelFormat);
+			packOnAcquire = false;
+		}
+		else {
+			pixelFormat = "Mono8";
+			bytesPerPixel = sizeof(pointgrey_t);
+			rawPixels = false;
+		}
+		packing = PACKING_NONE;
+	}
 public:
 	//PointGreyCamera(Spinnaker::CameraList* _camlist, std::string _serial) :
 			//camlist(_camlist), serial(_serial) {
-	PointGreyCamera(Spinnaker::System* _sys, Spinnaker::Camera* _pCam, bool _triggeredAcquisition) :
-			sys(_sys), pCam(_pCam), triggeredAcquisition(_triggeredAcquisition) {
+	// [rawPixelFormat] is the camera's pixel format if frames should be saved in it as-is, or empty to
+	// convert them to Mono8 (as for formats neither getRawBytesPerPixel() nor getPixelPacking() supports).
+	// With a Mono16 sensor format, [packBits] = 10 or 12 packs frames to that many bits (Mono10p or Mono12p).
+	PointGreyCamera(Spinnaker::System* _sys, Spinnaker::Camera* _pCam, bool _triggeredAcquisition,
+			const std::string& rawPixelFormat = "", size_t packBits = 0) :
+			sys(_sys), pCam(_pCam), triggeredAcquisition(_triggeredAcquisition), pixelFormat("Mono8"), rawPixels(false),
+			packing(PACKING_NONE), packOnAcquire(false), pixelWidth(0), roiRequested(false), roiSoftwareOnly(false),
+			roiX(0), roiY(0), roiWidth(0), roiHeight(0), imageWidth(0), imageHeight(0), sensorOffsetX(0), sensorOffsetY(0),
+			cropX(0), cropY(0), sensorROI(false) {
 		debugMessage("PG Camera constructor", DEBUG_HIDDEN_INFO);
 		channels = 1;
 		camType = CAMERA_PG;
 		bytesPerPixel = sizeof(pointgrey_t);
+		if (!rawPixelFormat.empty()) {
+			if (getPixelPacking(rawPixelFormat) != PACKING_NONE) { // already packed by the camera
+				pixelFormat = rawPixelFormat;
+				rawPixels = true;
+				packing = getPixelPacking(rawPixelFormat);
+			}
+			else if (getRawBytesPerPixel(rawPixelFormat) > 0) {
+				pixelFormat = rawPixelFormat;
+				rawPixels = true;
+				bytesPerPixel = getRawBytesPerPixel(rawPixelFormat);
+				if (packBits > 0) {
+					if (rawPixelFormat == "Mono16" && (packBits == 10 || packBits == 12)) {
+						packing = (packBits == 10) ? PACKING_MONO10P : PACKING_MONO12P;
+						packOnAcquire = true;
+						pixelFormat = getPackingName(packing);
+						bytesPerPixel = 1;
+					}
+					else {
+						debugMessage("PG frames can only be packed to 10 or 12 bits from Mono16; saving " + rawPixelFormat, DEBUG_WARNING);
+					}
+				}
+			}
+			else {
+				debugMessage("PG pixel format " + rawPixelFormat + " cannot be saved as-is; converting to Mono8", DEBUG_WARNING);
+			}
+		}
 		// Get serial number
 		Spinnaker::GenApi::INodeMap& tldnmap = pCam->GetTLDeviceNodeMap();
 		Spinnaker::GenApi::CStringPtr node = tldnmap.GetNode("DeviceSerialNumber");
@@ -187,9 +535,20 @@ public:
 		try {
 			pCam->Init();
 			std::this_thread::sleep_for(std::chrono::milliseconds(200));
-			width = pCam->Width.GetValue();
-			height = pCam->Height.GetValue();
-			fps = pCam->AcquisitionFrameRate.GetValue();
+			applyRegionOfInterest();
+			width = pixelWidth;
+			if (packing != PACKING_NONE) {
+				width = getPackedBytes(packing, pixelWidth);
+				if (pixelWidth % getPackingGroupPixels(packing) != 0) {
+					// Packed rows would drop the trailing pixels, so save the frames unpacked instead
+					debugMessage("PG width " + std::to_string(pixelWidth) + " is not a multiple of " +
+						std::to_string(getPackingGroupPixels(packing)) + " pixels, as " + pixelFormat + " needs; saving " +
+						(packOnAcquire ? "Mono16" : "Mono8") + " frames instead", DEBUG_WARNING);
+					unpackFrames();
+					width = pixelWidth;
+				}
+			}
+			fps = pCam->AcquisitionFrameRate.GetValue(); // (after the ROI, which may change the maximum)
 
 			// For aligning Point Grey timestamps with Windows timestamps
 			//pCam->TimestampReset.Execute();
@@ -253,41 +612,18 @@ public:
 	BaseFrame getFrame() override {
 		debugMessage("pg getFrame", DEBUG_HIDDEN_INFO);
 		try {
-			int res = ensureReady(true);
-			//int res = isReady(true);
-			if (res < 0) {
-				debugMessage("PG camera is not ready. Error message " + std::to_string(res), DEBUG_ERROR);
+			// (Readiness is checked by checkHealth(), not on every frame)
+			if (pCam == nullptr) {
 				return BaseFrame();
 			}
 
 			// Pull frame
 			Spinnaker::ImagePtr pNewFrame = pCam->GetNextImage();
-			if (pNewFrame == nullptr) {
-				return BaseFrame();
-			}
-			if (pNewFrame->IsIncomplete()) {
-				debugMessage("PG image incomplete with image status " + std::to_string(pNewFrame->GetImageStatus()), DEBUG_ERROR);
-				return BaseFrame();
-			}
-			// Perform a deep copy and ensure each pixel is 1 byte
-			Spinnaker::ImagePtr pgBuffer = pNewFrame->Convert(Spinnaker::PixelFormat_Mono8, Spinnaker::HQ_LINEAR);
-
-			// Copy again in case pgBuffer deletes data when it goes out of scope
-			PointGreyFrame frame(getWidth(), getHeight());
-			frame.copyDataFromBuffer((pointgrey_t*) pgBuffer->GetData());
-
-			// Set timestamp TODO: more precise? Also kinect
-			//uint64_t nowTime = pNewFrame->GetTimeStamp();
-			//debugMessage(std::to_string(nowTime) + " - " + std::to_string(init_timestamp_ns) + " = " +
-			//	std::to_string((double)(nowTime - init_timestamp_ns)), DEBUG_INFO);
-			//double newTimestamp = (double)(nowTime - init_timestamp_ns) / 1000000000.0 + init_timestamp_win;
-			double newTimestamp = getClockStamp();
-			frame.setTimestamp(newTimestamp);
+			BaseFrame frame = convertImage(pNewFrame);
 
 			// Release image
-			pNewFrame->Release();
+			if (pNewFrame != nullptr) pNewFrame->Release();
 
-			totalFrames++;
 			return frame;
 		}
 		catch (...) {
@@ -295,6 +631,38 @@ public:
 		}
 	}
 
+	bool startFrameCallbacks(frameCallback _callback) override {
+		try {
+			callback = _callback;
+			imageEventHandler.reset(new ImageEventHandler(*this));
+			registerImageEvents(*imageEventHandler);
+			return true;
+		}
+		catch (...) {
+			debugMessage("Could not register PG image events; polling instead", DEBUG_WARNING);
+			imageEventHandler.reset();
+			callback = nullptr;
+			return false;
+		}
+	}
+
+	void stopFrameCallbacks() override {
+		if (imageEventHandler == nullptr) return;
+		try {
+			unregisterImageEvents(*imageEventHandler);
+		}
+		catch (...) {
+			debugMessage("Error while unregistering PG image events", DEBUG_ERROR);
+		}
+		imageEventHandler.reset();
+		callback = nullptr;
+	}
+
+	bool checkHealth() override {
+		// (This also starts streaming for triggered acquisition, whose beginAcquisition() does nothing)
+		return ensureReady(true) == 0;
+	}
+
 	// TODO: don't let acquisition start until all cameras ready
 	bool isReady() override {
 		if (pCam == nullptr) return false;
@@ -308,6 +676,47 @@ public:
 		return serial;
 	}
 
+	// Name of the Spinnaker pixel format of saved frames (e.g. "Mono8", "BayerRG8", "Mono12p")
+	std::string getPixelFormat() {
+		return pixelFormat;
+	}
+
+	pixelPacking getPacking() {
+		return packing;
+	}
+
+	size_t getPixelWidth() {
+		return pixelWidth;
+	}
+
+	// Crops frames to [_width] x [_height] pixels from ([x], [y]) on the sensor (a size of 0 extends to the
+	// sensor's edge), setting the camera's ROI unless [softwareOnly]. The region may grow a little to keep
+	// Bayer tiles and packing groups whole. Takes effect when the camera is (re)initialized.
+	void setRegionOfInterest(size_t x, size_t y, size_t _width, size_t _height, bool softwareOnly = false) {
+		roiRequested = true;
+		roiSoftwareOnly = softwareOnly;
+		roiX = x;
+		roiY = y;
+		roiWidth = _width;
+		roiHeight = _height;
+	}
+
+	// Offset of frames on the sensor, in pixels
+	size_t getOffsetX() {
+		return sensorOffsetX + cropX;
+	}
+
+	size_t getOffsetY() {
+		return sensorOffsetY + cropY;
+	}
+
+	// How frames are cropped: "none", "sensor" (the camera's ROI), "software" or "sensor+software"
+	std::string getCropping() {
+		bool software = (pixelWidth < imageWidth || height < imageHeight);
+		if (sensorROI) return software ? "sensor+software" : "sensor";
+		return software ? "software" : "none";
+	}
+
 	double getExposure() {
 		ensureReady(false);
 		return pCam->ExposureTime.GetValue();
@@ -9,8 +9,12 @@
 #include "acquirer.h"
 #include "saver.h"
 #include "pgcam.h"
+#include "kincam.h"
+#include "memorygovernor.h"
+#include "triggergate.h"
+#include "motiongate.h"
 
-enum format { DEPTH_16BIT, GRAY_8BIT, GRAY_16BIT };
+enum format { DEPTH_16BIT, GRAY_8BIT, GRAY_16BIT, GRAY_PACKED, DEPTH_PACKED }; // (packed Point Grey frames and Kinect depths)
 const int PROGRESSBAR_HEIGHT = 20;
 const int PROGRESSBAR_GAP = 5;
 
@@ -27,29 +31,48 @@ private:
 	GLFWwindow* win; // window handle
 	std::vector<stream_format> formats; // array of stream formats for displaying frames
 	std::vector<texture_buffer> buffers; // array of buffers to draw items
-	std::vector<BaseAcquirer*>& acquirers; // array of acquirers so that frames can be pulled from the GUI queue
+	std::vector<pixelPacking> packings; // array of packings of streams with packed frames (PACKING_NONE otherwise)
+	std::vector<size_t> depthBits; // array of bits depths are packed to (0 for streams without packed depths)
+	std::vector< std::vector<uint16_t> > unpacked; // array of buffers that packed frames are unpacked into for display
+	std::vector<BaseAcquirer*>& acquirers; // array of acquirers so that frames can be pulled from their GUI mailboxes
 	std::vector<BaseCamera*>& cameras; // array of cameras for diagnostic information
 	BaseSaver& saver; // saver
+	MemoryGovernor* governor; // memory governor whose counters are shown in the window title (nullptr if none)
+	std::string title; // window title (without the memory counters)
+	RecordingTrigger* trigger; // trigger fired by the T key (nullptr if none)
+	bool triggerKeyDown; // true while the T key is held (so that holding it fires once)
 
 	bool shouldClose; // flag to indicate if the window should close
 
 public:
-	PreviewWindow(int width, int height, const char* title,
+	PreviewWindow(int width, int height, const char* _title,
 				std::vector<BaseAcquirer*>& _acquirers, BaseSaver& _saver, std::vector<BaseCamera*>& _cameras,
 				std::vector<format>& _formats) :
 			numBuffers(_acquirers.size()), acquirers(_acquirers), saver(_saver), cameras(_cameras),
-			shouldClose(false), buffers(numBuffers) {
+			governor(nullptr), title(_title), trigger(nullptr), triggerKeyDown(false), shouldClose(false), buffers(numBuffers), packings(numBuffers, PACKING_NONE), depthBits(numBuffers, 0), unpacked(numBuffers) {
 		// Populate formats[] using enum values provided
 		for (size_t i = 0; i < _formats.size(); i++) {
 			switch (_formats[i]) {
 				case DEPTH_16BIT: formats.push_back(stream_format::z16); break;
 				case GRAY_8BIT: formats.push_back(stream_format::y8); break;
 				case GRAY_16BIT: formats.push_back(stream_format::y16); break;
+				case GRAY_PACKED: { // shown as 16-bit after unpacking
+					PointGreyCamera* pCam = dynamic_cast<PointGreyCamera*>(cameras[i]);
+					if (pCam != nullptr) packings[i] = pCam->getPacking();
+					formats.push_back(stream_format::y16);
+					break;
+				}
+				case DEPTH_PACKED: { // shown as depth after unpacking
+					KinectCamera* kCam = dynamic_cast<KinectCamera*>(cameras[i]);
+					if (kCam != nullptr) depthBits[i] = kCam->getDepthBits();
+					formats.push_back(stream_format::z16);
+					break;
+				}
 			}
 		}
 		// Initialize window
 		glfwInit();
-		win = glfwCreateWindow(width, height, title, 0, 0);
+		win = glfwCreateWindow(width, height, _title, 0, 0);
 		glfwMakeContextCurrent(win);
 		// Buffer array sizes
 		nRows = (int) std::ceil(std::sqrt((double) numBuffers));
@@ -62,6 +85,15 @@ public:
 		glfwTerminate();
 	}
 
+	// Show [_governor]'s memory use in the window title (nullptr to stop)
+	void setMemoryGovernor(MemoryGovernor* _governor) {
+		governor = _governor;
+		if (governor == nullptr) glfwSetWindowTitle(win, title.c_str());
+	}
+
+	// Fire [_trigger] when the T key is pressed (nullptr to stop)
+	void setTrigger(RecordingTrigger* _trigger) { trigger = _trigger; }
+
 	void run() {
 		while (true) {
 			try {
@@ -71,8 +103,11 @@ public:
 				if (shouldClose || state == GLFW_PRESS || glfwWindowShouldClose(win)) {
 					break;
 				}
+				bool triggerKey = (glfwGetKey(win, GLFW_KEY_T) == GLFW_PRESS); // T triggers a triggered recording
+				if (trigger != nullptr && triggerKey && !triggerKeyDown) trigger->fire("T key");
+				triggerKeyDown = triggerKey;
 
-				// Draw frames if all GUI queues have something to show
+				// Draw frames if all GUI mailboxes have something to show
 				if (std::all_of(acquirers.begin(), acquirers.end(), [](BaseAcquirer* acq) { return acq->shouldDraw(); })) {
 					// Get frame buffer dimensions and clear frame buffer
 					int w, h;
@@ -135,6 +170,19 @@ public:
 								label_sav += " (" + std::to_string(saver.getFramesSaved(i)) + " / "
 									+ std::to_string(acquirers[i]->getFramesToAcquire()) + " frames)";
 							}
+							if (acquirers[i]->getFramesDropped() > 0) {
+								label_sav += " [" + std::to_string(acquirers[i]->getFramesDropped()) + " dropped]";
+							}
+							FrameGate* gate = acquirers[i]->getFrameGate();
+							if (gate != nullptr) {
+								label_sav += gate->isPassing() ? " [saving" : " [waiting";
+								MotionGate* motionGate = dynamic_cast<MotionGate*>(gate);
+								if (motionGate != nullptr) label_sav += ": motion " + std::to_string(motionGate->getLastPermille()) + " per mille";
+								label_sav += "]";
+							}
+							if (acquirers[i]->getFramesSpilled() > 0) {
+								label_sav += " [" + std::to_string(acquirers[i]->getFramesSpilled()) + " spilled]";
+							}
 							GUI::progress_bar({ x1, y3, x2, y4 }, savingProgress, label_sav);
 						}
 					}
@@ -142,6 +190,12 @@ public:
 					// Show on screen
 					glPopMatrix();
 					glfwSwapBuffers(win);
+					if (governor != nullptr) {
+						std::string memoryTitle = title + " - memory " + std::to_string(governor->getMemoryBytes() >> 20) + " / " +
+							std::to_string(governor->getBudgetBytes() >> 20) + " MB, " + std::to_string(governor->getBytesSpilled() >> 20) +
+							" MB spilled (" + std::to_string(governor->getDiskBytes() >> 20) + " MB on disk)";
+						glfwSetWindowTitle(win, memoryTitle.c_str());
+					}
 					
 					// Break condition
 					if (!saver.isSaving()) break;
@@ -155,10 +209,24 @@ public:
 
 	void showFrame(size_t bufInd, BaseFrame& frame, int rx, int ry, int rw, int rh, const std::string caption = "") {
 		if (!frame.isValid()) return;
-		char* frameData = new char[frame.getBytes()];
-		frame.copyDataToBuffer(frameData);
-		buffers[bufInd].show(frameData, (int) frame.getWidth(), (int) frame.getHeight(), formats[bufInd], caption, rx, ry, rw, rh);
-		delete[] frameData;
+		if (packings[bufInd] != PACKING_NONE) {
+			// Unpack to the full 16-bit range
+			pixelPacking packing = packings[bufInd];
+			size_t pixelWidth = frame.getWidth() / getPackingGroupBytes(packing) * getPackingGroupPixels(packing);
+			unpacked[bufInd].resize(pixelWidth * frame.getHeight());
+			PointGreyFrame::unpack(frame, packing, unpacked[bufInd].data(), (unsigned int) (16 - getPackedBits(packing)));
+			buffers[bufInd].show(unpacked[bufInd].data(), (int) pixelWidth, (int) frame.getHeight(), formats[bufInd], caption, rx, ry, rw, rh);
+			return;
+		}
+		if (depthBits[bufInd] > 0) {
+			size_t pixelWidth = frame.getWidth() / depthBits[bufInd] * 8;
+			unpacked[bufInd].resize(pixelWidth * frame.getHeight());
+			KinectFrame::unpack(frame, depthBits[bufInd], unpacked[bufInd].data());
+			buffers[bufInd].show(unpacked[bufInd].data(), (int) pixelWidth, (int) frame.getHeight(), formats[bufInd], caption, rx, ry, rw, rh);
+			return;
+		}
+		// Upload straight from the shared frame buffer (no copy needed)
+		buffers[bufInd].show(frame.getData(), (int) frame.getWidth(), (int) frame.getHeight(), formats[bufInd], caption, rx, ry, rw, rh);
 	}
 
 	void close() {
@@ -0,0 +1,265 @@
+#include "rawconvert.h"
+#pragma warning(push, 0)
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <vector>
+#include "json.hpp" // session manifest
+#pragma warning(pop)
+#include "rawout.h"
+#include "segmentout.h"
+#include "h5out.h"
+#include "debug.h"
+
+/* * * * * * * * * *
+ * HELPER METHODS  *
+ * * * * * * * * * */
+
+// Reads a stream's index file. The entries of a recording that was not finished (e.g. after a crash) are
+// counted from the file size (frames are only indexed once their records are written), and limited to the
+// records within the data file.
+static bool readRawIndex(const std::string& indexname, uint64_t dataBytes, RawIndexHeader& header,
+		std::vector<RawIndexEntry>& entries, std::vector<unsigned long long>& dropped) {
+	std::ifstream f(indexname, std::ios::binary | std::ios::ate);
+	if (!f.good()) return false;
+	uint64_t indexBytes = (uint64_t) f.tellg();
+	f.seekg(0);
+	if (!f.read((char*) &header, sizeof(RawIndexHeader)) || std::string(header.magic, sizeof(header.magic)) != RAW_INDEX_MAGIC ||
+			header.version != RAW_INDEX_VERSION || header.recordBytes == 0) {
+		debugMessage(indexname + " is not a raw index", DEBUG_ERROR);
+		return false;
+	}
+	uint64_t numFrames = header.numFrames;
+	bool finished = (numFrames > 0 || header.numDropped > 0);
+	if (!finished) {
+		numFrames = (indexBytes - header.headerBytes) / sizeof(RawIndexEntry);
+		debugMessage(indexname + " was not finished; recovering " + std::to_string(numFrames) + " frames", DEBUG_WARNING);
+	}
+	entries.resize((size_t) numFrames);
+	dropped.resize(finished ? (size_t) header.numDropped : 0);
+	f.seekg(header.headerBytes);
+	if (!entries.empty() && !f.read((char*) entries.data(), entries.size() * sizeof(RawIndexEntry))) return false;
+	if (!dropped.empty() && !f.read((char*) dropped.data(), dropped.size() * sizeof(unsigned long long))) return false;
+	// Drop any frames whose records are not in the data file
+	while (!entries.empty() && entries.back().offset + header.frameBytes > dataBytes) entries.pop_back();
+	return true;
+}
+
+// Writes a scalar attribute to the root group, with the type H5Out would have given it
+static void writeRootAttribute(H5File& file, const std::string& name, const nlohmann::json& value) {
+	H5::Group root = file.openGroup("/");
+	H5::DataSpace attr_dataspace(H5S_SCALAR);
+	if (value.is_string()) {
+		H5::StrType datatype(0, H5T_VARIABLE); // variable length string
+		root.createAttribute(name, datatype, attr_dataspace).write(datatype, value.get<std::string>());
+	}
+	else if (value.is_number_unsigned()) {
+		unsigned long long data = value.get<unsigned long long>();
+		root.createAttribute(name, PredType::STD_U64LE, attr_dataspace).write(PredType::NATIVE_ULLONG, &data);
+	}
+	else if (value.is_number_integer()) {
+		int data = value.get<int>();
+		root.createAttribute(name, PredType::STD_I32LE, attr_dataspace).write(PredType::NATIVE_INT, &data);
+	}
+	else if (value.is_number()) {
+		double data = value.get<double>();
+		root.createAttribute(name, PredType::NATIVE_DOUBLE, attr_dataspace).write(PredType::NATIVE_DOUBLE, &data);
+	}
+}
+
+// Reads frame [k] of a stream into [dst], and its timestamp
+typedef std::function<bool(size_t k, char* dst, double& timestamp)> frameReader;
+
+// Writes a stream's frame, timestamp and dropped frame datasets, named and laid out as H5Out would have
+static bool writeStreamDatasets(H5File& file, const std::string& dsname, size_t channels, size_t height, size_t width,
+		size_t bytesPerPixel, size_t numFrames, frameReader readFrame, const std::vector<unsigned long long>& dropped,
+		std::map<std::string, size_t>& params) {
+	size_t frameBytes = channels * height * width * bytesPerPixel;
+
+	// Frame dataset, chunked and compressed as when recording (chunks no larger than the frames)
+	size_t chunkFrames = std::max(params["_frameChunkSize"], (size_t) 1);
+	bool kinect = (dsname == "kinect");
+	size_t yChunk = std::min(std::max(params[kinect ? "_kinectYchunk" : "_pgYchunk"], (size_t) 1), height);
+	size_t xChunk = std::min(std::max(params[kinect ? "_kinectXchunk" : "_pgXchunk"], (size_t) 1), width);
+	DSetCreatPropList dcpl = createStreamDcpl(params, dsname, chunkFrames, yChunk, xChunk);
+	const PredType& datatype = (bytesPerPixel == 2) ? PredType::STD_U16LE : PredType::STD_U8LE;
+	hsize_t dims[4] = { numFrames, channels, height, width };
+	hsize_t maxdims[4] = { H5S_UNLIMITED, channels, height, width };
+	DataSet dataset = file.createDataSet(dsname.c_str(), datatype, DataSpace(4, dims, maxdims), dcpl);
+	unsigned long long frames = numFrames;
+	dataset.createAttribute("framesSaved", PredType::STD_U64LE, DataSpace(H5S_SCALAR)).write(PredType::NATIVE_ULLONG, &frames);
+	auto delta = params.find("_temporalDelta_" + dsname);
+	bool temporalDelta = ((delta != params.end()) ? delta->second : params["_temporalDelta"]) != 0 && bytesPerPixel == 2;
+	if (temporalDelta) {
+		unsigned long long keyInterval = chunkFrames;
+		dataset.createAttribute(TEMPORAL_DELTA_ATTRIBUTE, PredType::STD_U64LE, DataSpace(H5S_SCALAR)).write(PredType::NATIVE_ULLONG, &keyInterval);
+	}
+
+	// Timestamp dataset
+	DSetCreatPropList time_dcpl;
+	hsize_t time_chunk_dims[2] = { chunkFrames, 1 };
+	time_dcpl.setChunk(2, time_chunk_dims);
+	hsize_t tsdims[2] = { numFrames, 1 };
+	hsize_t tsmaxdims[2] = { H5S_UNLIMITED, 1 };
+	DataSet tsdataset = file.createDataSet((dsname + "_time").c_str(), TIMESTAMP_H5T, DataSpace(2, tsdims, tsmaxdims), time_dcpl);
+
+	// Copy the frames one chunk at a time
+	std::vector<char> slab(chunkFrames * frameBytes);
+	std::vector<double> timestamps(chunkFrames);
+	DataSpace fileSpace = dataset.getSpace();
+	DataSpace tsFileSpace = tsdataset.getSpace();
+	for (size_t start = 0; start < numFrames; start += chunkFrames) {
+		size_t count = std::min(chunkFrames, numFrames - start);
+		for (size_t k = 0; k < count; k++) {
+			if (!readFrame(start + k, slab.data() + k * frameBytes, timestamps[k])) {
+				debugMessage("Failed to read frame " + std::to_string(start + k) + " of " + dsname, DEBUG_ERROR);
+				return false;
+			}
+		}
+		if (temporalDelta) encodeTemporalDelta((uint16_t*) slab.data(), count, channels * height * width);
+		hsize_t offset[4] = { start, 0, 0, 0 };
+		hsize_t slabdims[4] = { count, channels, height, width };
+		fileSpace.selectHyperslab(H5S_SELECT_SET, slabdims, offset);
+		dataset.write(slab.data(), datatype, DataSpace(4, slabdims), fileSpace);
+		hsize_t tsoffset[2] = { start, 0 };
+		hsize_t tscount[2] = { count, 1 };
+		tsFileSpace.selectHyperslab(H5S_SELECT_SET, tscount, tsoffset);
+		tsdataset.write(timestamps.data(), TIMESTAMP_H5T, DataSpace(2, tscount), tsFileSpace);
+	}
+
+	// Dropped frames
+	hsize_t droppeddims[1] = { dropped.size() };
+	DataSet droppedset = file.createDataSet((dsname + "_dropped").c_str(), PredType::STD_U64LE, DataSpace(1, droppeddims));
+	if (!dropped.empty()) droppedset.write(dropped.data(), PredType::NATIVE_ULLONG);
+
+	debugMessage("Converted " + std::to_string(numFrames) + " frames of " + dsname, DEBUG_INFO);
+	return true;
+}
+
+// Converts one stream written by RawOut
+static bool convertRawStream(H5File& file, const std::string& dsname, const std::string& dataname,
+		const std::string& indexname, std::map<std::string, size_t>& params) {
+	std::ifstream data(dataname, std::ios::binary | std::ios::ate);
+	if (!data.good()) {
+		debugMessage("Failed to open " + dataname, DEBUG_ERROR);
+		return false;
+	}
+	RawIndexHeader header;
+	std::vector<RawIndexEntry> entries;
+	std::vector<unsigned long long> dropped;
+	if (!readRawIndex(indexname, (uint64_t) data.tellg(), header, entries, dropped)) {
+		debugMessage("Failed to read " + indexname, DEBUG_ERROR);
+		return false;
+	}
+	return writeStreamDatasets(file, dsname, header.channels, header.height, header.width, header.bytesPerPixel, entries.size(),
+		[&](size_t k, char* dst, double& timestamp) {
+			data.seekg(entries[k].offset);
+			timestamp = entries[k].timestamp;
+			return (bool) data.read(dst, header.frameBytes);
+		}, dropped, params);
+}
+
+// Converts one stream written by SegmentOut. Segments are read until one is missing, rather than only those in
+// the index, so that the frames of a recording that was not finished (e.g. after a crash) are recovered.
+static bool convertSegmentStream(H5File& file, const std::string& dsname, const std::string& indexname,
+		const std::string& pattern, std::map<std::string, size_t>& params) {
+	// Index: layout and dropped frames
+	std::ifstream index(indexname, std::ios::binary);
+	SegmentIndexHeader indexHeader;
+	if (!index.read((char*) &indexHeader, sizeof(SegmentIndexHeader)) ||
+			std::string(indexHeader.magic, sizeof(indexHeader.magic)) != SEGMENT_INDEX_MAGIC || indexHeader.version != SEGMENT_VERSION) {
+		debugMessage("Failed to read " + indexname, DEBUG_ERROR);
+		return false;
+	}
+	std::vector<unsigned long long> dropped((size_t) indexHeader.numDropped);
+	index.seekg(indexHeader.headerBytes + indexHeader.numSegments * sizeof(SegmentIndexEntry));
+	if (!dropped.empty() && !index.read((char*) dropped.data(), dropped.size() * sizeof(unsigned long long))) return false;
+
+	// Segments
+	std::vector<std::string> names;
+	std::vector<SegmentHeader> headers;
+	size_t numFrames = 0;
+	while (true) {
+		char name[1024];
+		std::snprintf(name, sizeof(name), pattern.c_str(), (int) names.size());
+		std::ifstream segment(name, std::ios::binary);
+		SegmentHeader header;
+		if (!segment.read((char*) &header, sizeof(SegmentHeader)) || std::string(header.magic, sizeof(header.magic)) != SEGMENT_MAGIC ||
+				header.numFrames == 0 || header.firstFrame != numFrames)
+			break;
+		names.push_back(name);
+		headers.push_back(header);
+		numFrames += (size_t) header.numFrames;
+	}
+	if (headers.size() != indexHeader.numSegments) {
+		debugMessage(indexname + " was not finished; recovering " + std::to_string(numFrames) + " frames", DEBUG_WARNING);
+	}
+
+	size_t current = SIZE_MAX; // Segment open in [segment]
+	std::ifstream segment;
+	return writeStreamDatasets(file, dsname, indexHeader.channels, indexHeader.height, indexHeader.width,
+		indexHeader.bytesPerPixel, numFrames, [&](size_t k, char* dst, double& timestamp) {
+			size_t number = k / (size_t) indexHeader.capacity;
+			if (number != current) {
+				segment.close();
+				segment.open(names[number], std::ios::binary);
+				current = number;
+			}
+			const SegmentHeader& header = headers[number];
+			uint64_t position = k - header.firstFrame;
+			segment.seekg(header.timestampsOffset + position * sizeof(double));
+			if (!segment.read((char*) &timestamp, sizeof(double))) return false;
+			segment.seekg(header.framesOffset + position * header.frameBytes);
+			return (bool) segment.read(dst, header.frameBytes);
+		}, dropped, params);
+}
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+bool convertRawRecording(const std::string& root, const std::string& h5filename, std::map<std::string, size_t>& params) {
+	// Recordings are described by their manifest
+	std::string manifestname = root + ".raw.json";
+	if (!std::ifstream(manifestname).good()) manifestname = root + ".seg.json";
+	std::ifstream f(manifestname);
+	if (!f.good()) {
+		debugMessage("Failed to open " + root + ".raw.json or " + manifestname, DEBUG_ERROR);
+		return false;
+	}
+	try {
+		std::stringstream buffer;
+		buffer << f.rdbuf();
+		nlohmann::json manifest = nlohmann::json::parse(buffer.str());
+		bool segments = (manifest["format"].get<std::string>() == SEGMENT_MANIFEST_FORMAT);
+		// The stream files are named relative to the manifest
+		std::string dir;
+		size_t slash = root.find_last_of("/\\");
+		if (slash != std::string::npos) dir = root.substr(0, slash + 1);
+
+		H5File file(h5filename, H5F_ACC_TRUNC);
+		bool result = true;
+		for (const nlohmann::json& stream : manifest["streams"]) {
+			std::string dsname = stream["name"].get<std::string>();
+			std::string indexname = dir + stream["index"].get<std::string>();
+			if (segments) {
+				if (!convertSegmentStream(file, dsname, indexname, dir + stream["segments"].get<std::string>(), params)) result = false;
+			}
+			else {
+				if (!convertRawStream(file, dsname, dir + stream["data"].get<std::string>(), indexname, params)) result = false;
+			}
+		}
+		for (auto it = manifest["attributes"].begin(); it != manifest["attributes"].end(); ++it) {
+			writeRootAttribute(file, it.key(), it.value());
+		}
+		file.close();
+		return result;
+	}
+	catch (...) {
+		debugMessage("Failed to convert " + root + " to " + h5filename, DEBUG_ERROR);
+		return false;
+	}
+}
@@ -0,0 +1,10 @@
+#pragma once
+#pragma warning(push, 0)
+#include <map>
+#include <string>
+#pragma warning(pop)
+
+// Converts the recording written by RawOut or SegmentOut at [root] (i.e. with manifest [root].raw.json or
+// [root].seg.json) into the HDF5 file [h5filename], laid out as H5Out would have written it, with chunking and
+// compression set by [params] as for recording; returns false if it failed
+bool convertRawRecording(const std::string& root, const std::string& h5filename, std::map<std::string, size_t>& params);
@@ -0,0 +1,205 @@
+#pragma once
+#pragma warning(push, 0)
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#pragma warning(pop)
+
+#include "acquirer.h"
+#include "asyncfile.h"
+#include "manifest.h"
+#include "saver.h"
+#include "debug.h"
+
+#define RAW_MANIFEST_FORMAT "acquireWang raw"
+#define RAW_INDEX_MAGIC "AWIDX001"
+#define RAW_INDEX_VERSION 1
+#define RAW_QUEUE_DEPTH 4 // Default chunks in flight per stream
+
+// Header of a stream's index file
+struct RawIndexHeader {
+	char magic[8]; // RAW_INDEX_MAGIC
+	uint32_t version;
+	uint32_t headerBytes; // sizeof(RawIndexHeader), where the entries start
+	uint64_t numFrames; // Entries in the index (0 until the recording is finished: count them from the file size)
+	uint64_t numDropped; // Dropped frame numbers (uint64_t, in acquisition order from 0) after the entries
+	uint64_t frameBytes; // Bytes of frame data in each record of the data file
+	uint64_t recordBytes; // Bytes between records (frameBytes rounded up to ASYNC_FILE_ALIGNMENT)
+	uint32_t channels, height, width, bytesPerPixel;
+	double fps;
+};
+// Index entry for one saved frame
+struct RawIndexEntry {
+	uint64_t offset; // Offset of the frame's record in the data file
+	double timestamp;
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class implements an output stream to raw binary files, derived from
+ * the BaseSaver class, for when HDF5 cannot keep up. Each stream is written
+ * by its own thread to an append-only data file ("session_kinect.raw") of
+ * frame records padded to the disk's alignment, with unbuffered I/O and a
+ * few chunks in flight at once (see AsyncFile), plus a sidecar index
+ * ("session_kinect.idx") of each frame's offset and timestamp. A manifest
+ * ("session.raw.json") lists the streams and holds the metadata attributes.
+ * A frame is only indexed once its record is known to be in the data file,
+ * so the index of a recording cut short (e.g. by a crash) never points into
+ * the data file's preallocated space.
+ *
+ * Chunks are copied out of the chunk slab into the data file's own buffers,
+ * since the slab is released (and refilled) while the write is in flight.
+ *
+ * convertRawRecording() (rawconvert.h) turns a finished recording into an
+ * HDF5 file with the same layout as H5Out's.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class RawOut : public BaseSaver {
+private:
+	const std::vector<std::string> dsnames; // stream names
+	std::vector< std::unique_ptr<AsyncFile> > dataFiles; // frame records of each stream
+	std::vector<FILE*> indexFiles; // index of each stream
+	std::vector<RawIndexHeader> headers;
+	std::vector< std::deque<RawIndexEntry> > unindexed; // entries of frames still being written, for each stream
+	std::vector<size_t> framesIndexed; // entries in each stream's index
+	std::vector< std::vector<size_t> > droppedFrames; // from writeDroppedFrames()
+	SessionManifest manifest;
+
+	// Name of a file of the recording, e.g. "session" -> "session_kinect.raw"
+	std::string getStreamFilename(const std::string& dsname, const std::string& extension) {
+		return filename + "_" + dsname + extension;
+	}
+
+	// Appends the entries of a stream's frames whose records have been written to its index
+	bool indexWrittenFrames(size_t i) {
+		std::deque<RawIndexEntry>& entries = unindexed[i];
+		uint64_t completed = dataFiles[i]->getBytesCompleted();
+		size_t count = 0;
+		while (count < entries.size() && entries[count].offset + headers[i].recordBytes <= completed) count++;
+		if (count == 0) return true;
+		bool result = true;
+		for (size_t k = 0; k < count; k++) {
+			if (fwrite(&entries.front(), sizeof(RawIndexEntry), 1, indexFiles[i]) != 1) result = false;
+			entries.pop_front();
+		}
+		result = (fflush(indexFiles[i]) == 0) && result;
+		if (result) framesIndexed[i] += count;
+		return result;
+	}
+
+	// Completes a stream's index: the dropped frames after the entries, and the final counts in the header
+	bool finishIndex(size_t i) {
+		FILE* f = indexFiles[i];
+		headers[i].numFrames = framesIndexed[i];
+		headers[i].numDropped = droppedFrames[i].size();
+		std::vector<uint64_t> numbers(droppedFrames[i].begin(), droppedFrames[i].end());
+		bool result = (numbers.empty() || fwrite(numbers.data(), sizeof(uint64_t), numbers.size(), f) == numbers.size());
+		result = result && fseek(f, 0, SEEK_SET) == 0 && fwrite(&headers[i], sizeof(RawIndexHeader), 1, f) == 1;
+		result = (fclose(f) == 0) && result;
+		indexFiles[i] = nullptr;
+		return result;
+	}
+
+public:
+	// [_filename] is the root of the recording's file names (e.g. "session")
+	RawOut(std::string& _filename, std::vector<BaseAcquirer*>& _acquirers, const size_t _frameChunkSize,
+		const std::vector<std::string>& _dsnames, const size_t queueDepth = RAW_QUEUE_DEPTH) :
+			BaseSaver(_filename, _acquirers, _frameChunkSize, true), dsnames(_dsnames),
+			unindexed(numStreams), framesIndexed(numStreams, 0), droppedFrames(numStreams),
+			manifest(_filename + ".raw.json", RAW_MANIFEST_FORMAT, RAW_INDEX_VERSION) {
+		for (size_t i = 0; i < numStreams; i++) {
+			std::string dataname = getStreamFilename(dsnames[i], ".raw");
+			std::string indexname = getStreamFilename(dsnames[i], ".idx");
+
+			// Index header (the counts are filled in when the recording is finished)
+			RawIndexHeader header;
+			std::memset(&header, 0, sizeof(header));
+			std::memcpy(header.magic, RAW_INDEX_MAGIC, sizeof(header.magic));
+			header.version = RAW_INDEX_VERSION;
+			header.headerBytes = sizeof(RawIndexHeader);
+			header.frameBytes = acquirers[i]->getFrameBytes();
+			header.recordBytes = (header.frameBytes + ASYNC_FILE_ALIGNMENT - 1) / ASYNC_FILE_ALIGNMENT * ASYNC_FILE_ALIGNMENT;
+			std::vector<size_t> dims = acquirers[i]->getDims();
+			header.channels = (uint32_t) dims[0];
+			header.height = (uint32_t) dims[1];
+			header.width = (uint32_t) dims[2];
+			header.bytesPerPixel = (uint32_t) acquirers[i]->getBytesPerPixel();
+			header.fps = acquirers[i]->getFPS();
+			headers.push_back(header);
+
+			// Files (the data file is preallocated for all the frames to acquire, if known)
+			dataFiles.push_back(std::unique_ptr<AsyncFile>(new AsyncFile(dataname, frameChunkSize * header.recordBytes,
+				(queueDepth > 0) ? queueDepth : RAW_QUEUE_DEPTH, (uint64_t) acquirers[i]->getFramesToAcquire() * header.recordBytes)));
+			indexFiles.push_back(fopen(indexname.c_str(), "wb"));
+			if (!dataFiles[i]->isOpen() || indexFiles[i] == nullptr ||
+					fwrite(&header, sizeof(RawIndexHeader), 1, indexFiles[i]) != 1) {
+				debugMessage("Failed to create raw files for " + dsnames[i], DEBUG_ERROR);
+			}
+
+			manifest.addStream(dsnames[i], { { "data", dataname }, { "index", indexname } });
+		}
+		startSaving();
+	}
+
+	~RawOut() {
+		debugMessage("~RawOut", DEBUG_HIDDEN_INFO);
+		if (saving) abortSaving(true); // writer threads must stop before the files are closed
+		for (size_t i = 0; i < numStreams; i++) {
+			if (!dataFiles[i]->close()) debugMessage("Failed to finish data file for " + dsnames[i], DEBUG_ERROR);
+			if (indexFiles[i] != nullptr && !indexWrittenFrames(i)) debugMessage("Failed to index " + dsnames[i], DEBUG_ERROR);
+			if (indexFiles[i] != nullptr && !finishIndex(i)) debugMessage("Failed to finish index for " + dsnames[i], DEBUG_ERROR);
+		}
+	}
+
+	// Records the frames each stream dropped (call once acquisition has ended), to be written to the index
+	virtual void writeDroppedFrames() {
+		for (size_t i = 0; i < numStreams; i++) {
+			droppedFrames[i] = acquirers[i]->getDroppedFrames();
+			writeScalarAttribute(dsnames[i] + "_dropped", droppedFrames[i].size());
+		}
+	}
+
+	// This does not modify the contents of the write buffer (the saver releases the slab afterwards)
+	virtual bool writeFrames(size_t numFrames, size_t bufIndex) {
+		AsyncFile& file = *dataFiles[bufIndex];
+		const RawIndexHeader& header = headers[bufIndex];
+		const ChunkSlab& slab = writeBuffers[bufIndex]->front();
+		timers.start(DTIMER_WRITE_FRAME);
+		// Waits only if every buffer is still being written
+		char* buffer = file.getBuffer();
+		if (buffer == nullptr || indexFiles[bufIndex] == nullptr || !indexWrittenFrames(bufIndex)) {
+			timers.pause(DTIMER_WRITE_FRAME);
+			return false;
+		}
+		// Copy the frames into their records
+		if (header.recordBytes == header.frameBytes) {
+			std::memcpy(buffer, slab.data, numFrames * header.frameBytes);
+		}
+		else {
+			for (size_t k = 0; k < numFrames; k++) {
+				char* record = buffer + k * header.recordBytes;
+				std::memcpy(record, slab.data + k * header.frameBytes, header.frameBytes);
+				std::memset(record + header.frameBytes, 0, header.recordBytes - header.frameBytes);
+			}
+		}
+		// Index them once they have been written (see indexWrittenFrames())
+		uint64_t offset = file.getBytesWritten();
+		bool result = file.submit(numFrames * header.recordBytes);
+		if (result) {
+			for (size_t k = 0; k < numFrames; k++) {
+				RawIndexEntry entry = { offset + k * header.recordBytes, slab.timestamps[k] };
+				unindexed[bufIndex].push_back(entry);
+			}
+		}
+		timers.pause(DTIMER_WRITE_FRAME);
+		if (result) framesSaved[bufIndex] += numFrames;
+		return result;
+	}
+
+	// Write scalar attribute to the manifest
+	virtual void writeScalarAttribute(std::string name, int value) { manifest.setAttribute(name, value); }
+	virtual void writeScalarAttribute(std::string name, size_t value) { manifest.setAttribute(name, value); }
+	virtual void writeScalarAttribute(std::string name, double value) { manifest.setAttribute(name, value); }
+	virtual void writeScalarAttribute(std::string name, std::string value) { manifest.setAttribute(name, value); }
+};
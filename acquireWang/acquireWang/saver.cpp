@@ -4,99 +4,149 @@
  * PUBLIC METHODS  *
  * * * * * * * * * */
 
-BaseSaver::BaseSaver(std::string& _filename, std::vector<BaseAcquirer*>& _acquirers, const size_t _frameChunkSize) :
+BaseSaver::BaseSaver(std::string& _filename, std::vector<BaseAcquirer*>& _acquirers, const size_t _frameChunkSize,
+		const bool _threadPerStream) :
 		numStreams(_acquirers.size()), filename(_filename), acquirers(_acquirers),
-		framesSaved(numStreams, 0), frameChunkSize(_frameChunkSize),
-		writeBuffers(numStreams, std::deque<BaseFrame>()) {
+		framesSaved(numStreams, 0), frameChunkSize(_frameChunkSize), threadPerStream(_threadPerStream) {
 	debugMessage("BaseSaver constructor", DEBUG_HIDDEN_INFO);
+	// Preallocate chunk slabs for each stream
+	for (size_t i = 0; i < numStreams; i++) {
+		writeBuffers.push_back(std::unique_ptr<ChunkArena>(
+			new ChunkArena(acquirers[i]->getFrameBytes(), frameChunkSize, CHUNK_ARENA_SLABS)));
+	}
+	// Have acquirers wake their saving thread whenever a chunk is ready
+	size_t numThreads = threadPerStream ? numStreams : 1;
+	for (size_t i = 0; i < numThreads; i++) {
+		frameSignals.push_back(std::unique_ptr<FrameSignal>(new FrameSignal()));
+	}
+	for (size_t i = 0; i < numStreams; i++) {
+		acquirers[i]->setSaverSignal(frameSignals[threadPerStream ? i : 0].get(), frameChunkSize);
+	}
 	saving = true;
-	saveThread = new std::thread(&BaseSaver::writeLoop, this);
 }
 
 BaseSaver::~BaseSaver() {
 	debugMessage("~BaseSaver", DEBUG_HIDDEN_INFO);
 	if (saving) abortSaving(true);
+	for (size_t i = 0; i < numStreams; i++) {
+		acquirers[i]->setSaverSignal(nullptr, 0);
+	}
 	debugMessage("~BaseSaver: joined", DEBUG_HIDDEN_INFO);
 }
 
+/* * * * * * * * * * *
+ * PROTECTED METHODS *
+ * * * * * * * * * * */
+
+void BaseSaver::startSaving() {
+	for (size_t i = 0; i < frameSignals.size(); i++) {
+		saveThreads.push_back(new std::thread(&BaseSaver::writeLoop, this, i));
+	}
+}
+
 /* * * * * * * * * *
  * PRIVATE METHODS *
  * * * * * * * * * */
 
+std::vector<size_t> BaseSaver::getThreadStreams(size_t threadIndex) {
+	std::vector<size_t> streams;
+	if (threadPerStream) {
+		streams.push_back(threadIndex);
+	}
+	else {
+		for (size_t i = 0; i < numStreams; i++) streams.push_back(i);
+	}
+	return streams;
+}
+
 bool BaseSaver::moveFrameToWriteBuffer(size_t acqIndex) {
+	// Leave frames on the queue until a slab is free
+	if (!writeBuffers[acqIndex]->hasRoom()) return false;
 	timers.start(DTIMER_DEQUEUE);
 	BaseFrame dequeued = acquirers[acqIndex]->dequeue();
 	timers.pause(DTIMER_DEQUEUE);
 	bool result = dequeued.isValid();
-	if (result) { writeBuffers[acqIndex].push_back(dequeued); }
+	// Copy into its slot in the chunk slab (the frame buffer goes back to the pool)
+	if (result) { writeBuffers[acqIndex]->push(dequeued); }
 	return result;
 }
 
-void BaseSaver::writeLoop() {
+bool BaseSaver::writeNextChunk(const std::vector<size_t>& streams) {
+	// Find the stream with the least saving progress that has a chunk ready to write
+	double leastSoFar = DBL_MAX;
+	size_t leastIndex = 0;
+	bool lastChunk = false;
+	bool found = false;
+	for (size_t i : streams) {
+		BaseAcquirer* acq = acquirers[i];
+		ChunkArena& buf = *writeBuffers[i];
+		bool full = buf.frontFull(); // there is a full chunk in the buffer
+		bool last = !full &&
+			acq->getFramesToAcquire() > 0 && // (i.e. if not indefinite acquisition
+			!acq->isAcquiring() && // and we are done acquiring
+			!buf.empty() && // and the remaining frames are sitting in the write buffer)
+			buf.size() + framesSaved[i] >= acq->getFramesToSave();
+		if ((full || last) && getSavingProgress(i) < leastSoFar) {
+			leastSoFar = getSavingProgress(i);
+			leastIndex = i;
+			lastChunk = last;
+			found = true;
+		}
+	}
+	if (!found) return false;
+
+	/* Now, we deal only with the acquirer with the least saving progress */
+	BaseAcquirer* acq = acquirers[leastIndex];
+	ChunkArena& buf = *writeBuffers[leastIndex];
+	size_t numFrames = frameChunkSize;
+	if (lastChunk) {
+		debugMessage("Last chunk", DEBUG_HIDDEN_INFO);
+		numFrames = std::min(acq->getFramesToSave() - framesSaved[leastIndex], buf.front().numFrames);
+	}
+	// Write frames to file
+	bool res = writeFrames(numFrames, leastIndex);
+	// Release the slab if successful
+	if (res) { buf.popFront(); }
+	else debugMessage("Failed to write chunk for acquirer #" + std::to_string(leastIndex), DEBUG_ERROR);
+	return res;
+}
+
+void BaseSaver::writeLoop(size_t threadIndex) {
+	std::vector<size_t> streams = getThreadStreams(threadIndex);
+	FrameSignal& frameSignal = *frameSignals[threadIndex];
 	while (saving) {
 		// Move waiting frames to write buffers for each stream
 		timers.start(DTIMER_MOVE_WRITE);
-		//for (size_t i = 0; i < frameChunkSize * 2; i++) {
-		for (size_t i = 0; i < frameChunkSize; i++) {
-			bool allDone = true; // break if all cameras have no frames to dequeue
-			for (size_t j = 0; j < numStreams; j++) {
-				allDone = allDone && !moveFrameToWriteBuffer(j);
-			}
-			if (allDone) {
-				//debugMessage("Break after " + std::to_string(i) + " frames", DEBUG_INFO);
-				break;
-			}
+		bool moved = false;
+		for (size_t j : streams) {
+			while (moveFrameToWriteBuffer(j)) { moved = true; }
 		}
 		timers.pause(DTIMER_MOVE_WRITE);
-		
-		double leastSoFar = DBL_MAX;
-		size_t leastIndex = 0;
+
+		// Exit condition
 		bool done = true;
-		for (size_t i = 0; i < numStreams; i++) {
-			// Find stream with least saving progress
-			if (getSavingProgress(i) < leastSoFar) {
-				leastSoFar = getSavingProgress(i);
-				leastIndex = i;
-			}
-			// Exit condition not yet satisfied
+		for (size_t i : streams) {
 			if (acquirers[i]->getFramesToAcquire() == 0 ||
-					framesSaved[i] < acquirers[i]->getFramesToAcquire())
+					framesSaved[i] < acquirers[i]->getFramesToSave())
 				done = false;
 		}
-
-		// Exit condition
 		if (done) break;
 
-		/* Now, we deal only with the acquirer with the least saving progress */
-		BaseAcquirer* acq = acquirers[leastIndex];
-		std::deque<BaseFrame>& buf = writeBuffers[leastIndex];
+		// Write one chunk, then come back for more frames
+		bool wrote = writeNextChunk(streams);
 
-		// If we are at the end of acquisition
-		if (acq->getFramesToAcquire() > 0 && // (i.e. if not indefinite acquisition
-				!acq->isAcquiring() && // and we are done acquiring
-				buf.size() + framesSaved[leastIndex] >= acq->getFramesToAcquire()) { // and enough frames are sitting in the write buffer)
-			debugMessage("Last chunk", DEBUG_HIDDEN_INFO);
-			// Write frames to file
-			bool res = writeFrames(acq->getFramesToAcquire() - framesSaved[leastIndex], leastIndex);
-			// Remove those frames from the write buffer if successful
-			if (res) { buf.clear(); }
-			else debugMessage("Failed to write chunk for acquirer #" + std::to_string(leastIndex), DEBUG_ERROR);
-		}
-		
-		// Otherwise, if there are enough frames in the buffer to write a chunk...
-		else if (buf.size() >= frameChunkSize) {
-			// Write frames to file
-			bool res = writeFrames(frameChunkSize, leastIndex);
-			// Remove those frames from the write buffer if successful
-			if (res) {
-				for (size_t i = 0; i < frameChunkSize; i++) { buf.pop_front(); }
-			}
-			else debugMessage("Failed to write chunk for acquirer #" + std::to_string(leastIndex), DEBUG_ERROR);
+		// Nothing to do: sleep until an acquirer signals a full chunk (or acquisition ends),
+		// or until the flush deadline passes
+		if (!moved && !wrote && saving) {
+			timers.start(DTIMER_SAVER_WAIT);
+			frameSignal.waitUntil(std::chrono::steady_clock::now() + std::chrono::milliseconds(SAVER_FLUSH_INTERVAL_MS));
+			timers.pause(DTIMER_SAVER_WAIT);
 		}
 	}
 	std::string numbers;
-	for (size_t i = 0; i < numStreams; i++) {
+	for (size_t i : streams) {
 		numbers = numbers + std::to_string(framesSaved[i]) + ", ";
 	}
+	timers.addThreadCPUTime(threadPerStream ? acquirers[threadIndex]->getName() + " saving" : "saving", getThreadCPUTime());
 	debugMessage("[!] Exiting saving thread. Saved " + numbers + "frames.", DEBUG_IMPORTANT_INFO);
 }
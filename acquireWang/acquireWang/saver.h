@@ -1,35 +1,80 @@
 #pragma once
 #pragma warning(push, 0)
+#include <map>
 #include <string>
 #include <thread>
 #include <vector>
-#include <deque>
+#include <memory>
 #include <algorithm>
 #pragma warning(pop)
 #include "acquirer.h"
+#include "chunkarena.h"
+
+#define CHUNK_ARENA_SLABS 2 // Slabs per stream (one being filled while another waits to be written)
+#define SAVER_FLUSH_INTERVAL_MS 500 // Longest the saving thread sleeps before checking the queues anyway
+
+// Formats the recording can be saved in
+enum saveFormat {
+	SAVE_HDF5 = 0,		// HDF5 file(s) (H5Out)
+	SAVE_RAW = 1,		// raw binary files with unbuffered I/O (RawOut), converted to HDF5 afterwards
+	SAVE_SEGMENTS = 2	// memory-mapped segment files (SegmentOut), converted to HDF5 afterwards
+};
+
+// When the files are flushed to disk while saving
+enum flushPolicy {
+	FLUSH_EVERY_CHUNKS = 0,		// after every N chunks written (N = 1 flushes after every chunk)
+	FLUSH_EVERY_SECONDS = 1,	// every N seconds
+	FLUSH_NONE = 2				// only when the files are closed
+};
+
+// Returns the flush policy in the recording parameters (_flushPolicy), falling back to flushing after every
+// N chunks if it is unknown
+inline flushPolicy getFlushPolicy(std::map<std::string, size_t>& params) {
+	size_t value = params["_flushPolicy"];
+	if (value > FLUSH_NONE) {
+		debugMessage("Unknown flush policy " + std::to_string(value) + "; flushing every " +
+			std::to_string(params["_flushInterval"]) + " chunks", DEBUG_WARNING);
+		value = FLUSH_EVERY_CHUNKS;
+	}
+	return (flushPolicy) value;
+}
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * This class provides an interface for saving data to a file.
- * It manages a single thread to save to the provided filename.
- * Details of the file format should be implemented in derived classes.
+ * By default it manages a single thread to save every stream to the provided
+ * filename. With threadPerStream, each stream gets its own writer thread, so
+ * one stream's slabs are filled while another's are written (derived classes
+ * then typically write each stream to its own file). Whether a slow write
+ * holds up the other streams depends on the derived class: H5Out serializes
+ * its HDF5 calls, while RawOut and SegmentOut write each stream on its own.
+ * Details of the file format (including how metadata is stored) should be
+ * implemented in derived classes, which must call startSaving() at the end
+ * of their constructor.
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 class BaseSaver {
 protected:
 	const size_t numStreams; // Number of acquirers/streams
 	const size_t frameChunkSize; // Number of frames per "chunk" to write at one time
 								 // (some applications are faster when frames are written in chunks)
+	const bool threadPerStream; // true if each stream has its own writer thread
 	std::atomic<bool> saving; // Flag to indicate if saving should abort
 
 	// TODO: make a small class so that we have just one vector of that class?? Or is this okay...
-	std::vector< std::deque<BaseFrame> > writeBuffers; // Write buffer to pull frames off thread-safe queues
+	std::vector< std::unique_ptr<ChunkArena> > writeBuffers; // Write buffer to pull frames off thread-safe queues
 	std::vector<size_t> framesSaved; // Numbers of frames saved for each acquirer/stream
 	std::vector<BaseAcquirer*>& acquirers; // Acquirers for reference
+
+	// Starts the saving thread(s); call at the end of derived class constructors
+	void startSaving();
 private:
-	std::thread* saveThread; // Thread for saving
+	std::vector<std::thread*> saveThreads; // Threads for saving (one, or one per stream)
+	std::vector< std::unique_ptr<FrameSignal> > frameSignals; // Wake each saving thread when acquirers have a chunk ready
 
 	// Methods for thread
+	std::vector<size_t> getThreadStreams(size_t threadIndex); // Streams handled by a saving thread
 	bool moveFrameToWriteBuffer(size_t acqIndex);
-	void writeLoop();
+	bool writeNextChunk(const std::vector<size_t>& streams); // Returns true if a chunk was written
+	void writeLoop(size_t threadIndex);
 
 	// Disable assignment operator and copy constructor
 	BaseSaver& operator=(const BaseSaver& other) = delete;
@@ -39,27 +84,38 @@ public:
 	const std::string filename;
 
 	// Constructor and destructor
-	BaseSaver(std::string& _filename, std::vector<BaseAcquirer*>& _acquirers, const size_t _frameChunkSize = 1);
+	BaseSaver(std::string& _filename, std::vector<BaseAcquirer*>& _acquirers, const size_t _frameChunkSize = 1,
+		const bool _threadPerStream = false);
 	virtual ~BaseSaver();
 
-	// Must be overridden to write frame(s)
+	// Must be overridden to write the first nFrames frame(s) of writeBuffers[bufIndex]->front()
 	virtual bool writeFrames(size_t nFrames, size_t bufIndex) = 0;
 
+	// Metadata methods (call once saving has finished)
+	// Records the frames each stream dropped
+	virtual void writeDroppedFrames() = 0;
+	// Records a named value for the whole recording
+	virtual void writeScalarAttribute(std::string name, int value) = 0;
+	virtual void writeScalarAttribute(std::string name, size_t value) = 0;
+	virtual void writeScalarAttribute(std::string name, double value) = 0;
+	virtual void writeScalarAttribute(std::string name, std::string value) = 0;
+
 	// Saving flag methods
 	bool isSaving() {
 		bool result = false;
 		for (size_t i = 0; i < numStreams; i++) {
-			if (framesSaved[i] < acquirers[i]->getFramesToAcquire()) result = true;
+			if (framesSaved[i] < acquirers[i]->getFramesToSave()) result = true;
 		}
 		return saving && result;
 	}
 	void abortSaving(bool stopSaving) {
 		if (stopSaving) saving = false;
-		if (saveThread != nullptr) {
+		for (auto& signal : frameSignals) signal->notify();
+		for (auto& saveThread : saveThreads) {
 			saveThread->join();
 			delete saveThread;
-			saveThread = nullptr;
 		}
+		saveThreads.clear();
 	}
 
 	// Saving progress, in number of seconds' worth of frames saved
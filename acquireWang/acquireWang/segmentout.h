@@ -0,0 +1,393 @@
+#pragma once
+#pragma warning(push, 0)
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#pragma warning(pop)
+
+#include "acquirer.h"
+#include "mappedfile.h"
+#include "manifest.h"
+#include "saver.h"
+#include "debug.h"
+
+#define SEGMENT_MANIFEST_FORMAT "acquireWang segments"
+#define SEGMENT_MAGIC "AWSEG001"
+#define SEGMENT_INDEX_MAGIC "AWSGI001"
+#define SEGMENT_VERSION 1
+#define SEGMENT_HEADER_BYTES 4096 // Frames start on the page after a segment's header
+#define SEGMENT_DEFAULT_MB 512 // Default size of segment files
+#define SEGMENT_POLL_MS 100 // Longest the segment thread sleeps before checking for work anyway
+
+// Header at the start of each segment file
+struct SegmentHeader {
+	char magic[8]; // SEGMENT_MAGIC
+	uint32_t version;
+	uint32_t headerBytes; // SEGMENT_HEADER_BYTES
+	uint64_t segmentNumber; // From 0
+	uint64_t firstFrame; // Number (in the stream, from 0) of the segment's first frame
+	uint64_t numFrames; // Frames written so far (updated after every chunk)
+	uint64_t capacity; // Frames the segment has room for
+	uint64_t frameBytes;
+	uint64_t framesOffset; // Offset of the frames, back to back
+	uint64_t timestampsOffset; // Offset of the timestamps (one double per frame)
+	uint32_t channels, height, width, bytesPerPixel;
+	double fps;
+};
+// Header of a stream's segment index
+struct SegmentIndexHeader {
+	char magic[8]; // SEGMENT_INDEX_MAGIC
+	uint32_t version;
+	uint32_t headerBytes; // sizeof(SegmentIndexHeader), where the entries start
+	uint64_t numSegments; // Entries (updated as each segment is finished)
+	uint64_t numFrames; // Frames in the finished segments
+	uint64_t numDropped; // Dropped frame numbers (uint64_t, in acquisition order from 0) after the entries
+	uint64_t segmentBytes; // Size of every segment file
+	uint64_t capacity; // Frames per segment
+	uint64_t frameBytes;
+	uint32_t channels, height, width, bytesPerPixel;
+	double fps;
+};
+// Index entry for one finished segment
+struct SegmentIndexEntry {
+	uint64_t firstFrame;
+	uint64_t numFrames;
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class implements an output stream to memory-mapped segment files,
+ * derived from the BaseSaver class. Each stream is written by its own
+ * thread to a series of fixed-size segment files ("session_kinect_00000.seg",
+ * ...), each holding a header, room for a whole number of chunks of frames,
+ * and their timestamps. The chunk slabs are placed directly in the mapped
+ * segment, so frames are copied once, from their frame buffer into the
+ * file's pages, and writeFrames() only records their timestamps and count.
+ * The operating system writes the pages back in its own time.
+ *
+ * A separate thread maps each stream's next segment ahead of time, flushes
+ * the segments according to the flush policy, and syncs, indexes and closes
+ * every segment once it is full. Each stream's index ("session_kinect.segidx")
+ * lists its finished segments, and a manifest ("session.seg.json") lists the
+ * streams and holds the metadata attributes.
+ *
+ * Readers can map a segment and find everything at fixed offsets given by
+ * its header, whose frame count is kept up to date while it is written.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class SegmentOut : public BaseSaver {
+private:
+	// Segments of one stream
+	struct SegmentStream {
+		SegmentHeader layout; // Header of every segment (segmentNumber, firstFrame and numFrames are 0)
+		SegmentIndexHeader indexHeader;
+		FILE* index;
+		std::map< size_t, std::unique_ptr<MappedFile> > open; // Segments being filled or written, by number
+		std::unique_ptr<MappedFile> premapped; // Next segment, mapped ahead of time
+		size_t premappedNumber;
+		size_t nextNumber; // Number of the next segment to map
+		bool mapFailed; // true once a segment could not be mapped
+		std::vector<char> scratch; // Slab memory once mapping has failed (so the frames are lost)
+		std::vector<size_t> droppedFrames; // from writeDroppedFrames()
+	};
+
+	const std::vector<std::string> dsnames; // stream names
+	std::vector< std::unique_ptr<SegmentStream> > streams;
+	SessionManifest manifest;
+
+	std::mutex segmentMutex; // guards every stream's segments
+	std::condition_variable segmentWork; // wakes the segment thread
+	std::condition_variable segmentReady; // wakes writers waiting for a segment to be mapped
+	std::vector< std::pair< size_t, std::unique_ptr<MappedFile> > > retired; // (stream, segment) to sync and close
+	std::thread* segmentThread;
+	bool stopSegments;
+
+	const flushPolicy flushMode;
+	const size_t flushInterval; // Chunks or seconds between flushes
+	size_t chunksSinceFlush;
+
+	// Name of a segment file, e.g. "session" -> "session_kinect_00000.seg"
+	std::string getSegmentFilename(size_t streamIndex, size_t number) {
+		char suffix[32];
+		std::snprintf(suffix, sizeof(suffix), "_%05d.seg", (int) number);
+		return filename + "_" + dsnames[streamIndex] + suffix;
+	}
+
+	// Creates and maps a segment, and writes its header; returns nullptr if it failed
+	std::unique_ptr<MappedFile> mapSegment(size_t streamIndex, size_t number) {
+		const SegmentHeader& layout = streams[streamIndex]->layout;
+		uint64_t bytes = layout.timestampsOffset + (layout.capacity * sizeof(double) + SEGMENT_HEADER_BYTES - 1) /
+			SEGMENT_HEADER_BYTES * SEGMENT_HEADER_BYTES;
+		std::unique_ptr<MappedFile> segment(new MappedFile(getSegmentFilename(streamIndex, number), bytes));
+		if (!segment->isOpen()) return nullptr;
+		SegmentHeader* header = (SegmentHeader*) segment->getData();
+		*header = layout;
+		header->segmentNumber = number;
+		header->firstFrame = number * layout.capacity;
+		return segment;
+	}
+
+	// Returns the memory for a stream's [slabNumber]th slab, in the segment it falls in (called by the writer threads)
+	char* placeSlab(size_t streamIndex, size_t slabNumber) {
+		SegmentStream& stream = *streams[streamIndex];
+		size_t firstFrame = slabNumber * frameChunkSize;
+		size_t number = firstFrame / stream.layout.capacity;
+		std::unique_lock<std::mutex> lock(segmentMutex);
+		if (stream.open.find(number) == stream.open.end()) {
+			// Take the premapped segment (normally ready already)
+			segmentReady.wait(lock, [&]() { return stream.premapped != nullptr || stream.mapFailed; });
+			if (stream.mapFailed || stream.premappedNumber != number) {
+				debugMessage("No segment to write " + dsnames[streamIndex] + " to", DEBUG_ERROR);
+				stream.mapFailed = true;
+				return stream.scratch.data();
+			}
+			stream.open[number] = std::move(stream.premapped);
+			segmentWork.notify_one(); // map the one after
+		}
+		return stream.open[number]->getData() + stream.layout.framesOffset +
+			(firstFrame % stream.layout.capacity) * stream.layout.frameBytes;
+	}
+
+	// Syncs a segment to disk, adds it to its stream's index and closes it (deleting it if it is empty)
+	void finishSegment(size_t streamIndex, std::unique_ptr<MappedFile> segment) {
+		SegmentStream& stream = *streams[streamIndex];
+		SegmentHeader header = *(SegmentHeader*) segment->getData();
+		if (header.numFrames == 0) {
+			std::string name = segment->getFilename();
+			segment.reset();
+			std::remove(name.c_str());
+			return;
+		}
+		timers.start(DTIMER_FLUSH);
+		segment->flush(0, segment->getBytes(), true);
+		timers.pause(DTIMER_FLUSH);
+		segment.reset();
+		if (stream.index == nullptr) return;
+		SegmentIndexEntry entry = { header.firstFrame, header.numFrames };
+		stream.indexHeader.numSegments++;
+		stream.indexHeader.numFrames += header.numFrames;
+		bool result = fseek(stream.index, 0, SEEK_END) == 0 && fwrite(&entry, sizeof(entry), 1, stream.index) == 1 &&
+			fseek(stream.index, 0, SEEK_SET) == 0 && fwrite(&stream.indexHeader, sizeof(SegmentIndexHeader), 1, stream.index) == 1 &&
+			fflush(stream.index) == 0;
+		if (!result) debugMessage("Failed to index segment " + std::to_string(header.segmentNumber) + " of " + dsnames[streamIndex], DEBUG_ERROR);
+	}
+
+	// Returns true if the open segments are due to be flushed (call with segmentMutex held)
+	bool flushDue(std::chrono::steady_clock::time_point lastFlush) {
+		if (flushMode == FLUSH_EVERY_CHUNKS) return chunksSinceFlush >= flushInterval;
+		if (flushMode == FLUSH_EVERY_SECONDS) return std::chrono::steady_clock::now() - lastFlush >= std::chrono::seconds(flushInterval);
+		return false;
+	}
+
+	// Maps segments ahead of the writers, finishes full segments and flushes the open ones, until stopSegments
+	// (and every retired segment is finished)
+	void segmentLoop() {
+		std::chrono::steady_clock::time_point lastFlush = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> lock(segmentMutex);
+		while (true) {
+			// Map each stream's next segment
+			for (size_t i = 0; i < numStreams && !stopSegments; i++) {
+				SegmentStream& stream = *streams[i];
+				if (stream.premapped != nullptr || stream.mapFailed) continue;
+				size_t number = stream.nextNumber++;
+				lock.unlock();
+				std::unique_ptr<MappedFile> segment = mapSegment(i, number);
+				lock.lock();
+				if (segment != nullptr) {
+					stream.premapped = std::move(segment);
+					stream.premappedNumber = number;
+				}
+				else {
+					stream.mapFailed = true;
+				}
+				segmentReady.notify_all();
+			}
+			// Finish full segments
+			if (!retired.empty()) {
+				std::vector< std::pair< size_t, std::unique_ptr<MappedFile> > > finishing;
+				finishing.swap(retired);
+				lock.unlock();
+				for (auto& segment : finishing) finishSegment(segment.first, std::move(segment.second));
+				lock.lock();
+				continue; // (more may have been retired meanwhile)
+			}
+			if (stopSegments) break;
+			// Flush the open segments (only this thread closes them, so they stay valid while unlocked)
+			if (flushDue(lastFlush)) {
+				chunksSinceFlush = 0;
+				lastFlush = std::chrono::steady_clock::now();
+				std::vector<MappedFile*> flushing;
+				for (auto& stream : streams) {
+					for (auto& segment : stream->open) flushing.push_back(segment.second.get());
+				}
+				lock.unlock();
+				timers.start(DTIMER_FLUSH);
+				for (MappedFile* segment : flushing) segment->flush(0, segment->getBytes(), true);
+				timers.pause(DTIMER_FLUSH);
+				lock.lock();
+				continue;
+			}
+			segmentWork.wait_for(lock, std::chrono::milliseconds(SEGMENT_POLL_MS));
+		}
+		timers.addThreadCPUTime("segments", getThreadCPUTime());
+	}
+
+	// Completes a stream's index: the dropped frames after the entries, and the final count in the header
+	bool finishIndex(SegmentStream& stream) {
+		stream.indexHeader.numDropped = stream.droppedFrames.size();
+		std::vector<uint64_t> numbers(stream.droppedFrames.begin(), stream.droppedFrames.end());
+		bool result = fseek(stream.index, 0, SEEK_END) == 0 &&
+			(numbers.empty() || fwrite(numbers.data(), sizeof(uint64_t), numbers.size(), stream.index) == numbers.size());
+		result = result && fseek(stream.index, 0, SEEK_SET) == 0 &&
+			fwrite(&stream.indexHeader, sizeof(SegmentIndexHeader), 1, stream.index) == 1;
+		result = (fclose(stream.index) == 0) && result;
+		stream.index = nullptr;
+		return result;
+	}
+
+public:
+	// [_filename] is the root of the recording's file names (e.g. "session"); segments hold about [segmentMB]
+	// megabytes (in whole chunks)
+	SegmentOut(std::string& _filename, std::vector<BaseAcquirer*>& _acquirers, const size_t _frameChunkSize,
+		const std::vector<std::string>& _dsnames, const size_t segmentMB = SEGMENT_DEFAULT_MB,
+		const flushPolicy _flushMode = FLUSH_EVERY_SECONDS, const size_t _flushInterval = 1) :
+			BaseSaver(_filename, _acquirers, _frameChunkSize, true), dsnames(_dsnames),
+			manifest(_filename + ".seg.json", SEGMENT_MANIFEST_FORMAT, SEGMENT_VERSION),
+			segmentThread(nullptr), stopSegments(false),
+			flushMode(_flushMode), flushInterval((_flushInterval > 0) ? _flushInterval : 1), chunksSinceFlush(0) {
+		uint64_t targetBytes = (uint64_t) ((segmentMB > 0) ? segmentMB : SEGMENT_DEFAULT_MB) << 20;
+		for (size_t i = 0; i < numStreams; i++) {
+			std::unique_ptr<SegmentStream> stream(new SegmentStream());
+			uint64_t frameBytes = acquirers[i]->getFrameBytes();
+			std::vector<size_t> dims = acquirers[i]->getDims();
+
+			// Segment layout: header page, then whole chunks of frames, then their timestamps
+			SegmentHeader& layout = stream->layout;
+			std::memset(&layout, 0, sizeof(layout));
+			std::memcpy(layout.magic, SEGMENT_MAGIC, sizeof(layout.magic));
+			layout.version = SEGMENT_VERSION;
+			layout.headerBytes = SEGMENT_HEADER_BYTES;
+			layout.capacity = std::max(targetBytes / frameBytes / frameChunkSize, (uint64_t) 1) * frameChunkSize;
+			layout.frameBytes = frameBytes;
+			layout.framesOffset = SEGMENT_HEADER_BYTES;
+			layout.timestampsOffset = layout.framesOffset + (layout.capacity * frameBytes + SEGMENT_HEADER_BYTES - 1) /
+				SEGMENT_HEADER_BYTES * SEGMENT_HEADER_BYTES;
+			layout.channels = (uint32_t) dims[0];
+			layout.height = (uint32_t) dims[1];
+			layout.width = (uint32_t) dims[2];
+			layout.bytesPerPixel = (uint32_t) acquirers[i]->getBytesPerPixel();
+			layout.fps = acquirers[i]->getFPS();
+
+			// Index (the counts are updated as segments are finished)
+			SegmentIndexHeader& indexHeader = stream->indexHeader;
+			std::memset(&indexHeader, 0, sizeof(indexHeader));
+			std::memcpy(indexHeader.magic, SEGMENT_INDEX_MAGIC, sizeof(indexHeader.magic));
+			indexHeader.version = SEGMENT_VERSION;
+			indexHeader.headerBytes = sizeof(SegmentIndexHeader);
+			indexHeader.capacity = layout.capacity;
+			indexHeader.frameBytes = layout.frameBytes;
+			indexHeader.segmentBytes = layout.timestampsOffset + (layout.capacity * sizeof(double) + SEGMENT_HEADER_BYTES - 1) /
+				SEGMENT_HEADER_BYTES * SEGMENT_HEADER_BYTES;
+			indexHeader.channels = layout.channels;
+			indexHeader.height = layout.height;
+			indexHeader.width = layout.width;
+			indexHeader.bytesPerPixel = layout.bytesPerPixel;
+			indexHeader.fps = layout.fps;
+			std::string indexname = filename + "_" + dsnames[i] + ".segidx";
+			stream->index = fopen(indexname.c_str(), "wb+");
+			if (stream->index == nullptr || fwrite(&indexHeader, sizeof(SegmentIndexHeader), 1, stream->index) != 1) {
+				debugMessage("Failed to create " + indexname, DEBUG_ERROR);
+			}
+
+			stream->premappedNumber = 0;
+			stream->nextNumber = 0;
+			stream->mapFailed = false;
+			stream->scratch.resize(frameChunkSize * frameBytes);
+			streams.push_back(std::move(stream));
+
+			// Segment files are named "<segments>" with the segment number in place of %05d
+			std::string pattern = filename + "_" + dsnames[i] + "_%05d.seg";
+			manifest.addStream(dsnames[i], { { "index", indexname }, { "segments", pattern } });
+
+			// Put the slabs in the segments
+			writeBuffers[i]->setSlabPlacer([this, i](size_t slabNumber) { return placeSlab(i, slabNumber); });
+		}
+		segmentThread = new std::thread(&SegmentOut::segmentLoop, this);
+		startSaving();
+	}
+
+	~SegmentOut() {
+		debugMessage("~SegmentOut", DEBUG_HIDDEN_INFO);
+		if (saving) abortSaving(true); // writer threads must stop before the segments are closed
+		// Finish the last segments
+		{
+			std::lock_guard<std::mutex> lock(segmentMutex);
+			for (size_t i = 0; i < numStreams; i++) {
+				for (auto& segment : streams[i]->open) retired.push_back(std::make_pair(i, std::move(segment.second)));
+				streams[i]->open.clear();
+			}
+			stopSegments = true;
+		}
+		segmentWork.notify_one();
+		segmentThread->join();
+		delete segmentThread;
+		for (size_t i = 0; i < numStreams; i++) {
+			SegmentStream& stream = *streams[i];
+			// The premapped segment was never written
+			if (stream.premapped != nullptr) {
+				std::string name = stream.premapped->getFilename();
+				stream.premapped.reset();
+				std::remove(name.c_str());
+			}
+			if (stream.index != nullptr && !finishIndex(stream)) debugMessage("Failed to finish index for " + dsnames[i], DEBUG_ERROR);
+		}
+	}
+
+	// Records the frames each stream dropped (call once acquisition has ended), to be written to the index
+	virtual void writeDroppedFrames() {
+		for (size_t i = 0; i < numStreams; i++) {
+			streams[i]->droppedFrames = acquirers[i]->getDroppedFrames();
+			writeScalarAttribute(dsnames[i] + "_dropped", streams[i]->droppedFrames.size());
+		}
+	}
+
+	// The frames are already in the segment (placeSlab() put the slab there); this records their timestamps and count
+	virtual bool writeFrames(size_t numFrames, size_t bufIndex) {
+		SegmentStream& stream = *streams[bufIndex];
+		const ChunkSlab& slab = writeBuffers[bufIndex]->front();
+		size_t number = framesSaved[bufIndex] / stream.layout.capacity;
+		size_t position = framesSaved[bufIndex] % stream.layout.capacity;
+		bool flush = false;
+		{
+			std::lock_guard<std::mutex> lock(segmentMutex);
+			auto found = stream.open.find(number);
+			if (found == stream.open.end()) return false;
+			char* data = found->second->getData();
+			if (slab.data != data + stream.layout.framesOffset + position * stream.layout.frameBytes) return false;
+			timers.start(DTIMER_WRITE_FRAME);
+			std::memcpy(data + stream.layout.timestampsOffset + position * sizeof(double), slab.timestamps, numFrames * sizeof(double));
+			((SegmentHeader*) data)->numFrames = position + numFrames;
+			timers.pause(DTIMER_WRITE_FRAME);
+			framesSaved[bufIndex] += numFrames;
+			// Hand a full segment to the segment thread
+			if (position + numFrames == stream.layout.capacity) {
+				retired.push_back(std::make_pair(bufIndex, std::move(found->second)));
+				stream.open.erase(found);
+				flush = true;
+			}
+			if (flushMode == FLUSH_EVERY_CHUNKS && ++chunksSinceFlush >= flushInterval) flush = true;
+		}
+		if (flush) segmentWork.notify_one();
+		return true;
+	}
+
+	// Write scalar attribute to the manifest
+	virtual void writeScalarAttribute(std::string name, int value) { manifest.setAttribute(name, value); }
+	virtual void writeScalarAttribute(std::string name, size_t value) { manifest.setAttribute(name, value); }
+	virtual void writeScalarAttribute(std::string name, double value) { manifest.setAttribute(name, value); }
+	virtual void writeScalarAttribute(std::string name, std::string value) { manifest.setAttribute(name, value); }
+};
@@ -0,0 +1,78 @@
+#include "spillfile.h"
+#pragma warning(push, 0)
+#include <cstdio>
+#pragma warning(pop)
+#include "debug.h"
+
+// Header in front of each frame in the file
+struct SpillRecord {
+	uint64_t width, height, channels, bytesPerPixel;
+	double timestamp;
+};
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+FrameSpillFile::FrameSpillFile(const std::string& _filename, std::shared_ptr<FramePool> _pool) :
+		filename(_filename), pool(_pool), head(0), tail(0), pendingBytes(0), framesWritten(0), bytesWritten(0), framesRead(0),
+		readFailed(false) {
+	file.open(filename, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) debugMessage("Failed to create spill file " + filename, DEBUG_ERROR);
+}
+
+FrameSpillFile::~FrameSpillFile() {
+	if (!file.is_open()) return;
+	file.close();
+	std::remove(filename.c_str());
+}
+
+bool FrameSpillFile::write(BaseFrame& frame) {
+	if (!frame.isValid()) return false;
+	SpillRecord record = { frame.getWidth(), frame.getHeight(), frame.getChannels(), frame.getBytesPerPixel(), frame.getTimestamp() };
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!file.is_open() || readFailed) return false;
+	file.clear();
+	file.seekp((std::streamoff) tail);
+	file.write((const char*) &record, sizeof(record));
+	file.write((const char*) frame.getData(), (std::streamsize) frame.getBytes());
+	file.flush(); // (read back through the same stream, but make sure the data left its buffer)
+	if (!file.good()) {
+		debugMessage("Failed to write to spill file " + filename, DEBUG_ERROR);
+		return false;
+	}
+	tail += sizeof(record) + frame.getBytes();
+	pendingBytes += frame.getBytes();
+	framesWritten++;
+	bytesWritten += frame.getBytes();
+	return true;
+}
+
+bool FrameSpillFile::read(BaseFrame& frame) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!file.is_open() || readFailed || head >= tail) return false;
+	SpillRecord record;
+	file.clear();
+	file.seekg((std::streamoff) head);
+	file.read((char*) &record, sizeof(record));
+	if (!file.good()) {
+		debugMessage("Failed to read from spill file " + filename, DEBUG_ERROR);
+		readFailed = true;
+		return false;
+	}
+	BaseFrame result((size_t) record.width, (size_t) record.height, (size_t) record.bytesPerPixel, (size_t) record.channels, pool);
+	file.read((char*) result.getMutableData(), (std::streamsize) result.getBytes());
+	if (!file.good()) {
+		debugMessage("Failed to read from spill file " + filename, DEBUG_ERROR);
+		readFailed = true;
+		return false;
+	}
+	result.setTimestamp(record.timestamp);
+	head += sizeof(record) + result.getBytes();
+	pendingBytes -= result.getBytes();
+	framesRead++;
+	// Start again from the beginning once everything has been read back
+	if (head == tail) head = tail = 0;
+	frame = std::move(result);
+	return true;
+}
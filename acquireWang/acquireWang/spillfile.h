@@ -0,0 +1,55 @@
+#pragma once
+#pragma warning(push, 0)
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#pragma warning(pop)
+#include "frame.h"
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class implements a first-in, first-out file of frames, the overflow
+ * tier of a frame queue (see MemoryGovernor). Frames are appended at the
+ * tail and read back from the head, each with its dimensions and timestamp,
+ * into buffers from the stream's frame pool. Once every frame written has
+ * been read back, the file starts again from the beginning, so it only
+ * grows as large as the longest backlog. It is deleted when destroyed.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class FrameSpillFile {
+private:
+	const std::string filename;
+	std::fstream file;
+	std::mutex mutex; // Serializes appending (the governor) and reading back (the saver)
+	std::shared_ptr<FramePool> pool; // Pool that frames read back borrow buffers from
+	uint64_t head; // Offset of the oldest frame not yet read back
+	uint64_t tail; // Offset the next frame is appended at
+	std::atomic<uint64_t> pendingBytes; // Bytes of frame data waiting to be read back
+	std::atomic<size_t> framesWritten; // Frames appended so far
+	std::atomic<uint64_t> bytesWritten; // Bytes of frame data appended so far
+	std::atomic<size_t> framesRead; // Frames read back so far
+	bool readFailed; // true once reading back has failed (every later read fails too, and nothing more is written)
+
+	// Disable assignment operator and copy constructor
+	FrameSpillFile& operator=(const FrameSpillFile& other) = delete;
+	FrameSpillFile(const FrameSpillFile& other) = delete;
+
+public:
+	// Creates (or truncates) [_filename]; frames read back borrow buffers from [_pool] (if given)
+	FrameSpillFile(const std::string& _filename, std::shared_ptr<FramePool> _pool = nullptr);
+	~FrameSpillFile(); // Closes and deletes the file
+
+	bool isOpen() { return file.is_open(); }
+	const std::string& getFilename() { return filename; }
+	uint64_t getPendingBytes() { return pendingBytes; }
+	size_t getFramesWritten() { return framesWritten; }
+	uint64_t getBytesWritten() { return bytesWritten; }
+	size_t getFramesRead() { return framesRead; }
+
+	// Appends [frame]; returns false if it could not be written (or reading back has failed)
+	bool write(BaseFrame& frame);
+	// Reads the oldest frame not yet read back into [frame]; returns false if there is none, or reading failed (then or
+	// before: after a failure the file's frames can no longer be told apart, so none of them are read back)
+	bool read(BaseFrame& frame);
+};
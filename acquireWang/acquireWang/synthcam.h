@@ -0,0 +1,111 @@
+#pragma once
+#pragma warning(push, 0)
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#pragma warning(pop)
+#include "camera.h"
+#include "timer.h"
+
+#define SYNTHETIC_PATTERNS 16 // Number of distinct frames cycled through
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class implements a camera that produces synthetic frames, for
+ * benchmarking the pipeline without hardware. Frames are a smooth surface
+ * that moves from frame to frame plus a little noise, so they compress
+ * roughly like real depth/video frames.
+ *
+ * By default it paces itself to its frame rate like a real camera. When free
+ * running, it produces frames as fast as the pipeline takes them: like a real
+ * camera's driver buffers, it only produces a frame when its frame pool has
+ * a free buffer, so a slow saver throttles it instead of filling memory (the
+ * frame rate is then only nominal).
+ *
+ * It also stands in for a camera SDK's event source: startFrameCallbacks()
+ * runs a thread that pushes each frame to the callback, like a driver's
+ * image events, so the callback path can be exercised without hardware.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class SyntheticCamera : public BaseCamera {
+private:
+	std::vector< std::vector<char> > patterns; // Pregenerated frames
+	size_t frameIndex;
+	bool freeRunning; // true to ignore the frame rate and produce frames as fast as they are taken
+	std::chrono::steady_clock::time_point nextFrameTime;
+	std::thread* eventThread; // Fake event source (nullptr if not pushing frames)
+	std::atomic<bool> pushing;
+
+	void eventLoop(frameCallback callback) {
+		while (pushing) {
+			BaseFrame frame = getFrame();
+			callback(frame);
+		}
+		timers.addThreadCPUTime("synthetic events", getThreadCPUTime());
+	}
+
+public:
+	SyntheticCamera(size_t _width, size_t _height, size_t _bytesPerPixel, double _fps, bool _freeRunning = false) :
+			frameIndex(0), freeRunning(_freeRunning), eventThread(nullptr), pushing(false) {
+		width = _width;
+		height = _height;
+		channels = 1;
+		bytesPerPixel = _bytesPerPixel;
+		fps = _fps;
+		// Generate frames
+		uint32_t noise = 12345;
+		for (size_t f = 0; f < SYNTHETIC_PATTERNS; f++) {
+			std::vector<char> pattern(getBytes());
+			for (size_t y = 0; y < height; y++) {
+				for (size_t x = 0; x < width; x++) {
+					noise = noise * 1664525 + 1013904223; // linear congruential generator
+					size_t dx = x + 4 * f, dy = y + 2 * f;
+					uint32_t value = (uint32_t) ((dx * dx + dy * dy) / 64 + dx + (noise >> 29));
+					size_t i = y * width + x;
+					if (bytesPerPixel == 2) ((uint16_t*) pattern.data())[i] = (uint16_t) (500 + value % 4000);
+					else if (bytesPerPixel == 1) ((uint8_t*) pattern.data())[i] = (uint8_t) value;
+				}
+			}
+			patterns.push_back(pattern);
+		}
+	}
+
+	~SyntheticCamera() override {
+		stopFrameCallbacks();
+	}
+
+	virtual void beginAcquisition() {
+		nextFrameTime = std::chrono::steady_clock::now();
+	}
+
+	virtual BaseFrame getFrame() {
+		if (!freeRunning) {
+			nextFrameTime += std::chrono::microseconds((long long) (1e6 / fps));
+			std::this_thread::sleep_until(nextFrameTime);
+		}
+		else if (framePool != nullptr) {
+			while (framePool->getFreeCount(getBytes()) == 0) std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+		BaseFrame frame(width, height, bytesPerPixel, channels, framePool);
+		frame.copyDataFromBuffer(patterns[frameIndex % SYNTHETIC_PATTERNS].data());
+		frame.setTimestamp(getClockStamp());
+		frameIndex++;
+		totalFrames++;
+		return frame;
+	}
+
+	virtual bool startFrameCallbacks(frameCallback callback) {
+		if (eventThread != nullptr) return false;
+		pushing = true;
+		eventThread = new std::thread(&SyntheticCamera::eventLoop, this, callback);
+		return true;
+	}
+
+	virtual void stopFrameCallbacks() {
+		if (eventThread == nullptr) return;
+		pushing = false;
+		eventThread->join();
+		delete eventThread;
+		eventThread = nullptr;
+	}
+};
@@ -0,0 +1,174 @@
+#include "tailreader.h"
+#pragma warning(push, 0)
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include "json.hpp" // rotation index
+#pragma warning(pop)
+#include "debug.h"
+#include "temporaldelta.h"
+
+/* * * * * * * * * *
+ * HELPER METHODS  *
+ * * * * * * * * * */
+
+// Name of file [number] of a stream of a rotated recording, from its index (empty if it is not listed yet)
+static std::string getPartFilename(const std::string& indexname, const std::string& dsname, size_t number) {
+	std::ifstream f(indexname);
+	if (!f.good()) return "";
+	try {
+		nlohmann::json index = nlohmann::json::parse(f);
+		std::string dir = indexname.substr(0, indexname.find_last_of("/\\") + 1);
+		for (auto& stream : index["streams"]) {
+			if (stream["name"] != dsname || stream.find("parts") == stream.end()) continue;
+			if (number < stream["parts"].size() && !stream["parts"][number].is_null()) {
+				return dir + stream["parts"][number]["file"].get<std::string>();
+			}
+		}
+	}
+	catch (...) {} // (being rewritten: try again later)
+	return "";
+}
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+TailReader::TailReader(const std::string& _filename, const std::string& _dsname) :
+		filename(_filename), dsname(_dsname), frameBytes(0), batchFrames(1), framesRead(0), open(false), keyInterval(0) {
+	try {
+		// Files that are not being written in SWMR mode are opened normally
+		bool opened = false;
+#if H5_VERSION_GE(1, 10, 0)
+		H5E_BEGIN_TRY {
+			try {
+				file.openFile(filename, H5F_ACC_RDONLY | H5F_ACC_SWMR_READ);
+				opened = true;
+			}
+			catch (...) {}
+		} H5E_END_TRY;
+#endif
+		if (!opened) file.openFile(filename, H5F_ACC_RDONLY);
+		dataset = file.openDataSet(dsname);
+		tsdataset = file.openDataSet(dsname + "_time");
+		datatype = dataset.getDataType();
+		hsize_t dims[4];
+		dataset.getSpace().getSimpleExtentDims(dims);
+		for (int i = 0; i < 3; i++) frameDims[i] = dims[i + 1];
+		frameBytes = (size_t) (dims[1] * dims[2] * dims[3]) * datatype.getSize();
+		// Read a chunk's worth of frames at a time
+		H5::DSetCreatPropList dcpl = dataset.getCreatePlist();
+		hsize_t chunkDims[4];
+		if (dcpl.getLayout() == H5D_CHUNKED && dcpl.getChunk(4, chunkDims) == 4 && chunkDims[0] > 0) batchFrames = (size_t) chunkDims[0];
+		if (dataset.attrExists(TEMPORAL_DELTA_ATTRIBUTE)) {
+			unsigned long long interval = 0;
+			dataset.openAttribute(TEMPORAL_DELTA_ATTRIBUTE).read(H5::PredType::NATIVE_ULLONG, &interval);
+			keyInterval = (size_t) interval;
+			if (keyInterval == 0 || datatype.getSize() != sizeof(uint16_t)) {
+				debugMessage("Cannot decode the temporal delta coding of " + dsname + " in " + filename, DEBUG_ERROR);
+				return;
+			}
+		}
+		open = true;
+	}
+	catch (...) {
+		debugMessage("Failed to open " + dsname + " in " + filename, DEBUG_ERROR);
+	}
+}
+
+size_t TailReader::poll(const frameCallback& callback) {
+	if (!open) return 0;
+	size_t start = framesRead;
+	try {
+#if H5_VERSION_GE(1, 10, 0)
+		// Timestamps first: the frames they count have already been published
+		H5Drefresh(tsdataset.getId());
+		H5Drefresh(dataset.getId());
+#endif
+		hsize_t dims[4], tsdims[2];
+		H5::DataSpace fileSpace = dataset.getSpace();
+		H5::DataSpace tsFileSpace = tsdataset.getSpace();
+		fileSpace.getSimpleExtentDims(dims);
+		tsFileSpace.getSimpleExtentDims(tsdims);
+		size_t available = (size_t) std::min(dims[0], tsdims[0]);
+		while (framesRead < available) {
+			size_t numFrames = std::min(batchFrames, available - framesRead);
+			frames.resize(numFrames * frameBytes);
+			timestamps.resize(numFrames);
+			hsize_t offset[4] = { framesRead, 0, 0, 0 };
+			hsize_t count[4] = { numFrames, frameDims[0], frameDims[1], frameDims[2] };
+			fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+			dataset.read(frames.data(), datatype, H5::DataSpace(4, count), fileSpace);
+			hsize_t tsoffset[2] = { framesRead, 0 };
+			hsize_t tscount[2] = { numFrames, 1 };
+			tsFileSpace.selectHyperslab(H5S_SELECT_SET, tscount, tsoffset);
+			tsdataset.read(timestamps.data(), H5::PredType::NATIVE_DOUBLE, H5::DataSpace(2, tscount), tsFileSpace);
+			if (keyInterval > 0) {
+				size_t framePixels = frameBytes / sizeof(uint16_t);
+				uint16_t* batch = (uint16_t*) frames.data();
+				decodeTemporalDelta(batch, numFrames, framePixels, framesRead, keyInterval, lastFrame.empty() ? nullptr : lastFrame.data());
+				lastFrame.assign(batch + (numFrames - 1) * framePixels, batch + numFrames * framePixels);
+			}
+			for (size_t k = 0; k < numFrames; k++) callback(framesRead + k, frames.data() + k * frameBytes, timestamps[k]);
+			framesRead += numFrames;
+		}
+	}
+	catch (...) {
+		debugMessage("Failed to read " + dsname + " from " + filename, DEBUG_ERROR);
+	}
+	return framesRead - start;
+}
+
+bool tailRecording(const std::string& filename, const std::string& dsname, double idleSeconds) {
+	// A rotated recording is followed through the files listed in its index
+	std::string root = filename;
+	if (root.size() > 3 && root.substr(root.size() - 3) == ".h5") root = root.substr(0, root.size() - 3);
+	std::string indexname = root + ".rotation.json";
+	bool rotated = !std::ifstream(filename).good() && std::ifstream(indexname).good();
+	size_t part = 0;
+	std::unique_ptr<TailReader> reader(new TailReader(rotated ? getPartFilename(indexname, dsname, 0) : filename, dsname));
+	if (!reader->isOpen()) return false;
+	debugMessage("Following " + dsname + " in " + filename + (rotated ? " (rotated)" : "") + ":", DEBUG_MUST_SHOW);
+
+	size_t totalFrames = 0, updates = 0;
+	double longestWait = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now(), lastUpdate = start;
+	TailReader::frameCallback callback = [](size_t /*frameNumber*/, const char* /*frame*/, double /*timestamp*/) {}; // (analysis goes here)
+	while (true) {
+		size_t numFrames = reader->poll(callback);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		double waited = std::chrono::duration<double>(now - lastUpdate).count();
+		if (numFrames > 0) {
+			totalFrames += numFrames;
+			if (updates > 0) longestWait = std::max(longestWait, waited);
+			updates++;
+			lastUpdate = now;
+			char line[256];
+			std::snprintf(line, sizeof(line), "  %8.2f s  +%4zu frames  (%zu in all)", std::chrono::duration<double>(now - start).count(),
+				numFrames, totalFrames);
+			debugMessage(line, DEBUG_MUST_SHOW);
+			continue;
+		}
+		// Move on to the next file once it is listed (the previous one is finished by then)
+		if (rotated) {
+			std::string next = getPartFilename(indexname, dsname, part + 1);
+			if (!next.empty()) {
+				totalFrames += reader->poll(callback);
+				reader.reset(new TailReader(next, dsname));
+				if (!reader->isOpen()) return false;
+				part++;
+				continue;
+			}
+		}
+		if (waited >= idleSeconds) break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(TAIL_POLL_MS));
+	}
+	char line[256];
+	std::snprintf(line, sizeof(line), "%zu frames of %s in %zu updates (longest wait between updates %.2f s)",
+		totalFrames, dsname.c_str(), updates, longestWait);
+	debugMessage(line, DEBUG_MUST_SHOW);
+	return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#pragma warning(push, 0)
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "H5Cpp.h" // HDF5
+#pragma warning(pop)
+
+#define TAIL_POLL_MS 20 // Interval between polls of the file for new frames
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class follows one stream of an HDF5 recording while H5Out is still
+ * writing it in SWMR mode (_swmr = 1), so that analysis can start before
+ * the recording ends. Each poll() refreshes the stream's datasets and
+ * passes every frame published since the previous poll to a callback, in
+ * order. The writer flushes each slab of frames before extending the
+ * timestamp dataset, so the number of timestamps is the number of frames
+ * that can be read.
+ *
+ * A finished recording (or one written without SWMR) can be read the same
+ * way; it just never grows. Delta-coded streams (see temporaldelta.h) are
+ * decoded as they are read.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class TailReader {
+public:
+	// Receives each new frame: its number in the file (from 0), its pixels (in the dataset's type) and its timestamp
+	typedef std::function<void(size_t frameNumber, const char* frame, double timestamp)> frameCallback;
+
+private:
+	const std::string filename;
+	const std::string dsname;
+	H5::H5File file;
+	H5::DataSet dataset; // frames
+	H5::DataSet tsdataset; // timestamps
+	H5::DataType datatype; // (of the frames)
+	hsize_t frameDims[3]; // channels, height, width
+	size_t frameBytes;
+	size_t batchFrames; // Frames read at once (a chunk's worth)
+	size_t framesRead;
+	bool open;
+	std::vector<char> frames; // Frames of the batch being read
+	std::vector<double> timestamps; // Timestamps of the batch being read
+	size_t keyInterval; // Frames between key frames of a delta-coded stream (0 if it is not delta-coded)
+	std::vector<uint16_t> lastFrame; // Last frame read, decoded (for a delta-coded stream)
+
+	// Disable assignment operator and copy constructor
+	TailReader& operator=(const TailReader& other) = delete;
+	TailReader(const TailReader& other) = delete;
+
+public:
+	// Opens stream [_dsname] of the HDF5 file [_filename] for reading while it is written
+	TailReader(const std::string& _filename, const std::string& _dsname);
+
+	bool isOpen() { return open; }
+	size_t getFrameBytes() { return frameBytes; }
+	size_t getFramesRead() { return framesRead; }
+
+	// Reads the frames published since the last call, passing each to [callback]; returns the number of new frames,
+	// or 0 if there are none (or reading failed)
+	size_t poll(const frameCallback& callback);
+};
+
+// Follows stream [dsname] of the recording [filename] (and, for a rotated recording, its next files), printing
+// how many frames arrive with each update, until no new frames arrive for [idleSeconds]; returns false if the
+// recording could not be read
+bool tailRecording(const std::string& filename, const std::string& dsname, double idleSeconds);
@@ -0,0 +1,115 @@
+#include "temporaldelta.h"
+#pragma warning(push, 0)
+#include <immintrin.h>
+#pragma warning(pop)
+
+// MSVC compiles intrinsics for any instruction set; GCC and Clang need to be told per function
+#ifdef __GNUC__
+#define TARGET_SSE __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE
+#define TARGET_AVX2
+#endif
+
+/* * * * * * * * * *
+ * HELPER METHODS  *
+ * * * * * * * * * */
+
+// Zigzag coding of 16-bit differences
+static inline uint16_t zigzag(uint16_t difference) {
+	return (uint16_t) ((difference << 1) ^ (uint16_t) -(int16_t) (difference >> 15));
+}
+static inline uint16_t unzigzag(uint16_t code) {
+	return (uint16_t) ((code >> 1) ^ (uint16_t) -(int16_t) (code & 1));
+}
+
+// Each kernel processes as many pixels as fit its vectors, and returns how many it did
+static void encodeFrameScalar(uint16_t* frame, const uint16_t* previous, size_t numPixels) {
+	for (size_t i = 0; i < numPixels; i++) frame[i] = zigzag((uint16_t) (frame[i] - previous[i]));
+}
+static void decodeFrameScalar(uint16_t* frame, const uint16_t* previous, size_t numPixels) {
+	for (size_t i = 0; i < numPixels; i++) frame[i] = (uint16_t) (previous[i] + unzigzag(frame[i]));
+}
+
+TARGET_SSE static size_t encodeFrameSSE(uint16_t* frame, const uint16_t* previous, size_t numPixels) {
+	size_t done = 0;
+	for (; done + 8 <= numPixels; done += 8) {
+		__m128i difference = _mm_sub_epi16(_mm_loadu_si128((const __m128i*) (frame + done)),
+			_mm_loadu_si128((const __m128i*) (previous + done)));
+		__m128i code = _mm_xor_si128(_mm_slli_epi16(difference, 1), _mm_srai_epi16(difference, 15));
+		_mm_storeu_si128((__m128i*) (frame + done), code);
+	}
+	return done;
+}
+TARGET_SSE static size_t decodeFrameSSE(uint16_t* frame, const uint16_t* previous, size_t numPixels) {
+	const __m128i vOne = _mm_set1_epi16(1);
+	size_t done = 0;
+	for (; done + 8 <= numPixels; done += 8) {
+		__m128i code = _mm_loadu_si128((const __m128i*) (frame + done));
+		__m128i difference = _mm_xor_si128(_mm_srli_epi16(code, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(code, vOne)));
+		_mm_storeu_si128((__m128i*) (frame + done), _mm_add_epi16(_mm_loadu_si128((const __m128i*) (previous + done)), difference));
+	}
+	return done;
+}
+
+TARGET_AVX2 static size_t encodeFrameAVX2(uint16_t* frame, const uint16_t* previous, size_t numPixels) {
+	size_t done = 0;
+	for (; done + 16 <= numPixels; done += 16) {
+		__m256i difference = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*) (frame + done)),
+			_mm256_loadu_si256((const __m256i*) (previous + done)));
+		__m256i code = _mm256_xor_si256(_mm256_slli_epi16(difference, 1), _mm256_srai_epi16(difference, 15));
+		_mm256_storeu_si256((__m256i*) (frame + done), code);
+	}
+	return done;
+}
+TARGET_AVX2 static size_t decodeFrameAVX2(uint16_t* frame, const uint16_t* previous, size_t numPixels) {
+	const __m256i vOne = _mm256_set1_epi16(1);
+	size_t done = 0;
+	for (; done + 16 <= numPixels; done += 16) {
+		__m256i code = _mm256_loadu_si256((const __m256i*) (frame + done));
+		__m256i difference = _mm256_xor_si256(_mm256_srli_epi16(code, 1),
+			_mm256_sub_epi16(_mm256_setzero_si256(), _mm256_and_si256(code, vOne)));
+		_mm256_storeu_si256((__m256i*) (frame + done),
+			_mm256_add_epi16(_mm256_loadu_si256((const __m256i*) (previous + done)), difference));
+	}
+	return done;
+}
+
+// Replaces [frame] by its code relative to [previous], or back
+static void encodeFrame(uint16_t* frame, const uint16_t* previous, size_t numPixels, simdLevel level) {
+	size_t done = 0;
+	if (level >= SIMD_AVX2) done = encodeFrameAVX2(frame, previous, numPixels);
+	if (level >= SIMD_SSE) done += encodeFrameSSE(frame + done, previous + done, numPixels - done);
+	encodeFrameScalar(frame + done, previous + done, numPixels - done);
+}
+static void decodeFrame(uint16_t* frame, const uint16_t* previous, size_t numPixels, simdLevel level) {
+	size_t done = 0;
+	if (level >= SIMD_AVX2) done = decodeFrameAVX2(frame, previous, numPixels);
+	if (level >= SIMD_SSE) done += decodeFrameSSE(frame + done, previous + done, numPixels - done);
+	decodeFrameScalar(frame + done, previous + done, numPixels - done);
+}
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+void encodeTemporalDelta(uint16_t* frames, size_t numFrames, size_t framePixels) {
+	// Last frame first, so each is still intact when the next one needs it
+	simdLevel level = getSimdLevel();
+	for (size_t k = numFrames; k-- > 1; ) {
+		encodeFrame(frames + k * framePixels, frames + (k - 1) * framePixels, framePixels, level);
+	}
+}
+
+bool decodeTemporalDelta(uint16_t* frames, size_t numFrames, size_t framePixels, size_t firstFrame, size_t keyInterval,
+		const uint16_t* previous) {
+	if (numFrames == 0) return true;
+	if (keyInterval == 0 || (firstFrame % keyInterval != 0 && previous == nullptr)) return false;
+	simdLevel level = getSimdLevel();
+	for (size_t k = 0; k < numFrames; k++) {
+		if ((firstFrame + k) % keyInterval == 0) continue; // (key frame)
+		decodeFrame(frames + k * framePixels, (k > 0) ? frames + (k - 1) * framePixels : previous, framePixels, level);
+	}
+	return true;
+}
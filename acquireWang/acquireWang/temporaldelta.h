@@ -0,0 +1,32 @@
+#pragma once
+#pragma warning(push, 0)
+#include <cstddef>
+#include <cstdint>
+#pragma warning(pop)
+#include "bitpacking.h" // simdLevel
+
+#define TEMPORAL_DELTA_ATTRIBUTE "temporalDelta" // Frame dataset attribute: the key frame interval (absent if not encoded)
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * A reversible pre-filter for 16-bit depth frames (_temporalDelta), applied
+ * before the codec. Consecutive depth frames differ little, so each frame
+ * but the first of every chunk (the key frame) is replaced by its difference
+ * from the frame before it. The differences are zigzag-coded (0, -1, 1, -2,
+ * ... become 0, 1, 2, 3, ...), so that small changes either way leave the
+ * high bytes zero for the shuffle and the codec to squeeze out. Arithmetic
+ * wraps around, so every frame round-trips exactly.
+ *
+ * Key frames fall on chunk boundaries (every [keyInterval] frames of the
+ * dataset, stored in its TEMPORAL_DELTA_ATTRIBUTE attribute), so any chunk
+ * can be decoded on its own. The kernels use SSE2 or AVX2 where the CPU has
+ * them (limited by setSimdLevel(), as for bit packing).
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// Encodes [numFrames] frames of [framePixels] pixels in place; the first is a key frame
+void encodeTemporalDelta(uint16_t* frames, size_t numFrames, size_t framePixels);
+
+// Decodes [numFrames] frames of [framePixels] pixels in place, which are frames [firstFrame] onwards of a dataset
+// with a key frame every [keyInterval] frames. If the first is not a key frame, [previous] is the decoded frame
+// before it. Returns false (decoding nothing) if that frame is needed but missing.
+bool decodeTemporalDelta(uint16_t* frames, size_t numFrames, size_t framePixels, size_t firstFrame, size_t keyInterval,
+	const uint16_t* previous = nullptr);
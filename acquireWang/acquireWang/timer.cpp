@@ -1,8 +1,36 @@
 #include "timer.h"
+#ifndef _WIN32
+#pragma warning(push, 0)
+#include <time.h>
+#pragma warning(pop)
+#endif
 
+#ifdef _WIN32
 double getClockStamp() {
 	FILETIME preciseTime; ULONGLONG t;
 	GetSystemTimePreciseAsFileTime(&preciseTime);
 	t = ((ULONGLONG)preciseTime.dwHighDateTime << 32) | (ULONGLONG)preciseTime.dwLowDateTime;
 	return (double)t / 10000000.0; // converted to seconds
 }
+
+double getThreadCPUTime() {
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime)) return -1;
+	ULONGLONG kernel = ((ULONGLONG)kernelTime.dwHighDateTime << 32) | (ULONGLONG)kernelTime.dwLowDateTime;
+	ULONGLONG user = ((ULONGLONG)userTime.dwHighDateTime << 32) | (ULONGLONG)userTime.dwLowDateTime;
+	return (double)(kernel + user) / 10000000.0; // converted to seconds
+}
+#else
+// POSIX versions, so that the camera shims and benchmarks also run off Windows
+double getClockStamp() {
+	timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+double getThreadCPUTime() {
+	timespec t;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) != 0) return -1;
+	return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+#endif
\ No newline at end of file
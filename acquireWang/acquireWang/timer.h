@@ -1,8 +1,11 @@
 #pragma once
 #pragma warning(push, 0)
+#ifdef _WIN32
 #include "Windows.h"
+#endif
 #pragma warning(pop)
 
 typedef double timestamp_t;
 
-double getClockStamp();
\ No newline at end of file
+double getClockStamp();
+double getThreadCPUTime(); // CPU time (user + kernel) used by the calling thread, in seconds
\ No newline at end of file
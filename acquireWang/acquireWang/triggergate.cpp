@@ -0,0 +1,21 @@
+#include "triggergate.h"
+#include "timer.h"
+#include "debug.h"
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+std::vector< std::pair<double, std::string> > RecordingTrigger::getEvents() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return events;
+}
+
+void RecordingTrigger::fire(const std::string& source) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		events.push_back(std::make_pair(getClockStamp(), source));
+	}
+	count++;
+	debugMessage("Trigger " + std::to_string(count.load()) + " (" + source + ")", DEBUG_INFO);
+}
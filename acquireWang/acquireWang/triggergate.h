@@ -0,0 +1,64 @@
+#pragma once
+#pragma warning(push, 0)
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#pragma warning(pop)
+#include "framegate.h"
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This class lets any thread (the preview window on a keypress, the serial
+ * thread on a DAQ line change, or a caller of fire()) trigger a recording.
+ * It counts triggers and keeps when and why each fired; every stream's
+ * TriggerGate watches the count.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class RecordingTrigger {
+private:
+	std::atomic<size_t> count; // Triggers fired so far
+	std::mutex mutex; // Guards events
+	std::vector< std::pair<double, std::string> > events; // Clock stamp and source of each trigger
+
+	// Disable assignment operator and copy constructor
+	RecordingTrigger& operator=(const RecordingTrigger& other) = delete;
+	RecordingTrigger(const RecordingTrigger& other) = delete;
+
+public:
+	RecordingTrigger() : count(0) {}
+
+	size_t getCount() { return count; }
+	// Clock stamp (see getClockStamp()) and source of each trigger so far
+	std::vector< std::pair<double, std::string> > getEvents();
+
+	// Triggers the recording (from any thread); [source] says what fired it
+	void fire(const std::string& source);
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * This gate saves the frames around triggers: the last [preFrames] frames
+ * before each trigger (held in the ring until then) and [postFrames] frames
+ * from it on. A trigger within that window extends it.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+class TriggerGate : public FrameGate {
+private:
+	std::shared_ptr<RecordingTrigger> trigger;
+	size_t triggersSeen; // Trigger count at the last frame
+
+protected:
+	virtual bool isOpen(BaseFrame& /*frame*/) {
+		size_t triggers = trigger->getCount();
+		bool fired = (triggers != triggersSeen);
+		triggersSeen = triggers;
+		return fired;
+	}
+
+public:
+	TriggerGate(std::shared_ptr<RecordingTrigger> _trigger, size_t _preFrames, size_t _postFrames) :
+		FrameGate(_preFrames, _postFrames), trigger(_trigger), triggersSeen(_trigger->getCount()) {}
+
+	virtual std::string getDescription() {
+		return "trigger (" + std::to_string(getPreFrames()) + " frames before, " + std::to_string(getPostFrames()) + " after)";
+	}
+};
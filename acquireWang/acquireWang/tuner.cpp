@@ -0,0 +1,294 @@
+#include "tuner.h"
+#pragma warning(push, 0)
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <thread>
+#include "json.hpp" // JSON
+#pragma warning(pop)
+#include "synthcam.h"
+#include "acquirer.h"
+#include "h5out.h"
+#include "debug.h"
+
+#define TUNE_RANDOM_READS 10 // Reads timed (and averaged) for each random access pattern
+#define TUNE_BLOCK_FRAMES 50 // Consecutive frames read at once
+#define TUNE_ROI_SIZE 32 // Width and height of the region of interest read across every frame
+#define TUNE_MIN_GAIN 0.05 // Fraction of the current read latency another value must save to replace it (trials are noisy)
+
+// Results of one trial
+struct TuneResult {
+	std::string label;
+	bool ok;
+	double writeMBps; // sustained, in MB/s of uncompressed frames
+	double cpuPerFrame; // CPU time of the saving side per frame, in ms
+	double frameMs; // one random whole frame of every stream
+	double blockMs; // TUNE_BLOCK_FRAMES consecutive frames of every stream
+	double roiMs; // a small region of interest across every frame of every stream
+
+	double getReadMs() const { return frameMs + blockMs + roiMs; }
+};
+
+/* * * * * * * * * *
+ * HELPER METHODS  *
+ * * * * * * * * * */
+
+// Returns the smallest prime >= n (for _rdcc_nslots)
+static size_t nextPrime(size_t n) {
+	for (n = std::max(n, (size_t) 2); ; n++) {
+		bool prime = true;
+		for (size_t d = 2; d * d <= n && prime; d++) prime = (n % d != 0);
+		if (prime) return n;
+	}
+}
+
+// Returns the names of the spatial chunk parameters of a camera type
+static std::string getChunkPrefix(cameraType type) {
+	return (type == CAMERA_KINECT) ? "_kinect" : "_pg";
+}
+
+// Returns a stream's spatial chunk dimensions, clipped to its frames (HDF5 rejects chunks larger than fixed dimensions)
+static void getChunkDims(const TuneStream& stream, std::map<std::string, size_t>& params, size_t& yChunk, size_t& xChunk) {
+	std::string prefix = getChunkPrefix(stream.type);
+	yChunk = std::max((size_t) 1, std::min(params[prefix + "Ychunk"], stream.height));
+	xChunk = std::max((size_t) 1, std::min(params[prefix + "Xchunk"], stream.width));
+}
+
+// File access properties for [params] (also used to read the file back, since the chunk cache serves reads too)
+static FileAccPropList getFileAccess(std::map<std::string, size_t>& params) {
+	FileAccPropList fapl;
+	fapl.setCache(65536000, params["_rdcc_nslots"], params["_rdcc_nbytes"], 0);
+	fapl.setSieveBufSize(params["_sievebufsize"]);
+	return fapl;
+}
+
+// Times the read access patterns on the file written by a trial. The file was just written, so much of it may
+// still be in the OS's cache: the latencies compare layouts rather than predict cold reads.
+static void timeReads(const std::string& filename, const std::vector<TuneStream>& streams,
+		std::map<std::string, size_t>& params, TuneResult& result) {
+	H5File file(filename, H5F_ACC_RDONLY, FileCreatPropList::DEFAULT, getFileAccess(params));
+	std::mt19937 rng(1); // (the same frames for every trial)
+	std::vector<char> buffer;
+	for (const TuneStream& stream : streams) {
+		DataSet dataset = file.openDataSet(stream.name);
+		DataType datatype = dataset.getDataType();
+		DataSpace fileSpace = dataset.getSpace();
+		hsize_t dims[4];
+		fileSpace.getSimpleExtentDims(dims);
+		size_t numFrames = (size_t) dims[0];
+		if (numFrames == 0) continue;
+
+		// Reads [count] frames from [first], cropped to [height] x [width] at ([y], [x]); returns the time taken in ms
+		auto readFrames = [&](size_t first, size_t count, size_t y, size_t x, size_t height, size_t width) {
+			hsize_t offset[4] = { first, 0, y, x };
+			hsize_t counts[4] = { count, dims[1], height, width };
+			buffer.resize(std::max(buffer.size(), (size_t) (count * dims[1] * height * width) * datatype.getSize()));
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			fileSpace.selectHyperslab(H5S_SELECT_SET, counts, offset);
+			dataset.read(buffer.data(), datatype, DataSpace(4, counts), fileSpace);
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		};
+		size_t blockFrames = std::min(numFrames, (size_t) TUNE_BLOCK_FRAMES);
+		for (size_t k = 0; k < TUNE_RANDOM_READS; k++) {
+			result.frameMs += readFrames(rng() % numFrames, 1, 0, 0, stream.height, stream.width) / TUNE_RANDOM_READS;
+			result.blockMs += readFrames(rng() % (numFrames - blockFrames + 1), blockFrames, 0, 0,
+				stream.height, stream.width) / TUNE_RANDOM_READS;
+		}
+		size_t roiHeight = std::min((size_t) TUNE_ROI_SIZE, stream.height), roiWidth = std::min((size_t) TUNE_ROI_SIZE, stream.width);
+		result.roiMs += readFrames(0, numFrames, (stream.height - roiHeight) / 2, (stream.width - roiWidth) / 2, roiHeight, roiWidth);
+	}
+}
+
+// Saves [numFrames] synthetic frames of every stream with the layout in [params], and reads them back
+static TuneResult runTrial(const std::vector<TuneStream>& streams, std::map<std::string, size_t>& params, size_t numFrames,
+		const std::string& filename, const std::string& label) {
+	TuneResult result = { label, false, 0, 0, 0, 0, 0 };
+	size_t frameChunkSize = params["_frameChunkSize"];
+	std::vector< std::unique_ptr<SyntheticCamera> > cameras;
+	std::vector<BaseAcquirer*> acquirers;
+	std::vector<std::string> names;
+	std::vector<PredType> types;
+	std::vector<DSetCreatPropList> dcpls;
+	double rawBytes = 0;
+	for (const TuneStream& stream : streams) {
+		cameras.push_back(std::unique_ptr<SyntheticCamera>(new SyntheticCamera(stream.width, stream.height, stream.bytesPerPixel,
+			stream.fps, true)));
+		acquirers.push_back(new BaseAcquirer(stream.name, *cameras.back()));
+		acquirers.back()->setFramesToAcquire(numFrames);
+		names.push_back(stream.name);
+		types.push_back((stream.bytesPerPixel == 2) ? ((stream.type == CAMERA_KINECT) ? KINECT_H5T : POINTGREY16_H5T) : POINTGREY_H5T);
+		size_t yChunk, xChunk;
+		getChunkDims(stream, params, yChunk, xChunk);
+		dcpls.push_back(createStreamDcpl(params, stream.name, frameChunkSize, yChunk, xChunk));
+		rawBytes += (double) numFrames * cameras.back()->getBytes();
+	}
+
+	try {
+		// Save (one file, from one saving thread)
+		timers.resetAll();
+		std::string outFilename = filename;
+		std::unique_ptr<H5Out> out(new H5Out(outFilename, acquirers, frameChunkSize, names, types, FileCreatPropList::DEFAULT,
+			getFileAccess(params), dcpls, false, params["_compressionWorkers"],
+			getFlushPolicy(params), params["_flushInterval"]));
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (BaseAcquirer* acquirer : acquirers) {
+			acquirer->run();
+			acquirer->beginAcquisition();
+		}
+		while (out->isSaving()) {
+			// Stand in for the preview window
+			for (BaseAcquirer* acquirer : acquirers) acquirer->getMostRecentGUI();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		for (BaseAcquirer* acquirer : acquirers) acquirer->abortAcquisition();
+		out->abortSaving(false);
+		out.reset();
+		result.writeMBps = rawBytes / seconds / 1e6;
+
+		// CPU time of the threads whose work depends on the layout (not the cameras')
+		double cpuSeconds = 0;
+		for (auto& threadTime : timers.getThreadCPUTimes()) {
+			const std::string& name = threadTime.first;
+			if (name.find("acquisition") == std::string::npos && name.find("monitor") == std::string::npos &&
+				name.find("synthetic") == std::string::npos) cpuSeconds += threadTime.second;
+		}
+		result.cpuPerFrame = cpuSeconds * 1000 / (numFrames * streams.size());
+
+		// Read back
+		timeReads(filename, streams, params, result);
+		result.ok = true;
+	}
+	catch (...) {
+		debugMessage("Tuning trial " + label + " failed", DEBUG_ERROR);
+	}
+	for (BaseAcquirer* acquirer : acquirers) delete acquirer;
+	return result;
+}
+
+// Prints a trial's results ([chosen] marks the winner of its group)
+static void printResult(const TuneResult& result, bool chosen) {
+	char line[256];
+	if (!result.ok) std::snprintf(line, sizeof(line), "  %-22s   FAILED", result.label.c_str());
+	else std::snprintf(line, sizeof(line), "%s %-22s %8.1f MB/s %7.3f ms CPU/frame   read: frame %7.2f  block %8.2f  ROI %8.2f ms",
+		chosen ? "*" : " ", result.label.c_str(), result.writeMBps, result.cpuPerFrame, result.frameMs, result.blockMs, result.roiMs);
+	debugMessage(line, DEBUG_MUST_SHOW);
+}
+
+// Tries each of [candidates] (values of the parameters [keys], the current values first) and keeps the best in [params]
+static bool tuneGroup(const std::string& title, const std::vector<std::string>& keys, std::vector< std::vector<size_t> > candidates,
+		const std::vector<TuneStream>& streams, std::map<std::string, size_t>& params, size_t numFrames, const std::string& filename) {
+	std::vector<size_t> current;
+	for (const std::string& key : keys) current.push_back(params[key]);
+	candidates.insert(candidates.begin(), current);
+	std::vector< std::vector<size_t> > tried;
+	for (const std::vector<size_t>& candidate : candidates) {
+		if (std::find(tried.begin(), tried.end(), candidate) == tried.end()) tried.push_back(candidate);
+	}
+
+	debugMessage(title + ":", DEBUG_MUST_SHOW);
+	std::vector<TuneResult> results;
+	double bestMBps = 0;
+	for (const std::vector<size_t>& candidate : tried) {
+		std::string label;
+		for (size_t i = 0; i < keys.size(); i++) {
+			params[keys[i]] = candidate[i];
+			label += (i > 0 ? " x " : "") + std::to_string(candidate[i]);
+		}
+		results.push_back(runTrial(streams, params, numFrames, filename, label));
+		if (results.back().ok) bestMBps = std::max(bestMBps, results.back().writeMBps);
+	}
+
+	// Among the trials that (nearly) sustain the best throughput, the one with the lowest read latency
+	// (unless that is the current value's by too little to tell)
+	size_t chosen = results.size();
+	for (size_t i = 0; i < results.size(); i++) {
+		if (!results[i].ok || results[i].writeMBps < TUNE_THROUGHPUT_MARGIN * bestMBps) continue;
+		if (chosen == results.size() || results[i].getReadMs() < results[chosen].getReadMs()) chosen = i;
+	}
+	if (chosen < results.size() && results[0].ok && results[0].writeMBps >= TUNE_THROUGHPUT_MARGIN * bestMBps &&
+		results[chosen].getReadMs() > (1 - TUNE_MIN_GAIN) * results[0].getReadMs()) chosen = 0;
+	for (size_t i = 0; i < results.size(); i++) printResult(results[i], i == chosen);
+	const std::vector<size_t>& best = (chosen < results.size()) ? tried[chosen] : current;
+	for (size_t i = 0; i < keys.size(); i++) params[keys[i]] = best[i];
+	return chosen < results.size();
+}
+
+/* * * * * * * * * *
+ * PUBLIC METHODS  *
+ * * * * * * * * * */
+
+bool tuneConfig(const std::vector<TuneStream>& streams, std::map<std::string, size_t>& params, size_t numFrames,
+		const std::string& outputFilename, const std::string& scratchFilename) {
+	if (streams.empty() || numFrames == 0) return false;
+	double neededMBps = 0;
+	for (const TuneStream& stream : streams) {
+		neededMBps += stream.fps * stream.width * stream.height * stream.bytesPerPixel / 1e6;
+		debugMessage("  " + stream.name + ": " + std::to_string(stream.width) + "x" + std::to_string(stream.height) + "x" +
+			std::to_string(8 * stream.bytesPerPixel) + " at " + std::to_string(stream.fps) + " fps", DEBUG_MUST_SHOW);
+	}
+	debugMessage("Tuning with " + std::to_string(numFrames) + " frames per stream per trial, written to " + scratchFilename +
+		" (the cameras need " + std::to_string(neededMBps) + " MB/s)", DEBUG_MUST_SHOW);
+
+	// Warm up (the disk, the OS's caches and the allocator), so the first trial is not penalized
+	runTrial(streams, params, numFrames, scratchFilename, "warm-up");
+
+	// Frames per chunk
+	bool result = tuneGroup("_frameChunkSize", { "_frameChunkSize" }, { { 10 }, { 25 }, { 50 }, { 100 } },
+		streams, params, numFrames, scratchFilename);
+
+	// Spatial chunks of each camera type: squares, row strips and whole frames
+	for (cameraType type : { CAMERA_KINECT, CAMERA_PG }) {
+		auto stream = std::find_if(streams.begin(), streams.end(), [type](const TuneStream& s) { return s.type == type; });
+		if (stream == streams.end()) continue;
+		std::string prefix = getChunkPrefix(type);
+		std::vector< std::vector<size_t> > candidates;
+		size_t shapes[][2] = { { 32, 32 }, { 64, 64 }, { 128, 128 }, { 16, stream->width }, { 64, stream->width },
+			{ stream->height, stream->width } };
+		for (auto& shape : shapes) candidates.push_back({ std::min(shape[0], stream->height), std::min(shape[1], stream->width) });
+		result = tuneGroup(prefix + "Ychunk x " + prefix + "Xchunk", { prefix + "Ychunk", prefix + "Xchunk" }, candidates,
+			streams, params, numFrames, scratchFilename) && result;
+	}
+
+	// Chunk cache: room for one or more chunks' worth of frames of the largest stream, with about 100 times as
+	// many slots as chunks that fit (as HDF5 recommends), then fewer or more slots
+	size_t slabBytes = 0, chunkBytes = SIZE_MAX;
+	for (const TuneStream& stream : streams) {
+		size_t yChunk, xChunk;
+		getChunkDims(stream, params, yChunk, xChunk);
+		slabBytes = std::max(slabBytes, params["_frameChunkSize"] * stream.width * stream.height * stream.bytesPerPixel);
+		chunkBytes = std::min(chunkBytes, params["_frameChunkSize"] * yChunk * xChunk * stream.bytesPerPixel);
+	}
+	result = tuneGroup("_rdcc_nbytes", { "_rdcc_nbytes" }, { { 1 << 20 }, { slabBytes }, { 2 * slabBytes }, { 4 * slabBytes } },
+		streams, params, numFrames, scratchFilename) && result;
+	size_t cachedChunks = std::max((size_t) 1, params["_rdcc_nbytes"] / std::max(chunkBytes, (size_t) 1));
+	result = tuneGroup("_rdcc_nslots", { "_rdcc_nslots" },
+		{ { nextPrime(10 * cachedChunks) }, { nextPrime(100 * cachedChunks) }, { nextPrime(1000 * cachedChunks) } },
+		streams, params, numFrames, scratchFilename) && result;
+
+	// Sieve buffer (only used for contiguous data and small raw reads, so expect little difference)
+	result = tuneGroup("_sievebufsize", { "_sievebufsize" }, { { 65536 }, { 1 << 20 }, { 8 << 20 } },
+		streams, params, numFrames, scratchFilename) && result;
+	std::remove(scratchFilename.c_str());
+
+	// Save (keeping the previous file)
+	std::ifstream previous(outputFilename);
+	if (previous.good()) {
+		previous.close();
+		std::remove((outputFilename + ".bak").c_str());
+		std::rename(outputFilename.c_str(), (outputFilename + ".bak").c_str());
+	}
+	nlohmann::json j_map(params);
+	std::ofstream f(outputFilename);
+	f << j_map.dump(4);
+	f.close();
+	if (!f.good()) {
+		debugMessage("Failed to write " + outputFilename, DEBUG_ERROR);
+		return false;
+	}
+	debugMessage("Tuned parameters (* above) saved to " + outputFilename, DEBUG_MUST_SHOW);
+	return result;
+}
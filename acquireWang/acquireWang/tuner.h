@@ -0,0 +1,45 @@
+#pragma once
+#pragma warning(push, 0)
+#include <map>
+#include <string>
+#include <vector>
+#pragma warning(pop)
+#include "camera.h"
+
+#define TUNE_DEFAULT_FRAMES 500 // Frames of each stream saved per trial
+#define TUNE_SCRATCH_FILENAME "tune_scratch.h5" // Written (and overwritten) by each trial, then removed
+#define TUNE_THROUGHPUT_MARGIN 0.9 // Trials within this fraction of the best write throughput are ranked by read latency
+
+// A stream to tune the HDF5 layout for: a camera's name and frame geometry
+struct TuneStream {
+	std::string name;
+	cameraType type; // Kinect streams share _kinectXchunk/_kinectYchunk; Point Grey streams share _pgXchunk/_pgYchunk
+	size_t width, height, bytesPerPixel;
+	double fps;
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Tunes the HDF5 chunk geometry and caches for [streams] on the disk that
+ * holds [scratchFilename], starting from the recording parameters in [params]
+ * and updating them with the best values found.
+ *
+ * Each trial saves [numFrames] synthetic frames of every stream at the
+ * streams' real dimensions through H5Out (as fast as they can be saved), and
+ * measures the sustained write throughput and the CPU time per frame of the
+ * saving, compression and flushing threads. It then reads the file back, timing the access
+ * patterns analysis uses: a random whole frame, a block of consecutive
+ * frames, and a small region of interest across every frame.
+ *
+ * The parameters are tuned one group at a time, keeping the best of each
+ * group for the next: _frameChunkSize, then each camera type's spatial
+ * chunks, then _rdcc_nbytes, _rdcc_nslots and _sievebufsize. Of the trials
+ * within TUNE_THROUGHPUT_MARGIN of the best throughput, the one with the
+ * lowest total read latency wins, unless it improves on the current value
+ * by less than TUNE_MIN_GAIN.
+ *
+ * The tuned parameters are written to [outputFilename] (an existing file is
+ * kept as [outputFilename].bak). Returns false if a trial failed or the
+ * parameters could not be written.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+bool tuneConfig(const std::vector<TuneStream>& streams, std::map<std::string, size_t>& params, size_t numFrames,
+	const std::string& outputFilename, const std::string& scratchFilename = TUNE_SCRATCH_FILENAME);
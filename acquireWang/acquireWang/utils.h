@@ -41,9 +41,16 @@ std::map<std::string, size_t> readConfig() {
 		params["_frameChunkSize"] = 50;
 		params["_kinectXchunk"] = 32;
 		params["_kinectYchunk"] = 53;
+		params["_kinectDepthBits"] = 0; // bits to pack Kinect depths to as they arrive (0 = 16-bit; 13 holds every depth)
+		params["_kinectMaxDepth"] = 0; // depth range in mm (larger depths are clamped and counted; 0 = all that fit the bits)
 		params["_pgXchunk"] = 32;
 		params["_pgYchunk"] = 32;
-		params["_compression"] = 0;
+		params["_compression"] = 0; // deflate level before LZ4 (with _codec 0)
+		params["_codec"] = 0; // 0 = LZ4, 1 = Zstandard, 2 = Blosc (bit shuffle + LZ4), 3 = Blosc (bit shuffle + Zstandard),
+		                      // 4 = none (each can be overridden per stream, e.g. "_codec_kinect"; see --bench codecs)
+		params["_codecLevel"] = 0; // compression level of _codec (0 = the codec's default; also per stream)
+		params["_temporalDelta"] = 0; // 1 to delta-code 16-bit frames over time before compressing them (also per stream,
+		                              // e.g. "_temporalDelta_kinect"; see --bench delta)
 
 		// Access parameters for efficient writing
 		params["_lz4_block_size"] = 1 << 30;
@@ -53,6 +60,47 @@ std::map<std::string, size_t> readConfig() {
 		params["_rdcc_nbytes"] = 50 * 1024 * 1280 * 8;
 		params["_sievebufsize"] = 8388608;
 
+		// Output format
+		params["_saveFormat"] = 0; // 0 = HDF5, 1 = raw binary files with unbuffered I/O, 2 = memory-mapped segment files
+		                           // (convert the last two to HDF5 with --convert)
+		params["_rawQueueDepth"] = 4; // chunks of each stream being written at once in the raw format
+		params["_segmentMB"] = 512; // size of each segment file in the segment format
+
+		// Threading
+		params["_perStreamFiles"] = 0; // 1 to write each stream to its own file from its own thread
+		params["_linkStreamFiles"] = 1; // 1 to tie per-stream files together into one session file
+		params["_compressionWorkers"] = 0; // threads compressing chunks in parallel (0 = compress inside HDF5 on the saving thread;
+		                                   // with _perStreamFiles, one per stream)
+
+		// Durability
+		params["_flushPolicy"] = 1; // when to flush files to disk: 0 = every N chunks, 1 = every N seconds, 2 = only at the end
+		params["_flushInterval"] = 1; // N (chunks or seconds) for _flushPolicy
+		params["_rotateMinutes"] = 20; // without a fixed length, start a new HDF5 file every N minutes (0 = no limit)
+		params["_rotateMB"] = 0; // without a fixed length, start a new HDF5 file once it reaches N MB (0 = no limit)
+		params["_swmr"] = 0; // 1 to write HDF5 files in SWMR mode, so they can be read while recording (see --tail)
+
+		// Frame queues (each can be overridden per stream, e.g. "_queueBytes_kinect")
+		params["_queueFrames"] = 100; // capacity in frames (if both capacities are 0, 100 frames)
+		params["_queueBytes"] = 0; // capacity in bytes (0 = no byte limit)
+		params["_overflowPolicy"] = 0; // when full: 0 = block the camera, 1 = drop the oldest frame, 2 = drop the newest frame
+		// Triggered recording: only the frames around triggers (T key, DAQ line change) are saved
+		params["_triggered"] = 0; // 1 to save only around triggers
+		params["_preTriggerSeconds"] = 5; // seconds kept in memory and saved from before each trigger
+		params["_postTriggerSeconds"] = 10; // seconds saved from each trigger on (a trigger within them extends them)
+		params["_triggerDaqColumn"] = 0; // DAQ (serial) CSV column, from 1, whose change to a nonzero value triggers (0 = none)
+		// Motion gating: only the frames around movement are saved (each can be overridden per stream, e.g. "_motionGate_pg0")
+		params["_motionGate"] = 0; // 1 to save only while frames change (ignored in triggered recordings)
+		params["_motionDecimation"] = 4; // score every Nth row
+		params["_motionPixelDelta"] = 16; // a pixel has changed if it differs by more than this (grey levels, or mm of depth)
+		params["_motionOnPermille"] = 5; // start saving when this many pixels per thousand have changed
+		params["_motionOffPermille"] = 2; // stop (after _motionPostSeconds) when fewer than this many have changed
+		params["_motionPreSeconds"] = 2; // seconds kept in memory and saved from before the movement started
+		params["_motionPostSeconds"] = 5; // seconds saved after it stopped
+		params["_memoryBudgetMB"] = 0; // memory for queued and buffered frames; beyond it the oldest queued frames spill to
+		                               // disk, next to the recording or in the directory given with --spill (0 = no budget)
+		params["_frameCallbacks"] = 0; // 1 to have cameras that support it push frames from driver events instead of being polled
+		                               // (off by default until the Spinnaker event path has been validated on hardware)
+
 		// Save
 		nlohmann::json j_map(params);
 		std::ofstream f2(config_filename);